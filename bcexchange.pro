@@ -151,6 +151,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/init.h \
     src/irc.h \
     src/mruset.h \
+    src/orderstatistic.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
     src/json/json_spirit_value.h \
@@ -205,6 +206,16 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/reputationvotedialog.h \
     src/qt/dividendkeysdialog.h \
     src/coinmetadata.h \
+    src/assetregistry.h \
+    src/kvstore.h \
+    src/logdb.h \
+    src/coins.h \
+    src/mappedfile.h \
+    src/addrindex.h \
+    src/chainscan.h \
+    src/lrucache.h \
+    src/checkqueue.h \
+    src/sha256.h \
     src/qt/assetvotedialog.h \
     src/qt/addassetvotedialog.h
 
@@ -281,6 +292,13 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/qt/reputationvotedialog.cpp \
     src/qt/dividendkeysdialog.cpp \
     src/coinmetadata.cpp \
+    src/assetregistry.cpp \
+    src/logdb.cpp \
+    src/coins.cpp \
+    src/mappedfile.cpp \
+    src/addrindex.cpp \
+    src/chainscan.cpp \
+    src/sha256.cpp \
     src/qt/assetvotedialog.cpp \
     src/qt/addassetvotedialog.cpp
 
@@ -0,0 +1,86 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrindex.h"
+#include "coins.h"
+#include "base58.h"
+
+using namespace std;
+
+bool fAddrIndex = false;
+
+
+bool CAddressIndexKey::SetAddress(const CScript& scriptPubKey, unsigned char cUnitIn)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return false;
+
+    cUnit = cUnitIn;
+    if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+    {
+        cType = ADDRINDEX_KEY;
+        hashAddress = *pkeyID;
+        return true;
+    }
+    if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+    {
+        cType = ADDRINDEX_SCRIPT;
+        hashAddress = *pscriptID;
+        return true;
+    }
+    return false;
+}
+
+bool CAddressIndexKey::SetAddress(const CBitcoinAddress& address)
+{
+    if (!address.IsValid())
+        return false;
+
+    cUnit = address.GetUnit();
+    CTxDestination dest = address.Get();
+    if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+    {
+        cType = ADDRINDEX_KEY;
+        hashAddress = *pkeyID;
+        return true;
+    }
+    if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+    {
+        cType = ADDRINDEX_SCRIPT;
+        hashAddress = *pscriptID;
+        return true;
+    }
+    return false;
+}
+
+
+void GetAddressIndexEntries(const CBlock& block, int nHeight, const CBlockUndo& blockundo, vector<CAddressIndexEntry>& vEntries)
+{
+    for (unsigned int nTx = 0; nTx < block.vtx.size(); nTx++)
+    {
+        const CTransaction& tx = block.vtx[nTx];
+        uint256 hashTx = tx.GetHash();
+
+        if (!tx.IsCoinBase() && !tx.IsCustodianGrant() && nTx < blockundo.vtxundo.size())
+        {
+            const CTxUndo& txundo = blockundo.vtxundo[nTx];
+            for (unsigned int i = 0; i < txundo.vprevout.size(); i++)
+            {
+                const CTxInUndo& undo = txundo.vprevout[i];
+                CAddressIndexKey key(undo.cUnit, 0, 0, nHeight, hashTx, i, true);
+                if (key.SetAddress(undo.txout.scriptPubKey, undo.cUnit))
+                    vEntries.push_back(make_pair(key, -undo.txout.nValue));
+            }
+        }
+
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            const CTxOut& txout = tx.vout[i];
+            CAddressIndexKey key(tx.cUnit, 0, 0, nHeight, hashTx, i, false);
+            if (key.SetAddress(txout.scriptPubKey, tx.cUnit))
+                vEntries.push_back(make_pair(key, txout.nValue));
+        }
+    }
+}
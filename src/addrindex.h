@@ -0,0 +1,95 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_ADDRINDEX_H
+#define BITCOIN_ADDRINDEX_H
+
+#include "main.h"
+
+#include <vector>
+
+class CBlockUndo;
+
+extern bool fAddrIndex;
+
+static const unsigned char ADDRINDEX_KEY = 1;
+static const unsigned char ADDRINDEX_SCRIPT = 2;
+
+/** Key of an address index record. A record is kept for each output paid to
+ * an address and for each input spending one, with the change of the balance
+ * of the address as value. The height is serialized big endian so that the
+ * records of an address are ordered by height in the database. */
+class CAddressIndexKey
+{
+public:
+    unsigned char cUnit;
+    unsigned char cType;
+    uint160 hashAddress;
+    int nHeight;
+    uint256 txid;
+    // Output index, or input index if fSpending
+    unsigned int nIndex;
+    bool fSpending;
+
+    CAddressIndexKey()
+    {
+        SetNull();
+    }
+
+    CAddressIndexKey(unsigned char cUnitIn, unsigned char cTypeIn, const uint160& hashAddressIn, int nHeightIn, const uint256& txidIn, unsigned int nIndexIn, bool fSpendingIn)
+    {
+        cUnit = cUnitIn;
+        cType = cTypeIn;
+        hashAddress = hashAddressIn;
+        nHeight = nHeightIn;
+        txid = txidIn;
+        nIndex = nIndexIn;
+        fSpending = fSpendingIn;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(cUnit);
+        READWRITE(cType);
+        READWRITE(hashAddress);
+        unsigned int nHeightBE = ByteReverse((unsigned int)nHeight);
+        READWRITE(nHeightBE);
+        READWRITE(txid);
+        READWRITE(nIndex);
+        unsigned char nFlags = fSpending ? 1 : 0;
+        READWRITE(nFlags);
+        if (fRead)
+        {
+            const_cast<CAddressIndexKey*>(this)->nHeight = (int)ByteReverse(nHeightBE);
+            const_cast<CAddressIndexKey*>(this)->fSpending = (nFlags & 1);
+        }
+    )
+
+    void SetNull()
+    {
+        cUnit = 0;
+        cType = 0;
+        hashAddress = 0;
+        nHeight = 0;
+        txid = 0;
+        nIndex = 0;
+        fSpending = false;
+    }
+
+    bool IsSameAddress(const CAddressIndexKey& other) const
+    {
+        return cUnit == other.cUnit && cType == other.cType && hashAddress == other.hashAddress;
+    }
+
+    // Address of an output script, fails for scripts not paying to one address
+    bool SetAddress(const CScript& scriptPubKey, unsigned char cUnitIn);
+    bool SetAddress(const CBitcoinAddress& address);
+};
+
+/** Address index record: key and balance change */
+typedef std::pair<CAddressIndexKey, int64> CAddressIndexEntry;
+
+/** Address index records of a block. blockundo holds the outputs spent by the block. */
+void GetAddressIndexEntries(const CBlock& block, int nHeight, const CBlockUndo& blockundo, std::vector<CAddressIndexEntry>& vEntries);
+
+#endif
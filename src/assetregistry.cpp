@@ -0,0 +1,88 @@
+// Copyright (c) 2015 The B&C Exchange developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assetregistry.h"
+#include "main.h"
+
+using namespace std;
+
+CAssetRegistry assetRegistry;
+
+static bool CompareHeight(const CBlockIndex* pindexA, const CBlockIndex* pindexB)
+{
+    return pindexA->nHeight < pindexB->nHeight;
+}
+
+const CBlockIndex* CAssetRegistry::FindChange(const vector<const CBlockIndex*>& vChange, const CBlockIndex* pindex) const
+{
+    vector<const CBlockIndex*>::const_iterator it = upper_bound(vChange.begin(), vChange.end(), pindex, CompareHeight);
+    while (it != vChange.begin())
+    {
+        --it;
+        const CBlockIndex* pindexChange = *it;
+        if (pindexChange == pindex || pindex->GetAncestor(pindexChange->nHeight) == pindexChange)
+            return pindexChange;
+    }
+    return NULL;
+}
+
+void CAssetRegistry::Register(const CBlockIndex* pindex)
+{
+    LOCK(cs_registry);
+    BOOST_FOREACH(const PAIRTYPE(const uint32_t, CAsset)& item, pindex->mapAssets)
+    {
+        vector<const CBlockIndex*>& vChange = mapChanges[item.first];
+        if (find(vChange.begin(), vChange.end(), pindex) != vChange.end())
+            continue;
+        vChange.insert(upper_bound(vChange.begin(), vChange.end(), pindex, CompareHeight), pindex);
+    }
+}
+
+void CAssetRegistry::Unregister(const CBlockIndex* pindex)
+{
+    LOCK(cs_registry);
+    BOOST_FOREACH(const PAIRTYPE(const uint32_t, CAsset)& item, pindex->mapAssets)
+    {
+        map<uint32_t, vector<const CBlockIndex*> >::iterator mi = mapChanges.find(item.first);
+        if (mi == mapChanges.end())
+            continue;
+
+        vector<const CBlockIndex*>& vChange = mi->second;
+        vChange.erase(remove(vChange.begin(), vChange.end(), pindex), vChange.end());
+        if (vChange.empty())
+            mapChanges.erase(mi);
+    }
+}
+
+void CAssetRegistry::Clear()
+{
+    LOCK(cs_registry);
+    mapChanges.clear();
+}
+
+bool CAssetRegistry::GetVotedAsset(const CBlockIndex* pindex, uint32_t nAssetId, CAsset& assetRet) const
+{
+    LOCK(cs_registry);
+    map<uint32_t, vector<const CBlockIndex*> >::const_iterator mi = mapChanges.find(nAssetId);
+    if (mi == mapChanges.end())
+        return false;
+
+    const CBlockIndex* pindexChange = FindChange(mi->second, pindex);
+    if (pindexChange == NULL)
+        return false;
+
+    return pindexChange->GetBlockVotedAsset(nAssetId, assetRet);
+}
+
+void CAssetRegistry::GetVotedAssets(const CBlockIndex* pindex, map<uint32_t, CAsset>& mapAssetsRet) const
+{
+    LOCK(cs_registry);
+    mapAssetsRet.clear();
+    BOOST_FOREACH(const PAIRTYPE(const uint32_t, vector<const CBlockIndex*>)& item, mapChanges)
+    {
+        const CBlockIndex* pindexChange = FindChange(item.second, pindex);
+        if (pindexChange)
+            pindexChange->GetBlockVotedAsset(item.first, mapAssetsRet[item.first]);
+    }
+}
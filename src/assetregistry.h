@@ -0,0 +1,48 @@
+// Copyright (c) 2015 The B&C Exchange developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef ASSETREGISTRY_H
+#define ASSETREGISTRY_H
+
+#include <map>
+#include <vector>
+
+#include "exchange.h"
+#include "util.h"
+
+class CBlockIndex;
+
+/** Versioned registry of the asset vote results.
+ *
+ * Only the blocks where an asset changed are recorded (in their mapAssets),
+ * sorted by height for each asset. The asset in effect at a block is the last
+ * change found in the block or its ancestors: a binary search on the height
+ * gives the last candidate, and the candidates on other branches are skipped
+ * with an ancestor check.
+ *
+ * The block indexes register their changes once calculated or loaded and
+ * unregister them when destroyed.
+ */
+class CAssetRegistry
+{
+private:
+    mutable CCriticalSection cs_registry;
+    std::map<uint32_t, std::vector<const CBlockIndex*> > mapChanges;
+
+    const CBlockIndex* FindChange(const std::vector<const CBlockIndex*>& vChange, const CBlockIndex* pindex) const;
+
+public:
+    void Register(const CBlockIndex* pindex);
+    void Unregister(const CBlockIndex* pindex);
+    void Clear();
+
+    // The asset voted in pindex or its ancestors
+    bool GetVotedAsset(const CBlockIndex* pindex, uint32_t nAssetId, CAsset& assetRet) const;
+    // All the assets voted in pindex or its ancestors
+    void GetVotedAssets(const CBlockIndex* pindex, std::map<uint32_t, CAsset>& mapAssetsRet) const;
+};
+
+extern CAssetRegistry assetRegistry;
+
+#endif
@@ -18,6 +18,8 @@
 #include "bitcoinrpc.h"
 #include "distribution.h"
 #include "scanbalance.h"
+#include "addrindex.h"
+#include "coins.h"
 #include "liquidityinfo.h"
 #include "datafeed.h"
 #include "coinmetadata.h"
@@ -824,7 +826,7 @@ Value getinfo(const Array& params, bool fHelp)
 #ifdef TESTING
     obj.push_back(Pair("time",          DateTimeStrFormat(GetTime())));
     obj.push_back(Pair("timestamp",     (boost::int64_t)GetTime()));
-    obj.push_back(Pair("trust",         pindexBest->bnChainTrust.ToString()));
+    obj.push_back(Pair("trust",         CBigNum(pindexBest->nChainTrust).ToString()));
 #endif
     return obj;
 }
@@ -847,8 +849,7 @@ Value getparkrates(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > pindex->nHeight)
             throw JSONRPCError(-12, "Error: Invalid height");
 
-        while (pindex->nHeight != nHeight)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     unsigned char cUnit;
@@ -906,6 +907,28 @@ Value getmininginfo(const Array& params, bool fHelp)
 }
 
 
+Value gettxcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gettxcacheinfo\n"
+            "Returns the size and the hit and miss counts of the cache of transaction indexes and transactions.");
+
+    CTxCacheStats stats;
+    GetTxCacheStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("maxsize",       (uint64_t)stats.nMaxSize));
+    obj.push_back(Pair("txindexes",     (uint64_t)stats.nIndexSize));
+    obj.push_back(Pair("txindexhits",   (uint64_t)stats.nIndexHits));
+    obj.push_back(Pair("txindexmisses", (uint64_t)stats.nIndexMisses));
+    obj.push_back(Pair("transactions",  (uint64_t)stats.nTxSize));
+    obj.push_back(Pair("txhits",        (uint64_t)stats.nTxHits));
+    obj.push_back(Pair("txmisses",      (uint64_t)stats.nTxMisses));
+    return obj;
+}
+
+
 Value getnewaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -2138,10 +2161,7 @@ Value listsinceblock(const Array& params, bool fHelp)
     {
         int target_height = pindexBest->nHeight + 1 - target_confirms;
 
-        CBlockIndex *block;
-        for (block = pindexBest;
-             block && block->nHeight > target_height;
-             block = block->pprev)  { }
+        CBlockIndex *block = FindBlockByHeight(target_height);
 
         lastblock = block ? block->GetBlockHash() : 0;
     }
@@ -2785,10 +2805,7 @@ Value getblockhash(const Array& params, bool fHelp)
     if (nHeight < 0 || nHeight > nBestHeight)
         throw runtime_error("Block number out of range.");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
+    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     return pblockindex->phashBlock->GetHex();
 }
 
@@ -2809,6 +2826,8 @@ Value getblock(const Array& params, bool fHelp)
 
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
+    if (IsBlockFilePruned(pblockindex->nFile))
+        throw JSONRPCError(-5, "Block not available, its block file was pruned");
     block.ReadFromDisk(pblockindex, true);
 
     bool fTxInfo = params.size() > 1 ? params[1].get_bool() : false;
@@ -3190,9 +3209,7 @@ Value getprotocolvotes(const Array& params, bool fHelp)
     if(nBlockQuantity > nHeight)
         throw runtime_error("Invalid nBlockQuantity\n");
 
-    CBlockIndex *pindex = pindexBest;
-    for(int i = nBestHeight; i > nHeight; i--)
-        pindex = pindex->pprev;
+    CBlockIndex *pindex = FindBlockByHeight(nHeight);
 
     Object obj;
     CBlockIndex* pi = pindex;
@@ -3298,8 +3315,7 @@ Value getmotions(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw runtime_error("Invalid height\n");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     int nQuantity;
@@ -3383,8 +3399,7 @@ Value getcustodianvotes(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw runtime_error("Invalid height\n");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     int nQuantity;
@@ -3453,7 +3468,7 @@ Value getelectedcustodians(const Array& params, bool fHelp)
 
     Array result;
 
-    BOOST_FOREACH(const PAIRTYPE(CBitcoinAddress, CBlockIndex*)& pair, pindexBest->GetElectedCustodians())
+    BOOST_FOREACH(const PAIRTYPE(const CBitcoinAddress, CBlockIndex*)& pair, pindexBest->GetElectedCustodianMap())
     {
         const CBitcoinAddress address = pair.first;
         const CBlockIndex* pindex = pair.second;
@@ -3502,8 +3517,7 @@ Value getparkvotes(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw runtime_error("Invalid height\n");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     int nQuantity;
@@ -3615,8 +3629,7 @@ Value getreputations(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw JSONRPCError(-3, "Invalid height");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     map<CBitcoinAddress, int64> mapReputation;
@@ -3649,10 +3662,7 @@ static CBlockIndex* GetBlockIndexFromParamsHeight(const Array& params, int index
     if (nHeight < 0 || nHeight > nBestHeight)
         throw JSONRPCError(-3, "Invalid height");
 
-    for (int i = nBestHeight; i > nHeight; i--)
-        pindex = pindex->pprev;
-
-    return pindex;
+    return FindBlockByHeight(nHeight);
 }
 
 Value getsignerreward(const Array& params, bool fHelp)
@@ -3787,8 +3797,7 @@ Value getassetinfo(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw JSONRPCError(-3, "Invalid height");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     CAsset asset;
@@ -3825,8 +3834,7 @@ Value getassets(const Array& params, bool fHelp)
         if (nHeight < 0 || nHeight > nBestHeight)
             throw JSONRPCError(-3, "Invalid height");
 
-        for (int i = nBestHeight; i > nHeight; i--)
-            pindex = pindex->pprev;
+        pindex = FindBlockByHeight(nHeight);
     }
 
     std::map<uint32_t, CAsset> assets;
@@ -4133,7 +4141,13 @@ Value getrawtransaction(const Array& params, bool fHelp)
     CTransaction tx;
     uint256 hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock))
+    {
+        CTxDB txdb("r");
+        CTxIndex txindex;
+        if (txdb.ReadTxIndex(hash, txindex) && IsBlockFilePruned(txindex.pos.nFile))
+            throw JSONRPCError(-5, "Transaction not available, its block file was pruned");
         throw JSONRPCError(-5, "No information available about transaction");
+    }
 
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << tx;
@@ -4660,6 +4674,151 @@ Value gettxout(const Array& params, bool fHelp)
     return ret;
 }
 
+// Address index records of the address in params[0] between the heights in params[1] and params[2]
+static void ReadAddressIndexRange(const Array& params, vector<CAddressIndexEntry>& vEntries)
+{
+    if (!fAddrIndex)
+        throw JSONRPCError(-1, "Address index not enabled, restart with -addrindex");
+
+    CBitcoinAddress address(params[0].get_str());
+    CAddressIndexKey keyAddress;
+    if (!keyAddress.SetAddress(address))
+        throw JSONRPCError(-5, "Invalid address");
+
+    int nStartHeight = params.size() > 1 ? params[1].get_int() : 0;
+    int nEndHeight = params.size() > 2 ? params[2].get_int() : nBestHeight;
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(-8, "Invalid height range");
+
+    CTxDB txdb("r");
+    if (!txdb.ReadAddressIndex(keyAddress, nStartHeight, nEndHeight, vEntries))
+        throw JSONRPCError(-5, "Unable to read the address index");
+}
+
+// The records of a height are ordered by txid in the index. Put them in the
+// order of the transactions in the block, the inputs of a transaction before
+// its outputs, so that a spend never comes before the output it spends.
+static void SortAddressIndexByBlockOrder(vector<CAddressIndexEntry>& vEntries)
+{
+    CTxDB txdb("r");
+    map<uint256, unsigned int> mapTxPos;
+    vector<pair<pair<pair<int, unsigned int>, pair<int, unsigned int> >, unsigned int> > vOrder;
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+    {
+        const CAddressIndexKey& key = vEntries[i].first;
+        map<uint256, unsigned int>::iterator mi = mapTxPos.find(key.txid);
+        if (mi == mapTxPos.end())
+        {
+            CTxIndex txindex;
+            if (!txdb.ReadTxIndex(key.txid, txindex))
+                throw JSONRPCError(-5, "Unable to read the transaction index of " + key.txid.GetHex());
+            mi = mapTxPos.insert(make_pair(key.txid, txindex.pos.nTxPos)).first;
+        }
+        vOrder.push_back(make_pair(make_pair(make_pair(key.nHeight, mi->second), make_pair(key.fSpending ? 0 : 1, key.nIndex)), i));
+    }
+    sort(vOrder.begin(), vOrder.end());
+
+    vector<CAddressIndexEntry> vSorted;
+    vSorted.reserve(vEntries.size());
+    for (unsigned int i = 0; i < vOrder.size(); i++)
+        vSorted.push_back(vEntries[vOrder[i].second]);
+    vEntries.swap(vSorted);
+}
+
+Value getaddresshistory(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory <address> [startheight=0] [endheight]\n"
+            "Returns the outputs paid to <address> and the inputs spending them\n"
+            "in the main chain blocks from startheight to endheight, in block order:\n"
+            "by height, then by position of the transaction in the block.\n"
+            "Requires -addrindex.");
+
+    vector<CAddressIndexEntry> vEntries;
+    ReadAddressIndexRange(params, vEntries);
+    SortAddressIndexByBlockOrder(vEntries);
+
+    Array ret;
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+    {
+        const CAddressIndexKey& key = entry.first;
+        Object obj;
+        obj.push_back(Pair("txid", key.txid.GetHex()));
+        obj.push_back(Pair("height", key.nHeight));
+        obj.push_back(Pair(key.fSpending ? "vin" : "vout", (int)key.nIndex));
+        obj.push_back(Pair("amount", ValueFromAmount(entry.second)));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos <address> [startheight=0] [endheight]\n"
+            "Returns the outputs paid to <address> in the main chain blocks\n"
+            "from startheight to endheight that are still unspent.\n"
+            "Requires -addrindex.");
+
+    vector<CAddressIndexEntry> vEntries;
+    ReadAddressIndexRange(params, vEntries);
+
+    CTxDB txdb("r");
+    CCoinsViewDB viewDB(txdb);
+    CCoinsViewCache view(&viewDB);
+    Array ret;
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+    {
+        const CAddressIndexKey& key = entry.first;
+        if (key.fSpending)
+            continue;
+        const CCoins& coins = view.GetCoins(key.txid);
+        if (!coins.IsAvailable(key.nIndex))
+            continue;
+        Object obj;
+        obj.push_back(Pair("txid", key.txid.GetHex()));
+        obj.push_back(Pair("vout", (int)key.nIndex));
+        obj.push_back(Pair("height", key.nHeight));
+        obj.push_back(Pair("confirmations", nBestHeight - key.nHeight + 1));
+        obj.push_back(Pair("amount", ValueFromAmount(entry.second)));
+        obj.push_back(Pair("scriptPubKey", HexStr(coins.vout[key.nIndex].scriptPubKey.begin(), coins.vout[key.nIndex].scriptPubKey.end())));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressbalance <address> [startheight=0] [endheight]\n"
+            "Returns the amounts received and sent by <address> in the main chain\n"
+            "blocks from startheight to endheight, and the change of its balance.\n"
+            "With the default heights the change is the current balance.\n"
+            "Requires -addrindex.");
+
+    vector<CAddressIndexEntry> vEntries;
+    ReadAddressIndexRange(params, vEntries);
+
+    int64 nReceived = 0;
+    int64 nSent = 0;
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+    {
+        if (entry.second > 0)
+            nReceived += entry.second;
+        else
+            nSent -= entry.second;
+    }
+
+    Object ret;
+    ret.push_back(Pair("received", ValueFromAmount(nReceived)));
+    ret.push_back(Pair("sent", ValueFromAmount(nSent)));
+    ret.push_back(Pair("balance", ValueFromAmount(nReceived - nSent)));
+    return ret;
+}
+
 Value getrawmempool(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -4904,7 +5063,7 @@ Value duplicateblock(const Array& params, bool fHelp)
             throw JSONRPCError(-3, "unable to extract votes");
 
         vector<CTransaction> vCurrencyCoinBase;
-        if (!GenerateCurrencyCoinBases(vVote, pindexBest->GetElectedCustodians(), vCurrencyCoinBase))
+        if (!GenerateCurrencyCoinBases(vVote, pindexBest->GetElectedCustodianMap(), vCurrencyCoinBase))
             throw JSONRPCError(-3, "unable to generate currency coin bases");
 
         BOOST_FOREACH(const CTransaction& tx, vCurrencyCoinBase)
@@ -5047,6 +5206,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getinfo",                &getinfo,                true },
     { "getparkrates",           &getparkrates,           true },
     { "getmininginfo",          &getmininginfo,          true },
+    { "gettxcacheinfo",         &gettxcacheinfo,         true },
     { "getnewaddress",          &getnewaddress,          true },
     { "getaccountaddress",      &getaccountaddress,      true },
     { "setaccount",             &setaccount,             true },
@@ -5120,6 +5280,9 @@ static const CRPCCommand vRPCCommands[] =
     { "signrawtransaction",     &signrawtransaction,     false},
     { "sendrawtransaction",     &sendrawtransaction,     false},
     { "gettxout",               &gettxout,               true },
+    { "getaddresshistory",      &getaddresshistory,      false },
+    { "getaddressutxos",        &getaddressutxos,        false },
+    { "getaddressbalance",      &getaddressbalance,      false },
     { "getrawmempool",          &getrawmempool,          true },
     { "setdatafeed",            &setdatafeed,            true },
     { "getdatafeed",            &getdatafeed,            true },
@@ -5968,6 +6131,12 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "getassetinfo"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "getassets"               && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "burn"                    && n > 0) ConvertTo<double>(params[0]);
+    if (strMethod == "getaddresshistory"       && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddresshistory"       && n > 2) ConvertTo<boost::int64_t>(params[2]);
+    if (strMethod == "getaddressutxos"         && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddressutxos"         && n > 2) ConvertTo<boost::int64_t>(params[2]);
+    if (strMethod == "getaddressbalance"       && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getaddressbalance"       && n > 2) ConvertTo<boost::int64_t>(params[2]);
 #ifdef TESTING
     if (strMethod == "timetravel"              && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "setversionvote"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
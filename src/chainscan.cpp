@@ -0,0 +1,228 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainscan.h"
+#include "db.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+static const int MAX_SCAN_THREADS = 16;
+// Number of blocks a worker may read ahead of the scanning thread, per worker
+static const unsigned int SCAN_BLOCKS_AHEAD = 16;
+
+
+void CChainScanJob::ShowProgress(const string& strName, int nPercent)
+{
+    if (nPercent % 10 == 0)
+        printf("%s : %d%%\n", strName.c_str(), nPercent);
+}
+
+class CBlockFileScanWorker : public CChainScanWorker
+{
+public:
+    CChainScanJob& job;
+    CTxDB txdb;
+
+    CBlockFileScanWorker(CChainScanJob& jobIn) : job(jobIn), txdb("r")
+    {
+    }
+
+    CBlockScanFacts* Extract(const CBlockIndex* pindex)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+        {
+            printf("ScanChain() : failed to read block %d\n", pindex->nHeight);
+            return NULL;
+        }
+        return job.Extract(txdb, block, pindex);
+    }
+};
+
+CChainScanWorker* CChainScanJob::NewWorker()
+{
+    return new CBlockFileScanWorker(*this);
+}
+
+
+// State shared by the scanning thread and the workers
+class CChainScanState
+{
+public:
+    const vector<CBlockIndex*>& vBlocks;
+    CChainScanJob& job;
+
+    boost::mutex mutex;
+    // Signaled when the facts of a block are ready or the scan failed
+    boost::condition_variable condReady;
+    // Signaled when the scanning thread applied facts
+    boost::condition_variable condApplied;
+
+    vector<CBlockScanFacts*> vFacts;
+    unsigned int nNext;
+    unsigned int nApplied;
+    unsigned int nAhead;
+    bool fStop;
+    bool fFailed;
+
+    CChainScanState(const vector<CBlockIndex*>& vBlocksIn, CChainScanJob& jobIn, unsigned int nAheadIn)
+        : vBlocks(vBlocksIn), job(jobIn), vFacts(vBlocksIn.size(), (CBlockScanFacts*)NULL)
+    {
+        nNext = 0;
+        nApplied = 0;
+        nAhead = nAheadIn;
+        fStop = false;
+        fFailed = false;
+    }
+
+    ~CChainScanState()
+    {
+        BOOST_FOREACH(CBlockScanFacts* pfacts, vFacts)
+            delete pfacts;
+    }
+};
+
+static void ThreadChainScanWorker(CChainScanState* pstate)
+{
+    auto_ptr<CChainScanWorker> pworker;
+    try {
+        pworker.reset(pstate->job.NewWorker());
+    }
+    catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ThreadChainScanWorker()");
+    }
+    catch (...) {
+        PrintExceptionContinue(NULL, "ThreadChainScanWorker()");
+    }
+    if (!pworker.get())
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(pstate->mutex);
+            pstate->fStop = pstate->fFailed = true;
+        }
+        pstate->condReady.notify_all();
+        return;
+    }
+
+    loop
+    {
+        unsigned int i;
+        {
+            boost::unique_lock<boost::mutex> lock(pstate->mutex);
+            while (!pstate->fStop && pstate->nNext < pstate->vBlocks.size() && pstate->nNext >= pstate->nApplied + pstate->nAhead)
+                pstate->condApplied.wait(lock);
+            if (pstate->fStop || pstate->nNext >= pstate->vBlocks.size())
+                return;
+            i = pstate->nNext++;
+        }
+
+        CBlockIndex* pindex = pstate->vBlocks[i];
+        CBlockScanFacts* pfacts = NULL;
+        try {
+            pfacts = pworker->Extract(pindex);
+        }
+        catch (std::exception& e) {
+            PrintExceptionContinue(&e, "ThreadChainScanWorker()");
+        }
+        catch (...) {
+            PrintExceptionContinue(NULL, "ThreadChainScanWorker()");
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(pstate->mutex);
+            if (pfacts)
+                pstate->vFacts[i] = pfacts;
+            else
+                pstate->fStop = pstate->fFailed = true;
+        }
+        pstate->condReady.notify_all();
+    }
+}
+
+static void StopChainScan(CChainScanState& state, boost::thread_group& threadGroup)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(state.mutex);
+        state.fStop = true;
+    }
+    state.condApplied.notify_all();
+    threadGroup.join_all();
+}
+
+bool ScanChain(const string& strName, CBlockIndex* pindexStart, CBlockIndex* pindexStop, CChainScanJob& job)
+{
+    vector<CBlockIndex*> vBlocks;
+    for (CBlockIndex* pindex = pindexStart; pindex && pindex != pindexStop; pindex = pindex->pnext)
+        vBlocks.push_back(pindex);
+    if (vBlocks.empty())
+        return true;
+
+    int nThreads = boost::thread::hardware_concurrency();
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_SCAN_THREADS)
+        nThreads = MAX_SCAN_THREADS;
+    if ((unsigned int)nThreads > vBlocks.size())
+        nThreads = vBlocks.size();
+    printf("%s : scanning %u blocks from height %d with %d threads\n", strName.c_str(), (unsigned int)vBlocks.size(), vBlocks[0]->nHeight, nThreads);
+    int64 nStart = GetTimeMillis();
+
+    CChainScanState state(vBlocks, job, nThreads * SCAN_BLOCKS_AHEAD);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadChainScanWorker, &state));
+
+    // Apply the facts in chain order
+    bool fOk = true;
+    int nPercent = 0;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+    {
+        CBlockScanFacts* pfacts;
+        {
+            boost::unique_lock<boost::mutex> lock(state.mutex);
+            while (!state.vFacts[i] && !state.fFailed)
+                state.condReady.wait(lock);
+            if (state.fFailed)
+            {
+                fOk = false;
+                break;
+            }
+            pfacts = state.vFacts[i];
+            state.vFacts[i] = NULL;
+            state.nApplied = i + 1;
+        }
+        state.condApplied.notify_all();
+
+        bool fApplied;
+        try {
+            fApplied = job.Apply(pfacts, vBlocks[i]);
+        }
+        catch (...) {
+            delete pfacts;
+            StopChainScan(state, threadGroup);
+            throw;
+        }
+        delete pfacts;
+        if (!fApplied || fShutdown)
+        {
+            fOk = false;
+            break;
+        }
+
+        int nNewPercent = (int)((uint64)(i + 1) * 100 / vBlocks.size());
+        if (nNewPercent != nPercent)
+        {
+            nPercent = nNewPercent;
+            job.ShowProgress(strName, nPercent);
+        }
+    }
+
+    StopChainScan(state, threadGroup);
+
+    printf("%s : scan %s in %"PRI64d"ms\n", strName.c_str(), fOk ? "done" : "failed", GetTimeMillis() - nStart);
+    return fOk;
+}
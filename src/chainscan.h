@@ -0,0 +1,60 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_CHAINSCAN_H
+#define BITCOIN_CHAINSCAN_H
+
+#include <string>
+
+class CBlock;
+class CBlockIndex;
+class CTxDB;
+
+/** What a chain scan extracted from one block */
+class CBlockScanFacts
+{
+public:
+    virtual ~CBlockScanFacts() {}
+};
+
+/** Reads blocks and extracts their facts, in one of the worker threads of ScanChain */
+class CChainScanWorker
+{
+public:
+    virtual ~CChainScanWorker() {}
+
+    // Returns NULL on error
+    virtual CBlockScanFacts* Extract(const CBlockIndex* pindex) = 0;
+};
+
+/** Work done by ScanChain. The blocks are read and their facts extracted by
+ * a pool of threads, ahead of the scanning thread that applies the facts in
+ * chain order. */
+class CChainScanJob
+{
+public:
+    virtual ~CChainScanJob() {}
+
+    // Called from the worker threads, in any order. Must not change shared
+    // state. The block may be kept by swapping it into the facts.
+    // Returns NULL on error.
+    virtual CBlockScanFacts* Extract(CTxDB& txdb, CBlock& block, const CBlockIndex* pindex) = 0;
+
+    // Called from the scanning thread in chain order. Returns false to stop the scan.
+    virtual bool Apply(CBlockScanFacts* pfacts, const CBlockIndex* pindex) = 0;
+
+    // Called from the scanning thread each time the scan progresses by a percent
+    virtual void ShowProgress(const std::string& strName, int nPercent);
+
+    // Called once from each worker thread. The default worker reads the blocks
+    // from the block files and passes them to Extract with a database handle
+    // of its own. May throw.
+    virtual CChainScanWorker* NewWorker();
+};
+
+/** Scan the main chain blocks from pindexStart to pindexStop, excluded (to the
+ * end of the chain if NULL). Returns false if a block could not be read or
+ * the job stopped the scan. */
+bool ScanChain(const std::string& strName, CBlockIndex* pindexStart, CBlockIndex* pindexStop, CChainScanJob& job);
+
+#endif
@@ -0,0 +1,231 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_CHECKQUEUE_H
+#define BITCOIN_CHECKQUEUE_H
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+template <typename T> class CCheckQueueControl;
+
+/** Queue of checks run by a pool of worker threads, and by the thread
+ * waiting for their result. T must provide bool operator()() and swap().
+ * The checks are taken in batches of up to nBatchSize. Once a check failed
+ * the remaining ones are skipped and the first failed check is kept.
+ */
+template <typename T> class CCheckQueue
+{
+private:
+    // Protects the state below
+    boost::mutex mutex;
+    // Signaled to the workers when checks are added or the queue quits
+    boost::condition_variable condWorker;
+    // Signaled to the waiting thread when the last check is done
+    boost::condition_variable condMaster;
+
+    // Checks not taken by a thread yet
+    std::vector<T> queue;
+    // Number of threads waiting for checks, and of threads taking checks
+    int nIdle;
+    int nTotal;
+    // Checks added and not done yet
+    unsigned int nTodo;
+    bool fAllOk;
+    bool fQuit;
+    T checkFailed;
+    unsigned int nBatchSize;
+
+    // Held by the CCheckQueueControl, there is one waiting thread at a time
+    boost::mutex mutexControl;
+
+    bool Loop(bool fMaster, T* pcheckFailed = NULL)
+    {
+        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        unsigned int nNow = 0;
+        bool fOk = true;
+        T checkFirstFailed;
+        bool fFailedHere = false;
+        for (;;)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // Account for the checks done in the previous batch
+                if (nNow)
+                {
+                    if (fFailedHere && fAllOk)
+                        checkFailed.swap(checkFirstFailed);
+                    fAllOk &= fOk;
+                    nTodo -= nNow;
+                    if (nTodo == 0 && !fMaster)
+                        condMaster.notify_one();
+                }
+                else
+                    nTotal++;
+
+                while (queue.empty())
+                {
+                    if (fMaster && nTodo == 0)
+                    {
+                        nTotal--;
+                        bool fRet = fAllOk;
+                        if (!fRet && pcheckFailed)
+                            pcheckFailed->swap(checkFailed);
+                        fAllOk = true;
+                        return fRet;
+                    }
+                    if (!fMaster && fQuit)
+                    {
+                        nTotal--;
+                        return true;
+                    }
+                    nIdle++;
+                    cond.wait(lock);
+                    nIdle--;
+                }
+
+                // Take a share of the queue, smaller as it empties so that
+                // the last checks are spread over the threads
+                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                vChecks.resize(nNow);
+                for (unsigned int i = 0; i < nNow; i++)
+                {
+                    vChecks[i].swap(queue.back());
+                    queue.pop_back();
+                }
+                fOk = fAllOk;
+            }
+
+            fFailedHere = false;
+            for (typename std::vector<T>::iterator it = vChecks.begin(); it != vChecks.end(); ++it)
+            {
+                if (fOk)
+                {
+                    fOk = (*it)();
+                    if (!fOk)
+                    {
+                        fFailedHere = true;
+                        checkFirstFailed.swap(*it);
+                    }
+                }
+            }
+            vChecks.clear();
+        }
+    }
+
+public:
+    CCheckQueue(unsigned int nBatchSizeIn) :
+        nIdle(0), nTotal(0), nTodo(0), fAllOk(true), fQuit(false), nBatchSize(nBatchSizeIn)
+    {
+    }
+
+    // Body of a worker thread, returns once Quit is called
+    void Thread()
+    {
+        Loop(false);
+    }
+
+    // Run checks until all the checks added are done. Returns false and
+    // the first failed check found if one failed.
+    bool Wait(T* pcheckFailed = NULL)
+    {
+        return Loop(true, pcheckFailed);
+    }
+
+    // Add checks, they are swapped out of vChecks
+    void Add(std::vector<T>& vChecks)
+    {
+        if (vChecks.empty())
+            return;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (typename std::vector<T>::iterator it = vChecks.begin(); it != vChecks.end(); ++it)
+        {
+            queue.push_back(T());
+            it->swap(queue.back());
+        }
+        nTodo += vChecks.size();
+        if (vChecks.size() == 1)
+            condWorker.notify_one();
+        else
+            condWorker.notify_all();
+    }
+
+    // Make the worker threads return once the queue is empty
+    void Quit()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fQuit = true;
+        condWorker.notify_all();
+    }
+
+    friend class CCheckQueueControl<T>;
+};
+
+/** Scope in which checks are added to a queue. The checks are waited for
+ * when leaving it if Wait was not called. With no queue, the checks are
+ * run by Add in the calling thread.
+ */
+template <typename T> class CCheckQueueControl
+{
+private:
+    CCheckQueue<T>* pqueue;
+    bool fDone;
+    bool fOk;
+    T checkFailed;
+
+    CCheckQueueControl(const CCheckQueueControl&);
+    void operator=(const CCheckQueueControl&);
+
+public:
+    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false), fOk(true)
+    {
+        if (pqueue)
+            pqueue->mutexControl.lock();
+    }
+
+    ~CCheckQueueControl()
+    {
+        Wait();
+        if (pqueue)
+            pqueue->mutexControl.unlock();
+    }
+
+    // Returns false if a check failed, pcheckFailed receives the first one found
+    bool Wait(T* pcheckFailed = NULL)
+    {
+        if (!fDone)
+        {
+            if (pqueue)
+                fOk = pqueue->Wait(&checkFailed);
+            fDone = true;
+        }
+        if (!fOk && pcheckFailed)
+            pcheckFailed->swap(checkFailed);
+        return fOk;
+    }
+
+    void Add(std::vector<T>& vChecks)
+    {
+        if (pqueue)
+        {
+            pqueue->Add(vChecks);
+            return;
+        }
+        for (typename std::vector<T>::iterator it = vChecks.begin(); it != vChecks.end() && fOk; ++it)
+        {
+            if (!(*it)())
+            {
+                fOk = false;
+                checkFailed.swap(*it);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,168 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "db.h"
+
+using namespace std;
+
+
+bool CCoinsView::GetCoins(const uint256& txid, CCoins& coins) { return false; }
+bool CCoinsView::HaveCoins(const uint256& txid) { return false; }
+bool CCoinsView::BatchWrite(const map<uint256, CCoins>& mapCoins) { return false; }
+
+
+bool CCoinsViewBacked::GetCoins(const uint256& txid, CCoins& coins) { return base->GetCoins(txid, coins); }
+bool CCoinsViewBacked::HaveCoins(const uint256& txid) { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::BatchWrite(const map<uint256, CCoins>& mapCoins) { return base->BatchWrite(mapCoins); }
+
+
+bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins)
+{
+    return txdb.ReadCoins(txid, coins);
+}
+
+bool CCoinsViewDB::HaveCoins(const uint256& txid)
+{
+    return txdb.HaveCoins(txid);
+}
+
+bool CCoinsViewDB::BatchWrite(const map<uint256, CCoins>& mapCoins)
+{
+    if (!txdb.TxnBegin())
+        return error("CCoinsViewDB::BatchWrite() : TxnBegin failed");
+    for (map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+    {
+        bool fOk = it->second.IsPruned() ? txdb.EraseCoins(it->first) : txdb.WriteCoins(it->first, it->second);
+        if (!fOk)
+        {
+            txdb.TxnAbort();
+            return error("CCoinsViewDB::BatchWrite() : failed to write coins %s", it->first.ToString().substr(0,10).c_str());
+        }
+    }
+    if (!txdb.TxnCommit())
+        return error("CCoinsViewDB::BatchWrite() : TxnCommit failed");
+    return true;
+}
+
+
+map<uint256, CCoins>::iterator CCoinsViewCache::FetchCoins(const uint256& txid)
+{
+    map<uint256, CCoins>::iterator it = cacheCoins.lower_bound(txid);
+    if (it != cacheCoins.end() && it->first == txid)
+        return it;
+
+    // Missing coins are cached too, as pruned
+    CCoins coins;
+    if (!base->GetCoins(txid, coins))
+        coins = CCoins();
+    return cacheCoins.insert(it, make_pair(txid, coins));
+}
+
+bool CCoinsViewCache::GetCoins(const uint256& txid, CCoins& coins)
+{
+    map<uint256, CCoins>::iterator it = FetchCoins(txid);
+    if (it->second.IsPruned())
+        return false;
+    coins = it->second;
+    return true;
+}
+
+CCoins& CCoinsViewCache::GetCoins(const uint256& txid)
+{
+    return FetchCoins(txid)->second;
+}
+
+void CCoinsViewCache::SetCoins(const uint256& txid, const CCoins& coins)
+{
+    cacheCoins[txid] = coins;
+}
+
+bool CCoinsViewCache::HaveCoins(const uint256& txid)
+{
+    return !FetchCoins(txid)->second.IsPruned();
+}
+
+bool CCoinsViewCache::BatchWrite(const map<uint256, CCoins>& mapCoins)
+{
+    for (map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+        cacheCoins[it->first] = it->second;
+    return true;
+}
+
+bool CCoinsViewCache::HaveInputs(const CTransaction& tx)
+{
+    if (tx.IsCoinBase() || tx.IsCustodianGrant())
+        return true;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (!GetCoins(txin.prevout.hash).IsAvailable(txin.prevout.n))
+            return false;
+    return true;
+}
+
+const CTxOut& CCoinsViewCache::GetOutputFor(const CTxIn& input)
+{
+    const CCoins& coins = GetCoins(input.prevout.hash);
+    if (!coins.IsAvailable(input.prevout.n))
+        throw std::runtime_error("CCoinsViewCache::GetOutputFor() : output not available");
+    return coins.vout[input.prevout.n];
+}
+
+bool CCoinsViewCache::Flush()
+{
+    if (!base->BatchWrite(cacheCoins))
+        return false;
+    cacheCoins.clear();
+    return true;
+}
+
+
+bool CCoinsViewMemPool::GetCoins(const uint256& txid, CCoins& coins)
+{
+    if (base->GetCoins(txid, coins))
+        return true;
+
+    LOCK(mempool.cs);
+    if (!mempool.exists(txid))
+        return false;
+    coins = CCoins(mempool.lookup(txid), MEMPOOL_HEIGHT);
+    return true;
+}
+
+bool CCoinsViewMemPool::HaveCoins(const uint256& txid)
+{
+    if (base->HaveCoins(txid))
+        return true;
+
+    LOCK(mempool.cs);
+    return mempool.exists(txid);
+}
+
+
+bool GetBlockSpentOutputs(CTxDB& txdb, const CBlock& block, CBlockUndo& blockundo)
+{
+    if (txdb.ReadBlockUndo(block.GetHash(), blockundo))
+        return true;
+
+    // Blocks connected before the undo data was kept
+    blockundo.vtxundo.clear();
+    blockundo.vtxundo.resize(block.vtx.size());
+    for (unsigned int nTx = 0; nTx < block.vtx.size(); nTx++)
+    {
+        const CTransaction& tx = block.vtx[nTx];
+        if (tx.IsCoinBase() || tx.IsCustodianGrant())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            CTransaction txPrev;
+            if (!txdb.ReadDiskTx(txin.prevout.hash, txPrev))
+                return error("GetBlockSpentOutputs() : prev tx %s not found", txin.prevout.hash.ToString().substr(0,10).c_str());
+            if (txin.prevout.n >= txPrev.vout.size())
+                return error("GetBlockSpentOutputs() : prevout.n out of range");
+            blockundo.vtxundo[nTx].vprevout.push_back(CTxInUndo(txPrev.vout[txin.prevout.n], CCoins(txPrev, -1)));
+        }
+    }
+    return true;
+}
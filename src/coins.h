@@ -0,0 +1,286 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_COINS_H
+#define BITCOIN_COINS_H
+
+#include "main.h"
+
+#include <map>
+#include <vector>
+
+class CTxDB;
+
+/** Height of the transactions of the memory pool in a CCoinsViewMemPool */
+static const int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+
+/** The unspent outputs of a transaction, with what is needed to validate
+ * the transactions spending them without reading the block files.
+ * Spent outputs are null. A transaction with no unspent output left is
+ * pruned: it has no output at all and is removed from the set. */
+class CCoins
+{
+public:
+    bool fCoinBase;
+    bool fCoinStake;
+    unsigned char cUnit;
+    unsigned int nTime;
+    // Height of the block containing the transaction
+    int nHeight;
+    std::vector<CTxOut> vout;
+
+    CCoins()
+    {
+        fCoinBase = false;
+        fCoinStake = false;
+        cUnit = 0;
+        nTime = 0;
+        nHeight = -1;
+    }
+
+    CCoins(const CTransaction& tx, int nHeightIn)
+    {
+        fCoinBase = tx.IsCoinBase();
+        fCoinStake = tx.IsCoinStake();
+        cUnit = tx.cUnit;
+        nTime = tx.nTime;
+        nHeight = nHeightIn;
+        vout = tx.vout;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        unsigned char nFlags = (fCoinBase ? 1 : 0) | (fCoinStake ? 2 : 0);
+        READWRITE(nFlags);
+        READWRITE(cUnit);
+        READWRITE(nTime);
+        READWRITE(nHeight);
+        READWRITE(vout);
+        if (fRead)
+        {
+            const_cast<CCoins*>(this)->fCoinBase = (nFlags & 1);
+            const_cast<CCoins*>(this)->fCoinStake = (nFlags & 2);
+        }
+    )
+
+    bool IsAvailable(unsigned int n) const
+    {
+        return n < vout.size() && !vout[n].IsNull();
+    }
+
+    // Mark an output spent. Returns false if it was not available.
+    bool Spend(unsigned int n)
+    {
+        if (!IsAvailable(n))
+            return false;
+        vout[n].SetNull();
+        for (unsigned int i = 0; i < vout.size(); i++)
+            if (!vout[i].IsNull())
+                return true;
+        vout.clear();
+        return true;
+    }
+
+    bool IsPruned() const
+    {
+        return vout.empty();
+    }
+
+    friend bool operator==(const CCoins& a, const CCoins& b)
+    {
+        return a.fCoinBase == b.fCoinBase &&
+               a.fCoinStake == b.fCoinStake &&
+               a.cUnit == b.cUnit &&
+               a.nTime == b.nTime &&
+               a.nHeight == b.nHeight &&
+               a.vout == b.vout;
+    }
+
+    friend bool operator!=(const CCoins& a, const CCoins& b)
+    {
+        return !(a == b);
+    }
+};
+
+/** Undo information for an output spent by a transaction: the output, and the
+ * metadata of the coins it belonged to in case the spend pruned them */
+class CTxInUndo
+{
+public:
+    CTxOut txout;
+    bool fCoinBase;
+    bool fCoinStake;
+    unsigned char cUnit;
+    unsigned int nTime;
+    int nHeight;
+    unsigned int nOutputs;
+
+    CTxInUndo()
+    {
+        fCoinBase = false;
+        fCoinStake = false;
+        cUnit = 0;
+        nTime = 0;
+        nHeight = -1;
+        nOutputs = 0;
+    }
+
+    CTxInUndo(const CTxOut& txoutIn, const CCoins& coins)
+    {
+        txout = txoutIn;
+        fCoinBase = coins.fCoinBase;
+        fCoinStake = coins.fCoinStake;
+        cUnit = coins.cUnit;
+        nTime = coins.nTime;
+        nHeight = coins.nHeight;
+        nOutputs = coins.vout.size();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        unsigned char nFlags = (fCoinBase ? 1 : 0) | (fCoinStake ? 2 : 0);
+        READWRITE(nFlags);
+        READWRITE(cUnit);
+        READWRITE(nTime);
+        READWRITE(nHeight);
+        READWRITE(nOutputs);
+        READWRITE(txout);
+        if (fRead)
+        {
+            const_cast<CTxInUndo*>(this)->fCoinBase = (nFlags & 1);
+            const_cast<CTxInUndo*>(this)->fCoinStake = (nFlags & 2);
+        }
+    )
+
+    // Give the output back to the coins of its transaction
+    bool Restore(CCoins& coins, unsigned int n) const
+    {
+        if (coins.IsPruned())
+        {
+            coins.fCoinBase = fCoinBase;
+            coins.fCoinStake = fCoinStake;
+            coins.cUnit = cUnit;
+            coins.nTime = nTime;
+            coins.nHeight = nHeight;
+            coins.vout.resize(nOutputs);
+        }
+        if (n >= coins.vout.size() || coins.IsAvailable(n))
+            return false;
+        coins.vout[n] = txout;
+        return true;
+    }
+};
+
+/** Undo information for the inputs of a transaction, in input order */
+class CTxUndo
+{
+public:
+    std::vector<CTxInUndo> vprevout;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(vprevout);
+    )
+};
+
+/** Undo information of a block: one CTxUndo per transaction, in block order.
+ * It is kept in the transaction database with the coins, so that a block is
+ * disconnected without reading the previous transactions. */
+class CBlockUndo
+{
+public:
+    std::vector<CTxUndo> vtxundo;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(vtxundo);
+    )
+};
+
+/** Outputs spent by a block, from its undo data or read from the previous
+ * transactions for the blocks connected before the undo data was kept and
+ * the blocks more than MIN_BLOCKS_TO_KEEP deep */
+bool GetBlockSpentOutputs(CTxDB& txdb, const CBlock& block, CBlockUndo& blockundo);
+
+/** View on the set of unspent transaction outputs, keyed by transaction hash.
+ * Views can be stacked: the database, the changes of the block being
+ * connected and the memory pool. */
+class CCoinsView
+{
+public:
+    virtual ~CCoinsView() {}
+
+    // Retrieve the coins of a transaction. A pruned transaction is not found.
+    virtual bool GetCoins(const uint256& txid, CCoins& coins);
+    virtual bool HaveCoins(const uint256& txid);
+    // Write a set of modified coins; pruned coins are removed
+    virtual bool BatchWrite(const std::map<uint256, CCoins>& mapCoins);
+};
+
+/** CCoinsView on top of another view */
+class CCoinsViewBacked : public CCoinsView
+{
+protected:
+    CCoinsView* base;
+
+public:
+    CCoinsViewBacked(CCoinsView* baseIn) : base(baseIn) {}
+    bool GetCoins(const uint256& txid, CCoins& coins);
+    bool HaveCoins(const uint256& txid);
+    bool BatchWrite(const std::map<uint256, CCoins>& mapCoins);
+};
+
+/** The coins stored in the transaction database */
+class CCoinsViewDB : public CCoinsView
+{
+protected:
+    CTxDB& txdb;
+
+public:
+    CCoinsViewDB(CTxDB& txdbIn) : txdb(txdbIn) {}
+    bool GetCoins(const uint256& txid, CCoins& coins);
+    bool HaveCoins(const uint256& txid);
+    bool BatchWrite(const std::map<uint256, CCoins>& mapCoins);
+};
+
+/** Coins of a base view with the changes made through this view kept in
+ * memory until Flush() writes them to the base view */
+class CCoinsViewCache : public CCoinsViewBacked
+{
+protected:
+    std::map<uint256, CCoins> cacheCoins;
+
+    std::map<uint256, CCoins>::iterator FetchCoins(const uint256& txid);
+
+public:
+    CCoinsViewCache(CCoinsView* baseIn) : CCoinsViewBacked(baseIn) {}
+
+    bool GetCoins(const uint256& txid, CCoins& coins);
+    bool HaveCoins(const uint256& txid);
+    bool BatchWrite(const std::map<uint256, CCoins>& mapCoins);
+
+    // Modifiable coins of a transaction, pruned if the view does not have them
+    CCoins& GetCoins(const uint256& txid);
+    void SetCoins(const uint256& txid, const CCoins& coins);
+
+    // Whether all the transactions spent by tx have unspent outputs in the view
+    bool HaveInputs(const CTransaction& tx);
+    const CTxOut& GetOutputFor(const CTxIn& input);
+
+    bool Flush();
+    unsigned int GetCacheSize() const { return cacheCoins.size(); }
+};
+
+/** Coins of a base view completed with the outputs of the memory pool transactions */
+class CCoinsViewMemPool : public CCoinsViewBacked
+{
+protected:
+    CTxMemPool& mempool;
+
+public:
+    CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) {}
+    bool GetCoins(const uint256& txid, CCoins& coins);
+    bool HaveCoins(const uint256& txid);
+};
+
+#endif
@@ -12,6 +12,11 @@
 #include "util.h"
 #include "main.h"
 #include "kernel.h"
+#include "logdb.h"
+#include "coins.h"
+#include "addrindex.h"
+#include "scanbalance.h"
+#include "lrucache.h"
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -35,9 +40,11 @@ unsigned int nWalletDBUpdated;
 CCriticalSection cs_db;
 static bool fDbEnvInit = false;
 bool fDetachDB = false;
+bool fTxLogDB = false;
 DbEnv dbenv(0);
 map<string, int> mapFileUseCount;
 static map<string, Db*> mapDb;
+static CLogDB logdbTx;
 
 static void EnvShutdown()
 {
@@ -99,8 +106,8 @@ CDB::CDB(const char *pszFile, const char* pszMode) : pdb(NULL)
             dbenv.set_cachesize(nDbCache / 1024, (nDbCache % 1024)*1048576, 1);
             dbenv.set_lg_bsize(1048576);
             dbenv.set_lg_max(10485760);
-            dbenv.set_lk_max_locks(10000);
-            dbenv.set_lk_max_objects(10000);
+            dbenv.set_lk_max_locks(DB_MAX_LOCKS);
+            dbenv.set_lk_max_objects(DB_MAX_LOCKS);
             dbenv.set_errfile(fopen(pathErrorFile.string().c_str(), "a")); /// debug
             dbenv.set_flags(DB_TXN_WRITE_NOSYNC, 1);
             dbenv.set_flags(DB_AUTO_COMMIT, 1);
@@ -301,6 +308,10 @@ void DBFlush(bool fShutdown)
     // Flush log data to the actual data file
     //  on all files that are not in use
     printf("DBFlush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
+    if (fShutdown)
+        logdbTx.Close();
+    else if (logdbTx.IsOpen())
+        logdbTx.Flush();
     if (!fDbEnvInit)
         return;
     {
@@ -343,46 +354,894 @@ void DBFlush(bool fShutdown)
 
 
 
+//
+// CBerkeleyKeyValueStore
+//
+
+class CBerkeleyKeyValueCursor : public CKeyValueCursor
+{
+private:
+    CBerkeleyKeyValueStore* pstore;
+    Dbc* pcursor;
+    string strSeek;
+    bool fSeek;
+    bool fFailed;
+
+public:
+    CBerkeleyKeyValueCursor(CBerkeleyKeyValueStore* pstoreIn, Dbc* pcursorIn) : pstore(pstoreIn), pcursor(pcursorIn), fSeek(false), fFailed(false) {}
+
+    ~CBerkeleyKeyValueCursor()
+    {
+        pcursor->close();
+    }
+
+    void Seek(const CDataStream& ssKey)
+    {
+        strSeek.assign(ssKey.begin(), ssKey.end());
+        fSeek = !strSeek.empty();
+    }
+
+    bool Next(CDataStream& ssKey, CDataStream& ssValue)
+    {
+        if (fFailed)
+            return false;
+        unsigned int fFlags = DB_NEXT;
+        if (fSeek)
+        {
+            ssKey.clear();
+            ssKey.write(strSeek.data(), strSeek.size());
+            fFlags = DB_SET_RANGE;
+            fSeek = false;
+        }
+        int ret = pstore->ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        if (ret == DB_NOTFOUND)
+            return false;
+        if (ret != 0)
+        {
+            fFailed = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool Failed() const
+    {
+        return fFailed;
+    }
+};
+
+bool CBerkeleyKeyValueStore::Read(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    if (!pdb)
+        return false;
+
+    Dbt datKey((void*)&ssKey[0], ssKey.size());
+    Dbt datValue;
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
+    if (datValue.get_data() == NULL)
+        return false;
+
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+    free(datValue.get_data());
+    return (ret == 0);
+}
+
+bool CBerkeleyKeyValueStore::Write(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+
+    Dbt datKey((void*)&ssKey[0], ssKey.size());
+    Dbt datValue((void*)&ssValue[0], ssValue.size());
+    int ret = pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+    return (ret == 0);
+}
+
+bool CBerkeleyKeyValueStore::Erase(const CDataStream& ssKey)
+{
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Erase called on database in read-only mode");
+
+    Dbt datKey((void*)&ssKey[0], ssKey.size());
+    int ret = pdb->del(GetTxn(), &datKey, 0);
+    return (ret == 0 || ret == DB_NOTFOUND);
+}
+
+bool CBerkeleyKeyValueStore::Exists(const CDataStream& ssKey)
+{
+    if (!pdb)
+        return false;
+
+    Dbt datKey((void*)&ssKey[0], ssKey.size());
+    int ret = pdb->exists(GetTxn(), &datKey, 0);
+    return (ret == 0);
+}
+
+bool CBerkeleyKeyValueStore::WriteBatch(const CKeyValueBatch& batch)
+{
+    if (!TxnBegin())
+        return false;
+    for (CKeyValueBatch::MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+    {
+        Dbt datKey((void*)it->first.data(), it->first.size());
+        int ret;
+        if (it->second.first)
+        {
+            ret = pdb->del(GetTxn(), &datKey, 0);
+            if (ret == DB_NOTFOUND)
+                ret = 0;
+        }
+        else
+        {
+            Dbt datValue((void*)it->second.second.data(), it->second.second.size());
+            ret = pdb->put(GetTxn(), &datKey, &datValue, 0);
+        }
+        if (ret != 0)
+        {
+            TxnAbort();
+            return false;
+        }
+    }
+    return TxnCommit();
+}
+
+CKeyValueCursor* CBerkeleyKeyValueStore::NewCursor()
+{
+    Dbc* pcursor = GetCursor();
+    if (!pcursor)
+        return NULL;
+    return new CBerkeleyKeyValueCursor(this, pcursor);
+}
+
+bool CopyKeyValueStore(CKeyValueStore& from, CKeyValueStore& to, unsigned int nBatchSize)
+{
+    CKeyValueCursor* pcursor = from.NewCursor();
+    if (!pcursor)
+        return false;
+
+    CKeyValueBatch batch;
+    unsigned int nCopied = 0;
+    bool fSuccess = true;
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    while (fSuccess && pcursor->Next(ssKey, ssValue))
+    {
+        batch.Write(string(ssKey.begin(), ssKey.end()), string(ssValue.begin(), ssValue.end()));
+        if (batch.size() >= nBatchSize)
+        {
+            fSuccess = to.WriteBatch(batch);
+            nCopied += batch.size();
+            batch.clear();
+        }
+    }
+    fSuccess = fSuccess && !pcursor->Failed() && to.WriteBatch(batch);
+    nCopied += batch.size();
+    delete pcursor;
+
+    if (!fSuccess)
+        return error("CopyKeyValueStore() : copy failed after %u records", nCopied);
+    printf("CopyKeyValueStore() : copied %u records\n", nCopied);
+    return true;
+}
+
+static CLogDB& GetTxLogDB()
+{
+    LOCK(cs_db);
+    if (!logdbTx.IsOpen() && !logdbTx.Open(GetDataDir() / "txlog"))
+        throw runtime_error("CTxDB() : can't open transaction database txlog");
+    return logdbTx;
+}
+
+// Close a Berkeley DB file of the environment so that it can be moved or removed
+static void ReleaseDbFile(const string& strFile)
+{
+    LOCK(cs_db);
+    CloseDb(strFile);
+    dbenv.txn_checkpoint(0, 0, 0);
+    dbenv.lsn_reset(strFile.c_str(), 0);
+    mapFileUseCount.erase(strFile);
+}
+
+static bool ReadBestChain(CKeyValueStore& store, uint256& hashBestChain)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << string("hashBestChain");
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    if (!store.Read(ssKey, ssValue))
+        return false;
+    ssValue >> hashBestChain;
+    return true;
+}
+
+// A migration interrupted after the new database was moved in place leaves
+// the old one behind. It is removed if both hold the same chain, otherwise
+// there is no telling which one is current.
+static bool RemoveStaleTxDB(const filesystem::path& pathLog)
+{
+    uint256 hashBDB = 0, hashLog = 0;
+    bool fReadBDB, fReadLog;
+    {
+        CLogDB logdb;
+        fReadLog = logdb.Open(pathLog);
+        if (fReadLog)
+        {
+            CLogKeyValueStore logstore(logdb, "r");
+            fReadLog = ReadBestChain(logstore, hashLog);
+        }
+    }
+    {
+        CBerkeleyKeyValueStore bdbstore("blkindex.dat", "r");
+        fReadBDB = ReadBestChain(bdbstore, hashBDB);
+    }
+    ReleaseDbFile("blkindex.dat");
+
+    if (!fReadBDB || !fReadLog || hashBDB != hashLog)
+        return error("MigrateTxDB() : both blkindex.dat and txlog exist and do not hold the same chain, "
+                     "remove the one not used by -txdbengine=%s", fTxLogDB ? "log" : "bdb");
+
+    printf("MigrateTxDB() : removing the %s left by an interrupted migration\n", fTxLogDB ? "blkindex.dat" : "txlog");
+    try {
+        if (fTxLogDB)
+        {
+            Db db(&dbenv, 0);
+            db.remove("blkindex.dat", NULL, 0);
+        }
+        else
+            filesystem::remove_all(pathLog);
+    }
+    catch (std::exception &e) {
+        return error("MigrateTxDB() : %s", e.what());
+    }
+    return true;
+}
+
+bool MigrateTxDB()
+{
+    filesystem::path pathBDB = GetDataDir() / "blkindex.dat";
+    filesystem::path pathLog = GetDataDir() / "txlog";
+    bool fBDB = filesystem::exists(pathBDB);
+    bool fLog = filesystem::exists(CLogDB::GetDataPath(pathLog));
+
+    if (fBDB && fLog)
+        return RemoveStaleTxDB(pathLog);
+
+    // Nothing to do unless only the other engine holds a database
+    if (fTxLogDB ? !fBDB : !fLog)
+        return true;
+
+    printf("Migrating transaction database to %s...\n", fTxLogDB ? "txlog" : "blkindex.dat");
+    int64 nStart = GetTimeMillis();
+
+    // Copy into a temporary database and move it in place once complete,
+    // so that an interrupted migration restarts from scratch
+    const string strTmp = "blkindex.migrate";
+    filesystem::path pathLogTmp = GetDataDir() / "txlog.migrate";
+    bool fSuccess;
+    {
+        CLogDB logdb;
+        if (filesystem::exists(pathLogTmp))
+            filesystem::remove_all(pathLogTmp);
+        if (!logdb.Open(fTxLogDB ? pathLogTmp : pathLog))
+            return false;
+        CLogKeyValueStore logstore(logdb, fTxLogDB ? "cr+" : "r");
+        CBerkeleyKeyValueStore bdbstore(fTxLogDB ? "blkindex.dat" : strTmp.c_str(), fTxLogDB ? "r" : "cr+");
+        if (fTxLogDB)
+            fSuccess = CopyKeyValueStore(bdbstore, logstore);
+        else
+            fSuccess = CopyKeyValueStore(logstore, bdbstore);
+        fSuccess = fSuccess && logdb.Flush();
+    }
+
+    // Move the new database in place and remove the old one
+    ReleaseDbFile(fTxLogDB ? "blkindex.dat" : strTmp);
+    if (fSuccess)
+    {
+        try {
+            if (fTxLogDB)
+            {
+                filesystem::rename(pathLogTmp, pathLog);
+                Db dbA(&dbenv, 0);
+                dbA.remove("blkindex.dat", NULL, 0);
+            }
+            else
+            {
+                Db dbB(&dbenv, 0);
+                dbB.rename(strTmp.c_str(), NULL, "blkindex.dat", 0);
+                filesystem::remove_all(pathLog);
+            }
+        }
+        catch (std::exception &e) {
+            fSuccess = error("MigrateTxDB() : %s", e.what());
+        }
+    }
+    if (!fSuccess)
+        return error("MigrateTxDB() : migration of the transaction database failed");
+
+    printf("Migrated transaction database in %"PRI64d"ms\n", GetTimeMillis() - nStart);
+    return true;
+}
+
+
+
+//
+// CTxDB
+//
+
+CTxDB::CTxDB(const char* pszMode) : pstore(NULL)
+{
+    if (fTxLogDB)
+        pstore = new CLogKeyValueStore(GetTxLogDB(), pszMode);
+    else
+        pstore = new CBerkeleyKeyValueStore("blkindex.dat", pszMode);
+}
+
+void CTxDB::Close()
+{
+    // Uncommitted batches are dropped
+    vBatch.clear();
+    delete pstore;
+    pstore = NULL;
+}
+
+// Committed write batches not yet written to the database
+static CCriticalSection cs_batchDeferred;
+static CKeyValueBatch batchDeferred;
+static uint64 nDeferredSize = 0;
+static uint64 nMaxDeferredSize = DEFAULT_DB_BATCH_SIZE * 1024 * 1024;
+
+void SetTxDBBatchSize(uint64 nSize)
+{
+    LOCK(cs_batchDeferred);
+    nMaxDeferredSize = nSize;
+}
+
+// Cache of the recently read transaction indexes and transactions, shared by
+// all the CTxDB. A transaction is kept with its position and only used while
+// its index still points to it.
+static CCriticalSection cs_txCache;
+static CLRUCache<uint256, CTxIndex> cacheTxIndex(DEFAULT_TX_CACHE_SIZE);
+static CLRUCache<uint256, pair<CDiskTxPos, CTransaction> > cacheTx(DEFAULT_TX_CACHE_SIZE);
+static CTxCacheStats txCacheStats;
+// Incremented each time tx indexes are committed, so that an index read
+// from the database before the commit is not cached after it
+static uint64 nTxCacheGeneration = 0;
+
+void SetTxCacheSize(unsigned int nSize)
+{
+    LOCK(cs_txCache);
+    cacheTxIndex.max_size(nSize);
+    cacheTx.max_size(nSize);
+}
+
+void GetTxCacheStats(CTxCacheStats& stats)
+{
+    LOCK(cs_txCache);
+    stats = txCacheStats;
+    stats.nMaxSize = cacheTxIndex.max_size();
+    stats.nIndexSize = cacheTxIndex.size();
+    stats.nTxSize = cacheTx.size();
+}
+
+// Drop the cached tx indexes written by a committed batch
+static void InvalidateTxCache(const CKeyValueBatch& batch)
+{
+    static const string strPrefix("\x02tx", 3);
+    LOCK(cs_txCache);
+    nTxCacheGeneration++;
+    for (CKeyValueBatch::MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+    {
+        const string& strKey = it->first;
+        if (strKey.compare(0, strPrefix.size(), strPrefix) != 0)
+            continue;
+        CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+        string strType;
+        uint256 hash;
+        ssKey >> strType >> hash;
+        cacheTxIndex.erase(hash);
+        cacheTx.erase(hash);
+    }
+}
+
+bool CTxDB::LookupTxnBatch(const string& strKey, bool& fErased, string& strValue)
+{
+    for (vector<CKeyValueBatch>::reverse_iterator it = vBatch.rbegin(); it != vBatch.rend(); ++it)
+        if (it->Lookup(strKey, fErased, strValue))
+            return true;
+    return false;
+}
+
+bool CTxDB::LookupBatch(const string& strKey, bool& fErased, string& strValue)
+{
+    if (LookupTxnBatch(strKey, fErased, strValue))
+        return true;
+
+    LOCK(cs_batchDeferred);
+    return batchDeferred.Lookup(strKey, fErased, strValue);
+}
+
+bool CTxDB::ReadRaw(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    if (!pstore)
+        return false;
+
+    string strValue;
+    bool fErased;
+    if (!LookupBatch(string(ssKey.begin(), ssKey.end()), fErased, strValue))
+        return pstore->Read(ssKey, ssValue);
+    if (fErased)
+        return false;
+    ssValue.clear();
+    ssValue.write(strValue.data(), strValue.size());
+    return true;
+}
+
+bool CTxDB::ExistsRaw(const CDataStream& ssKey)
+{
+    if (!pstore)
+        return false;
+
+    string strValue;
+    bool fErased;
+    if (!LookupBatch(string(ssKey.begin(), ssKey.end()), fErased, strValue))
+        return pstore->Exists(ssKey);
+    return !fErased;
+}
+
+bool CTxDB::WriteRaw(const CDataStream& ssKey, const CDataStream* pssValue)
+{
+    if (!pstore)
+        return false;
+
+    CKeyValueBatch batchSingle;
+    CKeyValueBatch& batch = vBatch.empty() ? batchSingle : vBatch.back();
+    string strKey(ssKey.begin(), ssKey.end());
+    if (pssValue)
+        batch.Write(strKey, string(pssValue->begin(), pssValue->end()));
+    else
+        batch.Erase(strKey);
+    if (vBatch.empty())
+        return CommitBatch(batch);
+    return true;
+}
+
+bool CTxDB::TxnBegin()
+{
+    if (!pstore)
+        return false;
+    vBatch.push_back(CKeyValueBatch());
+    return true;
+}
+
+bool CTxDB::TxnCommit()
+{
+    if (!pstore)
+        return false;
+    if (vBatch.empty())
+        return false;
+
+    CKeyValueBatch batch;
+    batch.mapWrites.swap(vBatch.back().mapWrites);
+    vBatch.pop_back();
+    if (!vBatch.empty())
+    {
+        vBatch.back().Merge(batch);
+        return true;
+    }
+    return CommitBatch(batch);
+}
+
+bool CTxDB::TxnAbort()
+{
+    if (!pstore)
+        return false;
+    if (vBatch.empty())
+        return false;
+    vBatch.pop_back();
+    return true;
+}
+
+bool CTxDB::CommitBatch(const CKeyValueBatch& batch)
+{
+    LOCK(cs_batchDeferred);
+
+    // Group the writes of consecutive blocks during the initial download.
+    // Batches are applied in commit order so the database always holds a
+    // consistent, if older, state. The record count is bounded too, as
+    // Berkeley DB locks every page written until the transaction commits.
+    bool fDefer = nMaxDeferredSize > 0 && IsInitialBlockDownload();
+    bool fOk;
+    if (!fDefer && batchDeferred.empty())
+        fOk = pstore->WriteBatch(batch);
+    else
+    {
+        nDeferredSize += batch.GetDataSize();
+        batchDeferred.Merge(batch);
+        fOk = (fDefer && nDeferredSize < nMaxDeferredSize && batchDeferred.size() < MAX_DEFERRED_RECORDS) || Flush();
+    }
+
+    // The batch is now visible to the other CTxDB
+    InvalidateTxCache(batch);
+    return fOk;
+}
+
+bool CTxDB::Flush()
+{
+    if (!pstore)
+        return false;
+
+    LOCK(cs_batchDeferred);
+    if (batchDeferred.empty())
+        return true;
+
+    int64 nStart = GetTimeMillis();
+    if (!pstore->WriteBatch(batchDeferred))
+        return error("CTxDB::Flush() : failed to write %u records", batchDeferred.size());
+    if (fDebug)
+        printf("CTxDB::Flush() : wrote %u records in %"PRI64d"ms\n", batchDeferred.size(), GetTimeMillis() - nStart);
+    batchDeferred.clear();
+    nDeferredSize = 0;
+    return true;
+}
+
+bool FlushTxDBWrites()
+{
+    CTxDB txdb;
+    return txdb.Flush();
+}
+
+bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
+{
+    assert(!fClient);
+    txindex.SetNull();
+
+    // The cache only holds committed indexes, not those written by the
+    // open transactions of this CTxDB
+    bool fCache = true;
+    if (!vBatch.empty())
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("tx"), hash);
+        bool fErased;
+        string strValue;
+        fCache = !LookupTxnBatch(string(ssKey.begin(), ssKey.end()), fErased, strValue);
+    }
+
+    uint64 nGeneration = 0;
+    if (fCache)
+    {
+        LOCK(cs_txCache);
+        if (cacheTxIndex.get(hash, txindex))
+        {
+            txCacheStats.nIndexHits++;
+            return true;
+        }
+        txCacheStats.nIndexMisses++;
+        nGeneration = nTxCacheGeneration;
+    }
+
+    if (!Read(make_pair(string("tx"), hash), txindex))
+        return false;
+
+    if (fCache)
+    {
+        LOCK(cs_txCache);
+        if (nGeneration == nTxCacheGeneration)
+            cacheTxIndex.insert(hash, txindex);
+    }
+    return true;
+}
+
+bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
+{
+    assert(!fClient);
+    return Write(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
+{
+    assert(!fClient);
+
+    // Add to tx index
+    uint256 hash = tx.GetHash();
+    CTxIndex txindex(pos, tx.vout.size());
+    return Write(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::EraseTxIndex(const CTransaction& tx)
+{
+    assert(!fClient);
+    uint256 hash = tx.GetHash();
+
+    return Erase(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ContainsTx(uint256 hash)
+{
+    assert(!fClient);
+    return Exists(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ReadCoins(const uint256& hash, CCoins& coins)
+{
+    assert(!fClient);
+    return Read(make_pair(string("coins"), hash), coins);
+}
+
+bool CTxDB::WriteCoins(const uint256& hash, const CCoins& coins)
+{
+    assert(!fClient);
+    return Write(make_pair(string("coins"), hash), coins);
+}
+
+bool CTxDB::EraseCoins(const uint256& hash)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("coins"), hash));
+}
+
+bool CTxDB::HaveCoins(const uint256& hash)
+{
+    assert(!fClient);
+    return Exists(make_pair(string("coins"), hash));
+}
+
+bool CTxDB::ReadBlockUndo(const uint256& hashBlock, CBlockUndo& blockundo)
+{
+    assert(!fClient);
+    return Read(make_pair(string("blockundo"), hashBlock), blockundo);
+}
+
+bool CTxDB::WriteBlockUndo(const uint256& hashBlock, const CBlockUndo& blockundo)
+{
+    assert(!fClient);
+    return Write(make_pair(string("blockundo"), hashBlock), blockundo);
+}
 
-//
-// CTxDB
-//
+bool CTxDB::EraseBlockUndo(const uint256& hashBlock)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("blockundo"), hashBlock));
+}
 
-bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
+bool CTxDB::WriteAddressIndex(const vector<CAddressIndexEntry>& vEntries)
 {
     assert(!fClient);
-    txindex.SetNull();
-    return Read(make_pair(string("tx"), hash), txindex);
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+        if (!Write(make_pair(string("addrindex"), entry.first), entry.second))
+            return false;
+    return true;
 }
 
-bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
+bool CTxDB::EraseAddressIndex(const vector<CAddressIndexEntry>& vEntries)
 {
     assert(!fClient);
-    return Write(make_pair(string("tx"), hash), txindex);
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+        Erase(make_pair(string("addrindex"), entry.first));
+    return true;
 }
 
-bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
+bool CTxDB::ReadAddressIndex(const CAddressIndexKey& keyAddress, int nStartHeight, int nEndHeight, vector<CAddressIndexEntry>& vEntries)
 {
     assert(!fClient);
+    vEntries.clear();
 
-    // Add to tx index
-    uint256 hash = tx.GetHash();
-    CTxIndex txindex(pos, tx.vout.size());
-    return Write(make_pair(string("tx"), hash), txindex);
+    // Get cursor, cursors only see the records written to the database
+    if (!FlushTxDBWrites())
+        return false;
+    CKeyValueCursor* pcursor = pstore ? pstore->NewCursor() : NULL;
+    if (!pcursor)
+        return false;
+
+    // The records of an address are ordered by height
+    CAddressIndexKey keyStart(keyAddress.cUnit, keyAddress.cType, keyAddress.hashAddress, max(nStartHeight, 0), 0, 0, false);
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << string("addrindex") << keyStart;
+    pcursor->Seek(ssStart);
+    loop
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!pcursor->Next(ssKey, ssValue))
+        {
+            if (pcursor->Failed())
+            {
+                delete pcursor;
+                return false;
+            }
+            break;
+        }
+
+        // Unserialize
+        string strType;
+        CAddressIndexKey key;
+        int64 nValue;
+
+        try {
+            ssKey >> strType;
+            if (strType != "addrindex")
+                break;
+            ssKey >> key;
+            ssValue >> nValue;
+        }
+        catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+
+        if (!key.IsSameAddress(keyAddress) || key.nHeight > nEndHeight)
+            break;
+        vEntries.push_back(make_pair(key, nValue));
+    }
+
+    delete pcursor;
+    return true;
 }
 
-bool CTxDB::EraseTxIndex(const CTransaction& tx)
+bool CTxDB::EraseRecords(const string& strType)
 {
     assert(!fClient);
-    uint256 hash = tx.GetHash();
+    unsigned int nErased = 0;
+    loop
+    {
+        if (!FlushTxDBWrites())
+            return false;
+        CKeyValueCursor* pcursor = pstore ? pstore->NewCursor() : NULL;
+        if (!pcursor)
+            return false;
 
-    return Erase(make_pair(string("tx"), hash));
+        // Collect a batch of keys, the cursor is closed before they are erased
+        vector<CDataStream> vKeys;
+        CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+        ssStart << strType;
+        pcursor->Seek(ssStart);
+        while (vKeys.size() < 10000)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!pcursor->Next(ssKey, ssValue))
+            {
+                if (pcursor->Failed())
+                {
+                    delete pcursor;
+                    return false;
+                }
+                break;
+            }
+
+            string strKeyType;
+            try {
+                CDataStream ssType(ssKey);
+                ssType >> strKeyType;
+            }
+            catch (std::exception &e) {
+                delete pcursor;
+                return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            }
+            if (strKeyType != strType)
+                break;
+            vKeys.push_back(ssKey);
+        }
+        delete pcursor;
+
+        if (vKeys.empty())
+            break;
+        if (!TxnBegin())
+            return false;
+        BOOST_FOREACH(const CDataStream& ssKey, vKeys)
+            WriteRaw(ssKey, NULL);
+        if (!TxnCommit())
+            return false;
+        nErased += vKeys.size();
+    }
+    if (nErased)
+        printf("CTxDB::EraseRecords() : erased %u %s records\n", nErased, strType.c_str());
+    return true;
 }
 
-bool CTxDB::ContainsTx(uint256 hash)
+bool CTxDB::WipeAddressIndex()
+{
+    return EraseRecords("addrindex");
+}
+
+bool CTxDB::ReadShareBalance(const CBalanceKey& key, int64& nBalance)
+{
+    nBalance = 0;
+    return Read(make_pair(string("sharebalance"), key), nBalance);
+}
+
+bool CTxDB::WriteShareBalance(const CBalanceKey& key, int64 nBalance)
 {
     assert(!fClient);
-    return Exists(make_pair(string("tx"), hash));
+    return Write(make_pair(string("sharebalance"), key), nBalance);
+}
+
+bool CTxDB::EraseShareBalance(const CBalanceKey& key)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("sharebalance"), key));
+}
+
+bool CTxDB::ReadShareBalances(vector<pair<CBalanceKey, int64> >& vBalance)
+{
+    assert(!fClient);
+    vBalance.clear();
+
+    // Get cursor, cursors only see the records written to the database
+    if (!FlushTxDBWrites())
+        return false;
+    CKeyValueCursor* pcursor = pstore ? pstore->NewCursor() : NULL;
+    if (!pcursor)
+        return false;
+
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << string("sharebalance");
+    pcursor->Seek(ssStart);
+    loop
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!pcursor->Next(ssKey, ssValue))
+        {
+            if (pcursor->Failed())
+            {
+                delete pcursor;
+                return false;
+            }
+            break;
+        }
+
+        // Unserialize
+        string strType;
+        CBalanceKey key;
+        int64 nBalance;
+
+        try {
+            ssKey >> strType;
+            if (strType != "sharebalance")
+                break;
+            ssKey >> key;
+            ssValue >> nBalance;
+        }
+        catch (std::exception &e) {
+            delete pcursor;
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+        vBalance.push_back(make_pair(key, nBalance));
+    }
+
+    delete pcursor;
+    return true;
+}
+
+bool CTxDB::ReadBalanceSnapshot(int nHeight, CBalanceSnapshot& snapshot)
+{
+    return Read(make_pair(string("balancesnapshot"), nHeight), snapshot);
+}
+
+bool CTxDB::WriteBalanceSnapshot(int nHeight, const CBalanceSnapshot& snapshot)
+{
+    assert(!fClient);
+    return Write(make_pair(string("balancesnapshot"), nHeight), snapshot);
+}
+
+bool CTxDB::EraseBalanceSnapshot(int nHeight)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("balancesnapshot"), nHeight));
+}
+
+bool CTxDB::WipeBalanceIndex()
+{
+    return EraseRecords("sharebalance") && EraseRecords("balancesnapshot");
 }
 
 bool CTxDB::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<CTransaction>& vtx)
@@ -390,27 +1249,29 @@ bool CTxDB::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<CTransaction>&
     assert(!fClient);
     vtx.clear();
 
-    // Get cursor
-    Dbc* pcursor = GetCursor();
+    // Get cursor, cursors only see the records written to the database
+    if (!FlushTxDBWrites())
+        return false;
+    CKeyValueCursor* pcursor = pstore ? pstore->NewCursor() : NULL;
     if (!pcursor)
         return false;
 
-    unsigned int fFlags = DB_SET_RANGE;
+    CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+    ssStart << string("owner") << hash160 << CDiskTxPos(0, 0, 0);
+    pcursor->Seek(ssStart);
     loop
     {
         // Read next record
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fFlags == DB_SET_RANGE)
-            ssKey << string("owner") << hash160 << CDiskTxPos(0, 0, 0);
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
-        fFlags = DB_NEXT;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
+        if (!pcursor->Next(ssKey, ssValue))
         {
-            pcursor->close();
-            return false;
+            if (pcursor->Failed())
+            {
+                delete pcursor;
+                return false;
+            }
+            break;
         }
 
         // Unserialize
@@ -424,6 +1285,7 @@ bool CTxDB::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<CTransaction>&
             ssValue >> nItemHeight;
         }
         catch (std::exception &e) {
+            delete pcursor;
             return error("%s() : deserialize error", __PRETTY_FUNCTION__);
         }
 
@@ -435,13 +1297,13 @@ bool CTxDB::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<CTransaction>&
             vtx.resize(vtx.size()+1);
             if (!vtx.back().ReadFromDisk(pos))
             {
-                pcursor->close();
+                delete pcursor;
                 return false;
             }
         }
     }
 
-    pcursor->close();
+    delete pcursor;
     return true;
 }
 
@@ -451,7 +1313,27 @@ bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
     tx.SetNull();
     if (!ReadTxIndex(hash, txindex))
         return false;
-    return (tx.ReadFromDisk(txindex.pos));
+
+    {
+        LOCK(cs_txCache);
+        pair<CDiskTxPos, CTransaction> entry;
+        if (cacheTx.get(hash, entry) && entry.first == txindex.pos)
+        {
+            txCacheStats.nTxHits++;
+            tx = entry.second;
+            return true;
+        }
+        txCacheStats.nTxMisses++;
+    }
+
+    if (!tx.ReadFromDisk(txindex.pos))
+        return false;
+
+    {
+        LOCK(cs_txCache);
+        cacheTx.insert(hash, make_pair(txindex.pos, tx));
+    }
+    return true;
 }
 
 bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx)
@@ -491,6 +1373,17 @@ bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
     return Write(string("hashBestChain"), hashBestChain);
 }
 
+bool CTxDB::ReadPrunedBlockFiles(set<unsigned int>& setPruned)
+{
+    setPruned.clear();
+    return Read(string("prunedBlockFiles"), setPruned);
+}
+
+bool CTxDB::WritePrunedBlockFiles(const set<unsigned int>& setPruned)
+{
+    return Write(string("prunedBlockFiles"), setPruned);
+}
+
 bool CTxDB::ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust)
 {
     return Read(string("bnBestInvalidTrust"), bnBestInvalidTrust);
@@ -542,7 +1435,7 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = new (AllocateBlockIndex()) CBlockIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
@@ -551,28 +1444,227 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+// Construct the block index object of a block read from the database or from the snapshot
+static bool AddDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex)
+{
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nBlockPos      = diskindex.nBlockPos;
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nMint          = diskindex.nMint;
+    pindexNew->mapMoneySupply = diskindex.mapMoneySupply;
+    pindexNew->mapTotalParked = diskindex.mapTotalParked;
+    pindexNew->nFlags         = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    pindexNew->prevoutStake   = diskindex.prevoutStake;
+    pindexNew->nStakeTime     = diskindex.nStakeTime;
+    pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+    pindexNew->vote                   = diskindex.vote;
+    pindexNew->vote.nCoinAgeDestroyed = diskindex.nCoinAgeDestroyed;
+    pindexNew->vParkRateResult        = diskindex.vParkRateResult;
+    pindexNew->nCoinAgeDestroyed      = diskindex.nCoinAgeDestroyed;
+    pindexNew->vElectedCustodian      = diskindex.vElectedCustodian;
+    pindexNew->nProtocolVersion       = diskindex.nProtocolVersion;
+    pindexNew->mapVotedFee            = diskindex.mapVotedFee;
+    pindexNew->signerRewardVoteResult = diskindex.signerRewardVoteResult;
+    pindexNew->mapAssets              = diskindex.mapAssets;
+    pindexNew->rewardedSigner         = diskindex.rewardedSigner;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+
+    // Watch for genesis block
+    if (pindexGenesisBlock == NULL && hash == hashGenesisBlock)
+        pindexGenesisBlock = pindexNew;
+
+    if (!pindexNew->CheckIndex())
+        return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
+
+    // ppcoin: build setStakeSeen
+    if (pindexNew->IsProofOfStake())
+        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+    return true;
+}
+
+//
+// Block index snapshot: the block index records as stored in the database,
+// with their hash, stake modifier checksum and chain trust so that they don't
+// need to be recalculated, in a single file protected by a hash.
+// The snapshot is removed when the block index is loaded, so it is only used
+// if no block was added to the database since it was written.
+//
+
+static const unsigned int BLOCK_INDEX_SNAPSHOT_MAGIC = 0x53494342; // "BCIS"
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blkindex.snapshot";
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    if (pindexBest == NULL)
+        return false;
+
+    int64 nStart = GetTimeMillis();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << BLOCK_INDEX_SNAPSHOT_MAGIC << BLOCK_INDEX_SNAPSHOT_VERSION << CLIENT_VERSION << hashBestChain;
+    ss << (uint64)mapBlockIndex.size();
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        CBlockIndex* pindex = item.second;
+        ss << item.first << CDiskBlockIndex(pindex) << pindex->nStakeModifierChecksum << pindex->nChainTrust;
+    }
+    uint256 hash = Hash(ss.begin(), ss.end());
+    ss << hash;
+
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = pathSnapshot.string() + ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("WriteBlockIndexSnapshot() : unable to open %s", pathTmp.string().c_str());
+    bool fWritten = (fwrite(&ss.begin()[0], 1, ss.size(), file) == ss.size());
+    fclose(file);
+    if (!fWritten)
+    {
+        boost::filesystem::remove(pathTmp);
+        return error("WriteBlockIndexSnapshot() : unable to write %s", pathTmp.string().c_str());
+    }
+
+    try {
+        boost::filesystem::remove(pathSnapshot);
+        boost::filesystem::rename(pathTmp, pathSnapshot);
+    } catch (boost::filesystem::filesystem_error &e) {
+        return error("WriteBlockIndexSnapshot() : %s", e.what());
+    }
+
+    printf("Block index snapshot of %u blocks written in %"PRI64d"ms\n", (unsigned int)mapBlockIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+// Load the block index from the snapshot if it matches the database
+static bool ReadBlockIndexSnapshot(const uint256& hashBestChainDB)
+{
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    FILE* file = fopen(pathSnapshot.string().c_str(), "rb");
+    if (!file)
+        return false;
+
+    int64 nStart = GetTimeMillis();
+    vector<char> vch;
+    bool fRead = false;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long nSize = ftell(file);
+        if (nSize > (long)sizeof(uint256) && fseek(file, 0, SEEK_SET) == 0)
+        {
+            vch.resize(nSize);
+            fRead = (fread(&vch[0], 1, nSize, file) == (size_t)nSize);
+        }
+    }
+    fclose(file);
+
+    // The snapshot becomes stale as soon as the database is modified
+    boost::filesystem::remove(pathSnapshot);
+
+    if (!fRead)
+        return error("ReadBlockIndexSnapshot() : unable to read %s", pathSnapshot.string().c_str());
+
+    const char* pbegin = &vch[0];
+    const char* pend = pbegin + vch.size() - sizeof(uint256);
+    uint256 hashExpected;
+    memcpy(&hashExpected, pend, sizeof(hashExpected));
+    if (Hash(pbegin, pend) != hashExpected)
+        return error("ReadBlockIndexSnapshot() : checksum mismatch");
+
+    CDataStream ss(pbegin, pend, SER_DISK, CLIENT_VERSION);
+    vector<char>().swap(vch);
+
+    try {
+        unsigned int nMagic;
+        int nSnapshotVersion, nClientVersion;
+        uint256 hashBest;
+        uint64 nCount;
+        ss >> nMagic >> nSnapshotVersion >> nClientVersion >> hashBest >> nCount;
+        if (nMagic != BLOCK_INDEX_SNAPSHOT_MAGIC || nSnapshotVersion != BLOCK_INDEX_SNAPSHOT_VERSION || nClientVersion != CLIENT_VERSION)
+            return error("ReadBlockIndexSnapshot() : snapshot written by another version");
+        if (hashBest != hashBestChainDB)
+            return error("ReadBlockIndexSnapshot() : stale snapshot");
+
+        for (uint64 i = 0; i < nCount; i++)
+        {
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            unsigned int nStakeModifierChecksum;
+            uint256 nChainTrust;
+            ss >> hash >> diskindex >> nStakeModifierChecksum >> nChainTrust;
+
+            if (!AddDiskBlockIndex(hash, diskindex))
+                throw runtime_error("invalid block index");
+            CBlockIndex* pindex = mapBlockIndex[hash];
+            pindex->nStakeModifierChecksum = nStakeModifierChecksum;
+            pindex->nChainTrust = nChainTrust;
+        }
+    }
+    catch (std::exception &e) {
+        // Start over from the database
+        mapBlockIndex.clear();
+        setStakeSeen.clear();
+        pindexGenesisBlock = NULL;
+        return error("ReadBlockIndexSnapshot() : %s", e.what());
+    }
+
+    printf("Block index loaded from snapshot in %"PRI64d"ms\n", GetTimeMillis() - nStart);
+    return true;
+}
+
 bool CTxDB::LoadBlockIndex()
 {
+    // Block files deleted by -prune
+    set<unsigned int> setPruned;
+    if (ReadPrunedBlockFiles(setPruned))
+        SetPrunedBlockFiles(setPruned);
+
+    uint256 hashBestChainDB;
+    bool fSnapshot = ReadHashBestChain(hashBestChainDB) && ReadBlockIndexSnapshot(hashBestChainDB);
+    if (!fSnapshot)
+        boost::filesystem::remove(GetBlockIndexSnapshotPath());
+
     // Get database cursor
-    Dbc* pcursor = GetCursor();
-    if (!pcursor)
+    if (!fSnapshot && !FlushTxDBWrites())
+        return false;
+    CKeyValueCursor* pcursor = fSnapshot || !pstore ? NULL : pstore->NewCursor();
+    if (!fSnapshot && !pcursor)
         return false;
 
     // Load mapBlockIndex
-    unsigned int fFlags = DB_SET_RANGE;
-    loop
+    if (pcursor)
+    {
+        CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+        ssStart << make_pair(string("blockindex"), uint256(0));
+        pcursor->Seek(ssStart);
+    }
+    while (!fSnapshot)
     {
         // Read next record
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        if (fFlags == DB_SET_RANGE)
-            ssKey << make_pair(string("blockindex"), uint256(0));
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
-        fFlags = DB_NEXT;
-        if (ret == DB_NOTFOUND)
+        if (!pcursor->Next(ssKey, ssValue))
+        {
+            if (pcursor->Failed())
+            {
+                delete pcursor;
+                return false;
+            }
             break;
-        else if (ret != 0)
-            return false;
+        }
 
         // Unserialize
 
@@ -584,47 +1676,11 @@ bool CTxDB::LoadBlockIndex()
             CDiskBlockIndex diskindex;
             ssValue >> diskindex;
 
-            // Construct block index object
-            CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
-            pindexNew->nFile          = diskindex.nFile;
-            pindexNew->nBlockPos      = diskindex.nBlockPos;
-            pindexNew->nHeight        = diskindex.nHeight;
-            pindexNew->nMint          = diskindex.nMint;
-            pindexNew->mapMoneySupply = diskindex.mapMoneySupply;
-            pindexNew->mapTotalParked = diskindex.mapTotalParked;
-            pindexNew->nFlags         = diskindex.nFlags;
-            pindexNew->nStakeModifier = diskindex.nStakeModifier;
-            pindexNew->prevoutStake   = diskindex.prevoutStake;
-            pindexNew->nStakeTime     = diskindex.nStakeTime;
-            pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-            pindexNew->vote                   = diskindex.vote;
-            pindexNew->vote.nCoinAgeDestroyed = diskindex.nCoinAgeDestroyed;
-            pindexNew->vParkRateResult        = diskindex.vParkRateResult;
-            pindexNew->nCoinAgeDestroyed      = diskindex.nCoinAgeDestroyed;
-            pindexNew->vElectedCustodian      = diskindex.vElectedCustodian;
-            pindexNew->nProtocolVersion       = diskindex.nProtocolVersion;
-            pindexNew->mapVotedFee            = diskindex.mapVotedFee;
-            pindexNew->signerRewardVoteResult = diskindex.signerRewardVoteResult;
-            pindexNew->mapAssets              = diskindex.mapAssets;
-            pindexNew->rewardedSigner         = diskindex.rewardedSigner;
-            pindexNew->nVersion       = diskindex.nVersion;
-            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-            pindexNew->nTime          = diskindex.nTime;
-            pindexNew->nBits          = diskindex.nBits;
-            pindexNew->nNonce         = diskindex.nNonce;
-
-            // Watch for genesis block
-            if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == hashGenesisBlock)
-                pindexGenesisBlock = pindexNew;
-
-            if (!pindexNew->CheckIndex())
-                return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
-
-            // ppcoin: build setStakeSeen
-            if (pindexNew->IsProofOfStake())
-                setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+            if (!AddDiskBlockIndex(diskindex.GetBlockHash(), diskindex))
+            {
+                delete pcursor;
+                return false;
+            }
         }
         else
         {
@@ -632,10 +1688,11 @@ bool CTxDB::LoadBlockIndex()
         }
         }    // try
         catch (std::exception &e) {
+            delete pcursor;
             return error("%s() : deserialize error", __PRETTY_FUNCTION__);
         }
     }
-    pcursor->close();
+    delete pcursor;
 
     if (fRequestShutdown)
         return true;
@@ -659,7 +1716,7 @@ bool CTxDB::LoadBlockIndex()
         }
     }
 
-    // Calculate bnChainTrust
+    // Calculate nChainTrust
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -671,9 +1728,14 @@ bool CTxDB::LoadBlockIndex()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->bnChainTrust = (pindex->pprev ? pindex->pprev->bnChainTrust : 0) + pindex->GetBlockTrust();
-        // ppcoin: calculate stake modifier checksum
-        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+        pindex->BuildSkip();
+        // The snapshot already contains the chain trust and stake modifier checksum
+        if (!fSnapshot)
+        {
+            pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : uint256(0)) + pindex->GetBlockTrust().getuint256();
+            // ppcoin: calculate stake modifier checksum
+            pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+        }
         if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
             return error("CTxDB::LoadBlockIndex() : Failed stake modifier checkpoint height=%d, modifier=0x%016"PRI64x, pindex->nHeight, pindex->nStakeModifier);
         // nubit: rebuild per unit money supply for version <= 0.3.0
@@ -747,16 +1809,19 @@ bool CTxDB::LoadBlockIndex()
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
     {
+        // New database, the coins are kept from the first block connected
         if (pindexGenesisBlock == NULL)
-            return true;
+            return writedb.Write(string("fCoinsBuilt"), true) && writedb.Write(string("fAddrIndex"), fAddrIndex) && writedb.Write(string("fBalanceIndex"), fBalanceIndex);
         return error("CTxDB::LoadBlockIndex() : hashBestChain not loaded");
     }
     if (!mapBlockIndex.count(hashBestChain))
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
     pindexBest = mapBlockIndex[hashBestChain];
+    SetMainChainTip(pindexBest);
     nBestHeight = pindexBest->nHeight;
-    bnBestChainTrust = pindexBest->bnChainTrust;
+    bnBestChainTrust = CBigNum(pindexBest->nChainTrust);
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainTrust.ToString().c_str());
+    printf("LoadBlockIndex(): %u block indexes of %u bytes, %u bytes allocated\n", (unsigned int)mapBlockIndex.size(), (unsigned int)sizeof(CBlockIndex), GetBlockIndexArenaSize());
 
     // ppcoin: load hashSyncCheckpoint
     if (!ReadSyncCheckpoint(Checkpoints::hashSyncCheckpoint))
@@ -774,14 +1839,128 @@ bool CTxDB::LoadBlockIndex()
                 pindex->pprevElected = pindex->pprev;
             else
                 pindex->pprevElected = pindex->pprev->pprevElected;
+        }
+
+        // Register the blocks where an asset changed, on any branch
+        assetRegistry.Clear();
+        BOOST_FOREACH(const PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
+            if (!item.second->mapAssets.empty())
+                assetRegistry.Register(item.second);
+    }
+
+    // Build the coins from the main chain if they were not kept yet
+    bool fCoinsBuilt = false;
+    if (!Read(string("fCoinsBuilt"), fCoinsBuilt) || !fCoinsBuilt)
+    {
+        // Resume after the last height written if the build was interrupted
+        int nCoinsHeight = 0;
+        Read(string("nCoinsHeight"), nCoinsHeight);
+        printf("LoadBlockIndex(): building the coins of blocks %d to %d\n", nCoinsHeight + 1, nBestHeight);
+        int64 nStart = GetTimeMillis();
+        CCoinsViewDB viewDB(writedb);
+        CCoinsViewCache view(&viewDB);
+        for (CBlockIndex* pindex = pindexBest->GetAncestor(nCoinsHeight + 1); pindex; pindex = pindex->pnext)
+        {
+            CBlock block;
+            if (!block.ReadFromDisk(pindex))
+                return error("LoadBlockIndex() : block.ReadFromDisk failed");
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            {
+                if (!tx.IsCoinBase() && !tx.IsCustodianGrant())
+                    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                        if (!view.GetCoins(txin.prevout.hash).Spend(txin.prevout.n))
+                            return error("LoadBlockIndex() : building coins: %s spends unavailable output %s:%d", tx.GetHash().ToString().substr(0,10).c_str(), txin.prevout.hash.ToString().substr(0,10).c_str(), txin.prevout.n);
+                view.SetCoins(tx.GetHash(), CCoins(tx, pindex->nHeight));
+            }
+
+            if (pindex->nHeight % 1000 == 0 || !pindex->pnext || fRequestShutdown)
+            {
+                if (!writedb.TxnBegin())
+                    return error("LoadBlockIndex() : TxnBegin failed");
+                if (!view.Flush() || !writedb.Write(string("nCoinsHeight"), pindex->nHeight) || !writedb.TxnCommit())
+                    return error("LoadBlockIndex() : failed to write coins");
+                printf("LoadBlockIndex(): coins built up to height %d\n", pindex->nHeight);
+            }
+            if (fRequestShutdown)
+                return writedb.Flush();
+        }
+        fCoinsBuilt = true;
+        if (!writedb.Write(string("fCoinsBuilt"), fCoinsBuilt) || !writedb.Flush())
+            return error("LoadBlockIndex() : failed to write coins");
+        printf("LoadBlockIndex(): coins built in %"PRI64d"ms\n", GetTimeMillis() - nStart);
+    }
 
-            // Copy the asset map for the previous definitions
-            if (pindex->pprev->mapAssetsPrev.size())
-                pindex->mapAssetsPrev = pindex->pprev->mapAssetsPrev;
-            // Update any link for an asset that was updated in the previous block
-            BOOST_FOREACH(PAIRTYPE(const uint32_t, CAsset)& pair, pindex->pprev->mapAssets)
-                pindex->mapAssetsPrev[pair.first] = pindex->pprev;
+    // The address index is only maintained with -addrindex. It is built from the
+    // main chain when the option is turned on, and dropped when it is turned off.
+    bool fAddrIndexBuilt = false;
+    Read(string("fAddrIndex"), fAddrIndexBuilt);
+    int nAddrIndexHeight = -1;
+    bool fAddrIndexPartial = Read(string("nAddrIndexHeight"), nAddrIndexHeight);
+    if (!fAddrIndex && (fAddrIndexBuilt || fAddrIndexPartial))
+    {
+        writedb.Erase(string("nAddrIndexHeight"));
+        if (!writedb.Write(string("fAddrIndex"), false) || !writedb.WipeAddressIndex() || !writedb.Flush())
+            return error("LoadBlockIndex() : failed to drop the address index");
+        printf("LoadBlockIndex(): address index dropped\n");
+    }
+    else if (fAddrIndex && !fAddrIndexBuilt)
+    {
+        // Resume after the last height written if the build was interrupted
+        if (!fAddrIndexPartial && !writedb.WipeAddressIndex())
+            return error("LoadBlockIndex() : failed to drop the address index");
+        printf("LoadBlockIndex(): building the address index of blocks %d to %d\n", nAddrIndexHeight + 1, nBestHeight);
+        int64 nStart = GetTimeMillis();
+        vector<CAddressIndexEntry> vEntries;
+        for (CBlockIndex* pindex = pindexBest->GetAncestor(nAddrIndexHeight + 1); pindex; pindex = pindex->pnext)
+        {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!block.ReadFromDisk(pindex))
+                return error("LoadBlockIndex() : block.ReadFromDisk failed");
+            if (!GetBlockSpentOutputs(writedb, block, blockundo))
+                return error("LoadBlockIndex() : building address index: spent outputs of block %d not found", pindex->nHeight);
+            GetAddressIndexEntries(block, pindex->nHeight, blockundo, vEntries);
+
+            if (pindex->nHeight % 1000 == 0 || !pindex->pnext || fRequestShutdown)
+            {
+                if (!writedb.TxnBegin())
+                    return error("LoadBlockIndex() : TxnBegin failed");
+                if (!writedb.WriteAddressIndex(vEntries) || !writedb.Write(string("nAddrIndexHeight"), pindex->nHeight) || !writedb.TxnCommit())
+                    return error("LoadBlockIndex() : failed to write address index");
+                vEntries.clear();
+                printf("LoadBlockIndex(): address index built up to height %d\n", pindex->nHeight);
+            }
+            if (fRequestShutdown)
+                return writedb.Flush();
+        }
+        fAddrIndexBuilt = true;
+        if (!writedb.Write(string("fAddrIndex"), fAddrIndexBuilt) || !writedb.Erase(string("nAddrIndexHeight")) || !writedb.Flush())
+            return error("LoadBlockIndex() : failed to write address index");
+        printf("LoadBlockIndex(): address index built in %"PRI64d"ms\n", GetTimeMillis() - nStart);
+    }
+
+    // Same for the share balance index of -balanceindex. An interrupted build starts over.
+    bool fBalanceIndexBuilt = false;
+    Read(string("fBalanceIndex"), fBalanceIndexBuilt);
+    if (!fBalanceIndex && fBalanceIndexBuilt)
+    {
+        if (!writedb.Write(string("fBalanceIndex"), false) || !writedb.WipeBalanceIndex() || !writedb.Flush())
+            return error("LoadBlockIndex() : failed to drop the share balance index");
+        printf("LoadBlockIndex(): share balance index dropped\n");
+    }
+    else if (fBalanceIndex && !fBalanceIndexBuilt)
+    {
+        if (!writedb.WipeBalanceIndex())
+            return error("LoadBlockIndex() : failed to drop the share balance index");
+        if (!BuildBalanceIndex(writedb))
+        {
+            if (fRequestShutdown)
+                return writedb.Flush();
+            return error("LoadBlockIndex() : failed to build the share balance index");
         }
+        fBalanceIndexBuilt = true;
+        if (!writedb.Write(string("fBalanceIndex"), fBalanceIndexBuilt) || !writedb.Flush())
+            return error("LoadBlockIndex() : failed to write the share balance index");
     }
 
     // Verify blocks in the best chain
@@ -795,7 +1974,7 @@ bool CTxDB::LoadBlockIndex()
     map<pair<unsigned int, unsigned int>, CBlockIndex*> mapBlockPos;
     for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
     {
-        if (pindex->nHeight < nBestHeight-nCheckDepth)
+        if (pindex->nHeight < nBestHeight-nCheckDepth || IsBlockFilePruned(pindex->nFile))
             break;
         CBlock block;
         if (!block.ReadFromDisk(pindex))
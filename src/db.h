@@ -9,16 +9,23 @@
 #define BITCOIN_DB_H
 
 #include "main.h"
+#include "kvstore.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <db_cxx.h>
 
 class CAddress;
+class CAddressIndexKey;
 class CAddrMan;
+class CBalanceKey;
+class CBalanceSnapshot;
 class CBlockLocator;
+class CBlockUndo;
+class CCoins;
 class CDiskBlockIndex;
 class CDiskTxPos;
 class CMasterKey;
@@ -29,8 +36,13 @@ class CWalletTx;
 
 extern unsigned int nWalletDBUpdated;
 extern bool fDetachDB;
+extern bool fTxLogDB;
 extern DbEnv dbenv;
 
+// Size of the Berkeley DB lock table. A transaction holds a lock on every page
+// it writes until it commits, and a deferred CTxDB batch is written in one.
+static const unsigned int DB_MAX_LOCKS = 537000;
+
 extern void DBFlush(bool fShutdown);
 void ThreadFlushWalletDB(void* parg);
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
@@ -273,20 +285,165 @@ public:
 
 
 
-/** Access to the transaction database (blkindex.dat) */
-class CTxDB : public CDB
+/** CKeyValueStore backend on a Berkeley database */
+class CBerkeleyKeyValueStore : public CDB, public CKeyValueStore
 {
+    friend class CBerkeleyKeyValueCursor;
 public:
-    CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode) { }
+    explicit CBerkeleyKeyValueStore(const char* pszFile, const char* pszMode="r+") : CDB(pszFile, pszMode) { }
+
+    bool Read(const CDataStream& ssKey, CDataStream& ssValue);
+    bool Write(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite=true);
+    bool Erase(const CDataStream& ssKey);
+    bool Exists(const CDataStream& ssKey);
+    bool WriteBatch(const CKeyValueBatch& batch);
+    CKeyValueCursor* NewCursor();
+
+    bool TxnBegin() { return CDB::TxnBegin(); }
+    bool TxnCommit() { return CDB::TxnCommit(); }
+    bool TxnAbort() { return CDB::TxnAbort(); }
+
+    void Close() { CDB::Close(); }
+};
+
+/** Copy every record of a store into another one, in batches of nBatchSize records */
+bool CopyKeyValueStore(CKeyValueStore& from, CKeyValueStore& to, unsigned int nBatchSize = 1000);
+
+/** Move the transaction database to the engine selected with -txdbengine
+ * if it was created by the other one. */
+bool MigrateTxDB();
+
+
+
+
+/** Access to the transaction database (blkindex.dat, or txlog with -txdbengine=log)
+ *
+ * Writes are collected in write batches kept in memory: TxnBegin opens a
+ * batch (batches may be nested), and committing the outermost one applies all
+ * its writes to the database at once. During the initial block download the
+ * committed batches of a run of blocks are merged and written together once
+ * they reach -dbbatchsize. Reads see the pending writes of every handle.
+ */
+class CTxDB
+{
+protected:
+    CKeyValueStore* pstore;
+    std::vector<CKeyValueBatch> vBatch;
+
+public:
+    CTxDB(const char* pszMode="r+");
+    ~CTxDB() { Close(); }
+    void Close();
 private:
     CTxDB(const CTxDB&);
     void operator=(const CTxDB&);
+
+    bool LookupTxnBatch(const std::string& strKey, bool& fErased, std::string& strValue);
+    bool LookupBatch(const std::string& strKey, bool& fErased, std::string& strValue);
+    bool CommitBatch(const CKeyValueBatch& batch);
+
+protected:
+    bool ReadRaw(const CDataStream& ssKey, CDataStream& ssValue);
+    bool WriteRaw(const CDataStream& ssKey, const CDataStream* pssValue);
+    bool ExistsRaw(const CDataStream& ssKey);
+
+    // Erase all the records whose key starts with strType
+    bool EraseRecords(const std::string& strType);
+
+    template<typename K, typename T>
+    bool Read(const K& key, T& value)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (!ReadRaw(ssKey, ssValue))
+            return false;
+
+        try {
+            ssValue >> value;
+        }
+        catch (std::exception &e) {
+            return false;
+        }
+        return true;
+    }
+
+    template<typename K, typename T>
+    bool Write(const K& key, const T& value, bool fOverwrite=true)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        if (!fOverwrite && ExistsRaw(ssKey))
+            return false;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(10000);
+        ssValue << value;
+        return WriteRaw(ssKey, &ssValue);
+    }
+
+    template<typename K>
+    bool Erase(const K& key)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        return WriteRaw(ssKey, NULL);
+    }
+
+    template<typename K>
+    bool Exists(const K& key)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        return ExistsRaw(ssKey);
+    }
+
 public:
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+
+    // Write the committed batches deferred during the initial block download
+    bool Flush();
+
+    bool ReadVersion(int& nVersion)
+    {
+        nVersion = 0;
+        return Read(std::string("version"), nVersion);
+    }
+
+    bool WriteVersion(int nVersion)
+    {
+        return Write(std::string("version"), nVersion);
+    }
+
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
     bool EraseTxIndex(const CTransaction& tx);
     bool ContainsTx(uint256 hash);
+    bool ReadCoins(const uint256& hash, CCoins& coins);
+    bool WriteCoins(const uint256& hash, const CCoins& coins);
+    bool EraseCoins(const uint256& hash);
+    bool HaveCoins(const uint256& hash);
+    bool ReadBlockUndo(const uint256& hashBlock, CBlockUndo& blockundo);
+    bool WriteBlockUndo(const uint256& hashBlock, const CBlockUndo& blockundo);
+    bool EraseBlockUndo(const uint256& hashBlock);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, int64> >& vEntries);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, int64> >& vEntries);
+    bool ReadAddressIndex(const CAddressIndexKey& keyAddress, int nStartHeight, int nEndHeight, std::vector<std::pair<CAddressIndexKey, int64> >& vEntries);
+    bool WipeAddressIndex();
+    bool ReadShareBalance(const CBalanceKey& key, int64& nBalance);
+    bool WriteShareBalance(const CBalanceKey& key, int64 nBalance);
+    bool EraseShareBalance(const CBalanceKey& key);
+    bool ReadShareBalances(std::vector<std::pair<CBalanceKey, int64> >& vBalance);
+    bool ReadBalanceSnapshot(int nHeight, CBalanceSnapshot& snapshot);
+    bool WriteBalanceSnapshot(int nHeight, const CBalanceSnapshot& snapshot);
+    bool EraseBalanceSnapshot(int nHeight);
+    bool WipeBalanceIndex();
     bool ReadOwnerTxes(uint160 hash160, int nHeight, std::vector<CTransaction>& vtx);
     bool ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex);
     bool ReadDiskTx(uint256 hash, CTransaction& tx);
@@ -296,6 +453,8 @@ public:
     bool EraseBlockIndex(uint256 hash);
     bool ReadHashBestChain(uint256& hashBestChain);
     bool WriteHashBestChain(uint256 hashBestChain);
+    bool ReadPrunedBlockFiles(std::set<unsigned int>& setPruned);
+    bool WritePrunedBlockFiles(const std::set<unsigned int>& setPruned);
     bool ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust);
     bool WriteBestInvalidTrust(CBigNum bnBestInvalidTrust);
     bool ReadSyncCheckpoint(uint256& hashCheckpoint);
@@ -307,6 +466,51 @@ public:
     bool LoadBlockIndex();
 };
 
+/** Write the deferred transaction database batches, see CTxDB::Flush() */
+bool FlushTxDBWrites();
+
+static const unsigned int DEFAULT_DB_BATCH_SIZE = 4;
+// Deferred batches are written before they hold more records, well within DB_MAX_LOCKS
+static const unsigned int MAX_DEFERRED_RECORDS = 100000;
+
+/** Set the size in bytes up to which the writes of consecutive blocks are
+ * deferred during the initial block download (-dbbatchsize), 0 to disable */
+void SetTxDBBatchSize(uint64 nSize);
+
+static const unsigned int DEFAULT_TX_CACHE_SIZE = 20000;
+
+/** Counters of the cache of transaction indexes and transactions read by CTxDB */
+class CTxCacheStats
+{
+public:
+    unsigned int nMaxSize;
+    unsigned int nIndexSize;
+    uint64 nIndexHits;
+    uint64 nIndexMisses;
+    unsigned int nTxSize;
+    uint64 nTxHits;
+    uint64 nTxMisses;
+
+    CTxCacheStats()
+    {
+        nMaxSize = 0;
+        nIndexSize = 0;
+        nIndexHits = 0;
+        nIndexMisses = 0;
+        nTxSize = 0;
+        nTxHits = 0;
+        nTxMisses = 0;
+    }
+};
+
+/** Set the number of transaction indexes and of transactions kept in memory (-txcache) */
+void SetTxCacheSize(unsigned int nSize);
+void GetTxCacheStats(CTxCacheStats& stats);
+
+/** Save the block index in a flat file loaded at the next start (-blockindexsnapshot).
+ * Must be called at shutdown, once no more block can be added to the index. */
+bool WriteBlockIndexSnapshot();
+
 
 
 
@@ -15,6 +15,8 @@
 #include "wallet.h"
 #include "ui_interface.h"
 #include "checkpoints.h"
+#include "addrindex.h"
+#include "scanbalance.h"
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/convenience.hpp>
@@ -74,6 +76,10 @@ void Shutdown(void* parg)
         nTransactionsUpdated++;
         DBFlush(false);
         StopNode();
+        ThreadScriptCheckQuit();
+        FlushTxDBWrites();
+        if (GetBoolArg("-blockindexsnapshot"))
+            WriteBlockIndexSnapshot();
         DBFlush(true);
         curl_global_cleanup();
         boost::filesystem::remove(GetPidFile());
@@ -199,6 +205,15 @@ bool AppInit2(int argc, char* argv[])
             "  -datadir=<dir>   \t\t  " + _("Specify data directory") + "\n" +
             "  -dbcache=<n>     \t\t  " + _("Set database cache size in megabytes (default: 25)") + "\n" +
             "  -dblogsize=<n>   \t\t  " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+            "  -dbbatchsize=<n> \t  "   + _("Group the transaction database writes of consecutive blocks up to <n> megabytes during the initial block download (default: 4, 0 = off)") + "\n" +
+            "  -txdbengine=<engine>\t  " + _("Storage engine of the transaction database: bdb or log (default: bdb). The database is migrated when the engine changes") + "\n" +
+            "  -mapblockfiles   \t  "   + _("Read blocks and transactions through memory mappings of the block files (default: 1)") + "\n" +
+            "  -par=<n>         \t  "   + _("Set the number of script verification threads (0 = one per core, up to 16, 1 = no parallel verification, <0 = leave that many cores free, default: 0)") + "\n" +
+            "  -maxsigcachesize=<n>\t  " + _("Keep up to <n> megabytes of verified signatures in memory, formerly a number of signatures (default: 32, maximum: 1024)") + "\n" +
+            "  -txcache=<n>     \t  "   + _("Keep up to <n> of the most recently read transaction indexes and transactions in memory (default: 20000)") + "\n" +
+            "  -prune=<n>       \t  "   + _("Delete old block files to keep them under <n> MB, the outputs still unspent are kept. Disables distribute (default: 0 = disabled, minimum: 512)") + "\n" +
+            "  -addrindex       \t  "   + _("Maintain an index of the outputs and spends of each address, used by the getaddress* RPC commands (default: 0)") + "\n" +
+            "  -balanceindex    \t  "   + _("Maintain the share balances of the addresses with periodic snapshots, so that distribute does not replay the whole chain (default: 0)") + "\n" +
             "  -timeout=<n>     \t  "   + _("Specify connection timeout (in milliseconds)") + "\n" +
             "  -proxy=<ip:port> \t  "   + _("Connect through socks4 proxy") + "\n" +
             "  -dns             \t  "   + _("Allow DNS lookups for addnode and connect") + "\n" +
@@ -249,7 +264,8 @@ bool AppInit2(int argc, char* argv[])
             "  -keypool=<n>     \t  "   + _("Set key pool size to <n> (default: 100)") + "\n" +
             "  -rescan          \t  "   + _("Rescan the block chain for missing wallet transactions") + "\n" +
             "  -checkblocks=<n> \t\t  " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
-            "  -checklevel=<n>  \t\t  " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
+            "  -checklevel=<n>  \t\t  " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
+            "  -blockindexsnapshot \t  " + _("Save the block index in a snapshot file at shutdown to load it faster at the next start") + "\n";
 
         strUsage += string() +
             _("\nSSL options: (see the B&C Exchange Wiki for SSL setup instructions)") + "\n" +
@@ -287,6 +303,65 @@ bool AppInit2(int argc, char* argv[])
 
     fDebug = GetBoolArg("-debug");
     fDetachDB = GetBoolArg("-detachdb", false);
+    fMapBlockFiles = GetBoolArg("-mapblockfiles", true);
+
+    nPruneTarget = GetArg("-prune", 0) * 1024 * 1024;
+    if (nPruneTarget < 0 || (nPruneTarget > 0 && nPruneTarget < MIN_PRUNE_TARGET))
+    {
+        ThreadSafeMessageBox(strprintf(_("Invalid amount for -prune=<n>, the minimum is %d MB"), (int)(MIN_PRUNE_TARGET / 1024 / 1024)), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+
+    // The thread connecting a block runs script checks too, one thread less is started
+    nScriptCheckThreads = GetArg("-par", 0);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
+    int64 nTxCacheSize = GetArg("-txcache", DEFAULT_TX_CACHE_SIZE);
+    if (nTxCacheSize < 0)
+    {
+        ThreadSafeMessageBox(_("Invalid amount for -txcache=<n>"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+    SetTxCacheSize(nTxCacheSize);
+
+    // -maxsigcachesize used to count signatures, a value left from then would
+    // allocate far more memory than intended
+    int64 nMaxSigCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIGCACHE_SIZE);
+    if (nMaxSigCacheSize < 0 || nMaxSigCacheSize > MAX_MAX_SIGCACHE_SIZE)
+    {
+        ThreadSafeMessageBox(strprintf(_("Invalid amount for -maxsigcachesize=<n>, it is a number of megabytes up to %d"), (int)MAX_MAX_SIGCACHE_SIZE), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+
+    int64 nDBBatchSize = GetArg("-dbbatchsize", DEFAULT_DB_BATCH_SIZE);
+    if (nDBBatchSize < 0)
+    {
+        ThreadSafeMessageBox(_("Invalid amount for -dbbatchsize=<n>"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+    SetTxDBBatchSize(nDBBatchSize * 1024 * 1024);
+
+    string strTxDBEngine = GetArg("-txdbengine", "bdb");
+    if (strTxDBEngine != "bdb" && strTxDBEngine != "log")
+    {
+        ThreadSafeMessageBox(_("Invalid engine for -txdbengine=<engine>"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+    fTxLogDB = (strTxDBEngine == "log");
+
+    fAddrIndex = GetBoolArg("-addrindex", false);
+    fBalanceIndex = GetBoolArg("-balanceindex", false);
+    // The indexes are built and replayed from every block of the chain
+    if (nPruneTarget > 0 && (fAddrIndex || fBalanceIndex))
+    {
+        ThreadSafeMessageBox(_("-prune cannot be used with -addrindex or -balanceindex, they need every block file"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
 
 #if !defined(WIN32) && !defined(QT_GUI)
     fDaemon = GetBoolArg("-daemon");
@@ -347,6 +422,14 @@ bool AppInit2(int argc, char* argv[])
     printf("B&C Exchange version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
 
+    // Before anything is hashed with the detected transforms
+    printf("Using SHA-256 implementation: %s\n", SHA256AutoDetect().c_str());
+    if (!SHA256SelfTest())
+    {
+        ThreadSafeMessageBox(_("SHA-256 self-test failed, hashes computed on this system would be wrong"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+
     if (GetBoolArg("-loadblockindextest"))
     {
         CTxDB txdb("r");
@@ -374,6 +457,14 @@ bool AppInit2(int argc, char* argv[])
         fprintf(stdout, "B&C Exchange server starting\n");
     int64 nStart;
 
+    if (nScriptCheckThreads)
+    {
+        printf("Using %d threads for script verification\n", nScriptCheckThreads);
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            if (!CreateThread(ThreadScriptCheck, NULL))
+                printf("Error: CreateThread(ThreadScriptCheck) failed\n");
+    }
+
     InitMessage(_("Loading addresses..."));
     printf("Loading addresses...\n");
     nStart = GetTimeMillis();
@@ -381,6 +472,12 @@ bool AppInit2(int argc, char* argv[])
         strErrors << _("Error loading addr.dat") << "\n";
     printf(" addresses   %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    if (!MigrateTxDB())
+    {
+        ThreadSafeMessageBox(_("Error migrating the transaction database to the engine selected with -txdbengine, see debug.log"), _("B&C Exchange"), wxOK | wxMODAL);
+        return false;
+    }
+
     InitMessage(_("Loading block index..."));
     printf("Loading block index...\n");
     nStart = GetTimeMillis();
@@ -476,11 +573,22 @@ bool AppInit2(int argc, char* argv[])
         }
         if (pindexBest != pindexRescan && pindexBest && pindexRescan && pindexBest->nHeight > pindexRescan->nHeight)
         {
+            for (CBlockIndex* pindex = pindexRescan; pindex; pindex = pindex->pnext)
+            {
+                if (IsBlockFilePruned(pindex->nFile))
+                {
+                    ThreadSafeMessageBox(_("Cannot rescan the wallet, some of the blocks to scan were deleted by -prune"), _("B&C Exchange"), wxOK | wxMODAL);
+                    return false;
+                }
+            }
             InitMessage(_("Rescanning..."));
             printf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+            bool fScanned;
+            pwalletMain->ScanForWalletTransactions(pindexRescan, true, true, &fScanned);
             printf(" rescan      %15"PRI64d"ms\n", GetTimeMillis() - nStart);
+            if (!fScanned)
+                error("Rescan stopped before the end of the chain, some blocks could not be read");
         }
 
         InitMessage(_("Done loading"));
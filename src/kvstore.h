@@ -0,0 +1,107 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_KVSTORE_H
+#define BITCOIN_KVSTORE_H
+
+#include "serialize.h"
+
+#include <map>
+#include <string>
+#include <utility>
+
+/** Set of writes and erasures to apply to a key/value store at once */
+class CKeyValueBatch
+{
+public:
+    // key -> (erased, value)
+    typedef std::map<std::string, std::pair<bool, std::string> > MapType;
+    MapType mapWrites;
+
+    void Write(const std::string& strKey, const std::string& strValue)
+    {
+        mapWrites[strKey] = std::make_pair(false, strValue);
+    }
+
+    void Erase(const std::string& strKey)
+    {
+        mapWrites[strKey] = std::make_pair(true, std::string());
+    }
+
+    // Returns false if the batch does not touch the key. Otherwise fErased tells
+    // whether the key was erased and strValue receives the value written.
+    bool Lookup(const std::string& strKey, bool& fErased, std::string& strValue) const
+    {
+        MapType::const_iterator it = mapWrites.find(strKey);
+        if (it == mapWrites.end())
+            return false;
+        fErased = it->second.first;
+        strValue = it->second.second;
+        return true;
+    }
+
+    // Apply the writes of another batch on top of this one
+    void Merge(const CKeyValueBatch& batch)
+    {
+        for (MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+            mapWrites[it->first] = it->second;
+    }
+
+    // Bytes of keys and values written by the batch
+    uint64 GetDataSize() const
+    {
+        uint64 nSize = 0;
+        for (MapType::const_iterator it = mapWrites.begin(); it != mapWrites.end(); ++it)
+            nSize += it->first.size() + it->second.second.size();
+        return nSize;
+    }
+
+    bool empty() const { return mapWrites.empty(); }
+    unsigned int size() const { return mapWrites.size(); }
+    void clear() { mapWrites.clear(); }
+};
+
+/** Iterator over the records of a key/value store in key order */
+class CKeyValueCursor
+{
+public:
+    virtual ~CKeyValueCursor() {}
+
+    // Position the cursor before the first record whose key is not less than ssKey
+    virtual void Seek(const CDataStream& ssKey) = 0;
+
+    // Read the record following the cursor position and move past it.
+    // Returns false at the end of the store or on error (see Failed()).
+    virtual bool Next(CDataStream& ssKey, CDataStream& ssValue) = 0;
+
+    virtual bool Failed() const = 0;
+};
+
+/** Handle to a key/value storage backend. Keys and values are serialized streams.
+ * Like CDB a handle is opened for a short use and may hold nested transactions:
+ * writes made inside a transaction are only visible to other handles once the
+ * outermost transaction is committed. */
+class CKeyValueStore
+{
+public:
+    virtual ~CKeyValueStore() {}
+
+    virtual bool Read(const CDataStream& ssKey, CDataStream& ssValue) = 0;
+    virtual bool Write(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite=true) = 0;
+    virtual bool Erase(const CDataStream& ssKey) = 0;
+    virtual bool Exists(const CDataStream& ssKey) = 0;
+
+    // Apply all the writes of the batch atomically
+    virtual bool WriteBatch(const CKeyValueBatch& batch) = 0;
+
+    // The caller owns the returned cursor. Returns NULL on failure.
+    virtual CKeyValueCursor* NewCursor() = 0;
+
+    virtual bool TxnBegin() = 0;
+    virtual bool TxnCommit() = 0;
+    virtual bool TxnAbort() = 0;
+
+    virtual void Close() = 0;
+};
+
+#endif
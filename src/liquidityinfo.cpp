@@ -65,8 +65,8 @@ bool CLiquidityInfo::ProcessLiquidityInfo()
         if (pindexBest->nProtocolVersion >= PROTOCOL_V2_0 && nVersion > pindexBest->nProtocolVersion)
             return false;
 
-        map<CBitcoinAddress, CBlockIndex*> mapElectedCustodian = pindexBest->GetElectedCustodians();
-        map<CBitcoinAddress, CBlockIndex*>::iterator it;
+        const map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian = pindexBest->GetElectedCustodianMap();
+        map<CBitcoinAddress, CBlockIndex*>::const_iterator it;
         it = mapElectedCustodian.find(address);
         if (it == mapElectedCustodian.end())
             return false;
@@ -127,7 +127,7 @@ void RemoveExpiredLiquidityInfo(int nCurrentHeight)
     {
         LOCK2(cs_main, cs_mapLiquidityInfo);
 
-        map<CBitcoinAddress, CBlockIndex*> mapElectedCustodian = pindexBest->GetElectedCustodians();
+        const map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian = pindexBest->GetElectedCustodianMap();
         map<const CLiquiditySource, CLiquidityInfo>::iterator it;
         it = mapLiquidityInfo.begin();
         while (it != mapLiquidityInfo.end())
@@ -0,0 +1,638 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logdb.h"
+#include "version.h"
+
+#include <boost/filesystem.hpp>
+
+#ifdef WIN32
+#include <io.h>
+#endif
+
+using namespace std;
+
+// Batch record: magic, payload size, payload, checksum of the payload.
+// The payload is the record count followed by (erased flag, key, value) records.
+static const unsigned int LOGDB_MAGIC = 0x4c42444e;
+static const unsigned int LOGDB_HEADER_SIZE = 8;
+static const unsigned int LOGDB_CHECKSUM_SIZE = 4;
+static const unsigned int MAX_LOGDB_BATCH_SIZE = 0x40000000;
+
+// Compact the data file once it exceeds this size and holds less than half live data
+static const uint64 LOGDB_COMPACT_MIN_SIZE = 64 * 1024 * 1024;
+
+// Size of the batches written to the new data file during a compaction
+static const unsigned int LOGDB_COMPACT_BATCH_SIZE = 4 * 1024 * 1024;
+
+static bool SeekFile(FILE* file, uint64 nPos)
+{
+#ifdef WIN32
+    return _fseeki64(file, nPos, SEEK_SET) == 0;
+#else
+    return fseeko(file, nPos, SEEK_SET) == 0;
+#endif
+}
+
+static bool CommitFile(FILE* file)
+{
+    if (fflush(file) != 0)
+        return false;
+#ifdef WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void WriteLE32(unsigned char* p, unsigned int n)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (n >> (8 * i)) & 0xff;
+}
+
+static unsigned int ReadLE32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int PayloadChecksum(const char* pbegin, const char* pend)
+{
+    return (unsigned int)Hash(pbegin, pend).Get64();
+}
+
+
+//
+// CLogDB
+//
+
+CLogDB::CLogDB() : file(NULL), nFileSize(0), nLiveSize(0)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+boost::filesystem::path CLogDB::GetDataPath(const boost::filesystem::path& pathDir)
+{
+    return pathDir / "data.log";
+}
+
+bool CLogDB::Open(const boost::filesystem::path& pathDirIn)
+{
+    LOCK(cs_logdb);
+    if (file)
+        return error("CLogDB::Open() : already open");
+
+    pathDir = pathDirIn;
+    boost::filesystem::path pathData = GetDataPath(pathDir);
+    try {
+        boost::filesystem::create_directories(pathDir);
+        // Left over by an interrupted compaction
+        boost::filesystem::remove_all(pathDir / "compact");
+    }
+    catch (boost::filesystem::filesystem_error &e) {
+        return error("CLogDB::Open() : %s", e.what());
+    }
+
+    file = fopen(pathData.string().c_str(), "r+b");
+    if (!file)
+        file = fopen(pathData.string().c_str(), "w+b");
+    if (!file)
+        return error("CLogDB::Open() : cannot open %s", pathData.string().c_str());
+
+    if (!Replay())
+    {
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK(cs_logdb);
+    if (!file)
+        return;
+    CommitFile(file);
+    fclose(file);
+    file = NULL;
+    mapKeys.clear();
+    nFileSize = 0;
+    nLiveSize = 0;
+}
+
+bool CLogDB::IsOpen() const
+{
+    LOCK(cs_logdb);
+    return file != NULL;
+}
+
+bool CLogDB::Flush()
+{
+    LOCK(cs_logdb);
+    if (!file)
+        return false;
+    return CommitFile(file);
+}
+
+void CLogDB::SetKey(const string& strKey, const CValuePos* ppos)
+{
+    MapType::iterator it = mapKeys.find(strKey);
+    if (it != mapKeys.end())
+    {
+        nLiveSize -= it->first.size() + it->second.nSize;
+        if (!ppos)
+        {
+            mapKeys.erase(it);
+            return;
+        }
+        it->second = *ppos;
+    }
+    else if (ppos)
+        mapKeys.insert(make_pair(strKey, *ppos));
+    else
+        return;
+    nLiveSize += strKey.size() + ppos->nSize;
+}
+
+bool CLogDB::Replay()
+{
+    mapKeys.clear();
+    nLiveSize = 0;
+    nFileSize = 0;
+
+    if (!SeekFile(file, 0))
+        return error("CLogDB::Replay() : seek failed");
+
+    vector<char> vPayload;
+    vector<pair<string, CValuePos> > vRecords;
+    vector<bool> vErased;
+    bool fTruncate = false;
+    loop
+    {
+        unsigned char header[LOGDB_HEADER_SIZE];
+        size_t nRead = fread(header, 1, sizeof(header), file);
+        if (nRead == 0 && feof(file))
+            break;
+        if (nRead != sizeof(header) || ReadLE32(header) != LOGDB_MAGIC)
+        {
+            fTruncate = true;
+            break;
+        }
+        unsigned int nSize = ReadLE32(header + 4);
+        if (nSize > MAX_LOGDB_BATCH_SIZE)
+        {
+            fTruncate = true;
+            break;
+        }
+        vPayload.resize(nSize + LOGDB_CHECKSUM_SIZE);
+        if (fread(&vPayload[0], 1, vPayload.size(), file) != vPayload.size() ||
+            PayloadChecksum(&vPayload[0], &vPayload[0] + nSize) != ReadLE32((unsigned char*)&vPayload[nSize]))
+        {
+            // Torn write of the last batch
+            fTruncate = true;
+            break;
+        }
+
+        vRecords.clear();
+        vErased.clear();
+        try {
+            CDataStream ss(&vPayload[0], &vPayload[0] + nSize, SER_DISK, CLIENT_VERSION);
+            uint64 nCount = ReadCompactSize(ss);
+            for (uint64 i = 0; i < nCount; i++)
+            {
+                unsigned char fErased;
+                string strKey;
+                ss >> fErased >> strKey;
+                CValuePos pos;
+                pos.nPos = 0;
+                pos.nSize = 0;
+                if (!fErased)
+                {
+                    pos.nSize = ReadCompactSize(ss);
+                    pos.nPos = nFileSize + LOGDB_HEADER_SIZE + (nSize - ss.size());
+                    ss.ignore(pos.nSize);
+                }
+                vRecords.push_back(make_pair(strKey, pos));
+                vErased.push_back(fErased);
+            }
+        }
+        catch (std::exception &e) {
+            return error("CLogDB::Replay() : corrupted batch at position %"PRI64u, nFileSize);
+        }
+
+        for (unsigned int i = 0; i < vRecords.size(); i++)
+            SetKey(vRecords[i].first, vErased[i] ? NULL : &vRecords[i].second);
+        nFileSize += LOGDB_HEADER_SIZE + vPayload.size();
+    }
+
+    if (fTruncate)
+    {
+        // The last batch was not completely written: it was never committed
+        boost::filesystem::path pathData = GetDataPath(pathDir);
+        printf("CLogDB::Replay() : dropping incomplete batch at the end of %s\n", pathData.string().c_str());
+        fclose(file);
+        file = NULL;
+        try {
+            boost::filesystem::resize_file(pathData, nFileSize);
+        }
+        catch (boost::filesystem::filesystem_error &e) {
+            return error("CLogDB::Replay() : %s", e.what());
+        }
+        file = fopen(pathData.string().c_str(), "r+b");
+        if (!file)
+            return error("CLogDB::Replay() : cannot reopen %s", pathData.string().c_str());
+    }
+
+    printf("CLogDB : loaded %u keys from %s, %"PRI64u" bytes live of %"PRI64u"\n",
+           (unsigned int)mapKeys.size(), pathDir.string().c_str(), nLiveSize, nFileSize);
+    return true;
+}
+
+bool CLogDB::Append(const CKeyValueBatch& batch)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    vector<unsigned int> vOffset;
+    vOffset.reserve(batch.size());
+    WriteCompactSize(ss, batch.size());
+    for (CKeyValueBatch::MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+    {
+        bool fErased = it->second.first;
+        const string& strValue = it->second.second;
+        ss << (unsigned char)fErased << it->first;
+        if (!fErased)
+        {
+            WriteCompactSize(ss, strValue.size());
+            vOffset.push_back(ss.size());
+            ss.write(strValue.data(), strValue.size());
+        }
+    }
+    if (ss.size() > MAX_LOGDB_BATCH_SIZE)
+        return error("CLogDB::Append() : batch too large");
+
+    unsigned char header[LOGDB_HEADER_SIZE];
+    WriteLE32(header, LOGDB_MAGIC);
+    WriteLE32(header + 4, ss.size());
+    unsigned char checksum[LOGDB_CHECKSUM_SIZE];
+    WriteLE32(checksum, PayloadChecksum(&ss[0], &ss[0] + ss.size()));
+
+    if (!SeekFile(file, nFileSize) ||
+        fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+        fwrite(&ss[0], 1, ss.size(), file) != ss.size() ||
+        fwrite(checksum, 1, sizeof(checksum), file) != sizeof(checksum) ||
+        fflush(file) != 0)
+    {
+        // Drop whatever part of the batch reached the file at the next replay
+        return error("CLogDB::Append() : write failed");
+    }
+
+    unsigned int nValue = 0;
+    for (CKeyValueBatch::MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+    {
+        if (it->second.first)
+        {
+            SetKey(it->first, NULL);
+            continue;
+        }
+        CValuePos pos;
+        pos.nPos = nFileSize + LOGDB_HEADER_SIZE + vOffset[nValue++];
+        pos.nSize = it->second.second.size();
+        SetKey(it->first, &pos);
+    }
+    nFileSize += LOGDB_HEADER_SIZE + ss.size() + LOGDB_CHECKSUM_SIZE;
+    return true;
+}
+
+bool CLogDB::ReadValue(const CValuePos& pos, string& strValue)
+{
+    strValue.resize(pos.nSize);
+    if (pos.nSize == 0)
+        return true;
+    if (!SeekFile(file, pos.nPos) || fread(&strValue[0], 1, pos.nSize, file) != pos.nSize)
+        return error("CLogDB::ReadValue() : read failed at position %"PRI64u, pos.nPos);
+    return true;
+}
+
+bool CLogDB::Read(const string& strKey, string& strValue)
+{
+    LOCK(cs_logdb);
+    if (!file)
+        return false;
+    MapType::const_iterator it = mapKeys.find(strKey);
+    if (it == mapKeys.end())
+        return false;
+    return ReadValue(it->second, strValue);
+}
+
+bool CLogDB::Exists(const string& strKey)
+{
+    LOCK(cs_logdb);
+    return mapKeys.count(strKey) > 0;
+}
+
+bool CLogDB::ReadNext(const string& strKey, bool fAfter, string& strKeyFound, string& strValue, bool& fFound)
+{
+    LOCK(cs_logdb);
+    fFound = false;
+    if (!file)
+        return false;
+    MapType::const_iterator it = fAfter ? mapKeys.upper_bound(strKey) : mapKeys.lower_bound(strKey);
+    if (it == mapKeys.end())
+        return true;
+    fFound = true;
+    strKeyFound = it->first;
+    return ReadValue(it->second, strValue);
+}
+
+bool CLogDB::WriteBatch(const CKeyValueBatch& batch)
+{
+    LOCK(cs_logdb);
+    if (!file)
+        return false;
+    if (batch.empty())
+        return true;
+    if (!Append(batch))
+        return false;
+
+    if (nFileSize > LOGDB_COMPACT_MIN_SIZE && nLiveSize * 2 < nFileSize)
+        Compact();
+    return true;
+}
+
+bool CLogDB::Compact()
+{
+    LOCK(cs_logdb);
+    if (!file)
+        return false;
+
+    int64 nStart = GetTimeMillis();
+    uint64 nOldSize = nFileSize;
+    boost::filesystem::path pathCompact = pathDir / "compact";
+    {
+        CLogDB logdbCompact;
+        if (!logdbCompact.Open(pathCompact))
+            return false;
+
+        CKeyValueBatch batch;
+        unsigned int nBatchSize = 0;
+        string strValue;
+        for (MapType::const_iterator it = mapKeys.begin(); it != mapKeys.end(); ++it)
+        {
+            if (!ReadValue(it->second, strValue))
+                return false;
+            batch.Write(it->first, strValue);
+            nBatchSize += it->first.size() + strValue.size();
+            if (nBatchSize >= LOGDB_COMPACT_BATCH_SIZE)
+            {
+                if (!logdbCompact.WriteBatch(batch))
+                    return false;
+                batch.clear();
+                nBatchSize = 0;
+            }
+        }
+        if (!logdbCompact.WriteBatch(batch) || !logdbCompact.Flush())
+            return false;
+    }
+
+    fclose(file);
+    file = NULL;
+    boost::filesystem::path pathData = GetDataPath(pathDir);
+    try {
+        boost::filesystem::rename(GetDataPath(pathCompact), pathData);
+        boost::filesystem::remove_all(pathCompact);
+    }
+    catch (boost::filesystem::filesystem_error &e) {
+        error("CLogDB::Compact() : %s", e.what());
+    }
+
+    // Positions changed: reload the key directory from the new file
+    file = fopen(pathData.string().c_str(), "r+b");
+    if (!file)
+        return error("CLogDB::Compact() : cannot reopen %s", pathData.string().c_str());
+    if (!Replay())
+    {
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+
+    printf("CLogDB::Compact() : %"PRI64u" bytes -> %"PRI64u" bytes in %"PRI64d"ms\n",
+           nOldSize, nFileSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+unsigned int CLogDB::GetKeyCount() const
+{
+    LOCK(cs_logdb);
+    return mapKeys.size();
+}
+
+uint64 CLogDB::GetFileSize() const
+{
+    LOCK(cs_logdb);
+    return nFileSize;
+}
+
+
+//
+// CLogKeyValueStore
+//
+
+class CLogKeyValueCursor : public CKeyValueCursor
+{
+private:
+    CLogDB* plogdb;
+    string strKey;
+    bool fAfter;
+    bool fFailed;
+
+public:
+    CLogKeyValueCursor(CLogDB& logdb) : plogdb(&logdb), fAfter(false), fFailed(false) {}
+
+    void Seek(const CDataStream& ssKey)
+    {
+        strKey.assign(ssKey.begin(), ssKey.end());
+        fAfter = false;
+    }
+
+    bool Next(CDataStream& ssKey, CDataStream& ssValue)
+    {
+        if (fFailed)
+            return false;
+        string strKeyFound, strValue;
+        bool fFound;
+        if (!plogdb->ReadNext(strKey, fAfter, strKeyFound, strValue, fFound))
+        {
+            fFailed = true;
+            return false;
+        }
+        if (!fFound)
+            return false;
+        strKey = strKeyFound;
+        fAfter = true;
+
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write(strKeyFound.data(), strKeyFound.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write(strValue.data(), strValue.size());
+        return true;
+    }
+
+    bool Failed() const
+    {
+        return fFailed;
+    }
+};
+
+CLogKeyValueStore::CLogKeyValueStore(CLogDB& logdb, const char* pszMode) : plogdb(&logdb)
+{
+    fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << string("version");
+    string strKey(ssKey.begin(), ssKey.end());
+    if (strchr(pszMode, 'c') && !plogdb->Exists(strKey))
+    {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << CLIENT_VERSION;
+        CKeyValueBatch batch;
+        batch.Write(strKey, string(ssValue.begin(), ssValue.end()));
+        plogdb->WriteBatch(batch);
+    }
+}
+
+void CLogKeyValueStore::Close()
+{
+    // Like CDB, uncommitted transactions are aborted
+    vTxn.clear();
+    plogdb = NULL;
+}
+
+bool CLogKeyValueStore::Read(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    if (!plogdb)
+        return false;
+
+    string strKey(ssKey.begin(), ssKey.end());
+    string strValue;
+    bool fErased = false;
+    bool fFound = false;
+    for (vector<CKeyValueBatch>::reverse_iterator it = vTxn.rbegin(); it != vTxn.rend() && !fFound; ++it)
+        fFound = it->Lookup(strKey, fErased, strValue);
+    if (fFound ? fErased : !plogdb->Read(strKey, strValue))
+        return false;
+
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write(strValue.data(), strValue.size());
+    return true;
+}
+
+bool CLogKeyValueStore::Apply(const string& strKey, const string* pstrValue)
+{
+    if (!plogdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+
+    CKeyValueBatch batchSingle;
+    CKeyValueBatch& batch = vTxn.empty() ? batchSingle : vTxn.back();
+    if (pstrValue)
+        batch.Write(strKey, *pstrValue);
+    else
+        batch.Erase(strKey);
+    if (vTxn.empty())
+        return plogdb->WriteBatch(batch);
+    return true;
+}
+
+bool CLogKeyValueStore::Write(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && Exists(ssKey))
+        return false;
+    string strValue(ssValue.begin(), ssValue.end());
+    return Apply(string(ssKey.begin(), ssKey.end()), &strValue);
+}
+
+bool CLogKeyValueStore::Erase(const CDataStream& ssKey)
+{
+    return Apply(string(ssKey.begin(), ssKey.end()), NULL);
+}
+
+bool CLogKeyValueStore::Exists(const CDataStream& ssKey)
+{
+    if (!plogdb)
+        return false;
+
+    string strKey(ssKey.begin(), ssKey.end());
+    string strValue;
+    bool fErased;
+    for (vector<CKeyValueBatch>::reverse_iterator it = vTxn.rbegin(); it != vTxn.rend(); ++it)
+        if (it->Lookup(strKey, fErased, strValue))
+            return !fErased;
+    return plogdb->Exists(strKey);
+}
+
+bool CLogKeyValueStore::WriteBatch(const CKeyValueBatch& batch)
+{
+    if (!plogdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+
+    if (!vTxn.empty())
+    {
+        vTxn.back().Merge(batch);
+        return true;
+    }
+    return plogdb->WriteBatch(batch);
+}
+
+CKeyValueCursor* CLogKeyValueStore::NewCursor()
+{
+    if (!plogdb)
+        return NULL;
+    return new CLogKeyValueCursor(*plogdb);
+}
+
+bool CLogKeyValueStore::TxnBegin()
+{
+    if (!plogdb)
+        return false;
+    vTxn.push_back(CKeyValueBatch());
+    return true;
+}
+
+bool CLogKeyValueStore::TxnCommit()
+{
+    if (!plogdb)
+        return false;
+    if (vTxn.empty())
+        return false;
+    CKeyValueBatch batch;
+    batch.mapWrites.swap(vTxn.back().mapWrites);
+    vTxn.pop_back();
+    if (!vTxn.empty())
+    {
+        vTxn.back().Merge(batch);
+        return true;
+    }
+    return plogdb->WriteBatch(batch);
+}
+
+bool CLogKeyValueStore::TxnAbort()
+{
+    if (!plogdb)
+        return false;
+    if (vTxn.empty())
+        return false;
+    vTxn.pop_back();
+    return true;
+}
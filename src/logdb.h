@@ -0,0 +1,111 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_LOGDB_H
+#define BITCOIN_LOGDB_H
+
+#include "kvstore.h"
+#include "util.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Embedded log-structured key/value engine.
+ *
+ * Each committed batch is appended to a single data file with a checksum, and
+ * an ordered in-memory directory maps every live key to the position of its
+ * latest value in the file. Writes are therefore sequential and a batch is
+ * atomic: a batch torn by a crash fails its checksum and is dropped when the
+ * file is replayed at the next open. Space held by overwritten and erased
+ * values is reclaimed by rewriting the live records into a new file once they
+ * make up less than half of the data file.
+ */
+class CLogDB
+{
+public:
+    CLogDB();
+    ~CLogDB();
+
+    bool Open(const boost::filesystem::path& pathDirIn);
+    void Close();
+    bool IsOpen() const;
+
+    // Write the data file to disk
+    bool Flush();
+
+    bool Read(const std::string& strKey, std::string& strValue);
+    bool Exists(const std::string& strKey);
+    bool WriteBatch(const CKeyValueBatch& batch);
+
+    // Read the first record whose key is not less than strKey (greater than
+    // strKey if fAfter is set). fFound is cleared if there is none.
+    bool ReadNext(const std::string& strKey, bool fAfter, std::string& strKeyFound, std::string& strValue, bool& fFound);
+
+    // Rewrite the live records into a new data file
+    bool Compact();
+
+    unsigned int GetKeyCount() const;
+    uint64 GetFileSize() const;
+
+    static boost::filesystem::path GetDataPath(const boost::filesystem::path& pathDir);
+
+private:
+    struct CValuePos
+    {
+        uint64 nPos;
+        unsigned int nSize;
+    };
+    typedef std::map<std::string, CValuePos> MapType;
+
+    mutable CCriticalSection cs_logdb;
+    boost::filesystem::path pathDir;
+    FILE* file;
+    uint64 nFileSize;
+    uint64 nLiveSize;
+    MapType mapKeys;
+
+    CLogDB(const CLogDB&);
+    void operator=(const CLogDB&);
+
+    bool Replay();
+    bool Append(const CKeyValueBatch& batch);
+    bool ReadValue(const CValuePos& pos, std::string& strValue);
+    void SetKey(const std::string& strKey, const CValuePos* ppos);
+};
+
+/** CKeyValueStore handle on a CLogDB. Transactions are buffered in the handle
+ * and written as a single batch when the outermost one is committed. */
+class CLogKeyValueStore : public CKeyValueStore
+{
+private:
+    CLogDB* plogdb;
+    std::vector<CKeyValueBatch> vTxn;
+    bool fReadOnly;
+
+    CLogKeyValueStore(const CLogKeyValueStore&);
+    void operator=(const CLogKeyValueStore&);
+
+    bool Apply(const std::string& strKey, const std::string* pstrValue);
+
+public:
+    CLogKeyValueStore(CLogDB& logdb, const char* pszMode="r+");
+    ~CLogKeyValueStore() { Close(); }
+
+    bool Read(const CDataStream& ssKey, CDataStream& ssValue);
+    bool Write(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite=true);
+    bool Erase(const CDataStream& ssKey);
+    bool Exists(const CDataStream& ssKey);
+    bool WriteBatch(const CKeyValueBatch& batch);
+    CKeyValueCursor* NewCursor();
+
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+
+    void Close();
+};
+
+#endif
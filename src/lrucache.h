@@ -0,0 +1,91 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_LRUCACHE_H
+#define BITCOIN_LRUCACHE_H
+
+#include <list>
+#include <map>
+#include <utility>
+
+/** Map that only keeps the N most recently used elements. Not thread safe. */
+template <typename K, typename V> class CLRUCache
+{
+public:
+    typedef std::size_t size_type;
+
+protected:
+    typedef std::list<std::pair<K, V> > ListType;
+    typedef std::map<K, typename ListType::iterator> MapType;
+
+    // Most recently used first
+    ListType list;
+    MapType map;
+    size_type nMaxSize;
+
+public:
+    CLRUCache(size_type nMaxSizeIn = 0) { nMaxSize = nMaxSizeIn; }
+
+    size_type size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+    size_type max_size() const { return nMaxSize; }
+
+    void max_size(size_type s)
+    {
+        nMaxSize = s;
+        while (map.size() > nMaxSize)
+            pop_back();
+    }
+
+    // Copy the value of k and mark it as the most recently used
+    bool get(const K& k, V& v)
+    {
+        typename MapType::iterator mi = map.find(k);
+        if (mi == map.end())
+            return false;
+        list.splice(list.begin(), list, mi->second);
+        v = mi->second->second;
+        return true;
+    }
+
+    void insert(const K& k, const V& v)
+    {
+        if (nMaxSize == 0)
+            return;
+        typename MapType::iterator mi = map.find(k);
+        if (mi != map.end())
+        {
+            mi->second->second = v;
+            list.splice(list.begin(), list, mi->second);
+            return;
+        }
+        if (map.size() >= nMaxSize)
+            pop_back();
+        list.push_front(std::make_pair(k, v));
+        map.insert(std::make_pair(k, list.begin()));
+    }
+
+    void erase(const K& k)
+    {
+        typename MapType::iterator mi = map.find(k);
+        if (mi == map.end())
+            return;
+        list.erase(mi->second);
+        map.erase(mi);
+    }
+
+    void clear()
+    {
+        list.clear();
+        map.clear();
+    }
+
+protected:
+    void pop_back()
+    {
+        map.erase(list.back().first);
+        list.pop_back();
+    }
+};
+
+#endif
@@ -8,6 +8,9 @@
 
 #include "checkpoints.h"
 #include "db.h"
+#include "coins.h"
+#include "addrindex.h"
+#include "scanbalance.h"
 #include "net.h"
 #include "init.h"
 #include "ui_interface.h"
@@ -16,6 +19,8 @@
 #include "liquidityinfo.h"
 #include "coincontrol.h"
 #include "datafeed.h"
+#include "checkqueue.h"
+#include "lrucache.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -55,6 +60,10 @@ uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
 
+// Blocks of the main chain indexed by height, kept in sync with the pnext links
+static vector<CBlockIndex*> vMainChain;
+static CCriticalSection cs_vMainChain;
+
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
 map<uint256, CBlock*> mapOrphanBlocks;
@@ -81,6 +90,12 @@ int nBlocksToIgnore = 0;
 
 // Settings
 int64 nSplitShareOutputs = MIN_COINSTAKE_VALUE;
+bool fMapBlockFiles = true;
+int64 nPruneTarget = 0;
+int nScriptCheckThreads = 0;
+
+// Script checks of the block being connected, or of the transaction entering the memory pool
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 static string strProtocolWarningMessage = _("Unknown protocol vote received. You may need to upgrade your client.");
 string strProtocolWarning = "";
@@ -531,6 +546,45 @@ void CTransaction::AddChange(int64 nChange, CScript& scriptChange, const CCoinCo
     vout.insert(position, CTxOut(nChangeRemaining, scriptChange));
 }
 
+// Merkle trees of the blocks last read by SetMerkleBranch, by position on
+// disk, so that the wallet transactions of a block share one read and tree
+class CBlockMerkleTree
+{
+public:
+    uint256 hashBlock;
+    int nTx;
+    std::vector<uint256> vMerkleTree;
+};
+
+static const unsigned int MERKLE_TREE_CACHE_SIZE = 16;
+static CCriticalSection cs_merkleTreeCache;
+static CLRUCache<pair<unsigned int, unsigned int>, boost::shared_ptr<const CBlockMerkleTree> > merkleTreeCache(MERKLE_TREE_CACHE_SIZE);
+
+static boost::shared_ptr<const CBlockMerkleTree> ReadBlockMerkleTree(unsigned int nFile, unsigned int nBlockPos)
+{
+    pair<unsigned int, unsigned int> pos(nFile, nBlockPos);
+    boost::shared_ptr<const CBlockMerkleTree> ptree;
+    {
+        LOCK(cs_merkleTreeCache);
+        if (merkleTreeCache.get(pos, ptree))
+            return ptree;
+    }
+
+    CBlock block;
+    if (!block.ReadFromDisk(nFile, nBlockPos))
+        return ptree;
+    boost::shared_ptr<CBlockMerkleTree> ptreeNew(new CBlockMerkleTree());
+    ptreeNew->hashBlock = block.GetHash();
+    ptreeNew->nTx = block.vtx.size();
+    block.BuildMerkleTree();
+    ptreeNew->vMerkleTree.swap(block.vMerkleTree);
+    ptree = ptreeNew;
+
+    LOCK(cs_merkleTreeCache);
+    merkleTreeCache.insert(pos, ptree);
+    return ptree;
+}
+
 int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
 {
     if (fClient)
@@ -538,20 +592,37 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
         if (hashBlock == 0)
             return 0;
     }
-    else
+    else if (pblock == NULL)
     {
-        CBlock blockTmp;
-        if (pblock == NULL)
+        // Load the tree of the block this tx is in
+        uint256 hash = GetHash();
+        CTxIndex txindex;
+        if (!CTxDB("r").ReadTxIndex(hash, txindex))
+            return 0;
+        boost::shared_ptr<const CBlockMerkleTree> ptree = ReadBlockMerkleTree(txindex.pos.nFile, txindex.pos.nBlockPos);
+        if (!ptree)
+            return 0;
+
+        // Update the tx's hashBlock
+        hashBlock = ptree->hashBlock;
+
+        // Locate the transaction among the leaves of the tree
+        for (nIndex = 0; nIndex < ptree->nTx; nIndex++)
+            if (ptree->vMerkleTree[nIndex] == hash)
+                break;
+        if (nIndex == ptree->nTx)
         {
-            // Load the block this tx is in
-            CTxIndex txindex;
-            if (!CTxDB("r").ReadTxIndex(GetHash(), txindex))
-                return 0;
-            if (!blockTmp.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos))
-                return 0;
-            pblock = &blockTmp;
+            vMerkleBranch.clear();
+            nIndex = -1;
+            printf("ERROR: SetMerkleBranch() : couldn't find tx in block\n");
+            return 0;
         }
 
+        // Fill in merkle branch
+        vMerkleBranch = CBlock::GetMerkleBranch(ptree->vMerkleTree, ptree->nTx, nIndex);
+    }
+    else
+    {
         // Update the tx's hashBlock
         hashBlock = pblock->GetHash();
 
@@ -791,6 +862,26 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
 
     if (fCheckInputs)
     {
+        // Look the inputs up in the coins first so that transactions spending
+        // unknown or spent outputs are turned down without reading the block files
+        {
+            CCoinsViewDB viewDB(txdb);
+            CCoinsViewMemPool viewMemPool(&viewDB, *this);
+            CCoinsViewCache view(&viewMemPool);
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                const CCoins& coins = view.GetCoins(txin.prevout.hash);
+                if (coins.IsPruned() && !txdb.ContainsTx(txin.prevout.hash))
+                {
+                    if (pfMissingInputs)
+                        *pfMissingInputs = true;
+                    return error("CTxMemPool::accept() : FetchInputs failed %s", hash.ToString().substr(0,10).c_str());
+                }
+                if (coins.IsPruned() || (txin.prevout.n < coins.vout.size() && coins.vout[txin.prevout.n].IsNull()))
+                    return error("CTxMemPool::accept() : %s prev tx %s already used", hash.ToString().substr(0,10).c_str(), txin.prevout.hash.ToString().substr(0,10).c_str());
+            }
+        }
+
         MapPrevTx mapInputs;
         map<uint256, CTxIndex> mapUnused;
         bool fInvalid = false;
@@ -834,10 +925,20 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1,1,1), pindexBest, false, false))
+        // The scripts of the inputs are verified by the script check threads.
+        vector<CScriptCheck> vChecks;
+        if (!tx.ConnectInputs(txdb, mapInputs, mapUnused, CDiskTxPos(1,1,1), pindexBest, false, false, true, &vChecks))
         {
             return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().substr(0,10).c_str());
         }
+        CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads && vChecks.size() > 1 ? &scriptcheckqueue : NULL);
+        control.Add(vChecks);
+        CScriptCheck checkFailed;
+        if (!control.Wait(&checkFailed))
+        {
+            checkFailed.Error();
+            return error("CTxMemPool::accept() : ConnectInputs failed %s", hash.ToString().substr(0,10).c_str());
+        }
     }
 
     // Store transaction in memory
@@ -1017,6 +1118,42 @@ int CTxIndex::GetDepthInChain(const CBlockIndex* pindexChain, CBlockIndex* &pind
     return 1 + nBestHeight - pindex->nHeight;
 }
 
+// Find the block stored at the position of txpos among the last nMaxDepth blocks of pindexChain
+static const CBlockIndex* GetAncestorAtPos(const CBlockIndex* pindexChain, const CDiskTxPos& txpos, int nMaxDepth)
+{
+    // Read block header to locate the block in the index
+    CBlock block;
+    if (block.ReadFromDisk(txpos.nFile, txpos.nBlockPos, false))
+    {
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+        if (mi != mapBlockIndex.end() && mi->second->nFile == txpos.nFile && mi->second->nBlockPos == txpos.nBlockPos)
+        {
+            const CBlockIndex* pindex = mi->second;
+            if (pindexChain->nHeight - pindex->nHeight < nMaxDepth && pindexChain->GetAncestor(pindex->nHeight) == pindex)
+                return pindex;
+            return NULL;
+        }
+    }
+
+    // The header could not be matched with the index, search the chain instead
+    for (const CBlockIndex* pindex = pindexChain; pindex && pindexChain->nHeight - pindex->nHeight < nMaxDepth; pindex = pindex->pprev)
+        if (pindex->nBlockPos == txpos.nBlockPos && pindex->nFile == txpos.nFile)
+            return pindex;
+    return NULL;
+}
+
+// Height of the block stored at the position of txpos, or -1 if it is not in the index
+static int GetHeightAtPos(const CDiskTxPos& txpos)
+{
+    CBlock block;
+    if (!block.ReadFromDisk(txpos.nFile, txpos.nBlockPos, false))
+        return -1;
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    if (mi == mapBlockIndex.end() || mi->second->nFile != txpos.nFile || mi->second->nBlockPos != txpos.nBlockPos)
+        return -1;
+    return mi->second->nHeight;
+}
+
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 {
@@ -1043,7 +1180,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
         BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
         {
             CBlockIndex* pindex = item.second;
-            if (pindex == pindexBest || pindex->pnext != 0)
+            if (pindex == pindexBest || pindex->pnext != 0 || IsBlockFilePruned(pindex->nFile))
                 continue;
             CBlock block;
             if (!block.ReadFromDisk(pindex))
@@ -1121,6 +1258,103 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
     return pindex;
 }
 
+// Turn the lowest '1' bit in the binary representation of a number into a '0'
+static inline int InvertLowestOne(int n)
+{
+    return n & (n - 1);
+}
+
+// Compute what height to jump back to with the skip pointer of a block
+static inline int GetSkipHeight(int nHeight)
+{
+    if (nHeight < 2)
+        return 0;
+
+    // Determine which height to jump back to. Any number strictly lower than
+    // nHeight is acceptable, but the following expression performs well in
+    // simulations (max 110 steps to go back up to 2**18 blocks).
+    return (nHeight & 1) ? InvertLowestOne(InvertLowestOne(nHeight - 1)) + 1 : InvertLowestOne(nHeight);
+}
+
+CBlockIndex* CBlockIndex::GetAncestor(int nAncestorHeight)
+{
+    if (nAncestorHeight > nHeight || nAncestorHeight < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int nHeightWalk = nHeight;
+    while (nHeightWalk > nAncestorHeight)
+    {
+        int nHeightSkip = GetSkipHeight(nHeightWalk);
+        int nHeightSkipPrev = GetSkipHeight(nHeightWalk - 1);
+        if (pindexWalk->pskip != NULL &&
+            (nHeightSkip == nAncestorHeight ||
+             (nHeightSkip > nAncestorHeight && !(nHeightSkipPrev < nHeightSkip - 2 &&
+                                                 nHeightSkipPrev >= nAncestorHeight))))
+        {
+            // Only follow pskip if pprev->pskip isn't better than pskip->pprev.
+            pindexWalk = pindexWalk->pskip;
+            nHeightWalk = nHeightSkip;
+        }
+        else
+        {
+            pindexWalk = pindexWalk->pprev;
+            nHeightWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+void CBlockIndex::BuildSkip()
+{
+    if (pprev)
+        pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+}
+
+// find the main chain block at nHeight, or NULL if the main chain is not that long
+CBlockIndex* FindBlockByHeight(int nHeight)
+{
+    LOCK(cs_vMainChain);
+    if (nHeight < 0 || nHeight >= (int)vMainChain.size())
+        return NULL;
+    return vMainChain[nHeight];
+}
+
+// make pindexTip the last block of the height index, replacing the entries
+// of the branch it forks from
+void SetMainChainTip(CBlockIndex* pindexTip)
+{
+    LOCK(cs_vMainChain);
+    vMainChain.resize(pindexTip->nHeight + 1, NULL);
+    for (CBlockIndex* pindex = pindexTip; pindex && vMainChain[pindex->nHeight] != pindex; pindex = pindex->pprev)
+        vMainChain[pindex->nHeight] = pindex;
+}
+
+// Block indexes are never freed, so they are allocated in large contiguous
+// chunks instead of one heap allocation each
+static const unsigned int BLOCK_INDEX_ARENA_CHUNK = 4096;
+static vector<char*> vBlockIndexArena;
+static unsigned int nBlockIndexArenaUsed = BLOCK_INDEX_ARENA_CHUNK;
+static CCriticalSection cs_BlockIndexArena;
+
+// memory for a CBlockIndex to be constructed with placement new
+void* AllocateBlockIndex()
+{
+    LOCK(cs_BlockIndexArena);
+    if (nBlockIndexArenaUsed == BLOCK_INDEX_ARENA_CHUNK)
+    {
+        vBlockIndexArena.push_back(static_cast<char*>(::operator new(BLOCK_INDEX_ARENA_CHUNK * sizeof(CBlockIndex))));
+        nBlockIndexArenaUsed = 0;
+    }
+    return vBlockIndexArena.back() + sizeof(CBlockIndex) * nBlockIndexArenaUsed++;
+}
+
+unsigned int GetBlockIndexArenaSize()
+{
+    LOCK(cs_BlockIndexArena);
+    return vBlockIndexArena.size() * BLOCK_INDEX_ARENA_CHUNK * sizeof(CBlockIndex);
+}
+
 unsigned int static GetInitialTarget(bool fProofOfStake)
 {
     if (fProofOfStake)
@@ -1205,13 +1439,13 @@ bool IsInitialBlockDownload()
 
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
-    if (pindexNew->bnChainTrust > bnBestInvalidTrust)
+    if (CBigNum(pindexNew->nChainTrust) > bnBestInvalidTrust)
     {
-        bnBestInvalidTrust = pindexNew->bnChainTrust;
+        bnBestInvalidTrust = CBigNum(pindexNew->nChainTrust);
         CTxDB().WriteBestInvalidTrust(bnBestInvalidTrust);
         MainFrameRepaint();
     }
-    printf("InvalidChainFound: invalid block=%s  height=%d  trust=%s\n", pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight, CBigNum(pindexNew->bnChainTrust).ToString().c_str());
+    printf("InvalidChainFound: invalid block=%s  height=%d  trust=%s\n", pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight, CBigNum(pindexNew->nChainTrust).ToString().c_str());
     printf("InvalidChainFound:  current best=%s  height=%d  trust=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, CBigNum(bnBestChainTrust).ToString().c_str());
     // ppcoin: should not enter safe mode for longer invalid chain
 }
@@ -1231,14 +1465,44 @@ void CBlock::UpdateTime(const CBlockIndex* pindexPrev)
 
 
 
-bool CTransaction::DisconnectInputs(CTxDB& txdb)
+bool CTransaction::DisconnectInputs(CCoinsViewCache& view, const CTxUndo& txundo) const
+{
+    view.SetCoins(GetHash(), CCoins());
+
+    if (IsCoinBase() || IsCustodianGrant())
+        return true;
+
+    if (txundo.vprevout.size() != vin.size())
+        return error("DisconnectInputs() : undo data does not match the inputs");
+
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const COutPoint& prevout = vin[i].prevout;
+        if (!txundo.vprevout[i].Restore(view.GetCoins(prevout.hash), prevout.n))
+            return error("DisconnectInputs() : unable to restore output from the undo data");
+    }
+
+    return true;
+}
+
+bool CTransaction::DisconnectInputs(CTxDB& txdb, CCoinsViewCache& view, const CTxUndo* ptxundo)
 {
+    // Remove the outputs of this transaction from the coins and give back
+    // the outputs it spent
+    if (ptxundo)
+    {
+        if (!DisconnectInputs(view, *ptxundo))
+            return false;
+    }
+    else
+        view.SetCoins(GetHash(), CCoins());
+
     // Relinquish previous transactions' spent pointers
     if (!IsCoinBase() && !IsCustodianGrant())
     {
-        BOOST_FOREACH(const CTxIn& txin, vin)
+        for (unsigned int i = 0; i < vin.size(); i++)
         {
-            COutPoint prevout = txin.prevout;
+            COutPoint prevout = vin[i].prevout;
 
             // Get prev txindex from disk
             CTxIndex txindex;
@@ -1254,6 +1518,34 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
             // Write back
             if (!txdb.UpdateTxIndex(prevout.hash, txindex))
                 return error("DisconnectInputs() : UpdateTxIndex failed");
+
+            if (ptxundo)
+                continue;
+
+            // No undo data, read the output from the previous transaction
+            CTransaction txPrev;
+            if (!txPrev.ReadFromDisk(txindex.pos))
+                return error("DisconnectInputs() : ReadFromDisk prev tx failed");
+            if (prevout.n >= txPrev.vout.size())
+                return error("DisconnectInputs() : prevout.n out of range of prev tx");
+            CCoins& coins = view.GetCoins(prevout.hash);
+            if (coins.IsPruned())
+            {
+                // All the outputs were spent, restore the unspent ones from the index
+                int nHeight = GetHeightAtPos(txindex.pos);
+                if (nHeight < 0)
+                    return error("DisconnectInputs() : prev tx block not found");
+                coins = CCoins(txPrev, nHeight);
+                for (unsigned int i = 0; i < coins.vout.size() && i < txindex.vSpent.size(); i++)
+                    if (!txindex.vSpent[i].IsNull())
+                        coins.vout[i].SetNull();
+            }
+            else
+            {
+                if (prevout.n >= coins.vout.size())
+                    return error("DisconnectInputs() : prevout.n out of range of coins");
+                coins.vout[prevout.n] = txPrev.vout[prevout.n];
+            }
         }
     }
 
@@ -1384,9 +1676,164 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
     return nSigOps;
 }
 
+bool CTransaction::FetchInputs(CCoinsViewCache& view, bool& fInvalid) const
+{
+    fInvalid = false;
+
+    if (IsCoinBase() || IsCustodianGrant())
+        return true;
+
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const COutPoint& prevout = vin[i].prevout;
+        const CCoins& coins = view.GetCoins(prevout.hash);
+        if (coins.IsPruned())
+            return error("FetchInputs() : %s prev tx %s has no unspent output", GetHash().ToString().substr(0,10).c_str(), prevout.hash.ToString().substr(0,10).c_str());
+
+        if (prevout.n >= coins.vout.size())
+        {
+            fInvalid = true;
+            return DoS(100, error("FetchInputs() : %s prevout.n out of range %d %d prev tx %s", GetHash().ToString().substr(0,10).c_str(), prevout.n, coins.vout.size(), prevout.hash.ToString().substr(0,10).c_str()));
+        }
+
+        // Check for conflicts (double-spend)
+        // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
+        // for an attacker to attempt to split the network.
+        if (coins.vout[prevout.n].IsNull())
+            return error("FetchInputs() : %s prev tx %s output %d already used", GetHash().ToString().substr(0,10).c_str(), prevout.hash.ToString().substr(0,10).c_str(), prevout.n);
+    }
+
+    return true;
+}
+
+int64 CTransaction::GetValueIn(CCoinsViewCache& view) const
+{
+    if (IsCoinBase() || IsCustodianGrant())
+        return 0;
+
+    int64 nResult = 0;
+    for (unsigned int i = 0; i < vin.size(); i++)
+        nResult += view.GetOutputFor(vin[i]).nValue;
+    return nResult;
+}
+
+unsigned int CTransaction::GetP2SHSigOpCount(CCoinsViewCache& view) const
+{
+    if (IsCoinBase() || IsCustodianGrant())
+        return 0;
+
+    unsigned int nSigOps = 0;
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const CTxOut& prevout = view.GetOutputFor(vin[i]);
+        if (prevout.scriptPubKey.IsPayToScriptHash())
+            nSigOps += prevout.scriptPubKey.GetSigOpCount(vin[i].scriptSig);
+    }
+    return nSigOps;
+}
+
+bool CTransaction::CheckUnpark(const CTxOut& txoutPrev, unsigned char cUnitPrev, const CBlockIndex* pindexPark, int nDepth) const
+{
+    if (!txoutPrev.IsPark())
+        return error("ConnectInputs() : prevout is not parked");
+
+    if (vin.size() != 1)
+        return error("ConnectInputs() : unpark transaction with too many inputs");
+
+    if (vout.size() != 1)
+        return error("ConnectInputs() : unpark transaction with too many outputs");
+
+    int64 nDuration;
+    CTxDestination unparkDestination;
+    if (!ExtractPark(txoutPrev.scriptPubKey, nDuration, unparkDestination))
+        return error("ConnectInputs() : ExtractPark failed");
+    CBitcoinAddress unparkAddress(unparkDestination, cUnitPrev);
+
+    if (nDepth < nDuration)
+        return error("ConnectInputs() : parking duration has not passed");
+
+    if (!pindexPark)
+        return error("ConnectInputs() : parked transaction not in chain");
+
+    int64 nValue = txoutPrev.nValue;
+    int64 nPremium = pindexPark->GetPremium(nValue, nDuration, cUnit);
+    if (!MoneyRange(nPremium))
+        return error("ConnectInputs() : premium out of range");
+    int64 nExpectedValueOut = nValue + nPremium;
+    if (!MoneyRange(nExpectedValueOut))
+        return error("ConnectInputs() : expected output out of range");
+
+    if (GetValueOut() != nExpectedValueOut)
+        return error("ConnectInputs() : unpark value doesn't match the expected value");
+
+    CTxDestination outDestination;
+    if (!ExtractDestination(vout[0].scriptPubKey, outDestination))
+        return error("ConnectInputs() : ExtractAddress failed");
+    CBitcoinAddress outAddress(outDestination, cUnit);
+
+    if (unparkAddress != outAddress)
+        return error("ConnectInputs() : invalid unpark address");
+
+    return true;
+}
+
+bool CTransaction::CheckValueIn(const CBlockIndex* pindexBlock, int64 nValueIn, bool fValidUnpark, bool fBlock) const
+{
+    if (IsCoinStake())
+    {
+        // bcexchange: the signer reward is included in the coin stake
+        int64 nSignerReward;
+        CTxDestination addressSigner;
+        if (!CalculateSignerReward(pindexBlock, addressSigner, nSignerReward))
+            return error("ConnectInputs() : unable to get signer reward");
+
+        assert(nSignerReward >= 0);
+
+        if (nSignerReward > 0)
+        {
+            bool fSignerRewardFound = false;
+            BOOST_FOREACH(const CTxOut& txo, vout)
+            {
+                CTxDestination addressOutput;
+                if (ExtractDestination(txo.scriptPubKey, addressOutput) && addressOutput == addressSigner && txo.nValue == nSignerReward)
+                {
+                    fSignerRewardFound = true;
+                    break;
+                }
+            }
+
+            if (!fSignerRewardFound)
+                return error("ConnectInputs() : signer reward not found in coin stake");
+        }
+
+        // ppcoin: coin stake tx earns reward instead of paying fee
+        int64 nStakeReward = GetValueOut() - nValueIn - nSignerReward;
+        if (nStakeReward > GetProofOfStakeReward() - GetMinFee(pindexBlock) + GetUnitMinFee(pindexBlock))
+            return DoS(100, error("ConnectInputs() : %s stake reward exceeded", GetHash().ToString().substr(0,10).c_str()));
+    }
+    else if (!fValidUnpark)
+    {
+        if (nValueIn < GetValueOut())
+            return DoS(100, error("ConnectInputs() : %s value in < value out", GetHash().ToString().substr(0,10).c_str()));
+
+        // Tally transaction fees
+        int64 nTxFee = nValueIn - GetValueOut();
+        if (nTxFee < 0)
+            return DoS(100, error("ConnectInputs() : %s nTxFee < 0", GetHash().ToString().substr(0,10).c_str()));
+        // ppcoin: enforce transaction fees for every block
+        if (nTxFee < GetMinFee(pindexBlock))
+            return fBlock? DoS(100, error("ConnectInputs() : %s not paying required fee=%s, paid=%s", GetHash().ToString().substr(0,10).c_str(), FormatMoney(GetMinFee(pindexBlock)).c_str(), FormatMoney(nTxFee).c_str())) : false;
+        if (!MoneyRange(nTxFee))
+            return DoS(100, error("ConnectInputs() : nFees out of range"));
+    }
+
+    return true;
+}
+
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                                  map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash)
+                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash,
+                                 vector<CScriptCheck>* pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1395,7 +1842,6 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
     if (!IsCoinBase() && !IsCustodianGrant())
     {
         int64 nValueIn = 0;
-        int64 nFees = 0;
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1408,9 +1854,11 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
 
             // If prev is coinbase/coinstake, check that it's matured
             if (txPrev.IsCoinBase() || txPrev.IsCoinStake())
-                for (const CBlockIndex* pindex = pindexBlock; pindex && pindexBlock->nHeight - pindex->nHeight < GetMaturity(txPrev.IsCoinStake()); pindex = pindex->pprev)
-                    if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
-                        return error("ConnectInputs() : tried to spend coinbase/coinstake at depth %d", pindexBlock->nHeight - pindex->nHeight);
+            {
+                const CBlockIndex* pindex = GetAncestorAtPos(pindexBlock, txindex.pos, GetMaturity(txPrev.IsCoinStake()));
+                if (pindex)
+                    return error("ConnectInputs() : tried to spend coinbase/coinstake at depth %d", pindexBlock->nHeight - pindex->nHeight);
+            }
 
             // ppcoin: check transaction timestamp
             if (txPrev.nTime > nTime)
@@ -1426,6 +1874,11 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
         // nubit: Is the whole transaction is a valid unpark transaction
         bool fValidUnpark = false;
 
+        // The signature hashes of the inputs share their serialization
+        boost::shared_ptr<const CSignatureHashContext> psighashctx;
+        if (vin.size() > 1)
+            psighashctx.reset(new CSignatureHashContext(*this));
+
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -1445,47 +1898,10 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             // nubit: Check unpark transaction
             if (IsUnpark())
             {
-                if (!txPrev.IsParked(prevout.n))
-                    return error("ConnectInputs() : prevout is not parked");
-
-                if (vin.size() != 1)
-                    return error("ConnectInputs() : unpark transaction with too many inputs");
-
-                if (vout.size() != 1)
-                    return error("ConnectInputs() : unpark transaction with too many outputs");
-
-                int64 nDuration;
-                CTxDestination unparkDestination;
-                if (!ExtractPark(txPrev.vout[prevout.n].scriptPubKey, nDuration, unparkDestination))
-                    return error("ConnectInputs() : ExtractPark failed");
-                CBitcoinAddress unparkAddress(unparkDestination, txPrev.cUnit);
-
                 CBlockIndex *pindexPark = NULL;
-                if (txindex.GetDepthInChain(pindexBlock, pindexPark) < nDuration)
-                    return error("ConnectInputs() : parking duration has not passed");
-
-                if (!pindexPark)
-                    return error("ConnectInputs() : parked transaction not in chain");
-
-                int64 nValue = txPrev.vout[prevout.n].nValue;
-                int64 nPremium = pindexPark->GetPremium(nValue, nDuration, cUnit);
-                if (!MoneyRange(nPremium))
-                    return error("ConnectInputs() : premium out of range");
-                int64 nExpectedValueOut = nValue + nPremium;
-                if (!MoneyRange(nExpectedValueOut))
-                    return error("ConnectInputs() : expected output out of range");
-
-                if (GetValueOut() != nExpectedValueOut)
-                    return error("ConnectInputs() : unpark value doesn't match the expected value");
-
-                CTxDestination outDestination;
-                if (!ExtractDestination(vout[0].scriptPubKey, outDestination))
-                    return error("ConnectInputs() : ExtractAddress failed");
-                CBitcoinAddress outAddress(outDestination, cUnit);
-
-                if (unparkAddress != outAddress)
-                    return error("ConnectInputs() : invalid unpark address");
-
+                int nDepth = txindex.GetDepthInChain(pindexBlock, pindexPark);
+                if (!CheckUnpark(txPrev.vout[prevout.n], txPrev.cUnit, pindexPark, nDepth))
+                    return false;
                 fValidUnpark = true;
             }
 
@@ -1496,15 +1912,14 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             if (!fValidUnpark && !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
                 // Verify signature
-                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0))
+                CScriptCheck check(txPrev.vout[prevout.n], *this, i, fStrictPayToScriptHash, 0, psighashctx);
+                if (pvChecks)
                 {
-                    // only during transition phase for P2SH: do not invoke anti-DoS code for
-                    // potentially old clients relaying bad P2SH transactions
-                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0))
-                        return error("ConnectInputs() : %s P2SH VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
-
-                    return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str()));
+                    pvChecks->push_back(CScriptCheck());
+                    check.swap(pvChecks->back());
                 }
+                else if (!check())
+                    return check.Error();
             }
 
             // Mark outpoints as spent
@@ -1517,57 +1932,131 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             }
         }
 
-        if (IsCoinStake())
-        {
-            // bcexchange: the signer reward is included in the coin stake
-            int64 nSignerReward;
-            CTxDestination addressSigner;
-            if (!CalculateSignerReward(pindexBlock, addressSigner, nSignerReward))
-                return error("ConnectInputs() : unable to get signer reward");
+        if (!CheckValueIn(pindexBlock, nValueIn, fValidUnpark, fBlock))
+            return false;
+    }
 
-            assert(nSignerReward >= 0);
+    return true;
+}
 
-            if (nSignerReward > 0)
-            {
-                bool fSignerRewardFound = false;
-                BOOST_FOREACH(const CTxOut& txo, vout)
-                {
-                    CTxDestination addressOutput;
-                    if (ExtractDestination(txo.scriptPubKey, addressOutput) && addressOutput == addressSigner && txo.nValue == nSignerReward)
-                    {
-                        fSignerRewardFound = true;
-                        break;
-                    }
-                }
 
-                if (!fSignerRewardFound)
-                    return error("ConnectInputs() : signer reward not found in coin stake");
-            }
+bool CTransaction::ConnectInputs(CCoinsViewCache& view, const CBlockIndex* pindexBlock, CTxUndo& txundo, bool fStrictPayToScriptHash,
+                                 vector<CScriptCheck>* pvChecks)
+{
+    txundo.vprevout.clear();
 
-            // ppcoin: coin stake tx earns reward instead of paying fee
-            int64 nStakeReward = GetValueOut() - nValueIn - nSignerReward;
-            if (nStakeReward > GetProofOfStakeReward() - GetMinFee(pindexBlock) + GetUnitMinFee(pindexBlock))
-                return DoS(100, error("ConnectInputs() : %s stake reward exceeded", GetHash().ToString().substr(0,10).c_str()));
-        }
-        else if (!fValidUnpark)
+    if (IsCoinBase() || IsCustodianGrant())
+        return true;
+
+    int64 nValueIn = 0;
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const COutPoint& prevout = vin[i].prevout;
+        const CCoins& coins = view.GetCoins(prevout.hash);
+        if (!coins.IsAvailable(prevout.n))
+            return error("ConnectInputs() : %s prev tx %s output %d already used", GetHash().ToString().substr(0,10).c_str(), prevout.hash.ToString().substr(0,10).c_str(), prevout.n);
+
+        // If prev is coinbase/coinstake, check that it's matured
+        if ((coins.fCoinBase || coins.fCoinStake) && pindexBlock->nHeight - coins.nHeight < GetMaturity(coins.fCoinStake))
+            return error("ConnectInputs() : tried to spend coinbase/coinstake at depth %d", pindexBlock->nHeight - coins.nHeight);
+
+        // ppcoin: check transaction timestamp
+        if (coins.nTime > nTime)
+            return DoS(100, error("ConnectInputs() : transaction timestamp earlier than input transaction"));
+
+        // Check for negative or overflow input values
+        const CTxOut& txout = coins.vout[prevout.n];
+        nValueIn += txout.nValue;
+        if (!MoneyRange(txout.nValue) || !MoneyRange(nValueIn))
+            return DoS(100, error("ConnectInputs() : txin values out of range"));
+    }
+
+    // nubit: Is the whole transaction is a valid unpark transaction
+    bool fValidUnpark = false;
+
+    // The signature hashes of the inputs share their serialization
+    boost::shared_ptr<const CSignatureHashContext> psighashctx;
+    if (vin.size() > 1)
+        psighashctx.reset(new CSignatureHashContext(*this));
+
+    // The first loop above does all the inexpensive checks.
+    // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
+    // Helps prevent CPU exhaustion attacks.
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const COutPoint& prevout = vin[i].prevout;
+        CCoins& coins = view.GetCoins(prevout.hash);
+        if (!coins.IsAvailable(prevout.n))
+            return error("ConnectInputs() : %s prev tx %s output %d already used", GetHash().ToString().substr(0,10).c_str(), prevout.hash.ToString().substr(0,10).c_str(), prevout.n);
+        const CTxOut txout = coins.vout[prevout.n];
+
+        // nubit: Check unpark transaction
+        if (IsUnpark())
         {
-            if (nValueIn < GetValueOut())
-                return DoS(100, error("ConnectInputs() : %s value in < value out", GetHash().ToString().substr(0,10).c_str()));
+            const CBlockIndex* pindexPark = pindexBlock->GetAncestor(coins.nHeight);
+            int nDepth = pindexPark ? 1 + nBestHeight - coins.nHeight : 0;
+            if (!CheckUnpark(txout, coins.cUnit, pindexPark, nDepth))
+                return false;
+            fValidUnpark = true;
+        }
 
-            // Tally transaction fees
-            int64 nTxFee = nValueIn - GetValueOut();
-            if (nTxFee < 0)
-                return DoS(100, error("ConnectInputs() : %s nTxFee < 0", GetHash().ToString().substr(0,10).c_str()));
-            // ppcoin: enforce transaction fees for every block
-            if (nTxFee < GetMinFee(pindexBlock))
-                return fBlock? DoS(100, error("ConnectInputs() : %s not paying required fee=%s, paid=%s", GetHash().ToString().substr(0,10).c_str(), FormatMoney(GetMinFee(pindexBlock)).c_str(), FormatMoney(nTxFee).c_str())) : false;
-            nFees += nTxFee;
-            if (!MoneyRange(nFees))
-                return DoS(100, error("ConnectInputs() : nFees out of range"));
+        // Skip ECDSA signature verification before the last blockchain checkpoint,
+        // as ConnectInputs does when connecting blocks
+        // nubit: Skip signature on unpark transaction
+        if (!fValidUnpark && nBestHeight >= Checkpoints::GetTotalBlocksEstimate())
+        {
+            // Verify signature
+            CScriptCheck check(txout, *this, i, fStrictPayToScriptHash, 0, psighashctx);
+            if (pvChecks)
+            {
+                pvChecks->push_back(CScriptCheck());
+                check.swap(pvChecks->back());
+            }
+            else if (!check())
+                return check.Error();
         }
+
+        // Mark outpoint as spent
+        txundo.vprevout.push_back(CTxInUndo(txout, coins));
+        coins.Spend(prevout.n);
     }
 
-    return true;
+    return CheckValueIn(pindexBlock, nValueIn, fValidUnpark, true);
+}
+
+
+bool CScriptCheck::operator()() const
+{
+    const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
+    return VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, fStrictPayToScriptHash, nHashType, psighashctx.get());
+}
+
+bool CScriptCheck::Error() const
+{
+    // only during transition phase for P2SH: do not invoke anti-DoS code for
+    // potentially old clients relaying bad P2SH transactions
+    if (fStrictPayToScriptHash && VerifyScript(ptxTo->vin[nIn].scriptSig, scriptPubKey, *ptxTo, nIn, false, nHashType, psighashctx.get()))
+        return error("ConnectInputs() : %s P2SH VerifySignature failed", ptxTo->GetHash().ToString().substr(0,10).c_str());
+
+    return ptxTo->DoS(100, error("ConnectInputs() : %s VerifySignature failed", ptxTo->GetHash().ToString().substr(0,10).c_str()));
+}
+
+void ThreadScriptCheck(void* parg)
+{
+    try
+    {
+        scriptcheckqueue.Thread();
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadScriptCheck()");
+    } catch (...) {
+        PrintException(NULL, "ThreadScriptCheck()");
+    }
+}
+
+void ThreadScriptCheckQuit()
+{
+    scriptcheckqueue.Quit();
 }
 
 
@@ -1622,11 +2111,49 @@ bool CTransaction::ClientConnectInputs()
 
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    CCoinsViewDB viewDB(txdb);
+    CCoinsViewCache view(&viewDB);
+
+    // Blocks connected before the undo data was kept, or deeper than
+    // MIN_BLOCKS_TO_KEEP, are disconnected by reading the previous transactions
+    uint256 hashBlock = pindex->GetBlockHash();
+    CBlockUndo blockundo;
+    bool fUndo = txdb.ReadBlockUndo(hashBlock, blockundo);
+    if (fUndo && blockundo.vtxundo.size() != vtx.size())
+        return error("DisconnectBlock() : undo data does not match the block");
+
+    // Remove the block from the address and balance indexes
+    if (fAddrIndex || fBalanceIndex)
+    {
+        CBlockUndo blockspent;
+        if (!fUndo && !GetBlockSpentOutputs(txdb, *this, blockspent))
+            return error("DisconnectBlock() : spent outputs not found for the indexes");
+        const CBlockUndo& spent = fUndo ? blockundo : blockspent;
+        if (fAddrIndex)
+        {
+            vector<CAddressIndexEntry> vEntries;
+            GetAddressIndexEntries(*this, pindex->nHeight, spent, vEntries);
+            if (!txdb.EraseAddressIndex(vEntries))
+                return error("DisconnectBlock() : EraseAddressIndex failed");
+        }
+        if (fBalanceIndex)
+        {
+            if (!UpdateBalanceIndex(txdb, *this, spent, false))
+                return error("DisconnectBlock() : UpdateBalanceIndex failed");
+            txdb.EraseBalanceSnapshot(pindex->nHeight);
+        }
+    }
+
     // Disconnect in reverse order
     for (int i = vtx.size()-1; i >= 0; i--)
-        if (!vtx[i].DisconnectInputs(txdb))
+        if (!vtx[i].DisconnectInputs(txdb, view, fUndo ? &blockundo.vtxundo[i] : NULL))
             return false;
 
+    if (!view.Flush())
+        return error("DisconnectBlock() : failed to write coins");
+    if (fUndo && !txdb.EraseBlockUndo(hashBlock))
+        return error("DisconnectBlock() : EraseBlockUndo failed");
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1684,14 +2211,26 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
     //// issue here: it doesn't know the version
     unsigned int nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
 
+    // The outputs spent and created by the block are validated against the
+    // coins and written at the end, the block files are not read
+    CCoinsViewDB viewDB(txdb);
+    CCoinsViewCache view(&viewDB);
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(vtx.size());
+
+    // The scripts are verified by the script check threads while the rest of
+    // the block is checked. The checks are waited for before leaving.
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
     map<uint256, CTxIndex> mapQueuedChanges;
     map<unsigned char, int64> mapFees;
     map<unsigned char, int64> mapValueIn;
     map<unsigned char, int64> mapValueOut;
     map<unsigned char, int64> mapParked;
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(CTransaction& tx, vtx)
+    for (unsigned int nTx = 0; nTx < vtx.size(); nTx++)
     {
+        CTransaction& tx = vtx[nTx];
         nSigOps += tx.GetLegacySigOpCount();
         if (nSigOps > MAX_BLOCK_SIGOPS)
             return DoS(100, error("ConnectBlock() : too many sigops"));
@@ -1699,13 +2238,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
         CDiskTxPos posThisTx(pindex->nFile, pindex->nBlockPos, nTxPos);
         nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
 
-        MapPrevTx mapInputs;
         if (tx.IsCoinBase() || tx.IsCustodianGrant())
             mapValueOut[tx.cUnit] += tx.GetValueOut();
         else
         {
             bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapQueuedChanges, true, false, mapInputs, fInvalid))
+            if (!tx.FetchInputs(view, fInvalid))
                 return false;
 
             if (fStrictPayToScriptHash)
@@ -1713,12 +2251,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
                 // Add in sigops done by pay-to-script-hash inputs;
                 // this is to prevent a "rogue miner" from creating
                 // an incredibly-expensive-to-validate block.
-                nSigOps += tx.GetP2SHSigOpCount(mapInputs);
+                nSigOps += tx.GetP2SHSigOpCount(view);
                 if (nSigOps > MAX_BLOCK_SIGOPS)
                     return DoS(100, error("ConnectBlock() : too many sigops"));
             }
 
-            int64 nTxValueIn = tx.GetValueIn(mapInputs);
+            int64 nTxValueIn = tx.GetValueIn(view);
             int64 nTxValueOut = tx.GetValueOut();
             mapValueIn[tx.cUnit] += nTxValueIn;
             mapValueOut[tx.cUnit] += nTxValueOut;
@@ -1733,13 +2271,36 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
             if (tx.IsUnpark())
                 mapParked[tx.cUnit] -= nTxValueIn;
 
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fStrictPayToScriptHash))
+            vector<CScriptCheck> vChecks;
+            if (!tx.ConnectInputs(view, pindex, blockundo.vtxundo[nTx], fStrictPayToScriptHash, &vChecks))
                 return false;
+            control.Add(vChecks);
+
+            // Keep the spent pointers of the transaction index up to date
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                map<uint256, CTxIndex>::iterator mi = mapQueuedChanges.find(txin.prevout.hash);
+                if (mi == mapQueuedChanges.end())
+                {
+                    CTxIndex txindex;
+                    if (!txdb.ReadTxIndex(txin.prevout.hash, txindex))
+                        return error("ConnectBlock() : %s prev tx %s index entry not found", tx.GetHash().ToString().substr(0,10).c_str(), txin.prevout.hash.ToString().substr(0,10).c_str());
+                    mi = mapQueuedChanges.insert(make_pair(txin.prevout.hash, txindex)).first;
+                }
+                if (txin.prevout.n >= mi->second.vSpent.size())
+                    return error("ConnectBlock() : prevout.n out of range of the tx index");
+                mi->second.vSpent[txin.prevout.n] = posThisTx;
+            }
         }
 
         mapQueuedChanges[tx.GetHash()] = CTxIndex(posThisTx, tx.vout.size());
+        view.SetCoins(tx.GetHash(), CCoins(tx, pindex->nHeight));
     }
 
+    CScriptCheck checkFailed;
+    if (!control.Wait(&checkFailed))
+        return checkFailed.Error();
+
     // ppcoin: track money supply and mint amount info
     // nubit: per unit tracking
     pindex->nMint = mapValueOut['8'] - mapValueIn['8'] + mapFees['8'];
@@ -1760,6 +2321,28 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
+    if (!view.Flush())
+        return error("ConnectBlock() : failed to write coins");
+    if (!txdb.WriteBlockUndo(pindex->GetBlockHash(), blockundo))
+        return error("ConnectBlock() : WriteBlockUndo failed");
+    // Undo data is only kept for the blocks a reorganization can disconnect
+    if (pindex->nHeight >= (int)MIN_BLOCKS_TO_KEEP)
+    {
+        const CBlockIndex* pindexUndo = pindex->GetAncestor(pindex->nHeight - MIN_BLOCKS_TO_KEEP);
+        if (!txdb.EraseBlockUndo(pindexUndo->GetBlockHash()))
+            return error("ConnectBlock() : EraseBlockUndo failed");
+    }
+
+    if (fAddrIndex)
+    {
+        vector<CAddressIndexEntry> vEntries;
+        GetAddressIndexEntries(*this, pindex->nHeight, blockundo, vEntries);
+        if (!txdb.WriteAddressIndex(vEntries))
+            return error("ConnectBlock() : WriteAddressIndex failed");
+    }
+    if (fBalanceIndex && !UpdateBalanceIndex(txdb, *this, blockundo, true))
+        return error("ConnectBlock() : UpdateBalanceIndex failed");
+
     // ppcoin: fees are not collected by miners as in bitcoin
     // ppcoin: fees are destroyed to compensate the entire network
     if (fDebug && GetBoolArg("-printcreation"))
@@ -1782,20 +2365,46 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
     return true;
 }
 
-void CBlockIndex::GetElectedCustodians(std::map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian) const
+const std::map<CBitcoinAddress, CBlockIndex*>& CBlockIndex::GetElectedCustodianMap() const
 {
-    mapElectedCustodian.clear();
-    for (const CBlockIndex* pindex = this; pindex; pindex = pindex->pprevElected)
+    static const std::map<CBitcoinAddress, CBlockIndex*> mapNoCustodian;
+
+    const CBlockIndex* pindexElected = vElectedCustodian.empty() ? pprevElected : this;
+    if (pindexElected == NULL)
+        return mapNoCustodian;
+
+    if (!pindexElected->pmapElectedCustodian)
     {
-        BOOST_FOREACH(const CCustodianVote& custodianVote, pindex->vElectedCustodian)
-            mapElectedCustodian[custodianVote.GetAddress()] = const_cast<CBlockIndex*>(pindex);
+        // Find the last block whose map is already built
+        vector<const CBlockIndex*> vMissing;
+        const CBlockIndex* pindex = pindexElected;
+        while (pindex && !pindex->pmapElectedCustodian)
+        {
+            vMissing.push_back(pindex);
+            pindex = pindex->pprevElected;
+        }
+
+        boost::shared_ptr<const std::map<CBitcoinAddress, CBlockIndex*> > pmapPrev;
+        if (pindex)
+            pmapPrev = pindex->pmapElectedCustodian;
+
+        BOOST_REVERSE_FOREACH(const CBlockIndex* pindexMissing, vMissing)
+        {
+            std::map<CBitcoinAddress, CBlockIndex*>* pmap = pmapPrev ? new std::map<CBitcoinAddress, CBlockIndex*>(*pmapPrev) : new std::map<CBitcoinAddress, CBlockIndex*>();
+            // A custodian keeps the block of its first election
+            BOOST_FOREACH(const CCustodianVote& custodianVote, pindexMissing->vElectedCustodian)
+                pmap->insert(make_pair(custodianVote.GetAddress(), const_cast<CBlockIndex*>(pindexMissing)));
+            pmapPrev.reset(pmap);
+            pindexMissing->pmapElectedCustodian = pmapPrev;
+        }
     }
+
+    return *pindexElected->pmapElectedCustodian;
 }
 
 bool CBlock::CheckCustodianGrants(const CBlockIndex* pindexPrev) const
 {
-    std::map<CBitcoinAddress, CBlockIndex*> mapElectedCustodian;
-    pindexPrev->GetElectedCustodians(mapElectedCustodian);
+    const std::map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian = pindexPrev->GetElectedCustodianMap();
 
     vector<CTransaction> vExpectedCurrencyCoinBase;
     if (IsProofOfStake())
@@ -1858,8 +2467,8 @@ bool Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
     CBlockIndex* plonger = pindexNew;
     while (pfork != plonger)
     {
-        while (plonger->nHeight > pfork->nHeight)
-            if (!(plonger = plonger->pprev))
+        if (plonger->nHeight > pfork->nHeight)
+            if (!(plonger = plonger->GetAncestor(pfork->nHeight)))
                 return error("Reorganize() : plonger->pprev is null");
         if (pfork == plonger)
             break;
@@ -1932,6 +2541,7 @@ bool Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
     BOOST_FOREACH(CBlockIndex* pindex, vConnect)
         if (pindex->pprev)
             pindex->pprev->pnext = pindex;
+    SetMainChainTip(pindexNew);
 
     // Resurrect memory transactions that were in the disconnected branch
     BOOST_FOREACH(CTransaction& tx, vResurrect)
@@ -1967,6 +2577,7 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
 
     // Add to current best branch
     pindexNew->pprev->pnext = pindexNew;
+    SetMainChainTip(pindexNew);
 
     // Delete redundant memory transactions
     BOOST_FOREACH(CTransaction& tx, vtx)
@@ -1988,6 +2599,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
         if (!txdb.TxnCommit())
             return error("SetBestChain() : TxnCommit failed");
         pindexGenesisBlock = pindexNew;
+        SetMainChainTip(pindexNew);
     }
     else if (hashPrevBlock == hashBestChain)
     {
@@ -2004,7 +2616,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 
         // Reorganize is costly in terms of db load, as it works in a single db transaction.
         // Try to limit how much needs to be done inside
-        while (pindexIntermediate->pprev && pindexIntermediate->pprev->bnChainTrust > pindexBest->bnChainTrust)
+        while (pindexIntermediate->pprev && pindexIntermediate->pprev->nChainTrust > pindexBest->nChainTrust)
         {
             vpindexSecondary.push_back(pindexIntermediate);
             pindexIntermediate = pindexIntermediate->pprev;
@@ -2052,7 +2664,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     hashBestChain = hash;
     pindexBest = pindexNew;
     nBestHeight = pindexBest->nHeight;
-    bnBestChainTrust = pindexNew->bnChainTrust;
+    bnBestChainTrust = CBigNum(pindexNew->nChainTrust);
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
     printf("SetBestChain: new best=%s  height=%d  trust=%s  moneysupply(S)=%s moneysupply(B)=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainTrust.ToString().c_str(), FormatMoney(pindexBest->GetMoneySupply('8')).c_str(), FormatMoney(pindexBest->GetMoneySupply('C')).c_str());
@@ -2067,6 +2679,13 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 
     RemoveExpiredLiquidityInfo(nBestHeight);
 
+    if (nPruneTarget > 0 && nBestHeight % PRUNE_CHECK_INTERVAL == 0)
+        PruneBlockFiles(txdb);
+
+    // Snapshot of the share balances, taken once the block is committed
+    if (fBalanceIndex && nBestHeight % BALANCE_SNAPSHOT_INTERVAL == 0)
+        SnapshotBalanceIndex(txdb, pindexBest);
+
     strProtocolWarning.clear();
     if (pindexBest->vote.nVersionVote > PROTOCOL_VERSION)
     {
@@ -2180,6 +2799,11 @@ bool CBlock::GetCoinStakeAge(int64& nCoinAge) const
     return vtx[1].GetCoinAge(txdb, nCoinAge);
 }
 
+// Sliding windows of the fee, signer reward and asset votes, following the last block added to the index
+static CFeeVoteTally feeVoteTally;
+static CSignerRewardVoteTally signerRewardVoteTally;
+static CAssetVoteTally assetVoteTally;
+
 bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
 {
     // Check for duplicate
@@ -2188,7 +2812,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return error("AddToBlockIndex() : %s already exists", hash.ToString().substr(0,20).c_str());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
+    CBlockIndex* pindexNew = new (AllocateBlockIndex()) CBlockIndex(nFile, nBlockPos, *this);
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
 
@@ -2198,6 +2822,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
+        pindexNew->BuildSkip();
     }
 
     // nubit: calculate the effective protocol version
@@ -2217,7 +2842,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     }
 
     // ppcoin: compute chain trust score
-    pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
+    pindexNew->nChainTrust = (pindexNew->pprev ? pindexNew->pprev->nChainTrust : uint256(0)) + pindexNew->GetBlockTrust().getuint256();
 
     // ppcoin: compute stake entropy bit for stake modifier
     if (!pindexNew->SetStakeEntropyBit(GetStakeEntropyBit()))
@@ -2253,10 +2878,10 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
             return error("AddToBlockIndex() : Unable to get coin age");
         pindexNew->vote.nCoinAgeDestroyed = pindexNew->nCoinAgeDestroyed;
 
-        if (!CalculateVotedFees(pindexNew))
+        if (!feeVoteTally.CalculateVotedFees(pindexNew))
             return error("Unable to calculate voted fees");
 
-        if (!CalculateVotedAssets(pindexNew))
+        if (!assetVoteTally.CalculateVotedAssets(pindexNew))
             return error("Unable to calculate voted assets");
         else if (pindexNew->mapAssets.size() != 0)
         {
@@ -2311,7 +2936,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     }
 
     // bcexchange: calculate signer reward vote result
-    if (!CalculateSignerRewardVoteResult(pindexNew))
+    if (!signerRewardVoteTally.CalculateSignerRewardVoteResult(pindexNew))
         return error("Unable to calculate signer reward vote result");
 
     if (!pindexNew->CalculateRewardedSigner())
@@ -2332,7 +2957,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return false;
 
     // New best
-    if (pindexNew->bnChainTrust > bnBestChainTrust)
+    if (CBigNum(pindexNew->nChainTrust) > bnBestChainTrust)
         if (!SetBestChain(txdb, pindexNew))
             return false;
 
@@ -2808,11 +3433,16 @@ bool CheckDiskSpace(uint64 nAdditionalBytes)
     return true;
 }
 
+static boost::filesystem::path GetBlockFilePath(unsigned int nFile)
+{
+    return GetDataDir() / strprintf("blk%04d.dat", nFile);
+}
+
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
     if (nFile == -1)
         return NULL;
-    FILE* file = fopen((GetDataDir() / strprintf("blk%04d.dat", nFile)).string().c_str(), pszMode);
+    FILE* file = fopen(GetBlockFilePath(nFile).string().c_str(), pszMode);
     if (!file)
         return NULL;
     if (nBlockPos != 0 && !strchr(pszMode, 'a') && !strchr(pszMode, 'w'))
@@ -2826,20 +3456,76 @@ FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszM
     return file;
 }
 
+// Read only mappings of the block files. A mapping is replaced by a larger one
+// when a read goes past its end, readers keep the old one alive until they are done.
+static CCriticalSection cs_mapMappedBlockFile;
+static map<unsigned int, boost::shared_ptr<const CMappedFile> > mapMappedBlockFile;
+
+boost::shared_ptr<const CMappedFile> MapBlockFile(unsigned int nFile, unsigned int nMinSize)
+{
+    if (nFile == -1)
+        return boost::shared_ptr<const CMappedFile>();
+
+    LOCK(cs_mapMappedBlockFile);
+    map<unsigned int, boost::shared_ptr<const CMappedFile> >::iterator mi = mapMappedBlockFile.find(nFile);
+    if (mi != mapMappedBlockFile.end() && mi->second->size() >= nMinSize)
+        return mi->second;
+
+    CMappedFile* pmapped = new CMappedFile();
+    if (!pmapped->Open(GetBlockFilePath(nFile)) || pmapped->size() < nMinSize)
+    {
+        delete pmapped;
+        return boost::shared_ptr<const CMappedFile>();
+    }
+    boost::shared_ptr<const CMappedFile> pshared(pmapped);
+    mapMappedBlockFile[nFile] = pshared;
+    return pshared;
+}
+
+static void UnmapBlockFile(unsigned int nFile)
+{
+    LOCK(cs_mapMappedBlockFile);
+    mapMappedBlockFile.erase(nFile);
+}
+
+// Block files deleted in pruning mode, also recorded in the transaction database
+static CCriticalSection cs_setPrunedBlockFiles;
+static set<unsigned int> setPrunedBlockFiles;
+
+bool IsBlockFilePruned(unsigned int nFile)
+{
+    LOCK(cs_setPrunedBlockFiles);
+    return setPrunedBlockFiles.count(nFile) > 0;
+}
+
+void SetPrunedBlockFiles(const set<unsigned int>& setPruned)
+{
+    LOCK(cs_setPrunedBlockFiles);
+    setPrunedBlockFiles = setPruned;
+}
+
 static unsigned int nCurrentBlockFile = 1;
 
 FILE* AppendBlockFile(unsigned int& nFileRet)
 {
     nFileRet = 0;
+    // Smaller files in pruning mode, so that the budget is respected file by file
+    const long nMaxFileSize = (nPruneTarget > 0 ? PRUNE_BLOCK_FILE_SIZE : 0x7F000000) - MAX_SIZE;
     loop
     {
+        // Never append to a file that was deleted
+        if (IsBlockFilePruned(nCurrentBlockFile))
+        {
+            nCurrentBlockFile++;
+            continue;
+        }
         FILE* file = OpenBlockFile(nCurrentBlockFile, 0, "ab");
         if (!file)
             return NULL;
         if (fseek(file, 0, SEEK_END) != 0)
             return NULL;
         // FAT32 filesize max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
-        if (ftell(file) < 0x7F000000 - MAX_SIZE)
+        if (ftell(file) < nMaxFileSize)
         {
             nFileRet = nCurrentBlockFile;
             return file;
@@ -2849,6 +3535,156 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
     }
 }
 
+// Whether a block file must be kept: it has recent blocks, or main chain
+// transactions with unspent outputs that are still read by the stake kernel,
+// the coin age computation and the wallet. See also GetRecentSpentBlockFiles.
+static bool IsBlockFileNeeded(CTxDB& txdb, const vector<CBlockIndex*>& vBlocks)
+{
+    CCoinsViewDB viewDB(txdb);
+    BOOST_FOREACH(CBlockIndex* pindex, vBlocks)
+    {
+        if (pindex->nHeight + (int)MIN_BLOCKS_TO_KEEP >= nBestHeight)
+            return true;
+    }
+    BOOST_FOREACH(CBlockIndex* pindex, vBlocks)
+    {
+        if (!pindex->IsInMainChain())
+            continue;
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return true;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            if (viewDB.HaveCoins(tx.GetHash()))
+                return true;
+    }
+    return false;
+}
+
+// Files holding the previous transactions of the outputs spent by the blocks
+// MIN_BLOCKS_TO_KEEP below the tip. Disconnecting one of these blocks makes
+// the outputs spendable again, and the stake kernel and the coin age of a
+// transaction spending them read the previous transaction and its block.
+static bool GetRecentSpentBlockFiles(CTxDB& txdb, set<unsigned int>& setFilesRet)
+{
+    for (CBlockIndex* pindex = pindexBest; pindex && pindex->nHeight + (int)MIN_BLOCKS_TO_KEEP >= nBestHeight; pindex = pindex->pprev)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("GetRecentSpentBlockFiles() : block.ReadFromDisk failed");
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            if (tx.IsCoinBase() || tx.IsCustodianGrant())
+                continue;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                CTxIndex txindex;
+                if (!txdb.ReadTxIndex(txin.prevout.hash, txindex))
+                    return error("GetRecentSpentBlockFiles() : prev tx %s index entry not found", txin.prevout.hash.ToString().substr(0,10).c_str());
+                setFilesRet.insert(txindex.pos.nFile);
+            }
+        }
+    }
+    return true;
+}
+
+bool PruneBlockFiles(CTxDB& txdb)
+{
+    if (nPruneTarget <= 0)
+        return true;
+
+    set<unsigned int> setPruned;
+    {
+        LOCK(cs_setPrunedBlockFiles);
+        setPruned = setPrunedBlockFiles;
+    }
+
+    // Disk usage of the block files
+    map<unsigned int, uint64> mapFileSize;
+    uint64 nTotalSize = 0;
+    for (unsigned int nFile = 1; nFile <= nCurrentBlockFile; nFile++)
+    {
+        boost::filesystem::path pathFile = GetBlockFilePath(nFile);
+        boost::system::error_code ec;
+        if (!boost::filesystem::exists(pathFile, ec))
+            continue;
+        // A previous removal may have failed
+        if (setPruned.count(nFile))
+        {
+            boost::filesystem::remove(pathFile, ec);
+            continue;
+        }
+        uint64 nSize = boost::filesystem::file_size(pathFile, ec);
+        if (ec)
+            continue;
+        mapFileSize[nFile] = nSize;
+        nTotalSize += nSize;
+    }
+    if (nTotalSize <= (uint64)nPruneTarget)
+        return true;
+
+    map<unsigned int, vector<CBlockIndex*> > mapFileBlocks;
+    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        mapFileBlocks[mi->second->nFile].push_back(mi->second);
+
+    // Only looked for once a file could be pruned
+    set<unsigned int> setRecentSpent;
+    bool fRecentSpentFound = false;
+
+    // Files found needed are not read again for a while, most keep unspent outputs for long
+    static map<unsigned int, int> mapFileChecked;
+
+    // Oldest files first, never the one being appended to
+    vector<unsigned int> vPrune;
+    for (map<unsigned int, uint64>::iterator mi = mapFileSize.begin(); mi != mapFileSize.end() && nTotalSize > (uint64)nPruneTarget; ++mi)
+    {
+        unsigned int nFile = mi->first;
+        if (nFile >= nCurrentBlockFile)
+            break;
+        map<unsigned int, int>::iterator it = mapFileChecked.find(nFile);
+        if (it != mapFileChecked.end() && nBestHeight - it->second < PRUNE_RECHECK_INTERVAL)
+            continue;
+        if (IsBlockFileNeeded(txdb, mapFileBlocks[nFile]))
+        {
+            mapFileChecked[nFile] = nBestHeight;
+            continue;
+        }
+        if (!fRecentSpentFound)
+        {
+            if (!GetRecentSpentBlockFiles(txdb, setRecentSpent))
+                return error("PruneBlockFiles() : files of the outputs spent by the recent blocks not found");
+            fRecentSpentFound = true;
+        }
+        if (setRecentSpent.count(nFile))
+            continue;
+        vPrune.push_back(nFile);
+        nTotalSize -= mi->second;
+    }
+    if (vPrune.empty())
+    {
+        if (fDebug)
+            printf("PruneBlockFiles() : %"PRI64u" bytes of block files, no file can be pruned\n", nTotalSize);
+        return true;
+    }
+
+    // Record the files as pruned before deleting them
+    setPruned.insert(vPrune.begin(), vPrune.end());
+    if (!txdb.Flush() || !txdb.WritePrunedBlockFiles(setPruned) || !txdb.Flush())
+        return error("PruneBlockFiles() : failed to write the pruned block files");
+    SetPrunedBlockFiles(setPruned);
+
+    BOOST_FOREACH(unsigned int nFile, vPrune)
+    {
+        UnmapBlockFile(nFile);
+        boost::system::error_code ec;
+        boost::filesystem::remove(GetBlockFilePath(nFile), ec);
+        if (ec)
+            printf("PruneBlockFiles() : failed to remove blk%04d.dat: %s\n", nFile, ec.message().c_str());
+        else
+            printf("PruneBlockFiles() : removed blk%04d.dat\n", nFile);
+    }
+    return true;
+}
+
 bool LoadBlockIndex(bool fAllowNew)
 {
     if (fTestNet)
@@ -3577,10 +4413,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             {
                 // Send block from disk
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                CBlock block;
+                if (mi != mapBlockIndex.end() && !IsBlockFilePruned((*mi).second->nFile) && block.ReadFromDisk((*mi).second))
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
                     pfrom->PushMessage("block", block);
                     fFound = true;
 
@@ -3645,6 +4480,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                     pfrom->PushInventory(CInv(MSG_BLOCK, hashBestChain));
                 break;
             }
+            // Blocks of pruned files cannot be served
+            if (IsBlockFilePruned(pindex->nFile))
+            {
+                printf("  getblocks stopping at pruned block %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().substr(0,20).c_str());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             CBlock block;
             block.ReadFromDisk(pindex, true);
@@ -4226,22 +5067,19 @@ int static FormatHashBlocks(void* pbuffer, unsigned int len)
 static const unsigned int pSHA256InitState[8] =
 {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
 
-void SHA256Transform(void* pstate, void* pinput, const void* pinit)
+// Compress the 16 words of pinput into the 8 words of pinit. The miner keeps
+// its buffers as native words of the big endian data.
+static void SHA256TransformWords(void* pstate, void* pinput, const void* pinit)
 {
-    SHA256_CTX ctx;
-    unsigned char data[64];
-
-    SHA256_Init(&ctx);
+    uint32_t data[16];
+    uint32_t state[8];
 
     for (int i = 0; i < 16; i++)
-        ((uint32_t*)data)[i] = ByteReverse(((uint32_t*)pinput)[i]);
+        data[i] = ByteReverse(((uint32_t*)pinput)[i]);
+    memcpy(state, pinit, sizeof(state));
 
-    for (int i = 0; i < 8; i++)
-        ctx.h[i] = ((uint32_t*)pinit)[i];
-
-    SHA256_Update(&ctx, data, sizeof(data));
-    for (int i = 0; i < 8; i++)
-        ((uint32_t*)pstate)[i] = ctx.h[i];
+    SHA256Transform(state, (unsigned char*)data, 1);
+    memcpy(pstate, state, sizeof(state));
 }
 
 //
@@ -4251,28 +5089,59 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 // between calls, but periodically or if nNonce is 0xffff0000 or above,
 // the block is rebuilt and nNonce starts over at zero.
 //
-unsigned int static ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+unsigned int static ScanHash(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
 {
     unsigned int& nNonce = *(unsigned int*)(pdata + 12);
-    for (;;)
+
+    // Big endian copies of the data and of the preformatted phash1, one
+    // per nonce tried at once
+    unsigned int nLanes = SHA256Lanes();
+    uint32_t pblocks[SHA256_MAX_LANES][16];
+    uint32_t phashblocks[SHA256_MAX_LANES][16];
+    uint32_t pstate[SHA256_MAX_LANES][8];
+    for (unsigned int i = 0; i < nLanes; i++)
     {
-        // Crypto++ SHA-256
-        // Hash pdata using pmidstate as the starting state into
-        // preformatted buffer phash1, then hash phash1 into phash
-        nNonce++;
-        SHA256Transform(phash1, pdata, pmidstate);
-        SHA256Transform(phash, phash1, pSHA256InitState);
+        for (int j = 0; j < 16; j++)
+        {
+            pblocks[i][j] = ByteReverse(((uint32_t*)pdata)[j]);
+            phashblocks[i][j] = ByteReverse(((uint32_t*)phash1)[j]);
+        }
+    }
 
-        // Return the nonce if the hash has at least some zero bits,
-        // caller will check if it has enough to reach the target
-        if (((unsigned short*)phash)[14] == 0)
-            return nNonce;
+    for (;;)
+    {
+        // Hash pdata with the next nonces using pmidstate as the starting
+        // state, then hash each result from the initial state
+        for (unsigned int i = 0; i < nLanes; i++)
+        {
+            pblocks[i][3] = ByteReverse(nNonce + 1 + i);
+            memcpy(pstate[i], pmidstate, sizeof(pstate[i]));
+        }
+        SHA256TransformLanes(pstate[0], (unsigned char*)pblocks[0], nLanes);
+        for (unsigned int i = 0; i < nLanes; i++)
+        {
+            for (int j = 0; j < 8; j++)
+                phashblocks[i][j] = ByteReverse(pstate[i][j]);
+            memcpy(pstate[i], pSHA256InitState, sizeof(pstate[i]));
+        }
+        SHA256TransformLanes(pstate[0], (unsigned char*)phashblocks[0], nLanes);
 
-        // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xffff) == 0)
+        for (unsigned int i = 0; i < nLanes; i++)
         {
-            nHashesDone = 0xffff+1;
-            return (unsigned int) -1;
+            nNonce++;
+            memcpy(phash, pstate[i], sizeof(pstate[i]));
+
+            // Return the nonce if the hash has at least some zero bits,
+            // caller will check if it has enough to reach the target
+            if (((unsigned short*)phash)[14] == 0)
+                return nNonce;
+
+            // If nothing found after trying for a while, return -1
+            if ((nNonce & 0xffff) == 0)
+            {
+                nHashesDone = 0xffff+1;
+                return (unsigned int) -1;
+            }
         }
     }
 }
@@ -4373,7 +5242,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfS
 
         vector<CTransaction> vCurrencyCoinBase;
 
-        if (!GenerateCurrencyCoinBases(vVote, pindexBest->GetElectedCustodians(), vCurrencyCoinBase))
+        if (!GenerateCurrencyCoinBases(vVote, pindexBest->GetElectedCustodianMap(), vCurrencyCoinBase))
         {
             printf("CreateNewBlock(): unable to generate currency coin bases");
             return NULL;
@@ -4657,7 +5526,7 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
         ((unsigned int*)&tmp)[i] = ByteReverse(((unsigned int*)&tmp)[i]);
 
     // Precalc the first half of the first hash, which stays constant
-    SHA256Transform(pmidstate, &tmp.block, pSHA256InitState);
+    SHA256TransformWords(pmidstate, &tmp.block, pSHA256InitState);
 
     memcpy(pdata, &tmp.block, 128);
     memcpy(phash1, &tmp.hash1, 64);
@@ -4821,9 +5690,8 @@ void BitcoinMiner(CWallet *pwallet, bool fProofOfStake)
             unsigned int nHashesDone = 0;
             unsigned int nNonceFound;
 
-            // Crypto++ SHA-256
-            nNonceFound = ScanHash_CryptoPP(pmidstate, pdata + 64, phash1,
-                                            (char*)&hash, nHashesDone);
+            nNonceFound = ScanHash(pmidstate, pdata + 64, phash1,
+                                   (char*)&hash, nHashesDone);
 
             // Check if something found
             if (nNonceFound != (unsigned int) -1)
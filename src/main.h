@@ -12,13 +12,17 @@
 #include "net.h"
 #include "script.h"
 #include "vote.h"
+#include "assetregistry.h"
 #include "serializable_tx_destination.h"
+#include "mappedfile.h"
 
 #ifdef WIN32
 #include <io.h> /* for _commit */
 #endif
 
 #include <list>
+#include <set>
+#include <boost/shared_ptr.hpp>
 
 class CWallet;
 class CBlock;
@@ -82,6 +86,13 @@ static const int ASSET_VOTES = 2000;
 static const int SAFE_FEE_BLOCKS = 10; // When a new transaction is created, the highest min fee of the next SAFE_FEE_BLOCKS blocks will be used, to make sure this transaction can be included in any of these blocks
 #endif
 
+static const unsigned int MIN_BLOCKS_TO_KEEP = 2880; // Blocks below the tip never pruned and with undo data kept, about two days
+static const int64 MIN_PRUNE_TARGET = 512 * 1024 * 1024; // Smallest -prune budget accepted
+static const unsigned int PRUNE_BLOCK_FILE_SIZE = 0x8000000; // Block files are cut at 128MB when pruning so whole files can be deleted
+static const int PRUNE_CHECK_INTERVAL = 100; // Number of blocks between two checks of the disk budget
+static const int PRUNE_RECHECK_INTERVAL = 1000; // Number of blocks before a block file that had to be kept is checked again
+static const int MAX_SCRIPTCHECK_THREADS = 16; // Largest number of script verification threads (-par)
+
 
 #ifdef USE_UPNP
 static const int fHaveUPnP = true;
@@ -107,6 +118,131 @@ inline bool IsValidUnit(unsigned char cUnit)
     return sAvailableUnits.find(cUnit) != std::string::npos;
 }
 
+static const unsigned int AVAILABLE_UNIT_COUNT = 2; // size of sAvailableUnits
+
+/** Per unit values of a block index. It replaces a std::map<unsigned char, T>
+ * with a fixed array indexed by the position of the unit in sAvailableUnits,
+ * which avoids a heap node per unit, and is serialized like the map was.
+ */
+template <typename T> class CUnitMap
+{
+private:
+    T values[AVAILABLE_UNIT_COUNT];
+    unsigned char nSetMask; // bit n is set if the unit at position n has a value
+
+    static int GetPosition(unsigned char cUnit)
+    {
+        std::string::size_type nPos = sAvailableUnits.find(cUnit);
+        if (nPos == std::string::npos)
+            return -1;
+        return nPos;
+    }
+
+public:
+    CUnitMap()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        nSetMask = 0;
+        for (unsigned int i = 0; i < AVAILABLE_UNIT_COUNT; i++)
+            values[i] = T();
+    }
+
+    bool empty() const
+    {
+        return nSetMask == 0;
+    }
+
+    unsigned int size() const
+    {
+        unsigned int nSize = 0;
+        for (unsigned int i = 0; i < AVAILABLE_UNIT_COUNT; i++)
+            if (nSetMask & (1 << i))
+                nSize++;
+        return nSize;
+    }
+
+    // Like std::map, accessing a unit without value sets it to T()
+    T& operator[](unsigned char cUnit)
+    {
+        int nPos = GetPosition(cUnit);
+        if (nPos < 0)
+            throw std::out_of_range("CUnitMap : invalid unit");
+        nSetMask |= (1 << nPos);
+        return values[nPos];
+    }
+
+    // The value of a unit, or NULL if it has none
+    const T* find(unsigned char cUnit) const
+    {
+        int nPos = GetPosition(cUnit);
+        if (nPos < 0 || !(nSetMask & (1 << nPos)))
+            return NULL;
+        return &values[nPos];
+    }
+
+    bool operator==(const CUnitMap& other) const
+    {
+        if (nSetMask != other.nSetMask)
+            return false;
+        for (unsigned int i = 0; i < AVAILABLE_UNIT_COUNT; i++)
+            if ((nSetMask & (1 << i)) && values[i] != other.values[i])
+                return false;
+        return true;
+    }
+
+    bool operator!=(const CUnitMap& other) const
+    {
+        return !(*this == other);
+    }
+
+    // Serialized as a std::map<unsigned char, T>. sAvailableUnits is sorted,
+    // so the positions follow the order of the map keys.
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nSize = GetSizeOfCompactSize(size());
+        for (unsigned int i = 0; i < AVAILABLE_UNIT_COUNT; i++)
+            if (nSetMask & (1 << i))
+                nSize += 1 + ::GetSerializeSize(values[i], nType, nVersion);
+        return nSize;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, size());
+        for (unsigned int i = 0; i < AVAILABLE_UNIT_COUNT; i++)
+        {
+            if (nSetMask & (1 << i))
+            {
+                unsigned char cUnit = sAvailableUnits[i];
+                ::Serialize(s, cUnit, nType, nVersion);
+                ::Serialize(s, values[i], nType, nVersion);
+            }
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        clear();
+        unsigned int nSize = ReadCompactSize(s);
+        for (unsigned int i = 0; i < nSize; i++)
+        {
+            unsigned char cUnit;
+            T value;
+            ::Unserialize(s, cUnit, nType, nVersion);
+            ::Unserialize(s, value, nType, nVersion);
+            if (!IsValidUnit(cUnit))
+                throw std::ios_base::failure("CUnitMap::Unserialize() : invalid unit");
+            (*this)[cUnit] = value;
+        }
+    }
+};
+
 inline bool IsValidCurrency(unsigned char cUnit)
 {
     return (cUnit != '8' && IsValidUnit(cUnit));
@@ -156,6 +292,9 @@ extern int nBlocksToIgnore;
 
 // Settings
 extern int64 nSplitShareOutputs;
+extern bool fMapBlockFiles;
+extern int64 nPruneTarget;
+extern int nScriptCheckThreads;
 
 
 
@@ -164,6 +303,9 @@ extern int64 nSplitShareOutputs;
 class CReserveKey;
 class CTxDB;
 class CTxIndex;
+class CCoinsViewCache;
+class CTxUndo;
+class CScriptCheck;
 
 CWallet *GetWallet(unsigned char cUnit);
 void RegisterWallet(CWallet* pwalletIn);
@@ -173,7 +315,13 @@ void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL, bool f
 bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64 nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
+boost::shared_ptr<const CMappedFile> MapBlockFile(unsigned int nFile, unsigned int nMinSize);
 FILE* AppendBlockFile(unsigned int& nFileRet);
+bool IsBlockFilePruned(unsigned int nFile);
+void SetPrunedBlockFiles(const std::set<unsigned int>& setPruned);
+bool PruneBlockFiles(CTxDB& txdb);
+void ThreadScriptCheck(void* parg);
+void ThreadScriptCheckQuit();
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 bool ProcessMessages(CNode* pfrom);
@@ -192,6 +340,10 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 uint256 WantedByOrphan(const CBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
+CBlockIndex* FindBlockByHeight(int nHeight);
+void SetMainChainTip(CBlockIndex* pindexTip);
+void* AllocateBlockIndex();
+unsigned int GetBlockIndexArenaSize();
 #ifdef TESTING
 void BitcoinMiner(CWallet *pwallet, bool fProofOfStake, bool fGenerateSingleBlock = false);
 #else
@@ -207,6 +359,37 @@ inline int GetMaturity(bool fProofOfStake)
     return fProofOfStake ? nCoinstakeMaturity : nCoinbaseMaturity;
 }
 
+/** Unserialize obj from position nPos of a block file through the memory
+ * mapping of the file. Returns false if the file is not mapped, in which
+ * case the caller reads it with OpenBlockFile instead.
+ */
+template<typename T>
+bool ReadBlockFileMapped(unsigned int nFile, unsigned int nPos, int nType, T& obj)
+{
+    if (!fMapBlockFiles)
+        return false;
+
+    unsigned int nMinSize = nPos + 1;
+    loop
+    {
+        boost::shared_ptr<const CMappedFile> pmapped = MapBlockFile(nFile, nMinSize);
+        if (!pmapped)
+            return false;
+
+        CBufferReader reader(pmapped->begin() + nPos, pmapped->end(), nType, CLIENT_VERSION);
+        try {
+            reader >> obj;
+            return true;
+        }
+        catch (std::ios_base::failure& e) {
+            // The file may have grown since it was mapped
+            if (!reader.eof())
+                throw;
+        }
+        nMinSize = pmapped->size() + 1;
+    }
+}
+
 inline int64 MinTxOutAmount(unsigned char cUnit)
 {
     return cUnit == '8' ? MIN_SHARE_TXOUT_AMOUNT : MIN_CURRENCY_TXOUT_AMOUNT;
@@ -444,7 +627,7 @@ public:
         scriptPubKey.clear();
     }
 
-    bool IsNull()
+    bool IsNull() const
     {
         return (nValue == -1);
     }
@@ -676,6 +859,7 @@ public:
         @see CTransaction::FetchInputs
      */
     unsigned int GetP2SHSigOpCount(const MapPrevTx& mapInputs) const;
+    unsigned int GetP2SHSigOpCount(CCoinsViewCache& view) const;
 
     /** Amount of peershares spent by this transaction.
         @return sum of all outputs (note: does not include fees)
@@ -701,6 +885,7 @@ public:
         @see CTransaction::FetchInputs
      */
     int64 GetValueIn(const MapPrevTx& mapInputs) const;
+    int64 GetValueIn(CCoinsViewCache& view) const;
 
     static bool AllowFree(double dPriority)
     {
@@ -731,6 +916,17 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        if (!pfileRet)
+        {
+            try {
+                if (ReadBlockFileMapped(pos.nFile, pos.nTxPos, SER_DISK, *this))
+                    return true;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -809,7 +1005,11 @@ public:
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet);
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout);
     bool ReadFromDisk(COutPoint prevout);
-    bool DisconnectInputs(CTxDB& txdb);
+    bool DisconnectInputs(CTxDB& txdb, CCoinsViewCache& view, const CTxUndo* ptxundo=NULL);
+
+    /** Remove the outputs of this transaction from a coins view and give back
+        the outputs it spent, from the undo data recorded by ConnectInputs. */
+    bool DisconnectInputs(CCoinsViewCache& view, const CTxUndo& txundo) const;
 
     /** Fetch from memory and/or disk. inputsRet keys are transaction hashes.
 
@@ -834,11 +1034,35 @@ public:
         @param[in] fBlock   true if called from ConnectBlock
         @param[in] fMiner   true if called from CreateNewBlock
         @param[in] fStrictPayToScriptHash   true if fully validating p2sh transactions
+        @param[out] pvChecks    If not NULL, receives the script checks instead of running them
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true,
+                       std::vector<CScriptCheck>* pvChecks=NULL);
+
+    /** Check that the outputs spent by this transaction are in the coins view.
+
+     @param[in] view    Coins view
+     @param[out] fInvalid   returns true if transaction is invalid
+     @return    Returns true if all the outputs spent are unspent in the view
+     */
+    bool FetchInputs(CCoinsViewCache& view, bool& fInvalid) const;
+
+    /** Same checks as the ConnectInputs above for a block connected to the chain,
+        with the previous outputs taken from a coins view instead of the block files.
+        The outputs spent are removed from the view.
+
+        @param[in] view Coins view (after FetchInputs)
+        @param[in] pindexBlock
+        @param[out] txundo  Receives the outputs spent, to disconnect the transaction
+        @param[in] fStrictPayToScriptHash   true if fully validating p2sh transactions
+        @param[out] pvChecks    If not NULL, receives the script checks instead of running them
+        @return Returns true if all checks succeed
+     */
+    bool ConnectInputs(CCoinsViewCache& view, const CBlockIndex* pindexBlock, CTxUndo& txundo, bool fStrictPayToScriptHash=true,
+                       std::vector<CScriptCheck>* pvChecks=NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -854,11 +1078,52 @@ public:
 
 protected:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
+
+    // Checks shared by both ConnectInputs
+    bool CheckUnpark(const CTxOut& txoutPrev, unsigned char cUnitPrev, const CBlockIndex* pindexPark, int nDepth) const;
+    bool CheckValueIn(const CBlockIndex* pindexBlock, int64 nValueIn, bool fValidUnpark, bool fBlock) const;
 };
 
 
 
 
+/** Verification of the script of a transaction input, run by the script
+ * check threads. The transaction must outlive the check. The checks of the
+ * inputs of a transaction can share a signature hash context. */
+class CScriptCheck
+{
+private:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    bool fStrictPayToScriptHash;
+    int nHashType;
+    boost::shared_ptr<const CSignatureHashContext> psighashctx;
+
+public:
+    CScriptCheck() : ptxTo(NULL), nIn(0), fStrictPayToScriptHash(false), nHashType(0) {}
+    CScriptCheck(const CTxOut& txoutPrev, const CTransaction& txToIn, unsigned int nInIn, bool fStrictPayToScriptHashIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSignatureHashContext>& psighashctxIn = boost::shared_ptr<const CSignatureHashContext>()) :
+        scriptPubKey(txoutPrev.scriptPubKey), ptxTo(&txToIn), nIn(nInIn), fStrictPayToScriptHash(fStrictPayToScriptHashIn), nHashType(nHashTypeIn),
+        psighashctx(psighashctxIn) {}
+
+    bool operator()() const;
+
+    // Log the failure of the check and set the DoS score of the transaction, returns false
+    bool Error() const;
+
+    void swap(CScriptCheck& check)
+    {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(fStrictPayToScriptHash, check.fStrictPayToScriptHash);
+        std::swap(nHashType, check.nHashType);
+        psighashctx.swap(check.psighashctx);
+    }
+};
+
+
 
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
@@ -1093,18 +1358,23 @@ public:
 
     uint256 BuildMerkleTree() const
     {
+        int nTreeSize = vtx.size();
+        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+            nTreeSize += (nSize + 1) / 2;
         vMerkleTree.clear();
+        vMerkleTree.reserve(nTreeSize);
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // The pairs of a level follow each other, hash them all at once
+            int nPairs = nSize / 2;
+            vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+            SHA256D64((unsigned char*)&vMerkleTree[j+nSize], (unsigned char*)&vMerkleTree[j], nPairs);
+            if (nSize & 1)
+                vMerkleTree[j+nSize+nPairs] = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                                   BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1114,9 +1384,15 @@ public:
     {
         if (vMerkleTree.empty())
             BuildMerkleTree();
+        return GetMerkleBranch(vMerkleTree, vtx.size(), nIndex);
+    }
+
+    // Branch of transaction nIndex in the tree built by BuildMerkleTree for nTx transactions
+    static std::vector<uint256> GetMerkleBranch(const std::vector<uint256>& vMerkleTree, int nTx, int nIndex)
+    {
         std::vector<uint256> vMerkleBranch;
         int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        for (int nSize = nTx; nSize > 1; nSize = (nSize + 1) / 2)
         {
             int i = std::min(nIndex^1, nSize-1);
             vMerkleBranch.push_back(vMerkleTree[j+i]);
@@ -1180,16 +1456,19 @@ public:
     {
         SetNull();
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+        int nType = SER_DISK;
         if (!fReadTransactions)
-            filein.nType |= SER_BLOCKHEADERONLY;
+            nType |= SER_BLOCKHEADERONLY;
 
-        // Read block
+        // Read block, from the mapping of the history file if possible
         try {
-            filein >> *this;
+            if (!ReadBlockFileMapped(nFile, nBlockPos, nType, *this))
+            {
+                CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), nType, CLIENT_VERSION);
+                if (!filein)
+                    return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+                filein >> *this;
+            }
         }
         catch (std::exception &e) {
             return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
@@ -1262,13 +1541,14 @@ public:
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
+    CBlockIndex* pskip; // ancestor used to jump back several blocks at once in GetAncestor
     unsigned int nFile;
     unsigned int nBlockPos;
-    CBigNum bnChainTrust; // ppcoin: trust score of block chain
+    uint256 nChainTrust; // ppcoin: trust score of block chain
     int nHeight;
     int64 nMint;
-    std::map<unsigned char, int64> mapMoneySupply;
-    std::map<unsigned char, int64> mapTotalParked;
+    CUnitMap<int64> mapMoneySupply;
+    CUnitMap<int64> mapTotalParked;
 
     unsigned int nFlags;  // ppcoin: block index flags
     enum  
@@ -1298,18 +1578,19 @@ public:
     int nProtocolVersion;
 
     // nubit: the result of the fee vote
-    std::map<unsigned char, uint32_t> mapVotedFee;
+    CUnitMap<uint32_t> mapVotedFee;
 
     // nubit: previous block with an elected custodian
     CBlockIndex* pprevElected;
 
+    // nubit: custodians elected up to this block, only built on blocks with an
+    // elected custodian (see GetElectedCustodianMap)
+    mutable boost::shared_ptr<const std::map<CBitcoinAddress, CBlockIndex*> > pmapElectedCustodian;
+
     // bcexchange: reputed signer reward vote results
     CSignerRewardVote signerRewardVoteResult;
 
-    // TODO move to a separate index as the current implementetion uses more memory
-    // bcexchange: previous blocks that contain the actual asset vote results
-    std::map<uint32_t, CBlockIndex*> mapAssetsPrev;
-    // bcexchange: asset votes results for this block
+    // bcexchange: asset vote results that changed in this block (see CAssetRegistry)
     std::map<uint32_t, CAsset> mapAssets;
 
     // bcexchange: rewarded signer
@@ -1328,10 +1609,11 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
         nFile = 0;
         nBlockPos = 0;
         nHeight = 0;
-        bnChainTrust = 0;
+        nChainTrust = 0;
         nMint = 0;
         mapMoneySupply.clear();
         mapTotalParked.clear();
@@ -1348,6 +1630,7 @@ public:
         nProtocolVersion = 0;
         mapVotedFee.clear();
         pprevElected = NULL;
+        pmapElectedCustodian.reset();
         signerRewardVoteResult.SetNull();
 
         nVersion       = 0;
@@ -1362,10 +1645,11 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
         nFile = nFileIn;
         nBlockPos = nBlockPosIn;
         nHeight = 0;
-        bnChainTrust = 0;
+        nChainTrust = 0;
         nMint = 0;
         mapMoneySupply.clear();
         mapTotalParked.clear();
@@ -1391,6 +1675,7 @@ public:
         nProtocolVersion = 0;
         mapVotedFee.clear();
         pprevElected = NULL;
+        pmapElectedCustodian.reset();
         signerRewardVoteResult.SetNull();
 
         nVersion       = block.nVersion;
@@ -1400,6 +1685,12 @@ public:
         nNonce         = block.nNonce;
     }
 
+    ~CBlockIndex()
+    {
+        if (!mapAssets.empty())
+            assetRegistry.Unregister(this);
+    }
+
     CBlock GetBlockHeader() const
     {
         CBlock block;
@@ -1437,15 +1728,28 @@ public:
         return (pnext || this == pindexBest);
     }
 
+    // true if this block is referenced by the main chain height index
+    bool IsInMainChainIndex() const
+    {
+        return FindBlockByHeight(nHeight) == this;
+    }
+
     bool IsInChain(const CBlockIndex* pindexChain) const
     {
         if (pindexChain == pindexBest)
             return IsInMainChain();
 
-        for (const CBlockIndex* pindex = pindexChain; pindex; pindex = pindex->pprev)
-            if (pindex == this)
-                return true;
-        return false;
+        return pindexChain && pindexChain->GetAncestor(nHeight) == this;
+    }
+
+    // Build the skip pointer. The ancestors must already have theirs.
+    void BuildSkip();
+
+    // Efficiently find the ancestor of this block at the given height
+    CBlockIndex* GetAncestor(int nAncestorHeight);
+    const CBlockIndex* GetAncestor(int nAncestorHeight) const
+    {
+        return const_cast<CBlockIndex*>(this)->GetAncestor(nAncestorHeight);
     }
 
     bool CheckIndex() const
@@ -1545,24 +1849,27 @@ public:
 
     int64 GetMoneySupply(unsigned char cUnit) const
     {
-        std::map<unsigned char, int64>::const_iterator it = mapMoneySupply.find(cUnit);
-        if (it != mapMoneySupply.end())
-            return it->second;
+        const int64* pnMoneySupply = mapMoneySupply.find(cUnit);
+        if (pnMoneySupply)
+            return *pnMoneySupply;
         else
             return -1;
     }
 
     int64 GetTotalParked(unsigned char cUnit) const
     {
-        std::map<unsigned char, int64>::const_iterator it = mapTotalParked.find(cUnit);
-        if (it != mapTotalParked.end())
-            return it->second;
+        const int64* pnTotalParked = mapTotalParked.find(cUnit);
+        if (pnTotalParked)
+            return *pnTotalParked;
         else
             return -1;
     }
 
     const CBlockIndex* GetEffectiveVoteIndex() const
     {
+        if (IsInMainChainIndex())
+            return FindBlockByHeight(std::max(nHeight - VOTE_DELAY_BLOCKS, 0));
+
         const CBlockIndex* pindex = this;
         for (int i = 0; i < VOTE_DELAY_BLOCKS && pindex->pprev; i++)
             pindex = pindex->pprev;
@@ -1576,9 +1883,9 @@ public:
 
     int64 GetVotedMinFee(unsigned char cUnit) const
     {
-        std::map<unsigned char, uint32_t>::const_iterator it = mapVotedFee.find(cUnit);
-        if (it != mapVotedFee.end())
-            return (int64)it->second;
+        const uint32_t* pnVotedFee = mapVotedFee.find(cUnit);
+        if (pnVotedFee)
+            return (int64)*pnVotedFee;
         else
             return GetDefaultFee(cUnit);
     }
@@ -1590,17 +1897,24 @@ public:
 
     int64 GetSafeMinFee(unsigned char cUnit) const;
 
-    void GetElectedCustodians(std::map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian) const;
+    // The custodians elected in this block or before, with the block that first
+    // elected them. The map is built once per block with an elected custodian and
+    // shared with the following blocks, so callers should keep the reference
+    // rather than copy it. cs_main must be held.
+    const std::map<CBitcoinAddress, CBlockIndex*>& GetElectedCustodianMap() const;
+
+    void GetElectedCustodians(std::map<CBitcoinAddress, CBlockIndex*>& mapElectedCustodian) const
+    {
+        mapElectedCustodian = GetElectedCustodianMap();
+    }
     std::map<CBitcoinAddress, CBlockIndex*> GetElectedCustodians() const
     {
-        std::map<CBitcoinAddress, CBlockIndex*> mapElectedCustodian;
-        GetElectedCustodians(mapElectedCustodian);
-        return mapElectedCustodian;
+        return GetElectedCustodianMap();
     }
 
     bool GetEffectiveReputation(std::map<CBitcoinAddress, int64>& mapReputation)
     {
-        return CalculateReputationResult(GetEffectiveVoteIndex(), mapReputation);
+        return reputationTally.GetReputation(GetEffectiveVoteIndex(), mapReputation);
     }
 
     CTxDestination GetRewardedSigner() const
@@ -1619,9 +1933,9 @@ public:
         mapEffectiveAssets.clear();
         const CBlockIndex* pEffectiveIndex = GetEffectiveVoteIndex();
 
-        // First copy the assets from the previous blocks
-        BOOST_FOREACH(const PAIRTYPE(const uint32_t, CBlockIndex*)& item, pEffectiveIndex->mapAssetsPrev)
-            item.second->GetBlockVotedAsset(item.first, mapEffectiveAssets[item.first]);
+        // First get the assets from the previous blocks
+        if (pEffectiveIndex->pprev)
+            assetRegistry.GetVotedAssets(pEffectiveIndex->pprev, mapEffectiveAssets);
 
         // Copy any assets that are voted in this block
         BOOST_FOREACH(const PAIRTYPE(const uint32_t, CAsset)& item, pEffectiveIndex->mapAssets)
@@ -1648,15 +1962,8 @@ public:
         if (GetBlockVotedAsset(nAssetId, asset))
             return true;
 
-        // Try to get the asset from a previous block
-        std::map<uint32_t, CBlockIndex*>::const_iterator it = mapAssetsPrev.find(nAssetId);
-        if(it != mapAssetsPrev.end())
-        {
-            CBlockIndex* pPrevBlock = it->second;
-            if (pPrevBlock->GetBlockVotedAsset(nAssetId, asset))
-                return true;
-        }
-        return false;
+        // Try to get the asset from the last previous block that changed it
+        return pprev && assetRegistry.GetVotedAsset(pprev, nAssetId, asset);
     }
 
     /**
@@ -0,0 +1,66 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+using namespace std;
+using namespace boost::interprocess;
+
+
+CMappedFile::CMappedFile()
+{
+    pmapping = NULL;
+    pregion = NULL;
+}
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(const boost::filesystem::path& path)
+{
+    Close();
+
+    try {
+        boost::system::error_code ec;
+        uintmax_t nFileSize = boost::filesystem::file_size(path, ec);
+        if (ec || nFileSize == 0 || nFileSize > (uintmax_t)std::numeric_limits<size_t>::max())
+            return false;
+
+        pmapping = new file_mapping(path.string().c_str(), read_only);
+        pregion = new mapped_region(*pmapping, read_only, 0, (size_t)nFileSize);
+    }
+    catch (interprocess_exception& e) {
+        // Not fatal, the caller reads the file instead
+        if (fDebug)
+            printf("CMappedFile::Open() : unable to map %s: %s\n", path.string().c_str(), e.what());
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    delete pregion;
+    pregion = NULL;
+    delete pmapping;
+    pmapping = NULL;
+}
+
+const char* CMappedFile::begin() const
+{
+    return pregion ? (const char*)pregion->get_address() : NULL;
+}
+
+size_t CMappedFile::size() const
+{
+    return pregion ? pregion->get_size() : 0;
+}
@@ -0,0 +1,43 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <cstddef>
+
+#include <boost/filesystem/path.hpp>
+
+namespace boost { namespace interprocess {
+class file_mapping;
+class mapped_region;
+} }
+
+/** Read only memory mapping of a whole file. The mapping keeps the size the
+ * file had when it was opened: data appended later is only visible to a new
+ * mapping.
+ */
+class CMappedFile
+{
+private:
+    boost::interprocess::file_mapping* pmapping;
+    boost::interprocess::mapped_region* pregion;
+
+    CMappedFile(const CMappedFile&);
+    void operator=(const CMappedFile&);
+
+public:
+    CMappedFile();
+    ~CMappedFile();
+
+    // Returns false if the file is missing, empty or cannot be mapped
+    bool Open(const boost::filesystem::path& path);
+    void Close();
+    bool IsOpen() const { return pregion != NULL; }
+
+    const char* begin() const;
+    const char* end() const { return begin() + size(); }
+    size_t size() const;
+};
+
+#endif
@@ -0,0 +1,335 @@
+// Copyright (c) 2014-2015 The B&C Exchange developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_ORDERSTATISTIC_H
+#define BITCOIN_ORDERSTATISTIC_H
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <stdint.h>
+
+/** Multiset that can return the nth smallest element and the rank of a value
+ * in O(log n). It is a treap where each node holds a distinct value, how many
+ * times it was inserted and the total count of its subtree.
+ */
+template <typename T> class COrderStatisticSet
+{
+private:
+    struct Node
+    {
+        T value;
+        int nCount;
+        int nTotal;
+        uint32_t nPriority;
+        Node* pleft;
+        Node* pright;
+
+        Node(const T& valueIn, int nCountIn, uint32_t nPriorityIn) :
+            value(valueIn), nCount(nCountIn), nTotal(nCountIn), nPriority(nPriorityIn), pleft(NULL), pright(NULL)
+        {
+        }
+    };
+
+    Node* proot;
+    uint32_t nRand;
+
+    static int Total(const Node* p)
+    {
+        return p ? p->nTotal : 0;
+    }
+
+    static void Update(Node* p)
+    {
+        p->nTotal = p->nCount + Total(p->pleft) + Total(p->pright);
+    }
+
+    // The priorities only need to be unpredictable enough to keep the tree balanced
+    uint32_t NextPriority()
+    {
+        nRand ^= nRand << 13;
+        nRand ^= nRand >> 17;
+        nRand ^= nRand << 5;
+        return nRand;
+    }
+
+    static void RotateRight(Node*& p)
+    {
+        Node* q = p->pleft;
+        p->pleft = q->pright;
+        q->pright = p;
+        Update(p);
+        Update(q);
+        p = q;
+    }
+
+    static void RotateLeft(Node*& p)
+    {
+        Node* q = p->pright;
+        p->pright = q->pleft;
+        q->pleft = p;
+        Update(p);
+        Update(q);
+        p = q;
+    }
+
+    void Insert(Node*& p, const T& value, int nCount)
+    {
+        if (p == NULL)
+            p = new Node(value, nCount, NextPriority());
+        else if (value < p->value)
+        {
+            Insert(p->pleft, value, nCount);
+            if (p->pleft->nPriority > p->nPriority)
+            {
+                RotateRight(p);
+                return;
+            }
+        }
+        else if (p->value < value)
+        {
+            Insert(p->pright, value, nCount);
+            if (p->pright->nPriority > p->nPriority)
+            {
+                RotateLeft(p);
+                return;
+            }
+        }
+        else
+            p->nCount += nCount;
+        Update(p);
+    }
+
+    static Node* Merge(Node* pleft, Node* pright)
+    {
+        if (pleft == NULL)
+            return pright;
+        if (pright == NULL)
+            return pleft;
+        if (pleft->nPriority > pright->nPriority)
+        {
+            pleft->pright = Merge(pleft->pright, pright);
+            Update(pleft);
+            return pleft;
+        }
+        else
+        {
+            pright->pleft = Merge(pleft, pright->pleft);
+            Update(pright);
+            return pright;
+        }
+    }
+
+    static bool Erase(Node*& p, const T& value, int nCount)
+    {
+        if (p == NULL)
+            return false;
+
+        bool fErased;
+        if (value < p->value)
+            fErased = Erase(p->pleft, value, nCount);
+        else if (p->value < value)
+            fErased = Erase(p->pright, value, nCount);
+        else
+        {
+            if (p->nCount < nCount)
+                return false;
+            p->nCount -= nCount;
+            if (p->nCount == 0)
+            {
+                Node* pdelete = p;
+                p = Merge(p->pleft, p->pright);
+                delete pdelete;
+                return true;
+            }
+            fErased = true;
+        }
+        if (fErased)
+            Update(p);
+        return fErased;
+    }
+
+    static void Destroy(Node* p)
+    {
+        if (p == NULL)
+            return;
+        Destroy(p->pleft);
+        Destroy(p->pright);
+        delete p;
+    }
+
+    static Node* Clone(const Node* p)
+    {
+        if (p == NULL)
+            return NULL;
+        Node* pclone = new Node(*p);
+        pclone->pleft = Clone(p->pleft);
+        pclone->pright = Clone(p->pright);
+        return pclone;
+    }
+
+public:
+    COrderStatisticSet() : proot(NULL), nRand(2463534242U)
+    {
+    }
+
+    COrderStatisticSet(const COrderStatisticSet& other) : proot(Clone(other.proot)), nRand(other.nRand)
+    {
+    }
+
+    COrderStatisticSet& operator=(const COrderStatisticSet& other)
+    {
+        if (this != &other)
+        {
+            Destroy(proot);
+            proot = Clone(other.proot);
+            nRand = other.nRand;
+        }
+        return *this;
+    }
+
+    ~COrderStatisticSet()
+    {
+        Destroy(proot);
+    }
+
+    void clear()
+    {
+        Destroy(proot);
+        proot = NULL;
+    }
+
+    /** Number of elements, counting duplicates */
+    int size() const
+    {
+        return Total(proot);
+    }
+
+    bool empty() const
+    {
+        return proot == NULL;
+    }
+
+    void insert(const T& value, int nCount = 1)
+    {
+        assert(nCount > 0);
+        Insert(proot, value, nCount);
+    }
+
+    /** Remove nCount occurences of value. Returns false and leaves the set
+     * untouched if it contains less than nCount of them. */
+    bool erase(const T& value, int nCount = 1)
+    {
+        assert(nCount > 0);
+        return Erase(proot, value, nCount);
+    }
+
+    int count(const T& value) const
+    {
+        const Node* p = proot;
+        while (p)
+        {
+            if (value < p->value)
+                p = p->pleft;
+            else if (p->value < value)
+                p = p->pright;
+            else
+                return p->nCount;
+        }
+        return 0;
+    }
+
+    /** Number of elements strictly lower than value */
+    int count_less(const T& value) const
+    {
+        int nResult = 0;
+        const Node* p = proot;
+        while (p)
+        {
+            if (p->value < value)
+            {
+                nResult += Total(p->pleft) + p->nCount;
+                p = p->pright;
+            }
+            else
+                p = p->pleft;
+        }
+        return nResult;
+    }
+
+    /** The nth smallest element (starting from 0) */
+    const T& nth(int n) const
+    {
+        assert(n >= 0 && n < size());
+        const Node* p = proot;
+        while (true)
+        {
+            int nLeft = Total(p->pleft);
+            if (n < nLeft)
+                p = p->pleft;
+            else if (n < nLeft + p->nCount)
+                return p->value;
+            else
+            {
+                n -= nLeft + p->nCount;
+                p = p->pright;
+            }
+        }
+    }
+};
+
+/** The last values pushed, at most nMaxSize of them, with the order statistic
+ * queries of COrderStatisticSet. Used to calculate sliding medians.
+ */
+template <typename T> class COrderStatisticWindow
+{
+private:
+    std::deque<T> values;
+    COrderStatisticSet<T> sorted;
+    unsigned int nMaxSize;
+
+public:
+    COrderStatisticWindow(unsigned int nMaxSizeIn) : nMaxSize(nMaxSizeIn)
+    {
+    }
+
+    void clear()
+    {
+        values.clear();
+        sorted.clear();
+    }
+
+    int size() const
+    {
+        return values.size();
+    }
+
+    /** Add a value and drop the oldest one if the window is full */
+    void push(const T& value)
+    {
+        values.push_back(value);
+        sorted.insert(value);
+        if (values.size() > nMaxSize)
+        {
+            sorted.erase(values.front());
+            values.pop_front();
+        }
+    }
+
+    const T& nth(int n) const
+    {
+        return sorted.nth(n);
+    }
+
+    int count(const T& value) const
+    {
+        return sorted.count(value);
+    }
+
+    int count_less(const T& value) const
+    {
+        return sorted.count_less(value);
+    }
+};
+
+#endif
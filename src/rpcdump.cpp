@@ -80,7 +80,10 @@ Value importprivkey(const Array& params, bool fHelp)
         if (!pwalletMain->AddKey(key))
             throw JSONRPCError(-4,"Error adding key to wallet");
 
-        pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+        bool fScanned;
+        pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true, false, &fScanned);
+        if (!fScanned)
+            throw JSONRPCError(-4, "Rescan failed, some blocks could not be read");
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -286,7 +289,10 @@ Value importnusharewallet(const Array& params, bool fHelp)
     if (fRescan)
     {
         if (fDebug) printf("Scanning for available BKS...\n");
-        pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+        bool fScanned;
+        pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true, false, &fScanned);
+        if (!fScanned)
+            throw JSONRPCError(-4, "Rescan failed, some blocks could not be read");
         pwalletMain->ReacceptWalletTransactions();
     }
 
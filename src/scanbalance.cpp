@@ -8,6 +8,8 @@
 #include "init.h"
 #include "util.h"
 #include "scanbalance.h"
+#include "coins.h"
+#include "chainscan.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -21,58 +23,205 @@
 using namespace std;
 using namespace boost;
 
-static void ScanTransactionInputs(CTxDB& txdb, const CTransaction& tx, BalanceMap& mapBalance)
+bool fBalanceIndex = false;
+
+
+CBalanceKey::CBalanceKey(const CBitcoinAddress& address)
 {
-    if (tx.IsCoinBase() || tx.IsCustodianGrant()) return;
+    cType = 0;
+    hash = 0;
+    CTxDestination dest = address.Get();
+    if (const CKeyID* pkeyID = boost::get<CKeyID>(&dest))
+    {
+        cType = 1;
+        hash = *pkeyID;
+    }
+    else if (const CScriptID* pscriptID = boost::get<CScriptID>(&dest))
+    {
+        cType = 2;
+        hash = *pscriptID;
+    }
+}
 
-    BOOST_FOREACH(const CTxIn& txi, tx.vin)
+CBitcoinAddress CBalanceKey::GetAddress() const
+{
+    switch (cType)
     {
-        CTransaction ti;
-        if (!txdb.ReadDiskTx(txi.prevout, ti))
-        {
-            string s = strprintf("Failed to load transaction %s", txi.ToStringShort().c_str());
-            throw runtime_error(s);
-        }
-        if (txi.prevout.n >= ti.vout.size())
+        case 1:
+            return CBitcoinAddress(CKeyID(hash), '8');
+        case 2:
+            return CBitcoinAddress(CScriptID(hash), '8');
+        default:
+            return CBitcoinAddress();
+    }
+}
+
+void CBalanceSnapshot::SetBalanceMap(const BalanceMap& mapBalance)
+{
+    vBalance.clear();
+    vBalance.reserve(mapBalance.size());
+    for (BalanceMap::const_iterator it = mapBalance.begin(); it != mapBalance.end(); ++it)
+        vBalance.push_back(make_pair(CBalanceKey(it->first), it->second));
+}
+
+void CBalanceSnapshot::GetBalanceMap(BalanceMap& mapBalance) const
+{
+    mapBalance.clear();
+    for (vector<pair<CBalanceKey, int64> >::const_iterator it = vBalance.begin(); it != vBalance.end(); ++it)
+        mapBalance[it->first.GetAddress()] = it->second;
+}
+
+
+void GetBlockBalanceChanges(const CBlock& block, const CBlockUndo& blockundo, BalanceMap& mapDelta)
+{
+    for (unsigned int nTx = 0; nTx < block.vtx.size(); nTx++)
+    {
+        const CTransaction& tx = block.vtx[nTx];
+
+        if (!tx.IsCoinBase() && !tx.IsCustodianGrant() && nTx < blockundo.vtxundo.size())
         {
-            string s = strprintf("Invalid index in transaction %s", txi.ToStringShort().c_str());
-            throw runtime_error(s);
+            BOOST_FOREACH(const CTxInUndo& undo, blockundo.vtxundo[nTx].vprevout)
+            {
+                const CTxOut& prevOut = undo.txout;
+                if (prevOut.nValue > 0)
+                {
+                    CTxDestination dest;
+                    ExtractDestination(prevOut.scriptPubKey, dest);
+                    mapDelta[CBitcoinAddress(dest, '8')] -= prevOut.nValue;
+                }
+            }
         }
 
-        CTxOut prevOut = ti.vout[txi.prevout.n];
-        CTxDestination dest;
-        ExtractDestination(prevOut.scriptPubKey, dest);
-        CBitcoinAddress addr(dest, '8');
-        if (prevOut.nValue > 0)
+        BOOST_FOREACH(const CTxOut& txo, tx.vout)
         {
-            if (mapBalance.count(addr) == 0) {
-                string s = strprintf("Missing input address: %s", txi.ToStringShort().c_str());
-                throw runtime_error(s);
+            if (txo.nValue > 0 && !txo.scriptPubKey.empty())
+            {
+                CTxDestination dest;
+                ExtractDestination(txo.scriptPubKey, dest);
+                mapDelta[CBitcoinAddress(dest, '8')] += txo.nValue;
             }
-            if (prevOut.nValue > mapBalance[addr]) {
-                string s = strprintf("Input address would have negative balance: %s", txi.ToStringShort().c_str());
-                throw runtime_error(s);
-            }
-            mapBalance[addr] -= prevOut.nValue;
-            if (mapBalance[addr] == 0) mapBalance.erase(addr);
         }
     }
 }
 
-static void ScanTransactionOutputs(const CTransaction& tx, BalanceMap& mapBalance)
+bool UpdateBalanceIndex(CTxDB& txdb, const CBlock& block, const CBlockUndo& blockundo, bool fConnect)
+{
+    BalanceMap mapDelta;
+    GetBlockBalanceChanges(block, blockundo, mapDelta);
+    for (BalanceMap::const_iterator it = mapDelta.begin(); it != mapDelta.end(); ++it)
+    {
+        if (it->second == 0)
+            continue;
+        CBalanceKey key(it->first);
+        int64 nBalance;
+        txdb.ReadShareBalance(key, nBalance);
+        nBalance += fConnect ? it->second : -it->second;
+        bool fOk = (nBalance == 0) ? txdb.EraseShareBalance(key) : txdb.WriteShareBalance(key, nBalance);
+        if (!fOk)
+            return error("UpdateBalanceIndex() : failed to write the balance of %s", it->first.ToString().c_str());
+    }
+    return true;
+}
+
+bool SnapshotBalanceIndex(CTxDB& txdb, const CBlockIndex* pindex)
 {
-    BOOST_FOREACH(const CTxOut& txo, tx.vout)
+    int64 nStart = GetTimeMillis();
+    CBalanceSnapshot snapshot;
+    snapshot.hashBlock = pindex->GetBlockHash();
+    if (!txdb.ReadShareBalances(snapshot.vBalance))
+        return error("SnapshotBalanceIndex() : failed to read the share balances");
+    if (!txdb.WriteBalanceSnapshot(pindex->nHeight, snapshot))
+        return error("SnapshotBalanceIndex() : failed to write the snapshot");
+    printf("SnapshotBalanceIndex() : %u share balances at height %d in %"PRI64d"ms\n", (unsigned int)snapshot.vBalance.size(), pindex->nHeight, GetTimeMillis() - nStart);
+    return true;
+}
+
+// Apply the changes of a block to the balances of the previous block
+static void ApplyBalanceChanges(const BalanceMap& mapDelta, BalanceMap& mapBalance)
+{
+    for (BalanceMap::const_iterator it = mapDelta.begin(); it != mapDelta.end(); ++it)
     {
-        if (txo.nValue > 0 && !txo.scriptPubKey.empty())
+        if (it->second == 0)
+            continue;
+        BalanceMap::iterator mi = mapBalance.find(it->first);
+        int64 nBalance = (mi == mapBalance.end() ? 0 : mi->second) + it->second;
+        if (nBalance < 0)
         {
-            CTxDestination dest;
-            ExtractDestination(txo.scriptPubKey, dest);
-            CBitcoinAddress addr(dest, '8');
-            mapBalance[addr] += txo.nValue;
+            string s = strprintf("Address would have negative balance: %s", it->first.ToString().c_str());
+            throw runtime_error(s);
         }
+        if (nBalance == 0)
+            mapBalance.erase(it->first);
+        else
+            mapBalance[it->first] = nBalance;
     }
 }
 
+class CBalanceScanFacts : public CBlockScanFacts
+{
+public:
+    BalanceMap mapDelta;
+};
+
+// Replays the balance changes of the blocks. The outputs spent by the blocks
+// come from their undo data, or from the previous transactions for the blocks
+// deeper than MIN_BLOCKS_TO_KEEP.
+class CBalanceScanJob : public CChainScanJob
+{
+public:
+    BalanceMap& mapBalance;
+
+    CBalanceScanJob(BalanceMap& mapBalanceIn) : mapBalance(mapBalanceIn)
+    {
+    }
+
+    CBlockScanFacts* Extract(CTxDB& txdb, CBlock& block, const CBlockIndex* pindex)
+    {
+        CBlockUndo blockundo;
+        if (!GetBlockSpentOutputs(txdb, block, blockundo))
+        {
+            error("CBalanceScanJob::Extract() : spent outputs of block %d not found", pindex->nHeight);
+            return NULL;
+        }
+        CBalanceScanFacts* pfacts = new CBalanceScanFacts();
+        GetBlockBalanceChanges(block, blockundo, pfacts->mapDelta);
+        return pfacts;
+    }
+
+    bool Apply(CBlockScanFacts* pfacts, const CBlockIndex* pindex)
+    {
+        ApplyBalanceChanges(((CBalanceScanFacts*)pfacts)->mapDelta, mapBalance);
+        return true;
+    }
+};
+
+// Writes a snapshot of the balances every BALANCE_SNAPSHOT_INTERVAL blocks
+class CBalanceIndexScanJob : public CBalanceScanJob
+{
+public:
+    CTxDB& txdb;
+
+    CBalanceIndexScanJob(CTxDB& txdbIn, BalanceMap& mapBalanceIn) : CBalanceScanJob(mapBalanceIn), txdb(txdbIn)
+    {
+    }
+
+    bool Apply(CBlockScanFacts* pfacts, const CBlockIndex* pindex)
+    {
+        CBalanceScanJob::Apply(pfacts, pindex);
+
+        if (pindex->nHeight > 0 && pindex->nHeight % BALANCE_SNAPSHOT_INTERVAL == 0)
+        {
+            CBalanceSnapshot snapshot;
+            snapshot.hashBlock = pindex->GetBlockHash();
+            snapshot.SetBalanceMap(mapBalance);
+            if (!txdb.WriteBalanceSnapshot(pindex->nHeight, snapshot))
+                return error("BuildBalanceIndex() : failed to write the snapshot");
+            printf("BuildBalanceIndex() : %u share balances at height %d\n", (unsigned int)mapBalance.size(), pindex->nHeight);
+        }
+        return !fRequestShutdown;
+    }
+};
+
 void GetAddressBalances(unsigned int cutoffTime, BalanceMap& mapBalance)
 {
     CBlockIndex* pblk0 = pindexGenesisBlock, *pblk1 = pindexBest;
@@ -81,23 +230,67 @@ void GetAddressBalances(unsigned int cutoffTime, BalanceMap& mapBalance)
 
     if (cutoffTime>pblk1->nTime)
         throw runtime_error("Cutoff date later than most recent block.");
+    if (nPruneTarget > 0)
+        throw runtime_error("The share balances cannot be replayed with -prune, the old block files are deleted.");
+
+    // The balances are those of the blocks before the first block at or after
+    // the cutoff time, the best block excluded
+    CBlockIndex* pblkStop = pblk0;
+    while (pblkStop != pblk1 && pblkStop->nTime < cutoffTime)
+        pblkStop = pblkStop->pnext;
 
     CTxDB txdb("r");
-    int nBlks = 0;
-    while (pblk0 != pblk1)
+
+    // Start from the last snapshot of the share balances before the stop block
+    if (fBalanceIndex)
     {
-        if (pblk0->nTime >= cutoffTime) break;
+        for (int nHeight = (pblkStop->nHeight - 1) / BALANCE_SNAPSHOT_INTERVAL * BALANCE_SNAPSHOT_INTERVAL; nHeight > 0; nHeight -= BALANCE_SNAPSHOT_INTERVAL)
+        {
+            CBalanceSnapshot snapshot;
+            if (!txdb.ReadBalanceSnapshot(nHeight, snapshot))
+                continue;
+            CBlockIndex* pindexSnapshot = pblkStop->GetAncestor(nHeight);
+            if (!pindexSnapshot || pindexSnapshot->GetBlockHash() != snapshot.hashBlock)
+                continue;
+            snapshot.GetBalanceMap(mapBalance);
+            pblk0 = pindexSnapshot->pnext;
+            break;
+        }
+    }
+    printf("GetAddressBalances() : replaying blocks %d to %d\n", pblk0->nHeight, pblkStop->nHeight - 1);
 
-        CBlock block;
-        block.ReadFromDisk(pblk0, true);
+    CBalanceScanJob job(mapBalance);
+    if (!ScanChain("GetAddressBalances()", pblk0, pblkStop, job))
+        throw runtime_error("Failed to replay the blocks");
+}
 
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+bool BuildBalanceIndex(CTxDB& txdb)
+{
+    printf("BuildBalanceIndex() : building the share balances of blocks 0 to %d\n", nBestHeight);
+    int64 nStart = GetTimeMillis();
+    BalanceMap mapBalance;
+    try {
+        CBalanceIndexScanJob job(txdb, mapBalance);
+        if (!ScanChain("BuildBalanceIndex()", pindexGenesisBlock, NULL, job))
+            return false;
+    }
+    catch (std::exception& e) {
+        return error("BuildBalanceIndex() : %s", e.what());
+    }
+
+    // Balances after the best block
+    if (!txdb.TxnBegin())
+        return error("BuildBalanceIndex() : TxnBegin failed");
+    for (BalanceMap::const_iterator it = mapBalance.begin(); it != mapBalance.end(); ++it)
+    {
+        if (!txdb.WriteShareBalance(CBalanceKey(it->first), it->second))
         {
-            ScanTransactionInputs(txdb, tx, mapBalance);
-            ScanTransactionOutputs(tx, mapBalance);
+            txdb.TxnAbort();
+            return error("BuildBalanceIndex() : failed to write the balance of %s", it->first.ToString().c_str());
         }
-
-        pblk0 = pblk0->pnext;
-        nBlks++;
     }
+    if (!txdb.TxnCommit())
+        return error("BuildBalanceIndex() : TxnCommit failed");
+    printf("BuildBalanceIndex() : %u share balances built in %"PRI64d"ms\n", (unsigned int)mapBalance.size(), GetTimeMillis() - nStart);
+    return true;
 }
@@ -6,7 +6,85 @@
 #define SCANBALANCE_H
 
 #include "distribution.h"
+#include "serialize.h"
 
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CTxDB;
+
+extern bool fBalanceIndex;
+
+#ifdef TESTING
+static const int BALANCE_SNAPSHOT_INTERVAL = 10;
+#else
+static const int BALANCE_SNAPSHOT_INTERVAL = 10000; // Number of blocks between two snapshots of the share balances
+#endif
+
+/** Address of a share balance as stored in the database. Outputs without
+ * destination are counted under an empty address, as GetAddressBalances
+ * always did. */
+class CBalanceKey
+{
+public:
+    // 0: no destination, 1: key hash, 2: script hash
+    unsigned char cType;
+    uint160 hash;
+
+    CBalanceKey()
+    {
+        cType = 0;
+        hash = 0;
+    }
+
+    explicit CBalanceKey(const CBitcoinAddress& address);
+    CBitcoinAddress GetAddress() const;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(cType);
+        READWRITE(hash);
+    )
+
+    friend bool operator<(const CBalanceKey& a, const CBalanceKey& b)
+    {
+        return a.cType < b.cType || (a.cType == b.cType && a.hash < b.hash);
+    }
+};
+
+/** Share balances after the main chain block hashBlock */
+class CBalanceSnapshot
+{
+public:
+    uint256 hashBlock;
+    std::vector<std::pair<CBalanceKey, int64> > vBalance;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(hashBlock);
+        READWRITE(vBalance);
+    )
+
+    void SetBalanceMap(const BalanceMap& mapBalance);
+    void GetBalanceMap(BalanceMap& mapBalance) const;
+};
+
+/** Change of the share balances made by a block. blockundo holds the outputs spent by the block. */
+void GetBlockBalanceChanges(const CBlock& block, const CBlockUndo& blockundo, BalanceMap& mapDelta);
+
+/** Apply the changes of a block to the share balances of a block connected or disconnected */
+bool UpdateBalanceIndex(CTxDB& txdb, const CBlock& block, const CBlockUndo& blockundo, bool fConnect);
+
+/** Build the share balances and their snapshots from the main chain */
+bool BuildBalanceIndex(CTxDB& txdb);
+
+/** Keep a snapshot of the share balances after the best block pindex */
+bool SnapshotBalanceIndex(CTxDB& txdb, const CBlockIndex* pindex);
+
+/** Share balances of the main chain blocks before cutoffTime. Starts from the
+ * last snapshot before the cutoff when the balance index is kept. */
 void GetAddressBalances(unsigned int cutoffTime, BalanceMap& mapBalance);
 
 #endif
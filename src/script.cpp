@@ -5,7 +5,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <openssl/sha.h>
 
 using namespace std;
 using namespace boost;
@@ -17,7 +17,8 @@ using namespace boost;
 #include "main.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              const CSignatureHashContext* psighashctx=NULL);
 
 
 
@@ -241,7 +242,8 @@ const char* GetOpName(opcodetype opcode)
     }
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighashctx)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -927,7 +929,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // Drop the signature, since there's no way for a signature to sign itself
                     scriptCode.FindAndDelete(CScript(vchSig));
 
-                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighashctx);
 
                     popstack(stack);
                     popstack(stack);
@@ -987,7 +989,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         valtype& vchPubKey = stacktop(-ikey);
 
                         // Check signature
-                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType))
+                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighashctx))
                         {
                             isig++;
                             nSigsCount--;
@@ -1106,66 +1108,169 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return Hash(ss.begin(), ss.end());
 }
 
+CSignatureHashContext::CSignatureHashContext(const CTransaction& txToIn) : ptxTo(&txToIn)
+{
+    const CTransaction& txTo = *ptxTo;
+
+    // Same serialization as SignatureHash
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
+
+    CSHA256 ctx;
+    ctx.Write((unsigned char*)&ss[0], ss.size());
+    ss.clear();
+
+    vMidstate.reserve(txTo.vin.size());
+    vInputPos.reserve(txTo.vin.size() + 1);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vMidstate.push_back(ctx);
+        vInputPos.push_back(vchInputs.size());
+
+        const CTxIn& txin = txTo.vin[i];
+        ss << txin.prevout << CScript() << txin.nSequence;
+        ctx.Write((unsigned char*)&ss[0], ss.size());
+        vchInputs.insert(vchInputs.end(), ss.begin(), ss.end());
+        ss.clear();
+    }
+    vInputPos.push_back(vchInputs.size());
+
+    ss << txTo.vout << txTo.nLockTime << txTo.cUnit;
+    vchTail.assign(ss.begin(), ss.end());
+}
+
+uint256 CSignatureHashContext::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    const CTransaction& txTo = *ptxTo;
+    if (nIn >= txTo.vin.size() || (nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE || (nHashType & SIGHASH_ANYONECANPAY))
+        return ::SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    // The input signed, with the script code as scriptSig
+    const CTxIn& txin = txTo.vin[nIn];
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txin.prevout << scriptCode << txin.nSequence;
+
+    CSHA256 ctx = vMidstate[nIn];
+    ctx.Write((unsigned char*)&ss[0], ss.size());
+    if (vInputPos[nIn + 1] < vchInputs.size())
+        ctx.Write(&vchInputs[vInputPos[nIn + 1]], vchInputs.size() - vInputPos[nIn + 1]);
+    ctx.Write(&vchTail[0], vchTail.size());
+    ctx.Write((unsigned char*)&nHashType, sizeof(nHashType));
+
+    // Double SHA-256, as Hash
+    uint256 hash1;
+    ctx.Finalize((unsigned char*)&hash1);
+    uint256 hash2;
+    CSHA256().Write((unsigned char*)&hash1, sizeof(hash1)).Finalize((unsigned char*)&hash2);
+    return hash2;
+}
+
 
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
+//
+// Only a salted digest of (signature hash, signature, public key) is kept,
+// in a fixed size table of buckets of SIGCACHE_WAYS digests. The buckets are
+// protected by SIGCACHE_STRIPES locks so that the script check threads do
+// not wait for each other.
+
+static const unsigned int SIGCACHE_WAYS = 4;
+static const unsigned int SIGCACHE_STRIPES = 64;
 
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, std::vector<unsigned char> > sigdata_type;
-    std::set< sigdata_type> setValid;
-    CCriticalSection cs_sigcache;
+    // Random salt so that the digests, and thus the buckets, cannot be predicted
+    uint256 salt;
+    // nBuckets * SIGCACHE_WAYS digests, 0 for an empty entry
+    std::vector<uint256> vDigest;
+    unsigned int nBuckets;
+    CCriticalSection cs_sigcache[SIGCACHE_STRIPES];
+
+    uint256 GetDigest(const uint256& hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey) const
+    {
+        uint256 digest;
+        unsigned int nSigSize = vchSig.size();
+        CSHA256 ctx;
+        ctx.Write((unsigned char*)BEGIN(salt), sizeof(salt));
+        ctx.Write((unsigned char*)BEGIN(hash), sizeof(hash));
+        ctx.Write((unsigned char*)&nSigSize, sizeof(nSigSize));
+        if (!vchSig.empty())
+            ctx.Write(&vchSig[0], vchSig.size());
+        if (!pubKey.empty())
+            ctx.Write(&pubKey[0], pubKey.size());
+        ctx.Finalize(digest.begin());
+        return digest;
+    }
 
 public:
+    CSignatureCache()
+    {
+        salt = GetRandHash();
+
+        // DoS prevention: the cache is limited to -maxsigcachesize megabytes.
+        // There are a maximum of 20,000 signature operations per block, the
+        // default holds about 50 times as many signatures. Out of range values
+        // are refused at startup.
+        int64 nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIGCACHE_SIZE);
+        if (nMaxCacheSize < 0)
+            nMaxCacheSize = 0;
+        if (nMaxCacheSize > MAX_MAX_SIGCACHE_SIZE)
+            nMaxCacheSize = MAX_MAX_SIGCACHE_SIZE;
+        nBuckets = nMaxCacheSize * 1024 * 1024 / (sizeof(uint256) * SIGCACHE_WAYS);
+        vDigest.resize(nBuckets * SIGCACHE_WAYS);
+    }
+
     bool
     Get(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
     {
-        LOCK(cs_sigcache);
+        if (nBuckets == 0)
+            return false;
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+        uint256 digest = GetDigest(hash, vchSig, pubKey);
+        unsigned int nFirst = (digest.Get64(0) % nBuckets) * SIGCACHE_WAYS;
+        LOCK(cs_sigcache[nFirst / SIGCACHE_WAYS % SIGCACHE_STRIPES]);
+        for (unsigned int i = nFirst; i < nFirst + SIGCACHE_WAYS; i++)
+            if (vDigest[i] == digest)
+                return true;
         return false;
     }
 
     void
     Set(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        LOCK(cs_sigcache);
-
-        while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
+        if (nBuckets == 0)
+            return;
+
+        uint256 digest = GetDigest(hash, vchSig, pubKey);
+        unsigned int nFirst = (digest.Get64(0) % nBuckets) * SIGCACHE_WAYS;
+        LOCK(cs_sigcache[nFirst / SIGCACHE_WAYS % SIGCACHE_STRIPES]);
+
+        // Take an empty entry of the bucket, or evict one. The entry evicted
+        // depends on the salted digest, which helps foil would-be DoS
+        // attackers who might try to pre-generate and re-use a set of valid
+        // signatures just-slightly-greater than our cache size.
+        unsigned int nEntry = nFirst + digest.Get64(1) % SIGCACHE_WAYS;
+        for (unsigned int i = nFirst; i < nFirst + SIGCACHE_WAYS; i++)
         {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            if (vDigest[i] == digest)
+                return;
+            if (vDigest[i] == 0)
+            {
+                nEntry = i;
+                break;
+            }
         }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        vDigest[nEntry] = digest;
     }
 };
 
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* psighashctx)
 {
     static CSignatureCache signatureCache;
 
@@ -1178,7 +1283,11 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash;
+    if (psighashctx && psighashctx->IsFor(txTo))
+        sighash = psighashctx->SignatureHash(scriptCode, nIn, nHashType);
+    else
+        sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
@@ -1660,13 +1769,19 @@ bool IsUnpark(const CScript& scriptSig)
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType)
+{
+    return VerifyScript(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, NULL);
+}
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                  bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* psighashctx)
 {
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType, psighashctx))
         return false;
     if (fValidatePayToScriptHash)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, psighashctx))
         return false;
     if (stack.empty())
         return false;
@@ -1684,7 +1799,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType, psighashctx))
             return false;
         if (stackCopy.empty())
             return false;
@@ -13,6 +13,8 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include "sha256.h"
+
 #include "keystore.h"
 #include "bignum.h"
 
@@ -29,6 +31,10 @@ enum
     SIGHASH_ANYONECANPAY = 0x80,
 };
 
+/** Default and largest size of the signature cache in megabytes (-maxsigcachesize) */
+static const int64 DEFAULT_MAX_SIGCACHE_SIZE = 32;
+static const int64 MAX_MAX_SIGCACHE_SIZE = 1024;
+
 
 enum txnouttype
 {
@@ -592,8 +598,44 @@ public:
 
 
 
+/** Parts of the signature hashes of a transaction shared by its inputs.
+ * SignatureHash serializes a copy of the transaction for each input, which
+ * is quadratic in the number of inputs. The context serializes once the
+ * inputs with a blank scriptSig and the outputs, and keeps the SHA-256
+ * state after the blank inputs before each input, so that only the input
+ * signed and the following ones are hashed. The hashes are the same as
+ * those of SignatureHash. Only SIGHASH_ALL hashes use the context, the
+ * others are computed by SignatureHash.
+ * The transaction must outlive the context and not change.
+ */
+class CSignatureHashContext
+{
+private:
+    const CTransaction* ptxTo;
+    // State after the transaction header and the blank inputs before input i
+    std::vector<CSHA256> vMidstate;
+    // Serialized inputs, with a blank scriptSig
+    std::vector<unsigned char> vchInputs;
+    std::vector<unsigned int> vInputPos;
+    // Serialized outputs, lock time and unit
+    std::vector<unsigned char> vchTail;
+
+public:
+    CSignatureHashContext(const CTransaction& txToIn);
+
+    bool IsFor(const CTransaction& txTo) const
+    {
+        return ptxTo == &txTo;
+    }
+
+    // Same as SignatureHash(scriptCode, txTo, nIn, nHashType)
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighashctx=NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -606,6 +648,8 @@ bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransa
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType,
+                  const CSignatureHashContext* psighashctx);
 CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
 bool IsPark(const CScript& scriptPubKey);
 bool ExtractPark(const CScript& scriptPubKey, int64& nDurationRet, CTxDestination& unparkAddressRet);
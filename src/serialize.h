@@ -30,6 +30,7 @@ typedef unsigned long long  uint64;
 class CScript;
 class CDataStream;
 class CAutoFile;
+class CBufferReader;
 static const unsigned int MAX_SIZE = 0x02000000;
 
 // Used to bypass the rule against non-const reference to temporary
@@ -1178,4 +1179,83 @@ public:
     }
 };
 
+
+/** Read only stream over a range of memory the caller keeps alive, such as
+ * a memory mapped file. Objects are unserialized directly from the range
+ * without copying it first.
+ */
+class CBufferReader
+{
+protected:
+    const char* pbegin;
+    const char* pend;
+    const char* pread;
+    bool fEof;
+public:
+    int nType;
+    int nVersion;
+
+    CBufferReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn)
+    {
+        pbegin = pbeginIn;
+        pend = pendIn;
+        pread = pbeginIn;
+        fEof = false;
+        nType = nTypeIn;
+        nVersion = nVersionIn;
+    }
+
+    //
+    // Stream subset
+    //
+    // Whether a read went past the end of the range
+    bool eof() const             { return fEof; }
+    size_t size() const          { return pend - pread; }
+    bool empty() const           { return pread == pend; }
+    size_t GetReadPos() const    { return pread - pbegin; }
+
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return nVersion; }
+
+    CBufferReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pread))
+        {
+            fEof = true;
+            throw std::ios_base::failure("CBufferReader::read : end of data");
+        }
+        memcpy(pch, pread, nSize);
+        pread += nSize;
+        return (*this);
+    }
+
+    CBufferReader& ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pread))
+        {
+            fEof = true;
+            throw std::ios_base::failure("CBufferReader::ignore : end of data");
+        }
+        pread += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    unsigned int GetSerializeSize(const T& obj)
+    {
+        // Tells the size of the object if serialized to this stream
+        return ::GetSerializeSize(obj, nType, nVersion);
+    }
+
+    template<typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif
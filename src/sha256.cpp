@@ -0,0 +1,517 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256.h"
+
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static const uint32_t pSHA256InitState[8] =
+{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static const uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+//
+// Reference transform: OpenSSL's, which has its own assembly for most CPUs
+//
+static void TransformOpenSSL(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    for (int i = 0; i < 8; i++)
+        ctx.h[i] = s[i];
+    while (nBlocks--)
+    {
+        SHA256_Transform(&ctx, chunk);
+        chunk += 64;
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = ctx.h[i];
+}
+
+static void TransformLanesOpenSSL(uint32_t* s, const unsigned char* blocks, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+        TransformOpenSSL(s + 8 * i, blocks + 64 * i, 1);
+}
+
+
+#ifdef USE_SHA256_X86
+//
+// Lanes: the same rounds on N independent blocks, one per 32 bit element of
+// a vector. Written with GCC vector extensions and inlined into functions
+// compiled for the instruction set of their vector width.
+//
+typedef uint32_t uint32x4 __attribute__((vector_size(16)));
+typedef uint32_t uint32x8 __attribute__((vector_size(32)));
+
+#define LANES_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Build a vector from the word at the same offset of each lane
+static inline __attribute__((always_inline)) void LanesRead(uint32x4& v, const unsigned char* p)
+{
+    uint32x4 r = {ReadBE32(p), ReadBE32(p + 64), ReadBE32(p + 128), ReadBE32(p + 192)};
+    v = r;
+}
+
+static inline __attribute__((always_inline)) void LanesRead(uint32x8& v, const unsigned char* p)
+{
+    uint32x8 r = {ReadBE32(p), ReadBE32(p + 64), ReadBE32(p + 128), ReadBE32(p + 192),
+                  ReadBE32(p + 256), ReadBE32(p + 320), ReadBE32(p + 384), ReadBE32(p + 448)};
+    v = r;
+}
+
+static inline __attribute__((always_inline)) void LanesGather(uint32x4& v, const uint32_t* p)
+{
+    uint32x4 r = {p[0], p[8], p[16], p[24]};
+    v = r;
+}
+
+static inline __attribute__((always_inline)) void LanesGather(uint32x8& v, const uint32_t* p)
+{
+    uint32x8 r = {p[0], p[8], p[16], p[24], p[32], p[40], p[48], p[56]};
+    v = r;
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) void LanesRound(const V& a, const V& b, const V& c, V& d, const V& e, const V& f, const V& g, V& h, uint32_t k, const V& w)
+{
+    V t1 = h + (LANES_ROTR(e, 6) ^ LANES_ROTR(e, 11) ^ LANES_ROTR(e, 25)) + (g ^ (e & (f ^ g))) + k + w;
+    V t2 = (LANES_ROTR(a, 2) ^ LANES_ROTR(a, 13) ^ LANES_ROTR(a, 22)) + ((a & b) | (c & (a | b)));
+    d += t1;
+    h = t1 + t2;
+}
+
+// Extend the message in place: w0 becomes the word 16 positions later
+template <typename V>
+static inline __attribute__((always_inline)) V& LanesExtend(V& w0, const V& w1, const V& w9, const V& w14)
+{
+    w0 += (LANES_ROTR(w14, 17) ^ LANES_ROTR(w14, 19) ^ (w14 >> 10)) + w9 +
+          (LANES_ROTR(w1, 7) ^ LANES_ROTR(w1, 18) ^ (w1 >> 3));
+    return w0;
+}
+
+template <typename V, unsigned int N>
+static inline __attribute__((always_inline)) void TransformLanesT(uint32_t* s, const unsigned char* blocks)
+{
+    uint32_t tmp[N];
+    V w[16];
+    V state[8];
+    for (int i = 0; i < 16; i++)
+        LanesRead(w[i], blocks + 4 * i);
+    for (int i = 0; i < 8; i++)
+        LanesGather(state[i], s + i);
+
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+    V e = state[4], f = state[5], g = state[6], h = state[7];
+    LanesRound(a, b, c, d, e, f, g, h, K[0], w[0]);
+    LanesRound(h, a, b, c, d, e, f, g, K[1], w[1]);
+    LanesRound(g, h, a, b, c, d, e, f, K[2], w[2]);
+    LanesRound(f, g, h, a, b, c, d, e, K[3], w[3]);
+    LanesRound(e, f, g, h, a, b, c, d, K[4], w[4]);
+    LanesRound(d, e, f, g, h, a, b, c, K[5], w[5]);
+    LanesRound(c, d, e, f, g, h, a, b, K[6], w[6]);
+    LanesRound(b, c, d, e, f, g, h, a, K[7], w[7]);
+    LanesRound(a, b, c, d, e, f, g, h, K[8], w[8]);
+    LanesRound(h, a, b, c, d, e, f, g, K[9], w[9]);
+    LanesRound(g, h, a, b, c, d, e, f, K[10], w[10]);
+    LanesRound(f, g, h, a, b, c, d, e, K[11], w[11]);
+    LanesRound(e, f, g, h, a, b, c, d, K[12], w[12]);
+    LanesRound(d, e, f, g, h, a, b, c, K[13], w[13]);
+    LanesRound(c, d, e, f, g, h, a, b, K[14], w[14]);
+    LanesRound(b, c, d, e, f, g, h, a, K[15], w[15]);
+    // Sixteen rounds per iteration so that the variables and words rotate back in place
+    for (int i = 16; i < 64; i += 16)
+    {
+        LanesRound(a, b, c, d, e, f, g, h, K[i + 0], LanesExtend(w[0], w[1], w[9], w[14]));
+        LanesRound(h, a, b, c, d, e, f, g, K[i + 1], LanesExtend(w[1], w[2], w[10], w[15]));
+        LanesRound(g, h, a, b, c, d, e, f, K[i + 2], LanesExtend(w[2], w[3], w[11], w[0]));
+        LanesRound(f, g, h, a, b, c, d, e, K[i + 3], LanesExtend(w[3], w[4], w[12], w[1]));
+        LanesRound(e, f, g, h, a, b, c, d, K[i + 4], LanesExtend(w[4], w[5], w[13], w[2]));
+        LanesRound(d, e, f, g, h, a, b, c, K[i + 5], LanesExtend(w[5], w[6], w[14], w[3]));
+        LanesRound(c, d, e, f, g, h, a, b, K[i + 6], LanesExtend(w[6], w[7], w[15], w[4]));
+        LanesRound(b, c, d, e, f, g, h, a, K[i + 7], LanesExtend(w[7], w[8], w[0], w[5]));
+        LanesRound(a, b, c, d, e, f, g, h, K[i + 8], LanesExtend(w[8], w[9], w[1], w[6]));
+        LanesRound(h, a, b, c, d, e, f, g, K[i + 9], LanesExtend(w[9], w[10], w[2], w[7]));
+        LanesRound(g, h, a, b, c, d, e, f, K[i + 10], LanesExtend(w[10], w[11], w[3], w[8]));
+        LanesRound(f, g, h, a, b, c, d, e, K[i + 11], LanesExtend(w[11], w[12], w[4], w[9]));
+        LanesRound(e, f, g, h, a, b, c, d, K[i + 12], LanesExtend(w[12], w[13], w[5], w[10]));
+        LanesRound(d, e, f, g, h, a, b, c, K[i + 13], LanesExtend(w[13], w[14], w[6], w[11]));
+        LanesRound(c, d, e, f, g, h, a, b, K[i + 14], LanesExtend(w[14], w[15], w[7], w[12]));
+        LanesRound(b, c, d, e, f, g, h, a, K[i + 15], LanesExtend(w[15], w[0], w[8], w[13]));
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+    for (int i = 0; i < 8; i++)
+    {
+        memcpy(tmp, &state[i], sizeof(V));
+        for (unsigned int j = 0; j < N; j++)
+            s[8 * j + i] = tmp[j];
+    }
+}
+
+__attribute__((target("sse2")))
+static void TransformLanes4Way(uint32_t* s, const unsigned char* blocks, unsigned int n)
+{
+    for (; n >= 4; n -= 4, s += 32, blocks += 256)
+        TransformLanesT<uint32x4, 4>(s, blocks);
+    TransformLanesOpenSSL(s, blocks, n);
+}
+
+__attribute__((target("avx2")))
+static void TransformLanes8Way(uint32_t* s, const unsigned char* blocks, unsigned int n)
+{
+    for (; n >= 8; n -= 8, s += 64, blocks += 512)
+        TransformLanesT<uint32x8, 8>(s, blocks);
+    if (n >= 4)
+    {
+        TransformLanesT<uint32x4, 4>(s, blocks);
+        n -= 4, s += 32, blocks += 256;
+    }
+    TransformLanesOpenSSL(s, blocks, n);
+}
+
+
+//
+// SHA extensions: the state is kept as ABEF and CDGH, sha256rnds2 does two
+// rounds and sha256msg1/2 extend the message four words at a time
+//
+#define SHANI_TARGET __attribute__((target("ssse3,sse4.1,sha")))
+
+SHANI_TARGET static inline void QuadRound(__m128i& state0, __m128i& state1, __m128i msg, int i)
+{
+    __m128i m = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&K[4 * i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E));
+}
+
+// Finish the next message words from the previous two
+SHANI_TARGET static inline void FinishMessage(__m128i prev, __m128i cur, __m128i& next)
+{
+    next = _mm_sha256msg2_epu32(_mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4)), cur);
+}
+
+// Start the message words after the next ones
+SHANI_TARGET static inline void StartMessage(__m128i& prev, __m128i cur)
+{
+    prev = _mm_sha256msg1_epu32(prev, cur);
+}
+
+SHANI_TARGET static void TransformSHANI(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (nBlocks--)
+    {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 0)), MASK);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16)), MASK);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 32)), MASK);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 48)), MASK);
+
+        QuadRound(state0, state1, m0, 0);
+        QuadRound(state0, state1, m1, 1); StartMessage(m0, m1);
+        QuadRound(state0, state1, m2, 2); StartMessage(m1, m2);
+        QuadRound(state0, state1, m3, 3); FinishMessage(m2, m3, m0); StartMessage(m2, m3);
+        QuadRound(state0, state1, m0, 4); FinishMessage(m3, m0, m1); StartMessage(m3, m0);
+        QuadRound(state0, state1, m1, 5); FinishMessage(m0, m1, m2); StartMessage(m0, m1);
+        QuadRound(state0, state1, m2, 6); FinishMessage(m1, m2, m3); StartMessage(m1, m2);
+        QuadRound(state0, state1, m3, 7); FinishMessage(m2, m3, m0); StartMessage(m2, m3);
+        QuadRound(state0, state1, m0, 8); FinishMessage(m3, m0, m1); StartMessage(m3, m0);
+        QuadRound(state0, state1, m1, 9); FinishMessage(m0, m1, m2); StartMessage(m0, m1);
+        QuadRound(state0, state1, m2, 10); FinishMessage(m1, m2, m3); StartMessage(m1, m2);
+        QuadRound(state0, state1, m3, 11); FinishMessage(m2, m3, m0); StartMessage(m2, m3);
+        QuadRound(state0, state1, m0, 12); FinishMessage(m3, m0, m1); StartMessage(m3, m0);
+        QuadRound(state0, state1, m1, 13); FinishMessage(m0, m1, m2);
+        QuadRound(state0, state1, m2, 14); FinishMessage(m1, m2, m3);
+        QuadRound(state0, state1, m3, 15);
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        chunk += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+SHANI_TARGET static void TransformLanesSHANI(uint32_t* s, const unsigned char* blocks, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+        TransformSHANI(s + 8 * i, blocks + 64 * i, 1);
+}
+
+static void CPUID(uint32_t nLeaf, uint32_t nSubLeaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(nLeaf, nSubLeaf, a, b, c, d);
+}
+
+// Whether the OS saves the YMM registers
+static bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
+
+typedef void (*TransformFn)(uint32_t* s, const unsigned char* chunk, size_t nBlocks);
+typedef void (*TransformLanesFn)(uint32_t* s, const unsigned char* blocks, unsigned int n);
+
+static TransformFn transform = TransformOpenSSL;
+static TransformLanesFn transformLanes = TransformLanesOpenSSL;
+static unsigned int nLanes = 1;
+
+string SHA256AutoDetect()
+{
+    string strRet = "openssl";
+    transform = TransformOpenSSL;
+    transformLanes = TransformLanesOpenSSL;
+    nLanes = 1;
+#ifdef USE_SHA256_X86
+    uint32_t a, b, c, d;
+    CPUID(0, 0, a, b, c, d);
+    uint32_t nMaxLeaf = a;
+    CPUID(1, 0, a, b, c, d);
+    bool fSSE2 = (d >> 26) & 1;
+    bool fSSE41 = (c >> 19) & 1;
+    bool fAVX = ((c >> 27) & 1) && ((c >> 28) & 1) && AVXEnabled();
+    bool fAVX2 = false, fSHANI = false;
+    if (nMaxLeaf >= 7)
+    {
+        CPUID(7, 0, a, b, c, d);
+        fAVX2 = fAVX && ((b >> 5) & 1);
+        fSHANI = fSSE41 && ((b >> 29) & 1);
+    }
+
+    // One block at a time with the SHA extensions is as fast as the lanes
+    if (fSHANI)
+    {
+        transform = TransformSHANI;
+        transformLanes = TransformLanesSHANI;
+        strRet = "shani";
+    }
+    else if (fAVX2)
+    {
+        transformLanes = TransformLanes8Way;
+        nLanes = 8;
+        strRet += ",avx2(8way)";
+    }
+    else if (fSSE2)
+    {
+        transformLanes = TransformLanes4Way;
+        nLanes = 4;
+        strRet += ",sse2(4way)";
+    }
+#endif
+    return strRet;
+}
+
+void SHA256Transform(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    transform(s, chunk, nBlocks);
+}
+
+void SHA256TransformLanes(uint32_t* s, const unsigned char* blocks, unsigned int n)
+{
+    transformLanes(s, blocks, n);
+}
+
+unsigned int SHA256Lanes()
+{
+    return nLanes;
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    uint32_t s[8 * SHA256_MAX_LANES];
+    unsigned char buf[64 * SHA256_MAX_LANES];
+    while (nBlocks)
+    {
+        unsigned int n = nBlocks < SHA256_MAX_LANES ? nBlocks : SHA256_MAX_LANES;
+
+        // The inputs, then the padding of a 64 byte message
+        for (unsigned int i = 0; i < n; i++)
+            memcpy(s + 8 * i, pSHA256InitState, sizeof(pSHA256InitState));
+        transformLanes(s, in, n);
+        memset(buf, 0, 64 * n);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            buf[64 * i] = 0x80;
+            buf[64 * i + 62] = 0x02;
+        }
+        transformLanes(s, buf, n);
+
+        // The first hashes with the padding of a 32 byte message
+        for (unsigned int i = 0; i < n; i++)
+        {
+            unsigned char* p = buf + 64 * i;
+            for (int j = 0; j < 8; j++)
+                WriteBE32(p + 4 * j, s[8 * i + j]);
+            memset(p + 32, 0, 32);
+            p[32] = 0x80;
+            p[62] = 0x01;
+            memcpy(s + 8 * i, pSHA256InitState, sizeof(pSHA256InitState));
+        }
+        transformLanes(s, buf, n);
+
+        for (unsigned int i = 0; i < n; i++)
+            for (int j = 0; j < 8; j++)
+                WriteBE32(out + 32 * i + 4 * j, s[8 * i + j]);
+        in += 64 * n;
+        out += 32 * n;
+        nBlocks -= n;
+    }
+}
+
+
+CSHA256::CSHA256()
+{
+    Reset();
+}
+
+CSHA256& CSHA256::Reset()
+{
+    memcpy(s, pSHA256InitState, sizeof(s));
+    nBytes = 0;
+    return *this;
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = nBytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // Complete the buffered block
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        nBytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        transform(s, buf, 1);
+        nBufSize = 0;
+    }
+    if (end - data >= 64)
+    {
+        size_t nBlocks = (end - data) / 64;
+        transform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        nBytes += 64 * nBlocks;
+    }
+    if (end > data)
+    {
+        memcpy(buf + nBufSize, data, end - data);
+        nBytes += end - data;
+    }
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = {0x80};
+    unsigned char sizedesc[8];
+    WriteBE32(sizedesc, (uint32_t)(nBytes >> 29));
+    WriteBE32(sizedesc + 4, (uint32_t)(nBytes << 3));
+    Write(pad, 1 + ((119 - (nBytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
+
+
+bool SHA256SelfTest()
+{
+    // Pseudo random data, the same every run
+    unsigned char data[1200];
+    uint32_t nRand = 1;
+    for (unsigned int i = 0; i < sizeof(data); i++)
+    {
+        nRand = nRand * 1103515245 + 12345;
+        data[i] = nRand >> 16;
+    }
+
+    // Every length up to a few blocks, written whole and in pieces
+    for (size_t len = 0; len <= sizeof(data); len += (len < 200 ? 1 : 97))
+    {
+        unsigned char hashRef[32], hash[32];
+        ::SHA256(data, len, hashRef);
+        CSHA256().Write(data, len).Finalize(hash);
+        if (memcmp(hash, hashRef, 32) != 0)
+            return false;
+        CSHA256 sha;
+        sha.Write(data, len / 3).Write(data + len / 3, len / 2 - len / 3).Write(data + len / 2, len - len / 2);
+        sha.Finalize(hash);
+        if (memcmp(hash, hashRef, 32) != 0)
+            return false;
+    }
+
+    // Double hashes of 64 byte inputs, side by side or not
+    unsigned char hashes[32 * 18];
+    SHA256D64(hashes, data, 18);
+    for (unsigned int i = 0; i < 18; i++)
+    {
+        unsigned char hash1[32], hashRef[32];
+        ::SHA256(data + 64 * i, 64, hash1);
+        ::SHA256(hash1, 32, hashRef);
+        if (memcmp(hashes + 32 * i, hashRef, 32) != 0)
+            return false;
+    }
+
+    // Lanes against one block at a time, for every count up to two full batches
+    uint32_t s[8 * 2 * SHA256_MAX_LANES + 8], sRef[8 * 2 * SHA256_MAX_LANES + 8];
+    for (unsigned int i = 0; i < sizeof(s) / sizeof(s[0]); i++)
+        s[i] = ReadBE32(data + 900 - 4 * (i % 200));
+    for (unsigned int n = 1; n <= 2 * SHA256_MAX_LANES + 1; n++)
+    {
+        memcpy(sRef, s, sizeof(s));
+        TransformLanesOpenSSL(sRef, data, n);
+        SHA256TransformLanes(s, data, n);
+        if (memcmp(s, sRef, sizeof(s)) != 0)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2014-2015 The Nu developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Most blocks SHA256TransformLanes compresses at once */
+static const unsigned int SHA256_MAX_LANES = 8;
+
+/** Incremental SHA-256 using the transform selected by SHA256AutoDetect.
+ * Can be copied to keep a midstate.
+ */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t nBytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+// Select the fastest transforms the CPU supports and return their names.
+// Until it is called the OpenSSL transform is used.
+std::string SHA256AutoDetect();
+
+// Check the selected transforms against OpenSSL's SHA-256
+bool SHA256SelfTest();
+
+// Compress nBlocks consecutive 64 byte blocks into state s
+void SHA256Transform(uint32_t* s, const unsigned char* chunk, size_t nBlocks);
+
+// Compress one 64 byte block into each of n independent states. The states
+// follow each other in s (8 words each), as do the blocks.
+void SHA256TransformLanes(uint32_t* s, const unsigned char* blocks, unsigned int n);
+
+// Number of lanes the selected SHA256TransformLanes kernel hashes at once
+unsigned int SHA256Lanes();
+
+// Double SHA-256 of nBlocks consecutive 64 byte inputs, into nBlocks
+// consecutive 32 byte hashes. The inputs are hashed side by side.
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+#endif
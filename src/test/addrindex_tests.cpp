@@ -0,0 +1,95 @@
+#include <boost/test/unit_test.hpp>
+
+#include "addrindex.h"
+#include "coins.h"
+
+using namespace std;
+
+static CAddressIndexKey CreateKey(const uint160& hash, int nHeight, unsigned int nIndex)
+{
+    return CAddressIndexKey('B', ADDRINDEX_KEY, hash, nHeight, 0, nIndex, false);
+}
+
+// Key as ordered by the databases, bytewise
+static string SerializeKey(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << string("addrindex") << key;
+    return string(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_SUITE(addrindex_tests)
+
+BOOST_AUTO_TEST_CASE(addrindex_key_serialize)
+{
+    CAddressIndexKey key('C', ADDRINDEX_SCRIPT, 12345, 70000, 678, 3, true);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    CAddressIndexKey keyRead;
+    ss >> keyRead;
+    BOOST_CHECK_EQUAL(keyRead.cUnit, 'C');
+    BOOST_CHECK_EQUAL(keyRead.cType, ADDRINDEX_SCRIPT);
+    BOOST_CHECK(keyRead.hashAddress == 12345);
+    BOOST_CHECK_EQUAL(keyRead.nHeight, 70000);
+    BOOST_CHECK(keyRead.txid == 678);
+    BOOST_CHECK_EQUAL(keyRead.nIndex, 3U);
+    BOOST_CHECK(keyRead.fSpending);
+    BOOST_CHECK(keyRead.IsSameAddress(key));
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_key_order)
+{
+    // The records of an address must follow the heights
+    int nHeights[] = {0, 1, 255, 256, 65535, 65536, 1000000};
+    for (unsigned int i = 1; i < sizeof(nHeights) / sizeof(nHeights[0]); i++)
+        BOOST_CHECK(SerializeKey(CreateKey(1, nHeights[i - 1], 9)) < SerializeKey(CreateKey(1, nHeights[i], 0)));
+
+    // All the records of an address come before the next address
+    BOOST_CHECK(SerializeKey(CreateKey(1, 1000000, 0)) < SerializeKey(CreateKey(2, 0, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_block_entries)
+{
+    CKeyID keyID(uint160(42));
+    CScript scriptPay;
+    scriptPay.SetDestination(keyID);
+
+    CBlock block;
+    CTransaction txNew;
+    txNew.cUnit = 'B';
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout = COutPoint(1, 0);
+    txNew.vout.push_back(CTxOut(5 * COIN, scriptPay));
+    txNew.vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    block.vtx.push_back(CTransaction());
+    block.vtx[0].cUnit = 'B';
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vout.push_back(CTxOut(0, CScript()));
+    block.vtx.push_back(txNew);
+
+    // The spent output was paid to the same address
+    CCoins coinsPrev;
+    coinsPrev.cUnit = 'B';
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(2);
+    blockundo.vtxundo[1].vprevout.push_back(CTxInUndo(CTxOut(7 * COIN, scriptPay), coinsPrev));
+
+    vector<CAddressIndexEntry> vEntries;
+    GetAddressIndexEntries(block, 10, blockundo, vEntries);
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 2U);
+
+    BOOST_CHECK(vEntries[0].first.fSpending);
+    BOOST_CHECK_EQUAL(vEntries[0].second, -7 * COIN);
+    BOOST_CHECK(!vEntries[1].first.fSpending);
+    BOOST_CHECK_EQUAL(vEntries[1].second, 5 * COIN);
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+    {
+        BOOST_CHECK(entry.first.hashAddress == uint160(42));
+        BOOST_CHECK_EQUAL(entry.first.cType, ADDRINDEX_KEY);
+        BOOST_CHECK_EQUAL(entry.first.nHeight, 10);
+        BOOST_CHECK(entry.first.txid == txNew.GetHash());
+        BOOST_CHECK_EQUAL(entry.first.nIndex, 0U);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "chainscan.h"
+#include "main.h"
+
+using namespace std;
+
+class CHeightFacts : public CBlockScanFacts
+{
+public:
+    int nHeight;
+
+    CHeightFacts(int nHeightIn) : nHeight(nHeightIn) {}
+};
+
+// Job that extracts the height of the blocks, without reading them, and records
+// the order in which the facts are applied
+class CTestScanJob : public CChainScanJob
+{
+public:
+    int nFailExtract;
+    int nThrowApply;
+
+    boost::mutex mutex;
+    int nWorkers;
+    vector<int> vApplied;
+
+    CTestScanJob(int nFailExtractIn = -1, int nThrowApplyIn = -1) :
+        nFailExtract(nFailExtractIn), nThrowApply(nThrowApplyIn), nWorkers(0) {}
+
+    CBlockScanFacts* Extract(CTxDB& txdb, CBlock& block, const CBlockIndex* pindex)
+    {
+        return NULL;
+    }
+
+    bool Apply(CBlockScanFacts* pfacts, const CBlockIndex* pindex)
+    {
+        int nHeight = ((CHeightFacts*)pfacts)->nHeight;
+        BOOST_CHECK_EQUAL(nHeight, pindex->nHeight);
+        if (nHeight == nThrowApply)
+            throw runtime_error("Apply failed");
+        vApplied.push_back(nHeight);
+        return true;
+    }
+
+    void ShowProgress(const string& strName, int nPercent)
+    {
+    }
+
+    CChainScanWorker* NewWorker();
+};
+
+class CTestScanWorker : public CChainScanWorker
+{
+public:
+    CTestScanJob& job;
+
+    CTestScanWorker(CTestScanJob& jobIn) : job(jobIn)
+    {
+        boost::unique_lock<boost::mutex> lock(job.mutex);
+        job.nWorkers++;
+    }
+
+    ~CTestScanWorker()
+    {
+        boost::unique_lock<boost::mutex> lock(job.mutex);
+        job.nWorkers--;
+    }
+
+    CBlockScanFacts* Extract(const CBlockIndex* pindex)
+    {
+        // Let the workers finish out of order
+        if (GetRand(4) == 0)
+            boost::this_thread::sleep(boost::posix_time::microseconds(GetRand(200)));
+        if (pindex->nHeight == job.nFailExtract)
+            return NULL;
+        return new CHeightFacts(pindex->nHeight);
+    }
+};
+
+CChainScanWorker* CTestScanJob::NewWorker()
+{
+    return new CTestScanWorker(*this);
+}
+
+static void BuildChain(vector<CBlockIndex*>& vIndex, int nBlocks)
+{
+    for (int i = 0; i < nBlocks; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = i;
+        if (i > 0)
+        {
+            pindex->pprev = vIndex.back();
+            vIndex.back()->pnext = pindex;
+        }
+        vIndex.push_back(pindex);
+    }
+}
+
+static void DeleteChain(vector<CBlockIndex*>& vIndex)
+{
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+    vIndex.clear();
+}
+
+BOOST_AUTO_TEST_SUITE(chainscan_tests)
+
+BOOST_AUTO_TEST_CASE(chainscan_order)
+{
+    const int nBlocks = 1000;
+    vector<CBlockIndex*> vIndex;
+    BuildChain(vIndex, nBlocks);
+
+    CTestScanJob job;
+    BOOST_CHECK(ScanChain("chainscan_order", vIndex[0], NULL, job));
+    BOOST_REQUIRE_EQUAL(job.vApplied.size(), (unsigned int)nBlocks);
+    for (int i = 0; i < nBlocks; i++)
+        BOOST_CHECK_EQUAL(job.vApplied[i], i);
+    BOOST_CHECK_EQUAL(job.nWorkers, 0);
+
+    // The stop block is excluded
+    CTestScanJob jobStop;
+    BOOST_CHECK(ScanChain("chainscan_order", vIndex[10], vIndex[20], jobStop));
+    BOOST_REQUIRE_EQUAL(jobStop.vApplied.size(), 10U);
+    BOOST_CHECK_EQUAL(jobStop.vApplied.front(), 10);
+    BOOST_CHECK_EQUAL(jobStop.vApplied.back(), 19);
+
+    DeleteChain(vIndex);
+}
+
+BOOST_AUTO_TEST_CASE(chainscan_extract_failed)
+{
+    const int nBlocks = 1000;
+    const int nFail = 500;
+    vector<CBlockIndex*> vIndex;
+    BuildChain(vIndex, nBlocks);
+
+    CTestScanJob job(nFail);
+    BOOST_CHECK(!ScanChain("chainscan_extract_failed", vIndex[0], NULL, job));
+    BOOST_CHECK(job.vApplied.size() <= (unsigned int)nFail);
+    for (unsigned int i = 0; i < job.vApplied.size(); i++)
+        BOOST_CHECK_EQUAL(job.vApplied[i], (int)i);
+    BOOST_CHECK_EQUAL(job.nWorkers, 0);
+
+    DeleteChain(vIndex);
+}
+
+BOOST_AUTO_TEST_CASE(chainscan_apply_throws)
+{
+    const int nBlocks = 1000;
+    const int nThrow = 300;
+    vector<CBlockIndex*> vIndex;
+    BuildChain(vIndex, nBlocks);
+
+    CTestScanJob job(-1, nThrow);
+    BOOST_CHECK_THROW(ScanChain("chainscan_apply_throws", vIndex[0], NULL, job), runtime_error);
+    BOOST_CHECK_EQUAL(job.vApplied.size(), (unsigned int)nThrow);
+    // The workers were joined before the exception left ScanChain
+    BOOST_CHECK_EQUAL(job.nWorkers, 0);
+
+    DeleteChain(vIndex);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "checkqueue.h"
+
+using namespace std;
+
+// Check that counts how many times it ran and fails for a given value
+class CCountingCheck
+{
+public:
+    int nValue;
+    int nFailValue;
+    boost::mutex* pmutex;
+    int* pnRun;
+
+    CCountingCheck() : nValue(0), nFailValue(-1), pmutex(NULL), pnRun(NULL) {}
+    CCountingCheck(int nValueIn, int nFailValueIn, boost::mutex* pmutexIn, int* pnRunIn) :
+        nValue(nValueIn), nFailValue(nFailValueIn), pmutex(pmutexIn), pnRun(pnRunIn) {}
+
+    bool operator()() const
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            (*pnRun)++;
+        }
+        return nValue != nFailValue;
+    }
+
+    void swap(CCountingCheck& check)
+    {
+        std::swap(nValue, check.nValue);
+        std::swap(nFailValue, check.nFailValue);
+        std::swap(pmutex, check.pmutex);
+        std::swap(pnRun, check.pnRun);
+    }
+};
+
+static void RunChecks(CCheckQueue<CCountingCheck>* pqueue, int nChecks, int nFailValue, bool& fOk, CCountingCheck& checkFailed, int& nRun)
+{
+    boost::mutex mutex;
+    nRun = 0;
+    CCheckQueueControl<CCountingCheck> control(pqueue);
+    // Add in small batches, like ConnectBlock does per transaction
+    for (int i = 0; i < nChecks; i += 3)
+    {
+        vector<CCountingCheck> vChecks;
+        for (int j = i; j < nChecks && j < i + 3; j++)
+            vChecks.push_back(CCountingCheck(j, nFailValue, &mutex, &nRun));
+        control.Add(vChecks);
+    }
+    fOk = control.Wait(&checkFailed);
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_threads)
+{
+    CCheckQueue<CCountingCheck> queue(8);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    bool fOk;
+    int nRun;
+    CCountingCheck checkFailed;
+    for (int nRound = 0; nRound < 50; nRound++)
+    {
+        RunChecks(&queue, 1000, -1, fOk, checkFailed, nRun);
+        BOOST_CHECK(fOk);
+        BOOST_CHECK_EQUAL(nRun, 1000);
+    }
+
+    // The queue is usable again after a failure, which returns the failed check
+    RunChecks(&queue, 1000, 500, fOk, checkFailed, nRun);
+    BOOST_CHECK(!fOk);
+    BOOST_CHECK_EQUAL(checkFailed.nValue, 500);
+    BOOST_CHECK(nRun <= 1000);
+    RunChecks(&queue, 10, -1, fOk, checkFailed, nRun);
+    BOOST_CHECK(fOk);
+    BOOST_CHECK_EQUAL(nRun, 10);
+
+    // Nothing to check
+    RunChecks(&queue, 0, -1, fOk, checkFailed, nRun);
+    BOOST_CHECK(fOk);
+
+    queue.Quit();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_queue)
+{
+    bool fOk;
+    int nRun;
+    CCountingCheck checkFailed;
+    RunChecks(NULL, 100, -1, fOk, checkFailed, nRun);
+    BOOST_CHECK(fOk);
+    BOOST_CHECK_EQUAL(nRun, 100);
+
+    // Without a queue the checks stop at the first failure
+    RunChecks(NULL, 100, 10, fOk, checkFailed, nRun);
+    BOOST_CHECK(!fOk);
+    BOOST_CHECK_EQUAL(checkFailed.nValue, 10);
+    BOOST_CHECK_EQUAL(nRun, 11);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,269 @@
+#include <boost/test/unit_test.hpp>
+
+#include "coins.h"
+
+using namespace std;
+
+// Coins view kept in a map, standing in for the database
+class CCoinsViewTest : public CCoinsView
+{
+public:
+    map<uint256, CCoins> mapCoins;
+
+    bool GetCoins(const uint256& txid, CCoins& coins)
+    {
+        map<uint256, CCoins>::const_iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256& txid)
+    {
+        return mapCoins.count(txid) > 0;
+    }
+
+    bool BatchWrite(const map<uint256, CCoins>& mapWrite)
+    {
+        for (map<uint256, CCoins>::const_iterator it = mapWrite.begin(); it != mapWrite.end(); ++it)
+        {
+            if (it->second.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = it->second;
+        }
+        return true;
+    }
+};
+
+static CTransaction CreateTransaction(int nOutputs)
+{
+    CTransaction tx;
+    tx.cUnit = 'B';
+    tx.nTime = 1234;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    for (int i = 0; i < nOutputs; i++)
+        tx.vout.push_back(CTxOut((i + 1) * COIN, CScript() << OP_TRUE));
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(coins_tests)
+
+BOOST_AUTO_TEST_CASE(coins_spend)
+{
+    CTransaction tx = CreateTransaction(2);
+    CCoins coins(tx, 10);
+    BOOST_CHECK_EQUAL(coins.nHeight, 10);
+    BOOST_CHECK(!coins.fCoinBase && !coins.fCoinStake);
+    BOOST_CHECK(coins.IsAvailable(0) && coins.IsAvailable(1));
+    BOOST_CHECK(!coins.IsAvailable(2));
+
+    BOOST_CHECK(coins.Spend(1));
+    BOOST_CHECK(!coins.IsAvailable(1));
+    BOOST_CHECK(!coins.Spend(1));
+    BOOST_CHECK(!coins.IsPruned());
+    BOOST_CHECK(coins.IsAvailable(0));
+
+    BOOST_CHECK(coins.Spend(0));
+    BOOST_CHECK(coins.IsPruned());
+    BOOST_CHECK(!coins.IsAvailable(0));
+}
+
+BOOST_AUTO_TEST_CASE(coins_serialize)
+{
+    CTransaction tx = CreateTransaction(3);
+    CCoins coins(tx, 42);
+    coins.fCoinStake = true;
+    coins.Spend(1);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << coins;
+    CCoins coinsRead;
+    ss >> coinsRead;
+    BOOST_CHECK(coinsRead == coins);
+    BOOST_CHECK(coinsRead.fCoinStake);
+    BOOST_CHECK(!coinsRead.IsAvailable(1));
+    BOOST_CHECK(coinsRead.IsAvailable(2));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_stack)
+{
+    CCoinsViewTest viewBase;
+    CTransaction tx1 = CreateTransaction(2);
+    CTransaction tx2 = CreateTransaction(1);
+    uint256 hash1 = tx1.GetHash();
+    uint256 hash2 = tx2.GetHash();
+    viewBase.mapCoins[hash1] = CCoins(tx1, 1);
+
+    CCoinsViewCache viewBlock(&viewBase);
+    CCoinsViewCache viewTx(&viewBlock);
+
+    // Changes made in the top view are not seen below until flushed
+    BOOST_CHECK(viewTx.GetCoins(hash1).Spend(0));
+    viewTx.SetCoins(hash2, CCoins(tx2, 2));
+    BOOST_CHECK(viewTx.HaveCoins(hash2));
+    BOOST_CHECK(!viewBlock.HaveCoins(hash2));
+    BOOST_CHECK(viewBlock.GetCoins(hash1).IsAvailable(0));
+
+    BOOST_CHECK(viewTx.Flush());
+    BOOST_CHECK(viewBlock.HaveCoins(hash2));
+    BOOST_CHECK(!viewBlock.GetCoins(hash1).IsAvailable(0));
+    BOOST_CHECK(viewBase.mapCoins[hash1].IsAvailable(0));
+    BOOST_CHECK(!viewBase.HaveCoins(hash2));
+
+    // Spending the last output erases the coins from the base view
+    BOOST_CHECK(viewBlock.GetCoins(hash1).Spend(1));
+    BOOST_CHECK(!viewBlock.HaveCoins(hash1));
+    BOOST_CHECK(viewBlock.Flush());
+    BOOST_CHECK(!viewBase.HaveCoins(hash1));
+    BOOST_CHECK(viewBase.HaveCoins(hash2));
+    BOOST_CHECK(viewBase.mapCoins[hash2].nHeight == 2);
+
+    // Missing coins are reported as pruned
+    CCoinsViewCache viewCheck(&viewBase);
+    BOOST_CHECK(viewCheck.GetCoins(GetRandHash()).IsPruned());
+    BOOST_CHECK(!viewCheck.HaveInputs(tx1));
+}
+
+BOOST_AUTO_TEST_CASE(coins_undo)
+{
+    CTransaction tx = CreateTransaction(3);
+    CCoins coinsOrig(tx, 7);
+    coinsOrig.fCoinStake = true;
+    coinsOrig.Spend(0);
+    CCoins coins = coinsOrig;
+
+    // Spend the remaining outputs, pruning the coins
+    CTxUndo txundo;
+    for (unsigned int n = 1; n < 3; n++)
+    {
+        txundo.vprevout.push_back(CTxInUndo(coins.vout[n], coins));
+        BOOST_CHECK(coins.Spend(n));
+    }
+    BOOST_CHECK(coins.IsPruned());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << txundo;
+    CTxUndo txundoRead;
+    ss >> txundoRead;
+    BOOST_REQUIRE_EQUAL(txundoRead.vprevout.size(), 2U);
+
+    // Restore in reverse order, as blocks are disconnected
+    BOOST_CHECK(txundoRead.vprevout[1].Restore(coins, 2));
+    BOOST_CHECK(txundoRead.vprevout[0].Restore(coins, 1));
+    BOOST_CHECK(coins == coinsOrig);
+    BOOST_CHECK(!coins.IsAvailable(0));
+
+    // An output that is not spent cannot be restored
+    BOOST_CHECK(!txundoRead.vprevout[0].Restore(coins, 1));
+}
+
+// Connect the transactions of a block to the coins as ConnectBlock does
+static CTransaction CreateBlockTransaction(int nOutputs)
+{
+    // The fees of the transactions are checked, in a unit with a default fee
+    CTransaction tx = CreateTransaction(nOutputs);
+    tx.cUnit = '8';
+    return tx;
+}
+
+static bool ConnectTestBlock(const vector<CTransaction>& vtx, const CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo& blockundo)
+{
+    blockundo.vtxundo.clear();
+    blockundo.vtxundo.resize(vtx.size());
+    for (unsigned int nTx = 0; nTx < vtx.size(); nTx++)
+    {
+        CTransaction tx = vtx[nTx];
+        bool fInvalid;
+        if (!tx.FetchInputs(view, fInvalid))
+            return false;
+        vector<CScriptCheck> vChecks;
+        if (!tx.ConnectInputs(view, pindex, blockundo.vtxundo[nTx], true, &vChecks))
+            return false;
+        view.SetCoins(tx.GetHash(), CCoins(tx, pindex->nHeight));
+    }
+    return view.Flush();
+}
+
+BOOST_AUTO_TEST_CASE(coins_block_undo)
+{
+    CCoinsViewTest viewBase;
+    CTransaction txFund = CreateBlockTransaction(3);
+    viewBase.mapCoins[txFund.GetHash()] = CCoins(txFund, 5);
+    viewBase.mapCoins[txFund.GetHash()].Spend(2);
+    map<uint256, CCoins> mapCoinsOrig = viewBase.mapCoins;
+
+    // A coinbase, a transaction spending two outputs of txFund and one
+    // spending an output of the previous transaction in the same block
+    vector<CTransaction> vtx;
+    CTransaction txCoinBase = CreateBlockTransaction(1);
+    txCoinBase.vin[0].prevout.SetNull();
+    vtx.push_back(txCoinBase);
+
+    CTransaction tx1 = CreateBlockTransaction(2);
+    tx1.vin.resize(2);
+    tx1.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    tx1.vin[1].prevout = COutPoint(txFund.GetHash(), 1);
+    tx1.vout[1].nValue = COIN;
+    vtx.push_back(tx1);
+
+    CTransaction tx2 = CreateBlockTransaction(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx2.vout[0].nValue = COIN / 2;
+    vtx.push_back(tx2);
+
+    CBlockIndex index;
+    index.nHeight = 10;
+
+    // Connect
+    CBlockUndo blockundo;
+    {
+        CCoinsViewCache view(&viewBase);
+        BOOST_REQUIRE(ConnectTestBlock(vtx, &index, view, blockundo));
+    }
+    map<uint256, CCoins> mapCoinsConnected = viewBase.mapCoins;
+    BOOST_CHECK(!viewBase.mapCoins.count(txFund.GetHash()));
+    BOOST_CHECK(viewBase.mapCoins[tx1.GetHash()].IsAvailable(0));
+    BOOST_CHECK(!viewBase.mapCoins[tx1.GetHash()].IsAvailable(1));
+    BOOST_CHECK(viewBase.mapCoins[tx2.GetHash()].IsAvailable(0));
+
+    // The undo data goes through the database
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << blockundo;
+    string strUndo = ss.str();
+    CBlockUndo blockundoRead;
+    ss >> blockundoRead;
+    BOOST_REQUIRE_EQUAL(blockundoRead.vtxundo.size(), vtx.size());
+    BOOST_CHECK(blockundoRead.vtxundo[0].vprevout.empty());
+
+    // Disconnect in reverse order with the undo data only
+    {
+        CCoinsViewCache view(&viewBase);
+        for (int i = vtx.size() - 1; i >= 0; i--)
+            BOOST_REQUIRE(vtx[i].DisconnectInputs(view, blockundoRead.vtxundo[i]));
+        BOOST_REQUIRE(view.Flush());
+    }
+    BOOST_CHECK(viewBase.mapCoins == mapCoinsOrig);
+
+    // Reconnect, giving the same coins and undo data
+    CBlockUndo blockundoReconnect;
+    {
+        CCoinsViewCache view(&viewBase);
+        BOOST_REQUIRE(ConnectTestBlock(vtx, &index, view, blockundoReconnect));
+    }
+    BOOST_CHECK(viewBase.mapCoins == mapCoinsConnected);
+    CDataStream ssReconnect(SER_DISK, CLIENT_VERSION);
+    ssReconnect << blockundoReconnect;
+    BOOST_CHECK(ssReconnect.str() == strUndo);
+
+    // Undo data that does not match the transaction is rejected
+    {
+        CCoinsViewCache view(&viewBase);
+        BOOST_CHECK(!vtx[1].DisconnectInputs(view, blockundoRead.vtxundo[2]));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
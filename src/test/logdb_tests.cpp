@@ -0,0 +1,372 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <limits>
+
+#include <db_cxx.h>
+
+#include "db.h"
+#include "logdb.h"
+#include "util.h"
+
+using namespace std;
+
+static boost::filesystem::path GetTestDir(const string& strName)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / strprintf("bcexchange_%s_%"PRI64x, strName.c_str(), GetRand(std::numeric_limits<uint64>::max()));
+    boost::filesystem::remove_all(path);
+    return path;
+}
+
+static CDataStream Stream(const string& str)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << str;
+    return ss;
+}
+
+static string ReadString(CKeyValueStore& store, const string& strKey)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    string strValue;
+    if (store.Read(Stream(strKey), ssValue))
+        ssValue >> strValue;
+    else
+        strValue = "<missing>";
+    return strValue;
+}
+
+BOOST_AUTO_TEST_SUITE(logdb_tests)
+
+BOOST_AUTO_TEST_CASE(keyvalue_batch_merge)
+{
+    CKeyValueBatch batch, batchLater;
+    batch.Write("a", "1");
+    batch.Write("b", "2");
+    batch.Erase("c");
+    batchLater.Erase("a");
+    batchLater.Write("c", "3");
+    batchLater.Write("d", "4");
+    batch.Merge(batchLater);
+
+    bool fErased;
+    string strValue;
+    BOOST_CHECK_EQUAL(batch.size(), 4U);
+    BOOST_CHECK(batch.Lookup("a", fErased, strValue) && fErased);
+    BOOST_CHECK(batch.Lookup("b", fErased, strValue) && !fErased && strValue == "2");
+    BOOST_CHECK(batch.Lookup("c", fErased, strValue) && !fErased && strValue == "3");
+    BOOST_CHECK(batch.Lookup("d", fErased, strValue) && !fErased && strValue == "4");
+    BOOST_CHECK(!batch.Lookup("e", fErased, strValue));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_read_write)
+{
+    boost::filesystem::path path = GetTestDir("logdb_read_write");
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(path));
+        CLogKeyValueStore store(logdb, "cr+");
+
+        BOOST_CHECK(store.Exists(Stream("version")));
+        BOOST_CHECK(store.Write(Stream("a"), Stream("1")));
+        BOOST_CHECK(store.Write(Stream("c"), Stream("3")));
+        BOOST_CHECK(store.Write(Stream("b"), Stream("2")));
+        BOOST_CHECK(!store.Write(Stream("b"), Stream("x"), false));
+        BOOST_CHECK(store.Write(Stream("c"), Stream("33")));
+        BOOST_CHECK(store.Erase(Stream("a")));
+        BOOST_CHECK(store.Erase(Stream("z")));
+
+        BOOST_CHECK_EQUAL(ReadString(store, "a"), "<missing>");
+        BOOST_CHECK_EQUAL(ReadString(store, "b"), "2");
+        BOOST_CHECK_EQUAL(ReadString(store, "c"), "33");
+        BOOST_CHECK(!store.Exists(Stream("a")));
+
+        // Transactions are only visible outside the handle once committed
+        CLogKeyValueStore other(logdb);
+        BOOST_CHECK(store.TxnBegin());
+        BOOST_CHECK(store.Write(Stream("d"), Stream("4")));
+        BOOST_CHECK(store.Erase(Stream("b")));
+        BOOST_CHECK(store.TxnBegin());
+        BOOST_CHECK(store.Write(Stream("e"), Stream("5")));
+        BOOST_CHECK(store.TxnAbort());
+        BOOST_CHECK_EQUAL(ReadString(store, "d"), "4");
+        BOOST_CHECK_EQUAL(ReadString(store, "b"), "<missing>");
+        BOOST_CHECK_EQUAL(ReadString(store, "e"), "<missing>");
+        BOOST_CHECK_EQUAL(ReadString(other, "d"), "<missing>");
+        BOOST_CHECK_EQUAL(ReadString(other, "b"), "2");
+        BOOST_CHECK(store.TxnCommit());
+        BOOST_CHECK_EQUAL(ReadString(other, "d"), "4");
+        BOOST_CHECK_EQUAL(ReadString(other, "b"), "<missing>");
+
+        // Uncommitted writes are dropped with the handle
+        {
+            CLogKeyValueStore store2(logdb);
+            BOOST_CHECK(store2.TxnBegin());
+            BOOST_CHECK(store2.Write(Stream("f"), Stream("6")));
+        }
+        BOOST_CHECK(!store.Exists(Stream("f")));
+    }
+
+    // The log is replayed at the next open
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(path));
+        CLogKeyValueStore store(logdb, "r");
+        BOOST_CHECK_EQUAL(logdb.GetKeyCount(), 3U);
+        BOOST_CHECK_EQUAL(ReadString(store, "c"), "33");
+        BOOST_CHECK_EQUAL(ReadString(store, "d"), "4");
+
+        // Cursor in key order, from the first key not less than the seek key.
+        // Keys are compared serialized, so shorter strings come first.
+        CKeyValueCursor* pcursor = store.NewCursor();
+        BOOST_REQUIRE(pcursor);
+        pcursor->Seek(Stream("b"));
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        vector<string> vKeys;
+        while (pcursor->Next(ssKey, ssValue))
+        {
+            string strKey;
+            ssKey >> strKey;
+            vKeys.push_back(strKey);
+        }
+        BOOST_CHECK(!pcursor->Failed());
+        delete pcursor;
+        BOOST_REQUIRE_EQUAL(vKeys.size(), 3U);
+        BOOST_CHECK_EQUAL(vKeys[0], "c");
+        BOOST_CHECK_EQUAL(vKeys[1], "d");
+        BOOST_CHECK_EQUAL(vKeys[2], "version");
+    }
+
+    boost::filesystem::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_torn_batch)
+{
+    boost::filesystem::path path = GetTestDir("logdb_torn_batch");
+    uint64 nSize;
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(path));
+        CLogKeyValueStore store(logdb);
+        BOOST_CHECK(store.Write(Stream("a"), Stream("1")));
+        nSize = logdb.GetFileSize();
+        BOOST_CHECK(store.TxnBegin());
+        BOOST_CHECK(store.Write(Stream("b"), Stream("2")));
+        BOOST_CHECK(store.Write(Stream("c"), Stream("3")));
+        BOOST_CHECK(store.TxnCommit());
+    }
+
+    // Crash in the middle of the write of the last batch
+    boost::filesystem::path pathData = CLogDB::GetDataPath(path);
+    boost::filesystem::resize_file(pathData, boost::filesystem::file_size(pathData) - 3);
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(path));
+        CLogKeyValueStore store(logdb);
+        BOOST_CHECK_EQUAL(ReadString(store, "a"), "1");
+        BOOST_CHECK(!store.Exists(Stream("b")));
+        BOOST_CHECK(!store.Exists(Stream("c")));
+        BOOST_CHECK_EQUAL(logdb.GetFileSize(), nSize);
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathData), nSize);
+
+        // Writes resume after the last complete batch
+        BOOST_CHECK(store.Write(Stream("d"), Stream("4")));
+    }
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(path));
+        CLogKeyValueStore store(logdb);
+        BOOST_CHECK_EQUAL(ReadString(store, "a"), "1");
+        BOOST_CHECK_EQUAL(ReadString(store, "d"), "4");
+    }
+
+    boost::filesystem::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_compact)
+{
+    boost::filesystem::path path = GetTestDir("logdb_compact");
+    CLogDB logdb;
+    BOOST_REQUIRE(logdb.Open(path));
+    CLogKeyValueStore store(logdb);
+    for (int nRound = 0; nRound < 10; nRound++)
+        for (int i = 0; i < 100; i++)
+            BOOST_CHECK(store.Write(Stream(strprintf("key%d", i)), Stream(strprintf("value%d-%d", i, nRound))));
+    for (int i = 0; i < 100; i += 2)
+        BOOST_CHECK(store.Erase(Stream(strprintf("key%d", i))));
+
+    uint64 nSize = logdb.GetFileSize();
+    BOOST_CHECK(logdb.Compact());
+    BOOST_CHECK(logdb.GetFileSize() < nSize / 10);
+    BOOST_CHECK_EQUAL(logdb.GetKeyCount(), 50U);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(ReadString(store, strprintf("key%d", i)), i % 2 ? strprintf("value%d-9", i) : "<missing>");
+
+    logdb.Close();
+    boost::filesystem::remove_all(path);
+}
+
+static uint64 GetDirectorySize(const boost::filesystem::path& path)
+{
+    uint64 nSize = 0;
+    for (boost::filesystem::recursive_directory_iterator it(path), end; it != end; ++it)
+        if (boost::filesystem::is_regular_file(it->status()))
+            nSize += boost::filesystem::file_size(it->path());
+    return nSize;
+}
+
+// Berkeley DB environment with the settings of CDB
+static void OpenTestEnv(DbEnv& env, const boost::filesystem::path& path)
+{
+    env.set_cachesize(0, 25 * 1048576, 1);
+    env.set_lg_bsize(1048576);
+    env.set_lg_max(10485760);
+    env.set_lk_max_locks(DB_MAX_LOCKS);
+    env.set_lk_max_objects(DB_MAX_LOCKS);
+    env.set_flags(DB_TXN_WRITE_NOSYNC, 1);
+    env.set_flags(DB_AUTO_COMMIT, 1);
+    env.log_set_config(DB_LOG_AUTO_REMOVE, 1);
+    env.open(path.string().c_str(), DB_CREATE | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_MPOOL | DB_INIT_TXN | DB_THREAD | DB_RECOVER, S_IRUSR | S_IWUSR);
+}
+
+// Records written while connecting a block during the initial download:
+// the block index entry, the index of each transaction and the best chain
+static void AddSyncBlock(CKeyValueBatch& batch, int nHeight, int nTx)
+{
+    uint256 hashBlock = Hash(BEGIN(nHeight), END(nHeight));
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(string("blockindex"), hashBlock);
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << vector<unsigned char>(220, (unsigned char)nHeight);
+    batch.Write(string(ssKey.begin(), ssKey.end()), string(ssValue.begin(), ssValue.end()));
+
+    for (int i = 0; i < nTx; i++)
+    {
+        uint256 hashTx = Hash(BEGIN(hashBlock), END(hashBlock), BEGIN(i), END(i));
+        ssKey.clear();
+        ssKey << make_pair(string("tx"), hashTx);
+        ssValue.clear();
+        ssValue << vector<unsigned char>(12 + 12 * (i % 3 + 1), (unsigned char)i);
+        batch.Write(string(ssKey.begin(), ssKey.end()), string(ssValue.begin(), ssValue.end()));
+    }
+
+    ssKey.clear();
+    ssKey << string("hashBestChain");
+    ssValue.clear();
+    ssValue << hashBlock;
+    batch.Write(string(ssKey.begin(), ssKey.end()), string(ssValue.begin(), ssValue.end()));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_sync_benchmark)
+{
+    const int nBlocks = 5000;
+    const int nTxPerBlock = 5;
+
+    // Log-structured engine
+    boost::filesystem::path pathLog = GetTestDir("logdb_sync_benchmark_log");
+    boost::posix_time::ptime mst1 = boost::posix_time::microsec_clock::local_time();
+    {
+        CLogDB logdb;
+        BOOST_REQUIRE(logdb.Open(pathLog));
+        CLogKeyValueStore store(logdb, "cr+");
+        for (int nHeight = 0; nHeight < nBlocks; nHeight++)
+        {
+            CKeyValueBatch batch;
+            AddSyncBlock(batch, nHeight, nTxPerBlock);
+            BOOST_REQUIRE(store.WriteBatch(batch));
+        }
+        BOOST_CHECK_EQUAL(logdb.GetKeyCount(), 1U + nBlocks * (1 + nTxPerBlock) + 1);
+    }
+    boost::posix_time::ptime mst2 = boost::posix_time::microsec_clock::local_time();
+    long nLogTime = (mst2 - mst1).total_microseconds();
+    uint64 nLogSize = GetDirectorySize(pathLog);
+
+    // Berkeley DB with the environment settings of CDB
+    boost::filesystem::path pathBDB = GetTestDir("logdb_sync_benchmark_bdb");
+    boost::filesystem::create_directories(pathBDB);
+    mst1 = boost::posix_time::microsec_clock::local_time();
+    {
+        DbEnv env(0);
+        OpenTestEnv(env, pathBDB);
+        Db db(&env, 0);
+        db.open(NULL, "blkindex.dat", "main", DB_BTREE, DB_CREATE | DB_THREAD, 0);
+        for (int nHeight = 0; nHeight < nBlocks; nHeight++)
+        {
+            CKeyValueBatch batch;
+            AddSyncBlock(batch, nHeight, nTxPerBlock);
+            DbTxn* ptxn = NULL;
+            env.txn_begin(NULL, &ptxn, DB_TXN_WRITE_NOSYNC);
+            for (CKeyValueBatch::MapType::const_iterator it = batch.mapWrites.begin(); it != batch.mapWrites.end(); ++it)
+            {
+                Dbt datKey((void*)it->first.data(), it->first.size());
+                Dbt datValue((void*)it->second.second.data(), it->second.second.size());
+                BOOST_REQUIRE(db.put(ptxn, &datKey, &datValue, 0) == 0);
+            }
+            BOOST_REQUIRE(ptxn->commit(0) == 0);
+        }
+        db.close(0);
+        env.txn_checkpoint(0, 0, 0);
+        env.close(0);
+    }
+    mst2 = boost::posix_time::microsec_clock::local_time();
+    long nBDBTime = (mst2 - mst1).total_microseconds();
+    uint64 nBDBSize = boost::filesystem::file_size(pathBDB / "blkindex.dat");
+
+    if (fDebug) printf("logdb_sync_benchmark: %d blocks, log %ldus %"PRI64u" bytes, bdb %ldus %"PRI64u" bytes\n",
+                       nBlocks, nLogTime, nLogSize, nBDBTime, nBDBSize);
+
+    BOOST_CHECK(nLogSize > 0);
+
+    boost::filesystem::remove_all(pathLog);
+    boost::filesystem::remove_all(pathBDB);
+}
+
+BOOST_AUTO_TEST_CASE(bdb_deferred_batch_flush)
+{
+    // The writes of the initial download are deferred until they reach the
+    // default -dbbatchsize or MAX_DEFERRED_RECORDS, then written in one transaction
+    CKeyValueBatch batchDeferred;
+    uint64 nDeferredSize = 0;
+    for (int nHeight = 0; nDeferredSize < DEFAULT_DB_BATCH_SIZE * 1024 * 1024 && batchDeferred.size() < MAX_DEFERRED_RECORDS; nHeight++)
+    {
+        CKeyValueBatch batch;
+        AddSyncBlock(batch, nHeight, 5);
+        nDeferredSize += batch.GetDataSize();
+        batchDeferred.Merge(batch);
+    }
+    BOOST_CHECK(batchDeferred.size() > 10000);
+
+    boost::filesystem::path pathBDB = GetTestDir("bdb_deferred_batch_flush");
+    boost::filesystem::create_directories(pathBDB);
+    {
+        DbEnv env(0);
+        OpenTestEnv(env, pathBDB);
+        Db db(&env, 0);
+        BOOST_REQUIRE(db.open(NULL, "blkindex.dat", "main", DB_BTREE, DB_CREATE | DB_THREAD, 0) == 0);
+        DbTxn* ptxn = NULL;
+        BOOST_REQUIRE(env.txn_begin(NULL, &ptxn, DB_TXN_WRITE_NOSYNC) == 0);
+        unsigned int nWritten = 0;
+        for (CKeyValueBatch::MapType::const_iterator it = batchDeferred.mapWrites.begin(); it != batchDeferred.mapWrites.end(); ++it)
+        {
+            Dbt datKey((void*)it->first.data(), it->first.size());
+            Dbt datValue((void*)it->second.second.data(), it->second.second.size());
+            if (db.put(ptxn, &datKey, &datValue, 0) != 0)
+                break;
+            nWritten++;
+        }
+        BOOST_CHECK_EQUAL(nWritten, batchDeferred.size());
+        if (nWritten == batchDeferred.size())
+            BOOST_CHECK(ptxn->commit(0) == 0);
+        else
+            ptxn->abort();
+        db.close(0);
+        env.txn_checkpoint(0, 0, 0);
+        env.close(0);
+    }
+
+    boost::filesystem::remove_all(pathBDB);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
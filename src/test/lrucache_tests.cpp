@@ -0,0 +1,63 @@
+#include <boost/test/unit_test.hpp>
+
+#include "lrucache.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(lrucache_tests)
+
+BOOST_AUTO_TEST_CASE(lrucache_evicts_least_recently_used)
+{
+    CLRUCache<int, string> cache(3);
+    cache.insert(1, "one");
+    cache.insert(2, "two");
+    cache.insert(3, "three");
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+    // Using 1 makes 2 the least recently used
+    string str;
+    BOOST_CHECK(cache.get(1, str));
+    BOOST_CHECK_EQUAL(str, "one");
+    cache.insert(4, "four");
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(!cache.get(2, str));
+    BOOST_CHECK(cache.get(1, str));
+    BOOST_CHECK(cache.get(3, str));
+    BOOST_CHECK(cache.get(4, str));
+
+    // Replacing a value does not grow the cache
+    cache.insert(3, "THREE");
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(cache.get(3, str));
+    BOOST_CHECK_EQUAL(str, "THREE");
+
+    cache.erase(3);
+    BOOST_CHECK(!cache.get(3, str));
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(lrucache_max_size)
+{
+    CLRUCache<int, int> cache(10);
+    for (int i = 0; i < 10; i++)
+        cache.insert(i, i * i);
+    int n;
+    BOOST_CHECK(cache.get(0, n));
+
+    // Shrinking keeps the most recently used
+    cache.max_size(2);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(cache.get(0, n));
+    BOOST_CHECK_EQUAL(n, 0);
+    BOOST_CHECK(cache.get(9, n));
+    BOOST_CHECK_EQUAL(n, 81);
+    BOOST_CHECK(!cache.get(8, n));
+
+    // A cache of size 0 keeps nothing
+    cache.max_size(0);
+    cache.insert(1, 1);
+    BOOST_CHECK(cache.empty());
+    BOOST_CHECK(!cache.get(1, n));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,78 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <limits>
+
+#include "mappedfile.h"
+#include "serialize.h"
+#include "util.h"
+
+using namespace std;
+
+static void AppendToFile(const boost::filesystem::path& path, const CDataStream& ss)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file != NULL);
+    BOOST_REQUIRE(fwrite(&ss[0], 1, ss.size(), file) == ss.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_SUITE(mappedfile_tests)
+
+BOOST_AUTO_TEST_CASE(buffer_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << 1234 << string("abc") << vector<unsigned char>(100, 7);
+
+    CBufferReader reader(&ss[0], &ss[0] + ss.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    string str;
+    vector<unsigned char> vch;
+    reader >> n >> str >> vch;
+    BOOST_CHECK_EQUAL(n, 1234);
+    BOOST_CHECK_EQUAL(str, "abc");
+    BOOST_CHECK(vch == vector<unsigned char>(100, 7));
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(!reader.eof());
+    BOOST_CHECK_EQUAL(reader.GetReadPos(), ss.size());
+
+    // Reading past the end fails without reading outside the range
+    CBufferReader readerShort(&ss[0], &ss[0] + ss.size() - 1, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(readerShort >> n >> str >> vch, std::ios_base::failure);
+    BOOST_CHECK(readerShort.eof());
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() / strprintf("bcexchange_mappedfile_%"PRI64x, GetRand(std::numeric_limits<uint64>::max()));
+
+    CMappedFile mapped;
+    BOOST_CHECK(!mapped.Open(path));
+    BOOST_CHECK(!mapped.IsOpen());
+
+    CDataStream ss1(SER_DISK, CLIENT_VERSION);
+    ss1 << string("first");
+    AppendToFile(path, ss1);
+    BOOST_REQUIRE(mapped.Open(path));
+    BOOST_CHECK_EQUAL(mapped.size(), ss1.size());
+
+    // Data appended later is only visible to a new mapping
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << string("second");
+    AppendToFile(path, ss2);
+    BOOST_CHECK_EQUAL(mapped.size(), ss1.size());
+
+    CMappedFile mappedNew;
+    BOOST_REQUIRE(mappedNew.Open(path));
+    BOOST_CHECK_EQUAL(mappedNew.size(), ss1.size() + ss2.size());
+    CBufferReader reader(mappedNew.begin() + ss1.size(), mappedNew.end(), SER_DISK, CLIENT_VERSION);
+    string str;
+    reader >> str;
+    BOOST_CHECK_EQUAL(str, "second");
+
+    mapped.Close();
+    mappedNew.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
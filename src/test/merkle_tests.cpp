@@ -0,0 +1,50 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+// Merkle root computed one pair at a time
+static uint256 MerkleRootPairwise(const vector<uint256>& vLeaves)
+{
+    vector<uint256> vLevel = vLeaves;
+    while (vLevel.size() > 1)
+    {
+        vector<uint256> vNext;
+        for (unsigned int i = 0; i < vLevel.size(); i += 2)
+        {
+            const uint256& right = vLevel[min(i + 1, (unsigned int)vLevel.size() - 1)];
+            vNext.push_back(Hash(BEGIN(vLevel[i]), END(vLevel[i]), BEGIN(right), END(right)));
+        }
+        vLevel.swap(vNext);
+    }
+    return vLevel.empty() ? 0 : vLevel[0];
+}
+
+BOOST_AUTO_TEST_SUITE(merkle_tests)
+
+BOOST_AUTO_TEST_CASE(merkle_tree)
+{
+    CBlock block;
+    BOOST_CHECK(block.BuildMerkleTree() == 0);
+
+    vector<uint256> vLeaves;
+    for (int nTx = 1; nTx <= 70; nTx++)
+    {
+        CTransaction tx;
+        tx.nLockTime = nTx;
+        block.vtx.push_back(tx);
+        vLeaves.push_back(tx.GetHash());
+
+        uint256 hashRoot = block.BuildMerkleTree();
+        BOOST_CHECK(hashRoot == MerkleRootPairwise(vLeaves));
+        for (int i = 0; i < nTx; i++)
+        {
+            vector<uint256> vBranch = block.GetMerkleBranch(i);
+            BOOST_CHECK(vBranch == CBlock::GetMerkleBranch(block.vMerkleTree, nTx, i));
+            BOOST_CHECK(CBlock::CheckMerkleBranch(vLeaves[i], vBranch, i) == hashRoot);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
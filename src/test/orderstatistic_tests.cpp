@@ -0,0 +1,81 @@
+#include <boost/test/unit_test.hpp>
+
+#include <set>
+
+#include "orderstatistic.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(orderstatistic_tests)
+
+BOOST_AUTO_TEST_CASE(orderstatistic_basics)
+{
+    COrderStatisticSet<int> set;
+    BOOST_CHECK(set.empty());
+    BOOST_CHECK_EQUAL(0, set.size());
+
+    set.insert(5);
+    set.insert(3);
+    set.insert(5);
+    set.insert(8, 3);
+    BOOST_CHECK_EQUAL(6, set.size());
+    BOOST_CHECK_EQUAL(3, set.nth(0));
+    BOOST_CHECK_EQUAL(5, set.nth(1));
+    BOOST_CHECK_EQUAL(5, set.nth(2));
+    BOOST_CHECK_EQUAL(8, set.nth(5));
+    BOOST_CHECK_EQUAL(0, set.count_less(3));
+    BOOST_CHECK_EQUAL(1, set.count_less(4));
+    BOOST_CHECK_EQUAL(3, set.count_less(8));
+    BOOST_CHECK_EQUAL(2, set.count(5));
+
+    BOOST_CHECK(!set.erase(4));
+    BOOST_CHECK(!set.erase(8, 4));
+    BOOST_CHECK_EQUAL(6, set.size());
+    BOOST_CHECK(set.erase(8, 2));
+    BOOST_CHECK(set.erase(3));
+    BOOST_CHECK_EQUAL(3, set.size());
+    BOOST_CHECK_EQUAL(5, set.nth(0));
+    BOOST_CHECK_EQUAL(8, set.nth(2));
+
+    COrderStatisticSet<int> copy(set);
+    set.clear();
+    BOOST_CHECK(set.empty());
+    BOOST_CHECK_EQUAL(3, copy.size());
+    BOOST_CHECK_EQUAL(8, copy.nth(2));
+}
+
+BOOST_AUTO_TEST_CASE(orderstatistic_random)
+{
+    COrderStatisticSet<int> set;
+    multiset<int> reference;
+
+    for (int i = 0; i < 5000; i++)
+    {
+        int nValue = GetRand(100);
+        if (GetRand(3))
+        {
+            set.insert(nValue);
+            reference.insert(nValue);
+        }
+        else
+        {
+            bool fFound = reference.count(nValue) > 0;
+            if (fFound)
+                reference.erase(reference.find(nValue));
+            BOOST_CHECK_EQUAL(fFound, set.erase(nValue));
+        }
+
+        BOOST_CHECK_EQUAL(reference.size(), set.size());
+        if (reference.empty())
+            continue;
+
+        int n = GetRand(reference.size());
+        multiset<int>::const_iterator it = reference.begin();
+        advance(it, n);
+        BOOST_CHECK_EQUAL(*it, set.nth(n));
+        BOOST_CHECK_EQUAL(distance(reference.begin(), reference.lower_bound(nValue)), set.count_less(nValue));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,63 @@
+#include <boost/test/unit_test.hpp>
+
+#include "scanbalance.h"
+#include "coins.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(scanbalance_tests)
+
+BOOST_AUTO_TEST_CASE(balance_snapshot_serialize)
+{
+    BalanceMap mapBalance;
+    mapBalance[CBitcoinAddress(CKeyID(uint160(1)), '8')] = 10 * COIN;
+    mapBalance[CBitcoinAddress(CScriptID(uint160(2)), '8')] = 20 * COIN;
+    // Outputs without destination are counted under an empty address
+    mapBalance[CBitcoinAddress()] = 30 * COIN;
+
+    CBalanceSnapshot snapshot;
+    snapshot.hashBlock = 1234;
+    snapshot.SetBalanceMap(mapBalance);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << snapshot;
+    CBalanceSnapshot snapshotRead;
+    ss >> snapshotRead;
+    BOOST_CHECK(snapshotRead.hashBlock == 1234);
+
+    BalanceMap mapRead;
+    snapshotRead.GetBalanceMap(mapRead);
+    BOOST_CHECK(mapRead == mapBalance);
+}
+
+BOOST_AUTO_TEST_CASE(balance_block_changes)
+{
+    CKeyID keyFrom(uint160(1));
+    CKeyID keyTo(uint160(2));
+    CScript scriptFrom, scriptTo;
+    scriptFrom.SetDestination(keyFrom);
+    scriptTo.SetDestination(keyTo);
+    CBitcoinAddress addrFrom(keyFrom, '8');
+    CBitcoinAddress addrTo(keyTo, '8');
+
+    CBlock block;
+    block.vtx.resize(2);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vout.push_back(CTxOut(0, CScript()));
+    block.vtx[1].vin.resize(1);
+    block.vtx[1].vin[0].prevout = COutPoint(1, 0);
+    block.vtx[1].vout.push_back(CTxOut(6 * COIN, scriptTo));
+    block.vtx[1].vout.push_back(CTxOut(3 * COIN, scriptFrom));
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(2);
+    blockundo.vtxundo[1].vprevout.push_back(CTxInUndo(CTxOut(10 * COIN, scriptFrom), CCoins()));
+
+    BalanceMap mapDelta;
+    GetBlockBalanceChanges(block, blockundo, mapDelta);
+    BOOST_CHECK_EQUAL(mapDelta.size(), 2U);
+    BOOST_CHECK_EQUAL(mapDelta[addrFrom], -7 * COIN);
+    BOOST_CHECK_EQUAL(mapDelta[addrTo], 6 * COIN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
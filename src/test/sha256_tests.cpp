@@ -0,0 +1,83 @@
+#include <boost/test/unit_test.hpp>
+
+#include <openssl/sha.h>
+
+#include "sha256.h"
+#include "util.h"
+
+using namespace std;
+
+static string HashHex(const string& str)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)str.data(), str.size()).Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256_vectors)
+{
+    BOOST_CHECK_EQUAL(HashHex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    BOOST_CHECK_EQUAL(HashHex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    BOOST_CHECK_EQUAL(HashHex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+                      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    BOOST_CHECK_EQUAL(HashHex(string(1000000, 'a')), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    BOOST_CHECK(SHA256SelfTest());
+}
+
+BOOST_AUTO_TEST_CASE(sha256_hash_matches_openssl)
+{
+    vector<unsigned char> vch;
+    for (int i = 0; i < 300; i++)
+    {
+        uint256 hash1, hash2;
+        SHA256(vch.empty() ? NULL : &vch[0], vch.size(), (unsigned char*)&hash1);
+        SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+        BOOST_CHECK(Hash(vch.begin(), vch.end()) == hash2);
+        size_t nSplit = vch.size() / 3;
+        BOOST_CHECK(Hash(vch.begin(), vch.begin() + nSplit, vch.begin() + nSplit, vch.end()) == hash2);
+
+        unsigned char ripemd[20];
+        RIPEMD160((unsigned char*)&hash1, sizeof(hash1), ripemd);
+        uint160 hash160 = Hash160(vch);
+        BOOST_CHECK(memcmp(&hash160, ripemd, sizeof(ripemd)) == 0);
+
+        vch.push_back(i * 37);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_lanes)
+{
+    // Every count of lanes gives the same states as one block at a time
+    unsigned char blocks[64 * 3 * SHA256_MAX_LANES];
+    for (unsigned int i = 0; i < sizeof(blocks); i++)
+        blocks[i] = i * 13 + 5;
+    for (unsigned int n = 0; n <= 3 * SHA256_MAX_LANES; n++)
+    {
+        vector<uint32_t> s(8 * n + 1), sRef(8 * n + 1);
+        for (unsigned int i = 0; i < s.size(); i++)
+            s[i] = sRef[i] = i * 0x9e3779b9;
+        SHA256TransformLanes(&s[0], blocks, n);
+        for (unsigned int i = 0; i < n; i++)
+            SHA256Transform(&sRef[8 * i], blocks + 64 * i, 1);
+        BOOST_CHECK(s == sRef);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_d64)
+{
+    unsigned char in[64 * 3 * SHA256_MAX_LANES];
+    for (unsigned int i = 0; i < sizeof(in); i++)
+        in[i] = i * 7 + 1;
+    for (unsigned int n = 0; n <= 3 * SHA256_MAX_LANES; n++)
+    {
+        vector<unsigned char> out(32 * n + 1, 0xff);
+        SHA256D64(&out[0], in, n);
+        for (unsigned int i = 0; i < n; i++)
+            BOOST_CHECK(memcmp(&out[32 * i], Hash(in + 64 * i, in + 64 * (i + 1)).begin(), 32) == 0);
+        BOOST_CHECK_EQUAL(out[32 * n], 0xff);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
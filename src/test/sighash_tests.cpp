@@ -0,0 +1,104 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+// Test routines internal to script.cpp:
+extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+static unsigned int nRandState = 42;
+
+static unsigned int Rand(unsigned int nMax)
+{
+    nRandState = nRandState * 1103515245 + 12345;
+    return (nRandState >> 8) % nMax;
+}
+
+static CScript RandScript()
+{
+    static const opcodetype ops[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int nOps = Rand(10);
+    for (int i = 0; i < nOps; i++)
+        script << ops[Rand(sizeof(ops) / sizeof(ops[0]))];
+    return script;
+}
+
+static void RandTransaction(CTransaction& tx, int nInputs, int nOutputs)
+{
+    tx.nVersion = Rand(3);
+    tx.nTime = Rand(0x7fffffff);
+    tx.nLockTime = Rand(2) ? Rand(0x7fffffff) : 0;
+    tx.cUnit = Rand(2) ? '8' : 'C';
+    tx.vin.resize(nInputs);
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nInputs; i++)
+    {
+        CTxIn& txin = tx.vin[i];
+        txin.prevout.hash = Rand(0x7fffffff);
+        txin.prevout.n = Rand(4);
+        txin.scriptSig = RandScript();
+        txin.nSequence = Rand(2) ? Rand(0x7fffffff) : (unsigned int)-1;
+    }
+    for (int i = 0; i < nOutputs; i++)
+    {
+        CTxOut& txout = tx.vout[i];
+        txout.nValue = Rand(100000000);
+        txout.scriptPubKey = RandScript();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_context_matches)
+{
+    static const int hashTypes[] = {0, SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 4,
+                                    SIGHASH_ALL | SIGHASH_ANYONECANPAY, SIGHASH_NONE | SIGHASH_ANYONECANPAY,
+                                    SIGHASH_SINGLE | SIGHASH_ANYONECANPAY, (int)0xffffff81};
+    for (int nTest = 0; nTest < 200; nTest++)
+    {
+        CTransaction tx;
+        RandTransaction(tx, 1 + Rand(8), Rand(8));
+        CSignatureHashContext context(tx);
+        BOOST_CHECK(context.IsFor(tx));
+        for (unsigned int nIn = 0; nIn <= tx.vin.size(); nIn++)
+        {
+            CScript scriptCode = RandScript();
+            int nHashType = hashTypes[Rand(sizeof(hashTypes) / sizeof(hashTypes[0]))];
+            BOOST_CHECK(context.SignatureHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, tx, nIn, nHashType));
+        }
+    }
+}
+
+// Not a check: prints the time taken to hash all the inputs of a large transaction
+BOOST_AUTO_TEST_CASE(sighash_context_benchmark)
+{
+    CTransaction tx;
+    RandTransaction(tx, 500, 2);
+    CScript scriptCode;
+    scriptCode << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_FOREACH(CTxIn& txin, tx.vin)
+        txin.scriptSig = CScript() << vector<unsigned char>(72, 2) << vector<unsigned char>(33, 3);
+
+    int64 nStart = GetTimeMillis();
+    uint256 hashLegacy = 0;
+    for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+        hashLegacy ^= SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL);
+    int64 nLegacyTime = GetTimeMillis() - nStart;
+
+    nStart = GetTimeMillis();
+    uint256 hashContext = 0;
+    CSignatureHashContext context(tx);
+    for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+        hashContext ^= context.SignatureHash(scriptCode, nIn, SIGHASH_ALL);
+    int64 nContextTime = GetTimeMillis() - nStart;
+
+    BOOST_CHECK(hashLegacy == hashContext);
+    BOOST_TEST_MESSAGE(strprintf("Signature hashes of %u inputs: %"PRI64d"ms with SignatureHash, %"PRI64d"ms with CSignatureHashContext",
+                                 (unsigned int)tx.vin.size(), nLegacyTime, nContextTime));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
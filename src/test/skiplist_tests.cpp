@@ -0,0 +1,74 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "main.h"
+#include "util.h"
+
+#define SKIPLIST_LENGTH 20000
+
+BOOST_AUTO_TEST_SUITE(skiplist_tests)
+
+BOOST_AUTO_TEST_CASE(skiplist_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK(vIndex[i].pskip == &vIndex[vIndex[i].pskip->nHeight]);
+            BOOST_CHECK(vIndex[i].pskip->nHeight < i);
+        } else {
+            BOOST_CHECK(vIndex[i].pskip == NULL);
+        }
+    }
+
+    for (int i=0; i < 1000; i++) {
+        int from = GetRand(SKIPLIST_LENGTH - 1);
+        int to = GetRand(from + 1);
+
+        BOOST_CHECK(vIndex[SKIPLIST_LENGTH - 1].GetAncestor(from) == &vIndex[from]);
+        BOOST_CHECK(vIndex[from].GetAncestor(to) == &vIndex[to]);
+        BOOST_CHECK(vIndex[from].GetAncestor(0) == &vIndex[0]);
+    }
+
+    BOOST_CHECK(vIndex[100].GetAncestor(101) == NULL);
+    BOOST_CHECK(vIndex[100].GetAncestor(-1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(skiplist_isinchain_test)
+{
+    std::vector<CBlockIndex> vMain(5000);
+    std::vector<CBlockIndex> vBranch(2000);
+
+    for (unsigned int i=0; i<vMain.size(); i++) {
+        vMain[i].nHeight = i;
+        vMain[i].pprev = (i == 0) ? NULL : &vMain[i - 1];
+        vMain[i].BuildSkip();
+    }
+
+    // the branch forks off after block 2999 of the main chain
+    for (unsigned int i=0; i<vBranch.size(); i++) {
+        vBranch[i].nHeight = 3000 + i;
+        vBranch[i].pprev = (i == 0) ? &vMain[2999] : &vBranch[i - 1];
+        vBranch[i].BuildSkip();
+    }
+
+    const CBlockIndex* pindexTip = &vBranch.back();
+    for (int i=0; i < 1000; i++) {
+        int nHeight = GetRand(vMain.size());
+        BOOST_CHECK(vMain[nHeight].IsInChain(&vMain.back()));
+        BOOST_CHECK_EQUAL(vMain[nHeight].IsInChain(pindexTip), nHeight < 3000);
+        if (nHeight < 3000)
+            BOOST_CHECK(pindexTip->GetAncestor(nHeight) == &vMain[nHeight]);
+        else
+            BOOST_CHECK(pindexTip->GetAncestor(nHeight) == &vBranch[nHeight - 3000]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@ extern bool fPrintToConsole;
 struct TestingSetup {
     TestingSetup() {
         fPrintToConsole = true; // don't want to write to debug.log file
+        SHA256AutoDetect();
         pwalletMain = new CWallet();
         RegisterWallet(pwalletMain);
     }
@@ -155,5 +155,46 @@ BOOST_AUTO_TEST_CASE(serialize_keeps_unit)
     BOOST_CHECK(t2.CheckTransaction());
 }
 
+BOOST_AUTO_TEST_CASE(unit_map_serialization)
+{
+    CUnitMap<int64> unitMap;
+    map<unsigned char, int64> mapReference;
+    BOOST_CHECK(unitMap.empty());
+    BOOST_CHECK(unitMap.find('8') == NULL);
+    BOOST_CHECK_THROW(unitMap['X'], std::out_of_range);
+
+    // Serialized exactly like the std::map it replaces
+    for (int i = 0; i < 3; i++)
+    {
+        CDataStream ssMap(SER_DISK, CLIENT_VERSION);
+        CDataStream ssReference(SER_DISK, CLIENT_VERSION);
+        ssMap << unitMap;
+        ssReference << mapReference;
+        BOOST_CHECK(ssMap.str() == ssReference.str());
+        BOOST_CHECK_EQUAL(ssMap.size(), ::GetSerializeSize(unitMap, SER_DISK, CLIENT_VERSION));
+
+        CUnitMap<int64> unitMapRead;
+        ssReference >> unitMapRead;
+        BOOST_CHECK(unitMapRead == unitMap);
+
+        if (i == 0)
+            unitMap['C'] = mapReference['C'] = 12 * COIN;
+        else
+            unitMap['8'] = mapReference['8'] = -5;
+    }
+
+    BOOST_CHECK_EQUAL(2, unitMap.size());
+    BOOST_CHECK_EQUAL(-5, *unitMap.find('8'));
+    unitMap.clear();
+    BOOST_CHECK(unitMap.empty());
+
+    // Invalid units are rejected
+    map<unsigned char, int64> mapInvalid;
+    mapInvalid['X'] = 1;
+    CDataStream ssInvalid(SER_DISK, CLIENT_VERSION);
+    ssInvalid << mapInvalid;
+    BOOST_CHECK_THROW(ssInvalid >> unitMap, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -1,4 +1,5 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <algorithm>
 
 #include "main.h"
@@ -1259,6 +1260,57 @@ BOOST_AUTO_TEST_CASE(fee_vote_calculation)
     ResetFeeVoteBlocks();
 }
 
+static void CheckFeeVoteTally(CFeeVoteTally& tally, CBlockIndex* pindex)
+{
+    CBlockIndex reference(*pindex);
+    BOOST_CHECK(CalculateVotedFees(&reference));
+    BOOST_CHECK(tally.CalculateVotedFees(pindex));
+    BOOST_CHECK(pindex->mapVotedFee == reference.mapVotedFee);
+}
+
+BOOST_AUTO_TEST_CASE(fee_vote_tally)
+{
+    const uint32_t nFeeVotes[] = { CENT, 2*CENT, 5*CENT, COIN, 3*COIN };
+    const int nBlocks = FEE_VOTES * 3;
+    const int nForkHeight = FEE_VOTES * 2;
+
+    vector<CBlockIndex*> vIndex;
+    CFeeVoteTally tally;
+
+    for (int i = 0; i < nBlocks; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = i;
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        // Votes drift over time and some blocks do not vote
+        BOOST_FOREACH(const unsigned char cUnit, sAvailableUnits)
+            if (GetRand(4))
+                pindex->vote.mapFeeVote[cUnit] = nFeeVotes[(GetRand(3) + i * 3 / nBlocks) % 5];
+        vIndex.push_back(pindex);
+        CheckFeeVoteTally(tally, pindex);
+    }
+
+    // A side chain forking from the main chain needs a rebuild of the window
+    vector<CBlockIndex*> vFork;
+    for (int i = 0; i < 10; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = nForkHeight + i;
+        pindex->pprev = vFork.empty() ? vIndex[nForkHeight - 1] : vFork.back();
+        pindex->vote.mapFeeVote['8'] = 3*COIN;
+        vFork.push_back(pindex);
+        CheckFeeVoteTally(tally, pindex);
+    }
+
+    // And back to the main chain
+    CheckFeeVoteTally(tally, vIndex.back());
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vFork)
+        delete pindex;
+}
+
 BOOST_AUTO_TEST_CASE(reputation_vote_distribution)
 {
     CUserVote vote;
@@ -1405,6 +1457,60 @@ BOOST_AUTO_TEST_CASE(reputation_vote_result)
     BOOST_CHECK_EQUAL(5000*2-20000*1, mapReputation[address4]);
 }
 
+static void CheckReputationTally(CReputationTally& tally, const CBlockIndex* pindex)
+{
+    map<CTxDestination, int64> mapReference;
+    map<CTxDestination, int64> mapReputation;
+    BOOST_CHECK(CalculateReputationDestinationResult(pindex, mapReference));
+    BOOST_CHECK(tally.GetReputation(pindex, mapReputation));
+    BOOST_CHECK(mapReputation == mapReference);
+}
+
+static CBlockIndex* AddReputationVoteBlock(CBlockIndex* pindexPrev)
+{
+    CBlockIndex* pindex = new CBlockIndex;
+    pindex->pprev = pindexPrev;
+    pindex->nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+    pindex->BuildSkip();
+    for (int i = GetRand(4); i > 0; i--)
+        pindex->vote.vReputationVote.push_back(CReputationVote(CBitcoinAddress(CKeyID(GetRand(20)), '8'), GetRand(3) ? 1 : -1));
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(reputation_vote_tally)
+{
+    CReputationTally tally;
+    vector<CBlockIndex*> vIndex;
+
+    // Follow a chain longer than the three weighted windows
+    for (int i = 0; i < 36000; i++)
+    {
+        vIndex.push_back(AddReputationVoteBlock(vIndex.empty() ? NULL : vIndex.back()));
+        map<CTxDestination, int64> mapReputation;
+        BOOST_CHECK(tally.GetReputation(vIndex.back(), mapReputation));
+        if (i % 4999 == 0 || i == 15000 || i == 35000)
+            CheckReputationTally(tally, vIndex.back());
+    }
+    CheckReputationTally(tally, vIndex.back());
+
+    // A short fork is reached by stepping back and forth
+    vector<CBlockIndex*> vFork;
+    for (int i = 0; i < 20; i++)
+        vFork.push_back(AddReputationVoteBlock(vFork.empty() ? vIndex[35950] : vFork.back()));
+    CheckReputationTally(tally, vFork.back());
+    CheckReputationTally(tally, vIndex.back());
+
+    // Going far back rebuilds the scores
+    CheckReputationTally(tally, vIndex[20000]);
+    CheckReputationTally(tally, vIndex[20001]);
+    CheckReputationTally(tally, vIndex[19990]);
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vFork)
+        delete pindex;
+}
+
 BOOST_AUTO_TEST_CASE(reputation_reward_calculation)
 {
     map<CTxDestination, int64> mapReputation;
@@ -1739,11 +1845,141 @@ BOOST_AUTO_TEST_CASE(signer_reward_vote_result)
     }
 }
 
+static void CheckSignerRewardVoteTally(CSignerRewardVoteTally& tally, CBlockIndex* pindex)
+{
+    CBlockIndex reference(*pindex);
+    BOOST_CHECK(CalculateSignerRewardVoteResult(&reference));
+    BOOST_CHECK(tally.CalculateSignerRewardVoteResult(pindex));
+    BOOST_CHECK_EQUAL(reference.signerRewardVoteResult.nCount, pindex->signerRewardVoteResult.nCount);
+    BOOST_CHECK_EQUAL(reference.signerRewardVoteResult.nAmount, pindex->signerRewardVoteResult.nAmount);
+}
+
+BOOST_AUTO_TEST_CASE(signer_reward_vote_tally)
+{
+    const int nBlocks = 5000;
+    const int nForkHeight = 3000;
+
+    vector<CBlockIndex*> vIndex;
+    CSignerRewardVoteTally tally;
+
+    for (int i = 0; i < nBlocks; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = i;
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        pindex->nProtocolVersion = (i < 100 ? PROTOCOL_V2_0 : PROTOCOL_V4_0);
+        // Votes drift over time and many blocks keep the current value
+        if (GetRand(3))
+            pindex->vote.signerReward.Set(GetRand(10) + i * 10 / nBlocks, GetRand(1000) + i);
+        vIndex.push_back(pindex);
+        CheckSignerRewardVoteTally(tally, pindex);
+    }
+
+    // A side chain forking from the main chain needs a rebuild of the windows
+    vector<CBlockIndex*> vFork;
+    for (int i = 0; i < 10; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = nForkHeight + i;
+        pindex->pprev = vFork.empty() ? vIndex[nForkHeight - 1] : vFork.back();
+        pindex->nProtocolVersion = PROTOCOL_V4_0;
+        pindex->vote.signerReward.Set(100, 100000);
+        vFork.push_back(pindex);
+        CheckSignerRewardVoteTally(tally, pindex);
+    }
+
+    // And back to the main chain
+    CheckSignerRewardVoteTally(tally, vIndex.back());
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vFork)
+        delete pindex;
+}
+
+static CBlockIndex* AddElectionBlock(vector<CBlockIndex*>& vIndex, CBlockIndex* pindexPrev, const CBitcoinAddress* paddress = NULL)
+{
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = pindexPrev;
+    if (pindexPrev)
+        pindex->pprevElected = pindexPrev->vElectedCustodian.size() ? pindexPrev : pindexPrev->pprevElected;
+    if (paddress)
+    {
+        CCustodianVote electedCustodian;
+        electedCustodian.SetAddress(*paddress);
+        electedCustodian.nAmount = 10 * COIN;
+        pindex->vElectedCustodian.push_back(electedCustodian);
+    }
+    vIndex.push_back(pindex);
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(elected_custodian_map)
+{
+    CBitcoinAddress address1(CKeyID(1), 'C');
+    CBitcoinAddress address2(CKeyID(2), 'C');
+    CBitcoinAddress address3(CKeyID(3), 'C');
+
+    vector<CBlockIndex*> vIndex;
+    CBlockIndex* pindex = NULL;
+    CBlockIndex* pindexElected1 = NULL;
+    CBlockIndex* pindexElected2 = NULL;
+    CBlockIndex* pindexFork = NULL;
+    for (int i = 0; i < 100; i++)
+    {
+        const CBitcoinAddress* paddress = NULL;
+        if (i == 10 || i == 60)
+            paddress = &address1;
+        if (i == 30)
+            paddress = &address2;
+        pindex = AddElectionBlock(vIndex, pindex, paddress);
+        if (i == 10)
+            pindexElected1 = pindex;
+        if (i == 30)
+            pindexElected2 = pindex;
+        if (i == 40)
+            pindexFork = pindex;
+    }
+    CBlockIndex* pindexMainTip = pindex;
+
+    BOOST_CHECK(vIndex[5]->GetElectedCustodianMap().empty());
+
+    // A custodian elected again keeps the block of its first election
+    const map<CBitcoinAddress, CBlockIndex*>& mapMain = pindexMainTip->GetElectedCustodianMap();
+    BOOST_CHECK_EQUAL(2, mapMain.size());
+    BOOST_CHECK(mapMain.find(address1)->second == pindexElected1);
+    BOOST_CHECK(mapMain.find(address2)->second == pindexElected2);
+
+    // The blocks following an election share its map
+    BOOST_CHECK(&vIndex[50]->GetElectedCustodianMap() == &vIndex[35]->GetElectedCustodianMap());
+    BOOST_CHECK(&vIndex[50]->GetElectedCustodianMap() != &mapMain);
+    BOOST_CHECK_EQUAL(1, vIndex[20]->GetElectedCustodianMap().size());
+
+    // A side chain with its own election
+    pindex = pindexFork;
+    for (int i = 0; i < 10; i++)
+        pindex = AddElectionBlock(vIndex, pindex, i == 5 ? &address3 : NULL);
+    const map<CBitcoinAddress, CBlockIndex*>& mapFork = pindex->GetElectedCustodianMap();
+    BOOST_CHECK_EQUAL(3, mapFork.size());
+    BOOST_CHECK(mapFork.find(address1)->second == pindexElected1);
+    BOOST_CHECK(mapFork.count(address3));
+    BOOST_CHECK(!pindexMainTip->GetElectedCustodianMap().count(address3));
+
+    map<CBitcoinAddress, CBlockIndex*> mapCopy;
+    pindex->GetElectedCustodians(mapCopy);
+    BOOST_CHECK(mapCopy == mapFork);
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+}
+
 void NewBlockTip(CBlockIndex*& pindexBest)
 {
     CBlockIndex *pindex = pindexBest;
     pindexBest = new CBlockIndex;
     pindexBest->pprev = pindex;
+    pindexBest->nHeight = pindex ? pindex->nHeight + 1 : 0;
+    pindexBest->BuildSkip();
 }
 
 void CheckAsset(const CAsset& asset, uint32_t assetId, unsigned short confirmations, unsigned char m, unsigned char n,
@@ -1826,7 +2062,7 @@ BOOST_AUTO_TEST_CASE(asset_vote_result)
     BOOST_CHECK_EQUAL(0, vAssets.size());
     BOOST_CHECK(CalculateVotedAssets(pindexBest));
     BOOST_CHECK_EQUAL(0, pindexBest->mapAssets.size());
-    BOOST_CHECK_EQUAL(0, pindexBest->mapAssetsPrev.size());
+    BOOST_CHECK(!pindexBest->GetVotedAsset(ASSET_ID, asset));
 
     // Add some asset votes but not enough to win the vote
     for (int i = 0; i < ASSET_VOTES / 2 - 5; i++)
@@ -1839,7 +2075,7 @@ BOOST_AUTO_TEST_CASE(asset_vote_result)
     BOOST_CHECK(ExtractAssetVoteResult(pindexBest, vAssets));
     BOOST_CHECK_EQUAL(0, vAssets.size());
     BOOST_CHECK_EQUAL(0, pindexBest->mapAssets.size());
-    BOOST_CHECK_EQUAL(0, pindexBest->mapAssetsPrev.size());
+    BOOST_CHECK(!pindexBest->GetVotedAsset(ASSET_ID, asset));
 
     // Add some asset votes for the same asset but different values
     for (int i = 0; i < 5; i++)
@@ -2169,4 +2405,245 @@ BOOST_AUTO_TEST_CASE(protocol_v5_upgrade_2_weeks_after_vote)
     CheckProtocolv5SwitchTime(GetTime(2015, 12, 25,  0,  0,  0), GetTime(2016,  1,  8, 14,  0,  0));
 }
 
+// The frequency map calculation used before the vote tally, kept as the oracle of the asset vote result
+static void OracleExtractAssetVoteResult(const CBlockIndex* pindex, vector<CAsset>& vAssets)
+{
+    vAssets.clear();
+
+    static const int nHalfAssetVotes = ASSET_VOTES / 2;
+    const CBlockIndex* pvoteindex = pindex;
+    map<uint32_t, vector<CAssetVote> > mapAssetsVotes;
+
+    for (int i = 0; i < ASSET_VOTES && pvoteindex; i++, pvoteindex = pvoteindex->pprev)
+        BOOST_FOREACH(const CAssetVote& vote, pvoteindex->vote.vAssetVote)
+            mapAssetsVotes[vote.nAssetId].push_back(vote);
+
+    BOOST_FOREACH(PAIRTYPE(const uint32_t, vector<CAssetVote>)& item, mapAssetsVotes)
+    {
+        const uint32_t nId = item.first;
+        const vector<CAssetVote>& vAssetVotes = item.second;
+        CAsset currentAsset;
+        bool assetExists = pindex->GetVotedAsset(nId, currentAsset);
+
+        if (!assetExists && (int)vAssetVotes.size() <= nHalfAssetVotes)
+            continue;
+
+        CAsset newAsset;
+        newAsset.nAssetId = nId;
+        uint8_t nUnitExponent = currentAsset.nUnitExponent;
+        int totalVotes = ASSET_VOTES;
+        map<uint16_t, int> mapNumberOfConfirmations;
+        map<uint8_t, int> mapRequiredDepositSigners;
+        map<uint8_t, int> mapTotalDepositSigners;
+        map<uint8_t, int> mapMaxTrade;
+        map<uint8_t, int> mapMinTrade;
+
+        if (!assetExists)
+        {
+            map<uint8_t, int> mapUnitExponent;
+            BOOST_FOREACH(const CAssetVote& assetVote, vAssetVotes)
+                mapUnitExponent[assetVote.nUnitExponent]++;
+
+            int nMaxVotes = 0;
+            BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& exponent, mapUnitExponent)
+            {
+                if (exponent.second >= nMaxVotes)
+                {
+                    nUnitExponent = exponent.first;
+                    nMaxVotes = exponent.second;
+                }
+            }
+
+            if (nMaxVotes <= nHalfAssetVotes)
+                continue;
+        }
+
+        newAsset.nUnitExponent = nUnitExponent;
+
+        BOOST_FOREACH(const CAssetVote& assetVote, vAssetVotes)
+        {
+            mapNumberOfConfirmations[assetVote.nNumberOfConfirmations]++;
+            mapRequiredDepositSigners[assetVote.nRequiredDepositSigners]++;
+            mapTotalDepositSigners[assetVote.nTotalDepositSigners]++;
+            mapMaxTrade[ConvertExpParameter(assetVote.nMaxTradeExpParam, assetVote.nUnitExponent, nUnitExponent)]++;
+            mapMinTrade[ConvertExpParameter(assetVote.nMinTradeExpParam, assetVote.nUnitExponent, nUnitExponent)]++;
+        }
+
+        int nDefaultVotes = ASSET_VOTES - vAssetVotes.size();
+        if (assetExists && (int)vAssetVotes.size() < ASSET_VOTES)
+        {
+            mapNumberOfConfirmations[currentAsset.nNumberOfConfirmations] += nDefaultVotes;
+            mapRequiredDepositSigners[currentAsset.nRequiredDepositSigners] += nDefaultVotes;
+            mapTotalDepositSigners[currentAsset.nTotalDepositSigners] += nDefaultVotes;
+            mapMaxTrade[currentAsset.nMaxTradeExpParam] += nDefaultVotes;
+            mapMinTrade[currentAsset.nMinTradeExpParam] += nDefaultVotes;
+        }
+        else if (!assetExists)
+        {
+            totalVotes = vAssetVotes.size();
+            mapMaxTrade[0] += nDefaultVotes;
+            mapMinTrade[0] += nDefaultVotes;
+        }
+
+        int total = 0;
+        BOOST_FOREACH(PAIRTYPE(const uint16_t, int)& vote, mapNumberOfConfirmations)
+        {
+            total += vote.second;
+            if (total > totalVotes / 2)
+            {
+                newAsset.nNumberOfConfirmations = vote.first;
+                break;
+            }
+        }
+
+        total = 0;
+        BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& vote, mapRequiredDepositSigners)
+        {
+            total += vote.second;
+            if (total > totalVotes / 2)
+            {
+                newAsset.nRequiredDepositSigners = vote.first;
+                break;
+            }
+        }
+
+        total = 0;
+        BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& vote, mapTotalDepositSigners)
+        {
+            total += vote.second;
+            if (total > totalVotes / 2)
+            {
+                newAsset.nTotalDepositSigners = vote.first;
+                break;
+            }
+        }
+
+        total = 0;
+        BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& vote, mapMaxTrade)
+        {
+            total += vote.second;
+            if (total > ASSET_VOTES / 2)
+            {
+                newAsset.nMaxTradeExpParam = vote.first;
+                break;
+            }
+        }
+
+        total = 0;
+        BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& vote, mapMinTrade)
+        {
+            total += vote.second;
+            if (total > ASSET_VOTES / 2)
+            {
+                newAsset.nMinTradeExpParam = vote.first;
+                break;
+            }
+        }
+
+        vAssets.push_back(newAsset);
+    }
+}
+
+static CBlockIndex* AddAssetVoteBlock(vector<CBlockIndex*>& vIndex, int nAssets, int nDrift)
+{
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+    pindex->nHeight = vIndex.size();
+    pindex->BuildSkip();
+    for (int i = 0; i < nAssets; i++)
+    {
+        if (GetRand(4) == 0)
+            continue;
+        pindex->vote.vAssetVote.push_back(NewAssetVote(0x40000000 + i, 10 + GetRand(3) + nDrift, 2 + GetRand(2), 5, 90 + GetRand(4) + nDrift, 80 + GetRand(4), GetRand(8) ? 8 : 7));
+    }
+    vIndex.push_back(pindex);
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(asset_vote_tally)
+{
+    const int nBlocks = ASSET_VOTES * 2;
+
+    vector<CBlockIndex*> vIndex;
+    vector<CBlockIndex*> vReference;
+    CAssetVoteTally tally;
+
+    for (int i = 0; i < nBlocks; i++)
+    {
+        CBlockIndex* pindex = AddAssetVoteBlock(vIndex, 5, i * 5 / nBlocks);
+        CBlockIndex* preference = new CBlockIndex(*pindex);
+        preference->pprev = vReference.empty() ? NULL : vReference.back();
+        preference->BuildSkip();
+        vReference.push_back(preference);
+
+        vector<CAsset> vAssets, vRescan, vExpected;
+        OracleExtractAssetVoteResult(pindex, vExpected);
+        BOOST_CHECK(tally.ExtractAssetVoteResult(pindex, vAssets));
+        BOOST_CHECK(ExtractAssetVoteResult(preference, vRescan));
+        BOOST_CHECK(vAssets == vExpected);
+        BOOST_CHECK(vRescan == vExpected);
+
+        BOOST_CHECK(tally.CalculateVotedAssets(pindex));
+        BOOST_CHECK(CalculateVotedAssets(preference));
+        BOOST_CHECK(pindex->mapAssets == preference->mapAssets);
+    }
+    map<uint32_t, CAsset> mapAssets;
+    BOOST_CHECK(vIndex.back()->GetEffectiveAssets(mapAssets));
+    BOOST_CHECK(!mapAssets.empty());
+
+    // A block that does not follow the previous one rebuilds the window
+    vector<CAsset> vAssets, vExpected;
+    BOOST_CHECK(tally.ExtractAssetVoteResult(vIndex[ASSET_VOTES + 10], vAssets));
+    OracleExtractAssetVoteResult(vIndex[ASSET_VOTES + 10], vExpected);
+    BOOST_CHECK(vAssets == vExpected);
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vReference)
+        delete pindex;
+}
+
+BOOST_AUTO_TEST_CASE(asset_vote_tally_benchmark)
+{
+    // Hundreds of assets voted in each block
+    const int nAssets = 300;
+    const int nBlocks = 10;
+
+    vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < ASSET_VOTES + nBlocks; i++)
+        AddAssetVoteBlock(vIndex, nAssets, 0);
+
+    CAssetVoteTally tally;
+    vector<CAsset> vAssets, vExpected;
+    BOOST_CHECK(tally.ExtractAssetVoteResult(vIndex[ASSET_VOTES - 1], vAssets));
+
+    boost::posix_time::ptime mst1 = boost::posix_time::microsec_clock::local_time();
+    for (int i = ASSET_VOTES; i < ASSET_VOTES + nBlocks; i++)
+        BOOST_CHECK(tally.ExtractAssetVoteResult(vIndex[i], vAssets));
+    boost::posix_time::ptime mst2 = boost::posix_time::microsec_clock::local_time();
+    long nTally = (mst2 - mst1).total_microseconds();
+
+    mst1 = boost::posix_time::microsec_clock::local_time();
+    for (int i = ASSET_VOTES; i < ASSET_VOTES + nBlocks; i++)
+        BOOST_CHECK(ExtractAssetVoteResult(vIndex[i], vExpected));
+    mst2 = boost::posix_time::microsec_clock::local_time();
+    long nRescan = (mst2 - mst1).total_microseconds();
+
+    mst1 = boost::posix_time::microsec_clock::local_time();
+    vector<CAsset> vOracle;
+    for (int i = ASSET_VOTES; i < ASSET_VOTES + nBlocks; i++)
+        OracleExtractAssetVoteResult(vIndex[i], vOracle);
+    mst2 = boost::posix_time::microsec_clock::local_time();
+    long nOracle = (mst2 - mst1).total_microseconds();
+
+    if (fDebug) printf("asset_vote_tally_benchmark: %d blocks, tally %ldus, rescan %ldus, frequency maps %ldus\n", nBlocks, nTally, nRescan, nOracle);
+
+    BOOST_CHECK_EQUAL(nAssets, vAssets.size());
+    BOOST_CHECK(vAssets == vExpected);
+    BOOST_CHECK(vAssets == vOracle);
+
+    BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        delete pindex;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
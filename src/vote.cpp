@@ -966,6 +966,74 @@ bool CalculateVotedFees(CBlockIndex* pindex)
     return true;
 }
 
+template <typename T, typename Extractor>
+void CBlockVoteWindow<T, Extractor>::MoveTo(const CBlockIndex* pindex)
+{
+    if (pindexLast != NULL && pindex == pindexLast)
+        return;
+
+    if (pindexLast != NULL && pindex->pprev == pindexLast)
+        window.push(extractor(pindex));
+    else
+    {
+        vector<T> vValue;
+        vValue.reserve(nBlocks);
+        const CBlockIndex* pi = pindex;
+        for (int i = 0; i < nBlocks; i++)
+        {
+            vValue.push_back(extractor(pi));
+            if (pi)
+                pi = pi->pprev;
+        }
+
+        window.clear();
+        BOOST_REVERSE_FOREACH(const T& value, vValue)
+            window.push(value);
+    }
+
+    pindexLast = pindex;
+}
+
+uint32_t CFeeVoteExtractor::operator()(const CBlockIndex* pindex) const
+{
+    if (!pindex)
+        return GetDefaultFee(cUnit);
+
+    const map<unsigned char, uint32_t>& mapFeeVote = pindex->vote.mapFeeVote;
+    map<unsigned char, uint32_t>::const_iterator it = mapFeeVote.find(cUnit);
+    if (it == mapFeeVote.end())
+        return GetDefaultFee(cUnit);
+    else
+        return it->second;
+}
+
+CFeeVoteTally::CFeeVoteTally()
+{
+    BOOST_FOREACH(const unsigned char cUnit, sAvailableUnits)
+        mapWindow.insert(make_pair(cUnit, CFeeVoteWindow(FEE_VOTES, CFeeVoteExtractor(cUnit))));
+}
+
+void CFeeVoteTally::SetNull()
+{
+    BOOST_FOREACH(PAIRTYPE(const unsigned char, CFeeVoteWindow)& item, mapWindow)
+        item.second.SetNull();
+}
+
+bool CFeeVoteTally::CalculateVotedFees(CBlockIndex* pindex)
+{
+    // Same rank as the first vote reaching half of the votes in CalculateVotedFees
+    const int nRank = max(FEE_VOTES / 2, 1) - 1;
+
+    pindex->mapVotedFee.clear();
+    BOOST_FOREACH(PAIRTYPE(const unsigned char, CFeeVoteWindow)& item, mapWindow)
+    {
+        item.second.MoveTo(pindex);
+        pindex->mapVotedFee[item.first] = item.second.GetWindow().nth(nRank);
+    }
+
+    return true;
+}
+
 bool CalculateReputationDestinationResult(const CBlockIndex* pindex, std::map<CTxDestination, int64>& mapReputation)
 {
     mapReputation.clear();
@@ -985,6 +1053,18 @@ bool CalculateReputationDestinationResult(const CBlockIndex* pindex, std::map<CT
     return true;
 }
 
+static void GetReputationAddresses(const std::map<CTxDestination, int64>& mapReputationDestination, std::map<CBitcoinAddress, int64>& mapReputation)
+{
+    mapReputation.clear();
+
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& pair, mapReputationDestination)
+    {
+        const CTxDestination& destination = pair.first;
+        const CBitcoinAddress address(destination, '8');
+        mapReputation[address] = pair.second;
+    }
+}
+
 bool CalculateReputationResult(const CBlockIndex* pindex, std::map<CBitcoinAddress, int64>& mapReputation)
 {
     std::map<CTxDestination, int64> mapReputationDestination;
@@ -994,12 +1074,150 @@ bool CalculateReputationResult(const CBlockIndex* pindex, std::map<CBitcoinAddre
     if (!CalculateReputationDestinationResult(pindex, mapReputationDestination))
         return false;
 
-    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& pair, mapReputationDestination)
+    GetReputationAddresses(mapReputationDestination, mapReputation);
+
+    return true;
+}
+
+CReputationTally reputationTally;
+
+// Depths at which the weight of a reputation vote decreases, and the weights before each of them
+static const int REPUTATION_WINDOW_ENDS[] = { 5000, 15000, 35000 };
+static const int REPUTATION_WINDOW_WEIGHTS[] = { 4, 2, 1 };
+static const int REPUTATION_WINDOWS = 3;
+
+static const int REPUTATION_TALLY_MAX_STEPS = 1000;
+
+void CReputationTally::ApplyVotes(const CBlockIndex* pindex, int nWeightBefore, int nWeightAfter)
+{
+    BOOST_FOREACH(const CReputationVote& vote, pindex->vote.vReputationVote)
     {
-        const CTxDestination& destination = pair.first;
-        const CBitcoinAddress address(destination, '8');
-        mapReputation[address] = pair.second;
+        const CTxDestination destination = vote.GetDestination();
+        std::map<CTxDestination, CScore>::iterator it = mapScore.find(destination);
+        if (it == mapScore.end())
+        {
+            CScore score;
+            score.nScore = 0;
+            score.nVotes = 0;
+            it = mapScore.insert(make_pair(destination, score)).first;
+        }
+
+        CScore& score = it->second;
+        score.nScore += (vote.nWeight >= 0 ? 1 : -1) * (nWeightAfter - nWeightBefore);
+        if (nWeightBefore == 0)
+            score.nVotes++;
+        if (nWeightAfter == 0)
+            score.nVotes--;
+        if (score.nVotes == 0)
+            mapScore.erase(it);
     }
+}
+
+// Make pindex, a child of pindexLast, the block the scores are calculated for
+void CReputationTally::StepForward(const CBlockIndex* pindex)
+{
+    ApplyVotes(pindex, 0, REPUTATION_WINDOW_WEIGHTS[0]);
+
+    for (int i = 0; i < REPUTATION_WINDOWS; i++)
+    {
+        const CBlockIndex* pindexLeaving = pindex->GetAncestor(pindex->nHeight - REPUTATION_WINDOW_ENDS[i]);
+        if (pindexLeaving)
+            ApplyVotes(pindexLeaving, REPUTATION_WINDOW_WEIGHTS[i], i + 1 < REPUTATION_WINDOWS ? REPUTATION_WINDOW_WEIGHTS[i + 1] : 0);
+    }
+
+    pindexLast = pindex;
+}
+
+// Make the parent of pindexLast the block the scores are calculated for
+void CReputationTally::StepBack()
+{
+    const CBlockIndex* pindex = pindexLast;
+
+    ApplyVotes(pindex, REPUTATION_WINDOW_WEIGHTS[0], 0);
+
+    for (int i = 0; i < REPUTATION_WINDOWS; i++)
+    {
+        const CBlockIndex* pindexEntering = pindex->GetAncestor(pindex->nHeight - REPUTATION_WINDOW_ENDS[i]);
+        if (pindexEntering)
+            ApplyVotes(pindexEntering, i + 1 < REPUTATION_WINDOWS ? REPUTATION_WINDOW_WEIGHTS[i + 1] : 0, REPUTATION_WINDOW_WEIGHTS[i]);
+    }
+
+    pindexLast = pindex->pprev;
+}
+
+// Move the scores to pindex through the fork with pindexLast if it is close enough
+bool CReputationTally::MoveTo(const CBlockIndex* pindex)
+{
+    if (pindexLast == NULL)
+        return false;
+    if (abs(pindex->nHeight - pindexLast->nHeight) > REPUTATION_TALLY_MAX_STEPS)
+        return false;
+
+    // Find the fork
+    const CBlockIndex* pfork = pindexLast->GetAncestor(min(pindex->nHeight, pindexLast->nHeight));
+    const CBlockIndex* pwalk = pindex->GetAncestor(min(pindex->nHeight, pindexLast->nHeight));
+    int nSteps = abs(pindex->nHeight - pindexLast->nHeight);
+    while (pfork != pwalk)
+    {
+        if (pfork == NULL || pwalk == NULL)
+            return false;
+        nSteps += 2;
+        if (nSteps > REPUTATION_TALLY_MAX_STEPS)
+            return false;
+        pfork = pfork->pprev;
+        pwalk = pwalk->pprev;
+    }
+
+    while (pindexLast != pfork)
+        StepBack();
+
+    vector<const CBlockIndex*> vConnect;
+    for (const CBlockIndex* pi = pindex; pi != pfork; pi = pi->pprev)
+        vConnect.push_back(pi);
+    BOOST_REVERSE_FOREACH(const CBlockIndex* pi, vConnect)
+        StepForward(pi);
+
+    return true;
+}
+
+void CReputationTally::Rebuild(const CBlockIndex* pindex)
+{
+    mapScore.clear();
+
+    const CBlockIndex* pi = pindex;
+    for (int nDepth = 0; pi && nDepth < REPUTATION_WINDOW_ENDS[REPUTATION_WINDOWS - 1]; nDepth++, pi = pi->pprev)
+    {
+        int nWindow = 0;
+        while (nDepth >= REPUTATION_WINDOW_ENDS[nWindow])
+            nWindow++;
+        ApplyVotes(pi, 0, REPUTATION_WINDOW_WEIGHTS[nWindow]);
+    }
+
+    pindexLast = pindex;
+}
+
+bool CReputationTally::GetReputation(const CBlockIndex* pindex, std::map<CTxDestination, int64>& mapReputation)
+{
+    LOCK(cs);
+
+    if (pindex != pindexLast && !MoveTo(pindex))
+        Rebuild(pindex);
+
+    mapReputation.clear();
+    for (std::map<CTxDestination, CScore>::const_iterator it = mapScore.begin(); it != mapScore.end(); ++it)
+        mapReputation.insert(mapReputation.end(), make_pair(it->first, it->second.nScore));
+
+    return true;
+}
+
+bool CReputationTally::GetReputation(const CBlockIndex* pindex, std::map<CBitcoinAddress, int64>& mapReputation)
+{
+    std::map<CTxDestination, int64> mapReputationDestination;
+
+    if (!GetReputation(pindex, mapReputationDestination))
+        return false;
+
+    GetReputationAddresses(mapReputationDestination, mapReputation);
 
     return true;
 }
@@ -1206,6 +1424,67 @@ bool CalculateSignerRewardVoteResult(CBlockIndex* pindex)
     return true;
 }
 
+int16_t CSignerRewardCountExtractor::operator()(const CBlockIndex* pindex) const
+{
+    if (pindex && pindex->vote.signerReward.nCount >= 0)
+        return pindex->vote.signerReward.nCount;
+    return -1;
+}
+
+int32_t CSignerRewardAmountExtractor::operator()(const CBlockIndex* pindex) const
+{
+    if (pindex && pindex->vote.signerReward.nAmount >= 0)
+        return pindex->vote.signerReward.nAmount;
+    return -1;
+}
+
+CSignerRewardVoteTally::CSignerRewardVoteTally() :
+    countWindow(SIGNER_REWARD_VOTE_MEDIAN_BLOCKS, CSignerRewardCountExtractor()),
+    amountWindow(SIGNER_REWARD_VOTE_MEDIAN_BLOCKS, CSignerRewardAmountExtractor())
+{
+}
+
+// The nth value of a window where the missing votes (-1) count as votes for valueMissing
+template <typename T>
+static T GetNthReplacingMissing(const COrderStatisticWindow<T>& window, int n, T valueMissing)
+{
+    const T valueNoVote = -1;
+    int nMissing = window.count(valueNoVote);
+    int nLower = window.count_less(valueMissing) - (valueNoVote < valueMissing ? nMissing : 0);
+
+    if (n < nLower)
+        return window.nth(nMissing + n);
+    if (n < nLower + nMissing)
+        return valueMissing;
+    return window.nth(n);
+}
+
+bool CSignerRewardVoteTally::CalculateSignerRewardVoteResult(CBlockIndex* pindex)
+{
+    countWindow.MoveTo(pindex);
+    amountWindow.MoveTo(pindex);
+
+    if (pindex->nProtocolVersion < PROTOCOL_V4_0)
+    {
+        pindex->signerRewardVoteResult.Set(0, 0);
+        return true;
+    }
+
+    CSignerRewardVote previous;
+    if  (pindex->pprev)
+        previous = pindex->pprev->signerRewardVoteResult;
+    else
+        previous.Set(0, 0);
+
+    // Same rank as the first vote exceeding half of the votes in CalculateSignerRewardVoteResult
+    const int nRank = SIGNER_REWARD_VOTE_MEDIAN_BLOCKS / 2;
+
+    pindex->signerRewardVoteResult.nCount = GetNthReplacingMissing(countWindow.GetWindow(), nRank, previous.nCount);
+    pindex->signerRewardVoteResult.nAmount = GetNthReplacingMissing(amountWindow.GetWindow(), nRank, previous.nAmount);
+
+    return true;
+}
+
 bool CalculateSignerReward(const CBlockIndex* pindex, CTxDestination& addressRet, int64& nRewardRet)
 {
     addressRet = CNoDestination();
@@ -1223,7 +1502,7 @@ bool CalculateSignerReward(const CBlockIndex* pindex, CTxDestination& addressRet
     assert(nReward >= 0);
 
     std::map<CTxDestination, int64> mapReputation;
-    if (!CalculateReputationDestinationResult(pindex, mapReputation))
+    if (!reputationTally.GetReputation(pindex, mapReputation))
         return false;
 
     std::map<CTxDestination, int> mapPastReward;
@@ -1254,177 +1533,170 @@ bool GetPastSignerRewards(const CBlockIndex* pindex, std::map<CTxDestination, in
     return true;
 }
 
-bool ExtractAssetVoteResult(const CBlockIndex* pindex, vector<CAsset>& vAssets)
+// Add nCount to a vote count, removing the values that are not voted anymore
+static void AddCount(int& nTotal, int nCount)
 {
-    vAssets.clear();
+    nTotal += nCount;
+    assert(nTotal >= 0);
+}
 
-    static const int nHalfAssetVotes = ASSET_VOTES / 2;
-    const CBlockIndex* pvoteindex = pindex;
-    map<uint32_t, vector<CAssetVote> > mapAssetsVotes;
+template <typename T>
+static void AddCount(map<T, int>& mapVoteCount, const T& value, int nCount)
+{
+    int& nValueCount = mapVoteCount[value];
+    nValueCount += nCount;
+    assert(nValueCount >= 0);
+    if (nValueCount == 0)
+        mapVoteCount.erase(value);
+}
 
-    for (int i = 0; i < ASSET_VOTES && pvoteindex; i++, pvoteindex = pvoteindex->pprev)
-        BOOST_FOREACH(const CAssetVote& vote, pvoteindex->vote.vAssetVote)
-            mapAssetsVotes[vote.nAssetId].push_back(vote);
+void CAssetVoteCounts::Add(const CAssetVote& vote, int nCount)
+{
+    AddCount(nVotes, nCount);
+    AddCount(mapNumberOfConfirmations, vote.nNumberOfConfirmations, nCount);
+    AddCount(mapRequiredDepositSigners, vote.nRequiredDepositSigners, nCount);
+    AddCount(mapTotalDepositSigners, vote.nTotalDepositSigners, nCount);
+    AddCount(mapUnitExponent, vote.nUnitExponent, nCount);
+    AddCount(mapMaxTrade, make_pair(vote.nMaxTradeExpParam, vote.nUnitExponent), nCount);
+    AddCount(mapMinTrade, make_pair(vote.nMinTradeExpParam, vote.nUnitExponent), nCount);
+}
 
-    BOOST_FOREACH(PAIRTYPE(const uint32_t, vector<CAssetVote>)& item, mapAssetsVotes)
+// The first value whose cumulated votes exceed half of nTotalVotes
+template <typename T>
+static bool GetMedianVote(const map<T, int>& mapVoteCount, int nTotalVotes, T& valueRet)
+{
+    int total = 0;
+    BOOST_FOREACH(const PAIRTYPE(const T, int)& item, mapVoteCount)
     {
-        const uint32_t nId = item.first;
-        const vector<CAssetVote>& vAssetVotes = item.second;
-        CAsset currentAsset;
-        bool assetExists = pindex->GetVotedAsset(nId, currentAsset);
-
-        if (assetExists || vAssetVotes.size() > nHalfAssetVotes)
+        total += item.second;
+        if (total > nTotalVotes / 2)
         {
-            CAsset newAsset;
-            newAsset.nAssetId = nId;
-            uint8_t nUnitExponent = currentAsset.nUnitExponent;
-            int totalVotes = ASSET_VOTES;
-            map<uint16_t, int> mapNumberOfConfirmations;
-            map<uint8_t, int> mapRequiredDepositSigners;
-            map<uint8_t, int> mapTotalDepositSigners;
-            map<uint8_t, int> mapMaxTrade;
-            map<uint8_t, int> mapMinTrade;
-
-            // If asset is new, calculate the unit exponent
-            if (!assetExists)
-            {
-                map<uint8_t, int> mapUnitExponent;
-                BOOST_FOREACH(const CAssetVote assetVote, vAssetVotes)
-                    mapUnitExponent[assetVote.nUnitExponent]++;
-
-                int nMaxVotes = 0;
-                BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& item, mapUnitExponent)
-                {
-                    if (item.second >= nMaxVotes)
-                    {
-                        // When creating an asset use a unit exponent that any majority votes
-                        // In case of equality use the highest value
-                        nUnitExponent = item.first;
-                        nMaxVotes = item.second;
-                    }
-                }
+            valueRet = item.first;
+            return true;
+        }
+    }
+    return false;
+}
 
-                // Do not add this asset if there's no absolute majority on the exponent (because it's permanent)
-                if (nMaxVotes <= nHalfAssetVotes)
-                    continue;
-            }
+// Trade parameter votes converted to the unit exponent of the asset
+static map<uint8_t, int> ConvertTradeVotes(const map<pair<uint8_t, uint8_t>, int>& mapVoteCount, uint8_t nUnitExponent)
+{
+    map<uint8_t, int> mapResult;
+    BOOST_FOREACH(const PAIRTYPE(const PAIRTYPE(uint8_t, uint8_t), int)& item, mapVoteCount)
+        mapResult[ConvertExpParameter(item.first.first, item.first.second, nUnitExponent)] += item.second;
+    return mapResult;
+}
 
-            newAsset.nUnitExponent = nUnitExponent;
+static bool GetAssetVoteResult(const CBlockIndex* pindex, uint32_t nId, const CAssetVoteCounts& counts, CAsset& newAssetRet)
+{
+    static const int nHalfAssetVotes = ASSET_VOTES / 2;
 
-            BOOST_FOREACH(const CAssetVote assetVote, vAssetVotes)
-            {
-                mapNumberOfConfirmations[assetVote.nNumberOfConfirmations]++;
-                mapRequiredDepositSigners[assetVote.nRequiredDepositSigners]++;
-                mapTotalDepositSigners[assetVote.nTotalDepositSigners]++;
-                // Convert the values to use the voted unit exponent
-                mapMaxTrade[ConvertExpParameter(assetVote.nMaxTradeExpParam, assetVote.nUnitExponent, nUnitExponent)]++;
-                mapMinTrade[ConvertExpParameter(assetVote.nMinTradeExpParam, assetVote.nUnitExponent, nUnitExponent)]++;
-            }
+    CAsset currentAsset;
+    bool assetExists = pindex->GetVotedAsset(nId, currentAsset);
 
-            int nDefaultVotes = ASSET_VOTES - vAssetVotes.size();
-            // If asset exists, fill in the current asset values that act as default values
-            if (assetExists && vAssetVotes.size() < ASSET_VOTES)
-            {
-                mapNumberOfConfirmations[currentAsset.nNumberOfConfirmations] += nDefaultVotes;
-                mapRequiredDepositSigners[currentAsset.nRequiredDepositSigners] += nDefaultVotes;
-                mapTotalDepositSigners[currentAsset.nTotalDepositSigners] += nDefaultVotes;
-                mapMaxTrade[currentAsset.nMaxTradeExpParam] += nDefaultVotes;
-                mapMinTrade[currentAsset.nMinTradeExpParam] += nDefaultVotes;
-            }
-            else if (!assetExists)
-            {
-                totalVotes = vAssetVotes.size();
-                // Max/min trade is special, so that the non votes can still influence it's value
-                mapMaxTrade[0] += nDefaultVotes;
-                mapMinTrade[0] += nDefaultVotes;
-            }
+    if (!assetExists && counts.nVotes <= nHalfAssetVotes)
+        return false;
 
-            int total = 0;
-            BOOST_FOREACH(PAIRTYPE(const uint16_t, int)& item, mapNumberOfConfirmations)
-            {
-                total += item.second;
-                if (total > totalVotes / 2)
-                {
-                    newAsset.nNumberOfConfirmations = item.first;
-                    break;
-                }
-            }
+    CAsset newAsset;
+    newAsset.nAssetId = nId;
+    uint8_t nUnitExponent = currentAsset.nUnitExponent;
+    int totalVotes = ASSET_VOTES;
 
-            total = 0;
-            BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& item, mapRequiredDepositSigners)
+    // If asset is new, calculate the unit exponent
+    if (!assetExists)
+    {
+        int nMaxVotes = 0;
+        BOOST_FOREACH(const PAIRTYPE(const uint8_t, int)& item, counts.mapUnitExponent)
+        {
+            if (item.second >= nMaxVotes)
             {
-                total += item.second;
-                if (total > totalVotes / 2)
-                {
-                    newAsset.nRequiredDepositSigners = item.first;
-                    break;
-                }
+                // When creating an asset use a unit exponent that any majority votes
+                // In case of equality use the highest value
+                nUnitExponent = item.first;
+                nMaxVotes = item.second;
             }
+        }
 
-            total = 0;
-            BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& item, mapTotalDepositSigners)
-            {
-                total += item.second;
-                if (total > totalVotes / 2)
-                {
-                    newAsset.nTotalDepositSigners = item.first;
-                    break;
-                }
-            }
+        // Do not add this asset if there's no absolute majority on the exponent (because it's permanent)
+        if (nMaxVotes <= nHalfAssetVotes)
+            return false;
+    }
 
-            total = 0;
-            BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& item, mapMaxTrade)
-            {
-                total += item.second;
-                // Max trade is always ASSET_VOTES votes, so ASSET_VOTES / 2 is the median
-                if (total > ASSET_VOTES / 2)
-                {
-                    newAsset.nMaxTradeExpParam = item.first;
-                    break;
-                }
-            }
+    newAsset.nUnitExponent = nUnitExponent;
 
-            total = 0;
-            BOOST_FOREACH(PAIRTYPE(const uint8_t, int)& item, mapMinTrade)
-            {
-                total += item.second;
-                // Min trade is always ASSET_VOTES votes, so ASSET_VOTES / 2 is the median
-                if (total > ASSET_VOTES / 2)
-                {
-                    newAsset.nMinTradeExpParam = item.first;
-                    break;
-                }
-            }
+    map<uint16_t, int> mapNumberOfConfirmations = counts.mapNumberOfConfirmations;
+    map<uint8_t, int> mapRequiredDepositSigners = counts.mapRequiredDepositSigners;
+    map<uint8_t, int> mapTotalDepositSigners = counts.mapTotalDepositSigners;
+    // Convert the values to use the voted unit exponent
+    map<uint8_t, int> mapMaxTrade = ConvertTradeVotes(counts.mapMaxTrade, nUnitExponent);
+    map<uint8_t, int> mapMinTrade = ConvertTradeVotes(counts.mapMinTrade, nUnitExponent);
 
-            vAssets.push_back(newAsset);
-        }
+    int nDefaultVotes = ASSET_VOTES - counts.nVotes;
+    // If asset exists, fill in the current asset values that act as default values
+    if (assetExists && counts.nVotes < ASSET_VOTES)
+    {
+        mapNumberOfConfirmations[currentAsset.nNumberOfConfirmations] += nDefaultVotes;
+        mapRequiredDepositSigners[currentAsset.nRequiredDepositSigners] += nDefaultVotes;
+        mapTotalDepositSigners[currentAsset.nTotalDepositSigners] += nDefaultVotes;
+        mapMaxTrade[currentAsset.nMaxTradeExpParam] += nDefaultVotes;
+        mapMinTrade[currentAsset.nMinTradeExpParam] += nDefaultVotes;
+    }
+    else if (!assetExists)
+    {
+        totalVotes = counts.nVotes;
+        // Max/min trade is special, so that the non votes can still influence it's value
+        mapMaxTrade[0] += nDefaultVotes;
+        mapMinTrade[0] += nDefaultVotes;
     }
 
+    GetMedianVote(mapNumberOfConfirmations, totalVotes, newAsset.nNumberOfConfirmations);
+    GetMedianVote(mapRequiredDepositSigners, totalVotes, newAsset.nRequiredDepositSigners);
+    GetMedianVote(mapTotalDepositSigners, totalVotes, newAsset.nTotalDepositSigners);
+    // Max/min trade is always ASSET_VOTES votes, so ASSET_VOTES / 2 is the median
+    GetMedianVote(mapMaxTrade, ASSET_VOTES, newAsset.nMaxTradeExpParam);
+    GetMedianVote(mapMinTrade, ASSET_VOTES, newAsset.nMinTradeExpParam);
+
+    newAssetRet = newAsset;
     return true;
 }
 
-bool CalculateVotedAssets(CBlockIndex* pindex)
+static void ExtractAssetVoteResult(const CBlockIndex* pindex, const map<uint32_t, CAssetVoteCounts>& mapCounts, vector<CAsset>& vAssets)
 {
-    pindex->mapAssetsPrev.clear();
-    pindex->mapAssets.clear();
+    vAssets.clear();
 
-    // Set the previous assets pointers
-    if (pindex->pprev)
+    BOOST_FOREACH(const PAIRTYPE(const uint32_t, CAssetVoteCounts)& item, mapCounts)
     {
-        CBlockIndex* pprev = pindex->pprev;
-        if (pprev->mapAssetsPrev.size() != 0)
-            pindex->mapAssetsPrev = pprev->mapAssetsPrev;
-        BOOST_FOREACH(PAIRTYPE(const uint32_t, CAsset)& pair, pprev->mapAssets)
-            pindex->mapAssetsPrev[pair.first] = pprev;
+        CAsset newAsset;
+        if (GetAssetVoteResult(pindex, item.first, item.second, newAsset))
+            vAssets.push_back(newAsset);
     }
+}
 
-    vector<CAsset> vAssets;
-    if (!ExtractAssetVoteResult(pindex, vAssets))
-        return false;
+bool ExtractAssetVoteResult(const CBlockIndex* pindex, vector<CAsset>& vAssets)
+{
+    const CBlockIndex* pvoteindex = pindex;
+    map<uint32_t, CAssetVoteCounts> mapCounts;
 
-    if (vAssets.size() == 0)
-        return true;
+    for (int i = 0; i < ASSET_VOTES && pvoteindex; i++, pvoteindex = pvoteindex->pprev)
+        BOOST_FOREACH(const CAssetVote& vote, pvoteindex->vote.vAssetVote)
+            mapCounts[vote.nAssetId].Add(vote, 1);
+
+    ExtractAssetVoteResult(pindex, mapCounts, vAssets);
+
+    return true;
+}
 
+static void ClearVotedAssets(CBlockIndex* pindex)
+{
+    if (!pindex->mapAssets.empty())
+    {
+        assetRegistry.Unregister(pindex);
+        pindex->mapAssets.clear();
+    }
+}
+
+static void SetVotedAssets(CBlockIndex* pindex, vector<CAsset>& vAssets)
+{
     BOOST_FOREACH(CAsset& newAsset, vAssets)
     {
         uint32_t gid = newAsset.nAssetId;
@@ -1435,5 +1707,79 @@ bool CalculateVotedAssets(CBlockIndex* pindex)
             pindex->mapAssets[gid] = newAsset;
     }
 
+    assetRegistry.Register(pindex);
+}
+
+bool CalculateVotedAssets(CBlockIndex* pindex)
+{
+    ClearVotedAssets(pindex);
+
+    vector<CAsset> vAssets;
+    if (!ExtractAssetVoteResult(pindex, vAssets))
+        return false;
+
+    SetVotedAssets(pindex, vAssets);
+
+    return true;
+}
+
+void CAssetVoteTally::AddBlock(const CBlockIndex* pindex, int nCount)
+{
+    BOOST_FOREACH(const CAssetVote& vote, pindex->vote.vAssetVote)
+    {
+        CAssetVoteCounts& counts = mapCounts[vote.nAssetId];
+        counts.Add(vote, nCount);
+        if (counts.nVotes == 0)
+            mapCounts.erase(vote.nAssetId);
+    }
+}
+
+void CAssetVoteTally::MoveTo(const CBlockIndex* pindex)
+{
+    if (pindexLast != NULL && pindex == pindexLast)
+        return;
+
+    if (pindexLast != NULL && pindex->pprev == pindexLast)
+    {
+        window.push_back(pindex);
+        AddBlock(pindex, 1);
+        if ((int)window.size() > ASSET_VOTES)
+        {
+            AddBlock(window.front(), -1);
+            window.pop_front();
+        }
+    }
+    else
+    {
+        window.clear();
+        mapCounts.clear();
+        const CBlockIndex* pvoteindex = pindex;
+        for (int i = 0; i < ASSET_VOTES && pvoteindex; i++, pvoteindex = pvoteindex->pprev)
+        {
+            window.push_front(pvoteindex);
+            AddBlock(pvoteindex, 1);
+        }
+    }
+
+    pindexLast = pindex;
+}
+
+bool CAssetVoteTally::ExtractAssetVoteResult(const CBlockIndex* pindex, vector<CAsset>& vAssets)
+{
+    MoveTo(pindex);
+    ::ExtractAssetVoteResult(pindex, mapCounts, vAssets);
+    return true;
+}
+
+bool CAssetVoteTally::CalculateVotedAssets(CBlockIndex* pindex)
+{
+    ClearVotedAssets(pindex);
+
+    vector<CAsset> vAssets;
+    if (!ExtractAssetVoteResult(pindex, vAssets))
+        return false;
+
+    SetVotedAssets(pindex, vAssets);
+
     return true;
 }
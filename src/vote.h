@@ -9,6 +9,9 @@
 #include "base58.h"
 #include "exchange.h"
 #include "util.h"
+#include "orderstatistic.h"
+
+#include <deque>
 
 class CBlock;
 class CBlockIndex;
@@ -695,9 +698,117 @@ bool IsProtocolActiveForNextBlock(const CBlockIndex* pPrevIndex, int nSwitchTime
 
 bool CalculateVotedFees(CBlockIndex* pindex);
 
+/** The values voted in a block and its ancestors, following the blocks given
+ * to MoveTo. When the block is a child of the previous one, only the value of
+ * the new block is added and the oldest one removed, so order statistics cost
+ * O(log n). Otherwise the window is rebuilt by walking nBlocks blocks back.
+ * Extractor returns the value voted in a block, or for a missing block (NULL)
+ * before the start of the chain.
+ */
+template <typename T, typename Extractor> class CBlockVoteWindow
+{
+private:
+    Extractor extractor;
+    int nBlocks;
+    const CBlockIndex* pindexLast;
+    COrderStatisticWindow<T> window;
+
+public:
+    CBlockVoteWindow(int nBlocksIn, const Extractor& extractorIn) :
+        extractor(extractorIn),
+        nBlocks(nBlocksIn),
+        pindexLast(NULL),
+        window(nBlocksIn)
+    {
+    }
+
+    void SetNull()
+    {
+        pindexLast = NULL;
+        window.clear();
+    }
+
+    // Defined in vote.cpp, where the block index is known
+    void MoveTo(const CBlockIndex* pindex);
+
+    const COrderStatisticWindow<T>& GetWindow() const
+    {
+        return window;
+    }
+};
+
+class CFeeVoteExtractor
+{
+private:
+    unsigned char cUnit;
+
+public:
+    CFeeVoteExtractor(unsigned char cUnitIn) :
+        cUnit(cUnitIn)
+    {
+    }
+
+    uint32_t operator()(const CBlockIndex* pindex) const;
+};
+
+/** Keeps the fee votes of the last FEE_VOTES blocks sorted so that the voted
+ * fee of a block following the previously calculated one only requires adding
+ * its vote and removing the one leaving the window. The results are the same
+ * as CalculateVotedFees.
+ */
+class CFeeVoteTally
+{
+private:
+    typedef CBlockVoteWindow<uint32_t, CFeeVoteExtractor> CFeeVoteWindow;
+    std::map<unsigned char, CFeeVoteWindow> mapWindow;
+
+public:
+    CFeeVoteTally();
+
+    void SetNull();
+    bool CalculateVotedFees(CBlockIndex* pindex);
+};
+
 bool CalculateReputationDestinationResult(const CBlockIndex* pindex, std::map<CTxDestination, int64>& mapReputation);
 bool CalculateReputationResult(const CBlockIndex* pindex, std::map<CBitcoinAddress, int64>& mapReputation);
 
+/** Maintains the reputation scores of CalculateReputationDestinationResult
+ * while following a chain. Moving to a child or a parent block only applies
+ * the votes of the blocks crossing a weight boundary. Moves of more than
+ * REPUTATION_TALLY_MAX_STEPS blocks rebuild the scores from scratch.
+ * The block indexes must have consistent heights.
+ */
+class CReputationTally
+{
+private:
+    struct CScore
+    {
+        int64 nScore;
+        int nVotes; // number of votes in the weighted windows
+    };
+
+    CCriticalSection cs;
+    const CBlockIndex* pindexLast;
+    std::map<CTxDestination, CScore> mapScore;
+
+    void ApplyVotes(const CBlockIndex* pindex, int nWeightBefore, int nWeightAfter);
+    void StepForward(const CBlockIndex* pindex);
+    void StepBack();
+    bool MoveTo(const CBlockIndex* pindex);
+    void Rebuild(const CBlockIndex* pindex);
+
+public:
+    CReputationTally() :
+        pindexLast(NULL)
+    {
+    }
+
+    bool GetReputation(const CBlockIndex* pindex, std::map<CTxDestination, int64>& mapReputation);
+    bool GetReputation(const CBlockIndex* pindex, std::map<CBitcoinAddress, int64>& mapReputation);
+};
+
+extern CReputationTally reputationTally;
+
 bool CalculateSignerReward(const CBlockIndex* pindex, CTxDestination& addressRet, int64& nRewardRet);
 bool CalculateSignerRewardRecipient(const std::map<CTxDestination, int64>& mapReputation, int nCount, const std::map<CTxDestination, int>& mapPastReward, bool& fFoundRet, CTxDestination& addressRecipientRet);
 bool GetPastSignerRewards(const CBlockIndex* pindex, std::map<CTxDestination, int>& mapPastRewardRet);
@@ -705,9 +816,96 @@ bool GetPastSignerRewards(const CBlockIndex* pindex, std::map<CTxDestination, in
 int CalculateSignerRewardVoteCounts(const CBlockIndex* pindex, std::map<int16_t, int>& mapCountRet, std::map<int32_t, int>& mapAmountRet);
 bool CalculateSignerRewardVoteResult(CBlockIndex* pindex);
 
+class CSignerRewardCountExtractor
+{
+public:
+    int16_t operator()(const CBlockIndex* pindex) const;
+};
+
+class CSignerRewardAmountExtractor
+{
+public:
+    int32_t operator()(const CBlockIndex* pindex) const;
+};
+
+/** Sliding medians of the signer reward votes. The results are the same as
+ * CalculateSignerRewardVoteResult.
+ */
+class CSignerRewardVoteTally
+{
+private:
+    CBlockVoteWindow<int16_t, CSignerRewardCountExtractor> countWindow;
+    CBlockVoteWindow<int32_t, CSignerRewardAmountExtractor> amountWindow;
+
+public:
+    CSignerRewardVoteTally();
+
+    void SetNull()
+    {
+        countWindow.SetNull();
+        amountWindow.SetNull();
+    }
+
+    bool CalculateSignerRewardVoteResult(CBlockIndex* pindex);
+};
+
 bool ExtractAssetVoteResult(const CBlockIndex *pindex, std::vector<CAsset> &vAssets);
 bool CalculateVotedAssets(CBlockIndex* pindex);
 
+/** How many times each parameter value was voted for an asset */
+class CAssetVoteCounts
+{
+public:
+    int nVotes;
+    std::map<uint16_t, int> mapNumberOfConfirmations;
+    std::map<uint8_t, int> mapRequiredDepositSigners;
+    std::map<uint8_t, int> mapTotalDepositSigners;
+    std::map<uint8_t, int> mapUnitExponent;
+    // Trade parameters with the unit exponent they were voted with
+    std::map<std::pair<uint8_t, uint8_t>, int> mapMaxTrade;
+    std::map<std::pair<uint8_t, uint8_t>, int> mapMinTrade;
+
+    CAssetVoteCounts() :
+        nVotes(0)
+    {
+    }
+
+    // Add nCount times the vote (remove it if nCount is negative)
+    void Add(const CAssetVote& vote, int nCount);
+};
+
+/** Keeps the asset vote counts of the last ASSET_VOTES blocks, adding the
+ * votes of the new block and removing those of the block leaving the window
+ * when it follows the previously calculated block. The results are the same
+ * as ExtractAssetVoteResult.
+ */
+class CAssetVoteTally
+{
+private:
+    const CBlockIndex* pindexLast;
+    std::deque<const CBlockIndex*> window;
+    std::map<uint32_t, CAssetVoteCounts> mapCounts;
+
+    void AddBlock(const CBlockIndex* pindex, int nCount);
+    void MoveTo(const CBlockIndex* pindex);
+
+public:
+    CAssetVoteTally()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        pindexLast = NULL;
+        window.clear();
+        mapCounts.clear();
+    }
+
+    bool ExtractAssetVoteResult(const CBlockIndex* pindex, std::vector<CAsset>& vAssets);
+    bool CalculateVotedAssets(CBlockIndex* pindex);
+};
+
 bool MustUpgradeProtocol(const CBlockIndex* pPrevIndex, int nProtocolVersion);
 
 #endif
@@ -16,6 +16,7 @@
 #include "script.h"
 #include "vote.h"
 #include "datafeed.h"
+#include "chainscan.h"
 #include <boost/algorithm/string/replace.hpp>
 
 using namespace std;
@@ -801,31 +802,90 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
-// Scan the block chain (starting in pindexStart) for transactions
-// from or to us. If fUpdate is true, found transactions that already
-// exist in the wallet will be updated.
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+// Add the transactions of a scanned block, vMine tells which ones pay to us
+int CWallet::AddScannedBlock(const CBlock& block, const vector<bool>& vMine, bool fUpdate)
 {
     int ret = 0;
-
-    CBlockIndex* pindex = pindexStart;
+    LOCK(cs_wallet);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        LOCK(cs_wallet);
-        while (pindex)
+        const CTransaction& tx = block.vtx[i];
+        if (tx.cUnit != cUnit)
+            continue;
+        // Same as AddToWalletIfInvolvingMe, with IsMine(tx) already known
+        if (vMine[i] || mapWallet.count(tx.GetHash()) || IsFromMe(tx))
         {
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = pindex->pnext;
+            if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                ret++;
         }
+        else
+            WalletUpdateSpent(tx);
     }
     return ret;
 }
 
+// Blocks read by the chain scan with the transactions paying to the wallet
+class CWalletScanFacts : public CBlockScanFacts
+{
+public:
+    CBlock block;
+    vector<bool> vMine;
+};
+
+class CWalletScanJob : public CChainScanJob
+{
+public:
+    CWallet* pwallet;
+    bool fUpdate;
+    bool fShowProgress;
+    int nFound;
+
+    CWalletScanJob(CWallet* pwalletIn, bool fUpdateIn, bool fShowProgressIn) : pwallet(pwalletIn), fUpdate(fUpdateIn), fShowProgress(fShowProgressIn), nFound(0) {}
+
+    CBlockScanFacts* Extract(CTxDB& txdb, CBlock& block, const CBlockIndex* pindex)
+    {
+        // Keep the block without copying its transactions
+        CWalletScanFacts* pfacts = new CWalletScanFacts();
+        vector<CTransaction> vtx;
+        vtx.swap(block.vtx);
+        pfacts->block = block;
+        pfacts->block.vtx.swap(vtx);
+        pfacts->vMine.resize(pfacts->block.vtx.size());
+        for (unsigned int i = 0; i < pfacts->block.vtx.size(); i++)
+            pfacts->vMine[i] = pwallet->IsMine(pfacts->block.vtx[i]);
+        return pfacts;
+    }
+
+    bool Apply(CBlockScanFacts* pfacts, const CBlockIndex* pindex)
+    {
+        CWalletScanFacts* pwalletfacts = (CWalletScanFacts*)pfacts;
+        nFound += pwallet->AddScannedBlock(pwalletfacts->block, pwalletfacts->vMine, fUpdate);
+        return true;
+    }
+
+    void ShowProgress(const string& strName, int nPercent)
+    {
+        CChainScanJob::ShowProgress(strName, nPercent);
+        if (fShowProgress)
+            InitMessage(strprintf(_("Rescanning... %d%%"), nPercent));
+    }
+};
+
+// Scan the block chain (starting in pindexStart) for transactions
+// from or to us. If fUpdate is true, found transactions that already
+// exist in the wallet will be updated. pfScanned is set to false if the
+// scan stopped before the end of the chain, on a block that could not be read.
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fShowProgress, bool* pfScanned)
+{
+    // Blocks are read and checked for outputs paying to the wallet in
+    // parallel, the transactions are added in chain order
+    CWalletScanJob job(this, fUpdate, fShowProgress);
+    bool fScanned = ScanChain("ScanForWalletTransactions()", pindexStart, NULL, job);
+    if (pfScanned)
+        *pfScanned = fScanned;
+    return job.nFound;
+}
+
 int CWallet::ScanForWalletTransaction(const uint256& hashTx)
 {
     CTransaction tx;